@@ -0,0 +1,98 @@
+/*
+ ** Copyright (C) 2016 Mellanox Technologies
+ **
+ ** Licensed under the Apache License, Version 2.0 (the "License");
+ ** you may not use this file except in compliance with the License.
+ ** You may obtain a copy of the License at:
+ **
+ ** http://www.apache.org/licenses/LICENSE-2.0
+ **
+ ** Unless required by applicable law or agreed to in writing, software
+ ** distributed under the License is distributed on an "AS IS" BASIS,
+ ** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+ ** either express or implied. See the License for the specific language
+ ** governing permissions and  limitations under the License.
+ **
+ */
+
+#ifndef ECO_ARENA_H_
+#define ECO_ARENA_H_
+
+/**
+ * @file eco_arena.h
+ * @brief Define a process-wide arena of huge pages for stripe buffers, registered once on every device which uses it.
+ *
+ * Mellanox EC library used for Erasure Coding and RAID HW offload.
+ * The arena maps chunks of 1GB or 2MB huge pages (transparent huge pages when none are reserved) and carves 64 bytes
+ * aligned stripes from them. A chunk is registered as a single memory region on the first device which needs it, so
+ * the blocks are found by the registration lookup of every operation without registering them, and the HCA
+ * translates them with few IOTLB entries. A chunk is unmapped when its last stripe is freed, except one empty chunk
+ * which stays mapped and registered for the next stripes.
+ * The region of a chunk is never evicted: the registered chunks, including the empty one which is kept, count
+ * against the registered memory budget (see mlx_eco_set_mr_budget()) and stay pinned until they are unmapped. The
+ * kept empty chunk stays pinned until it is used again or the process exits.
+ * Currently supported by mlx5 only.
+ */
+
+#include "eco_hca.h"
+#include <stdint.h>
+#include <stddef.h>
+
+#define ECO_ARENA_ALIGNMENT 64
+
+/**
+ * Blocks of a stripe allocated from the arena.
+ * The blocks are contiguous: every block starts at a multiple of 64 bytes from the first one.
+ *
+ * @data                          k data blocks.
+ * @coding                        m code blocks.
+ * @k                             Number of data blocks.
+ * @m                             Number of code blocks.
+ * @block_size                    Size of every block.
+ * @length                        Bytes taken from the arena.
+ */
+struct eco_stripe_buffers {
+	uint8_t                       **data;
+	uint8_t                       **coding;
+	int                           k;
+	int                           m;
+	int                           block_size;
+	size_t                        length;
+};
+
+/**
+ * Allocate 64 bytes aligned memory from the arena.
+ *
+ * @param length                  Size of the memory.
+ * @return                        The memory if successful, else NULL.
+ */
+void *eco_arena_alloc(size_t length);
+
+/**
+ * Register the chunk of an allocation on a device, if it is not registered on it yet. The chunk keeps the region, in
+ * use so it is never evicted, and a reference on the device until it is unmapped. The registration runs without the
+ * arena lock, so the other allocations and frees do not wait for it.
+ *
+ * @param addr                    Memory returned by eco_arena_alloc().
+ * @param hca                     Pointer to the shared HCA.
+ * @return                        0 successful, -ENOSPC if the budget of registered memory is exhausted, other fail.
+ */
+int eco_arena_register(void *addr, struct eco_hca *hca);
+
+/**
+ * Return memory to the arena.
+ *
+ * @param addr                    Memory returned by eco_arena_alloc().
+ * @param length                  Size given to eco_arena_alloc().
+ */
+void eco_arena_free(void *addr, size_t length);
+
+/**
+ * Free stripe buffers allocated by mlx_eco_encoder_alloc_stripe_buffers()/mlx_eco_decoder_alloc_stripe_buffers().
+ * No operation may use the blocks.
+ *
+ * @param buffers                 The stripe buffers.
+ */
+void mlx_eco_free_stripe_buffers(struct eco_stripe_buffers *buffers);
+
+#endif /* ECO_ARENA_H_ */
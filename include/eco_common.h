@@ -28,84 +28,427 @@
  * Currently supported by mlx5 only.
  */
 
-#include "eco_list.h"
+#include "list.h"
+#include "eco_gf.h"
+#include "eco_encode_matrix.h"
+#include "eco_workers.h"
+#include "eco_hca.h"
+#include "eco_arena.h"
 #include <string.h>
+#include <time.h>
 #include <jerasure.h>
 #include <infiniband/verbs_exp.h>
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 #define dbg_log                               if (0) printf
 #define err_log                               printf
 
 #define W 4
 
+/**
+ * Calculation engines of an Erasure Coding Offload context.
+ *
+ * @ECO_BACKEND_HW                           Calculations are offloaded to the HCA.
+ * @ECO_BACKEND_SW                           Calculations are done by the software GF(2^4) engine (no EC capable HCA).
+ */
+enum eco_backend {
+	ECO_BACKEND_HW,
+	ECO_BACKEND_SW,
+};
+
+/**
+ * Selection of the HCA(s) used by a context.
+ *
+ * @ECO_DEVICE_DEFAULT                       The device named by eco_device_attr.name (mlx5_0 if no name is given).
+ * @ECO_DEVICE_NUMA_LOCAL                    An EC capable device on the NUMA node of the calling thread, else the first EC capable device.
+ * @ECO_DEVICE_ALL                           All the EC capable devices - the operations are striped across them.
+ */
+enum eco_device_select {
+	ECO_DEVICE_DEFAULT,
+	ECO_DEVICE_NUMA_LOCAL,
+	ECO_DEVICE_ALL,
+};
+
+/**
+ * Device attributes of a context. Zeroed attributes select mlx5_0.
+ *
+ * @select                                   Selection policy.
+ * @name                                     Device name used by ECO_DEVICE_DEFAULT, NULL for mlx5_0.
+ */
+struct eco_device_attr {
+	enum eco_device_select                   select;
+	const char                               *name;
+};
+
+/**
+ * HCA used by a context. The protection domain and the registered buffers of the device are shared with the other
+ * contexts on the same device, the calculation engine is private to the context.
+ *
+ * @hca                                      Shared HCA of the process-wide registry.
+ * @calc                                     Verbs erasure coding engine context on the device.
+ * @affinity_hint                            CPU which handles the completions of calc, local to the device when its NUMA node is known.
+ */
+struct eco_device {
+	struct eco_hca                           *hca;
+	struct ibv_exp_ec_calc                   *calc;
+	int                                      affinity_hint;
+};
+
+/**
+ * Completion callback of asynchronous encode/decode operations.
+ *
+ * @param arg                                User argument given with the operation.
+ * @param status                             0 successful, other fail.
+ */
+typedef void (*eco_coder_done_func)(void *arg, int status);
+
+/**
+ * Completion of an asynchronous operation submitted without a completion callback, reaped with poll_completions.
+ *
+ * @arg                                      User argument given with the operation.
+ * @status                                   0 successful, other fail.
+ */
+struct eco_completion {
+	void                                     *arg;
+	int                                      status;
+};
+
+/**
+ * Strategy used by synchronous encode/decode operations to wait for the completion of the HCA.
+ *
+ * @ECO_WAIT_BLOCK                           Sleep on a futex right away - lowest CPU usage.
+ * @ECO_WAIT_SPIN                            Busy poll the completion - lowest latency, burns the calling core.
+ * @ECO_WAIT_ADAPTIVE                        Busy poll for a self-tuning interval derived from the recent completion latencies,
+ *                                           then sleep on a futex.
+ */
+enum eco_wait_mode {
+	ECO_WAIT_BLOCK,
+	ECO_WAIT_SPIN,
+	ECO_WAIT_ADAPTIVE,
+};
+
+/**
+ * Completion wait state of a context.
+ *
+ * @mode                                     Wait strategy.
+ * @spin_ns                                  Current busy poll interval of ECO_WAIT_ADAPTIVE.
+ * @latency_ns                               Moving average of the completion latency seen by the waiters.
+ */
+struct eco_wait {
+	enum eco_wait_mode                       mode;
+	uint64_t                                 spin_ns;
+	uint64_t                                 latency_ns;
+};
+
 /**
  * Erasure Coding Offload completion context. Used for async encode/decode operations.
  *
  * @comp                                     completion context of EC calculation.
  * @eco_coder                                Pointer to an encoder/decoder.
- * @is_remainder_comp                        Boolean variable which determine the type of the completion context.
  */
 struct eco_coder_comp {
 	struct ibv_exp_ec_comp                   comp;
 	void                                     *eco_coder;
-	int                                      is_remainder_comp;
+};
+
+/**
+ * Hybrid HCA + CPU execution state. When enabled, the head of every block is calculated by the HCA while
+ * the rest of the block is calculated by CPU threads. The split point follows the measured throughput of both paths.
+ *
+ * @enabled                                  Boolean variable which determine if large blocks are split between the HCA and the CPU.
+ * @min_block_size                           Blocks smaller than this size are calculated by the HCA only.
+ * @num_threads                              Number of CPU threads calculating the software part (including the calling thread).
+ * @workers                                  CPU threads helping the calling thread, NULL if the calling thread works alone.
+ * @hw_rate                                  Measured HCA throughput in bytes of block per nanosecond.
+ * @sw_rate                                  Measured throughput of a single CPU thread in bytes of block per nanosecond.
+ * @mutex                                    Held by the operation which uses the CPU threads and updates the rates.
+ */
+struct eco_hybrid {
+	int                                      enabled;
+	int                                      min_block_size;
+	int                                      num_threads;
+	struct eco_workers                       *workers;
+	double                                   hw_rate;
+	double                                   sw_rate;
+	pthread_mutex_t                          mutex;
+};
+
+/**
+ * Software calculation of a byte range of a stripe, optionally split between the hybrid CPU threads.
+ *
+ * @eco_ctx                                  Pointer to the EC context.
+ * @matrix                                   Encode matrix, or decode matrix if erasures is not NULL.
+ * @erasures                                 Byte-map of erased blocks for decode, NULL for encode.
+ * @data                                     Array of pointers to data buffers.
+ * @coding                                   Array of pointers to coding buffers.
+ * @offset                                   Offset of the first byte to calculate in each block.
+ * @len                                      Number of bytes to calculate in each block.
+ * @num_parts                                Number of CPU threads sharing the job (1 - calling thread only, else hybrid.num_threads).
+ */
+struct eco_sw_job {
+	struct eco_context                       *eco_ctx;
+	const uint8_t                            *matrix;
+	const uint8_t                            *erasures;
+	uint8_t                                  **data;
+	uint8_t                                  **coding;
+	int                                      offset;
+	int                                      len;
+	int                                      num_parts;
+};
+
+/**
+ * Registration of one block of a slot.
+ *
+ * @mr                                         Memory region which the sge of the block points into, the slot holds a reference on it.
+ * @used                                       Set while the operation of the slot uses mr, the region is not evicted until the slot is released.
+ * @bounce                                     Bounce buffer which the sge points to when the block could not be registered, else NULL.
+ * @buffer                                     User buffer of a bounced block.
+ */
+struct eco_slot_block {
+	struct eco_mr                            *mr;
+	int                                      used;
+	uint8_t                                  *bounce;
+	uint8_t                                  *buffer;
+};
+
+/**
+ * In flight operation slot. Every slot owns the memory layout and completion contexts of one operation, so a
+ * context can keep up to queue_depth operations in flight on the HCA.
+ *
+ * @comp                                       Erasure Coding Offload completion context of the HCA part.
+ * @mem                                        Verbs erasure coding memory layout context used for 64 bytes aligned buffers.
+ * @eco_ctx                                    Pointer to the owning EC context.
+ * @device                                     Device which calculates the operations of the slot (NULL for the software engine).
+ * @busy                                       Boolean variable which determine if the slot is used by an operation.
+ * @ref_count                                  Number of parts (HCA calculation, software calculation) of the operation which did not complete yet,
+ *                                             the futex word of a synchronous operation.
+ * @sleeping                                   Boolean variable which determine if the waiter of a synchronous operation sleeps on ref_count.
+ * @completing                                 Set until the thread which completes the last part of a synchronous operation no longer
+ *                                             uses the slot, the waiter releases the slot only after it is cleared.
+ * @event                                      Boolean variable which determine if the completion is reported through the event fd instead of done_func.
+ * @next_completed                             Next slot in the queue of completions waiting to be polled.
+ * @done_func                                  Completion callback of an asynchronous operation, NULL for synchronous operations.
+ * @done_arg                                   User argument of done_func.
+ * @status                                     Status of the operation.
+ * @hw_done_ns                                 Completion time of the HCA calculation.
+ * @erasures                                   Byte-map of erased blocks of a decode operation.
+ * @decode_matrix                              Decode matrix of a decode operation.
+ * @blocks                                     Registrations of the sges [k + m], the data blocks first.
+ * @num_bounced                                Number of blocks of the operation staged through bounce buffers.
+ */
+struct eco_slot {
+	struct eco_coder_comp                     comp;
+	struct ibv_exp_ec_mem                     mem;
+	struct eco_context                        *eco_ctx;
+	struct eco_device                         *device;
+	int                                       busy;
+	int                                       ref_count;
+	int                                       sleeping;
+	int                                       completing;
+	int                                       event;
+	struct eco_slot                           *next_completed;
+	eco_coder_done_func                       done_func;
+	void                                      *done_arg;
+	int                                       status;
+	uint64_t                                  hw_done_ns;
+	uint8_t                                   erasures[W * W];
+	uint8_t                                   decode_matrix[W * W * W * W];
+	struct eco_slot_block                     blocks[W * W];
+	int                                       num_bounced;
+};
+
+/**
+ * One stripe of a batched encode/decode call.
+ *
+ * @data                                       Array of pointers to data buffers.
+ * @coding                                     Array of pointers to coding buffers.
+ * @erasures                                   Array of erased blocks indices (decode only).
+ * @erasures_size                              Size of erasures array (decode only).
+ */
+struct eco_stripe {
+	uint8_t                                   **data;
+	uint8_t                                   **coding;
+	int                                       *erasures;
+	int                                       erasures_size;
+};
+
+/**
+ * Synchronous operations of a batched call, submitted back to back and waited for in submission order.
+ *
+ * @slots                                      Ring [queue_depth] of the slots of the pending operations.
+ * @first                                      Index of the oldest pending operation in slots.
+ * @num_pending                                Number of pending operations.
+ * @status                                     First failure of the completed operations.
+ */
+struct eco_batch {
+	struct eco_slot                           **slots;
+	int                                       first;
+	int                                       num_pending;
+	int                                       status;
 };
 
 /**
  * Erasure Coding Offload context structure.
  *
- * @calc                                       Verbs erasure coding engine context.
+ * @devices                                    HCAs of the context, the slots are spread across them (NULL for the software engine).
+ * @num_devices                                Number of devices.
  * @attr                                       Verbs erasure coding engine initialization attributes.
- * @alignment_mem                              Verbs erasure coding memory layout context used for 64 bytes aligned buffers.
- * @mrs_list                                   Simple doubly linked list of lbv_mr objects.
- * @int_encode_matrx                           Used for Jerasure to calculate the decode matrix.
- * @remainder_buffers                          [k + m] buffers each of size 64 bytes used for the remainder from 64 bytes.
- * @remainder_mem                              Verbs erasure coding memory layout context used for the remainder from 64 bytes.
- * @block_size                                 The size of the input blocks.
+ * @encode_matrix                              Shared encode matrix, attr.encode_matrix points to its content.
  * @async_mutex                                Mutex used for async encode/decode operations.
  * @async_cond                                 Condition used for async encode/decode operations.
- * @async_ref_count                            Reference count used for async encode/decode operations.
- * @data                                       Array of pointers to source input buffers.
- * @coding                                     Array of pointers to coded output buffers.
- * @alignment_comp                             Erasure Coding Offload completion context used for 64 bytes aligned buffers.
- * @remainder_comp                             Erasure Coding Offload completion context used for the remainder from 64 bytes.
+ * @slots                                      Ring of in flight operation slots.
+ * @queue_depth                                Number of slots (the queue depth of every device times num_devices).
+ * @next_slot                                  Index of the first slot to check for the next operation.
+ * @busy_slots                                 Number of slots used by operations.
+ * @async_callbacks                            Number of completion callbacks which are running.
+ * @status                                     First failure of an asynchronous operation since the last mlx_eco_op_wait().
+ * @wait                                       Completion wait state of synchronous operations.
+ * @event_fd                                   eventfd signaled on completions which wait to be polled, -1 until requested.
+ * @completed_head                             Oldest completion waiting to be polled, its slot is released once it is polled.
+ * @completed_tail                             Newest completion waiting to be polled.
+ * @num_completed                              Number of completions waiting to be polled.
+ * @backend                                    Calculation engine used by this context.
+ * @hybrid                                     Hybrid HCA + CPU execution state.
+ * @sw_threshold                               Blocks smaller than this size are calculated by the calling thread without the HCA.
+ * @ready                                      Set once the devices, calcs and slots are set up (read with acquire).
+ * @setup_mutex                                Serializes the setup of a lazy context.
+ * @setup_coder                                Encoder/decoder passed to the completion of the slots.
+ * @setup_comp_done                            Completion function of the slots.
+ * @setup_device                               Device selection of the context, with its own copy of the name.
  */
 struct eco_context {
-	struct ibv_exp_ec_calc                    *calc;
+	struct eco_device                         *devices;
+	int                                       num_devices;
 	struct ibv_exp_ec_calc_init_attr          attr;
-	struct ibv_exp_ec_mem                     alignment_mem;
-	eco_list                                  mrs_list;
-	int                                       *int_encode_matrix;
-	uint8_t                                   *remainder_buffers;
-	struct ibv_exp_ec_mem                     remainder_mem;
-	struct ibv_mr                             *remainder_mr;
-	int                                       block_size;
+	struct eco_encode_matrix                  *encode_matrix;
 	pthread_mutex_t                           async_mutex;
 	pthread_cond_t                            async_cond;
-	int                                       async_ref_count;
-	uint8_t                                   **data;
-	uint8_t                                   **coding;
-	struct eco_coder_comp                     alignment_comp;
-	struct eco_coder_comp                     remainder_comp;
+	struct eco_slot                           *slots;
+	int                                       queue_depth;
+	int                                       next_slot;
+	int                                       busy_slots;
+	int                                       async_callbacks;
+	int                                       status;
+	struct eco_wait                           wait;
+	int                                       event_fd;
+	struct eco_slot                           *completed_head;
+	struct eco_slot                           *completed_tail;
+	int                                       num_completed;
+	enum eco_backend                          backend;
+	struct eco_hybrid                         hybrid;
+	int                                       sw_threshold;
+	int                                       ready;
+	pthread_mutex_t                           setup_mutex;
+	void                                      *setup_coder;
+	void                                      (*setup_comp_done)(struct ibv_exp_ec_comp *);
+	struct eco_device_attr                    setup_device;
 };
 
+/**
+ * Get monotonic time in nanoseconds.
+ */
+static inline uint64_t mlx_eco_time_ns(void)
+{
+	struct timespec ts;
+
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+
+	return (uint64_t)ts.tv_sec * 1000000000ULL + ts.tv_nsec;
+}
+
 /**
  * Initialize verbs EC context for fast Erasure Coding HW offload.
+ * When no EC capable device is found the context falls back to the software GF(2^4) engine.
+ * The MLX_ECO_BACKEND environment variable may be set to "hw" (never fall back) or "sw" (never use the HCA).
  *
  * @param coder                              Pointer to an encoder/decoder.
  * @param k                                  Number of data blocks.
  * @param m                                  Number of code blocks.
  * @param use_vandermonde_matrix             Boolean variable which determine the type of the encode matrix:
  *                                           0 for Cauchy coding matrix else for Vandermonde coding matrix.
+ * @param queue_depth                        Maximum number of operations in flight per device, up to the max_ec_calc_inflight_calcs
+ *                                           capability of the device (0 - default).
+ * @param device_attr                        Device selection, NULL for mlx5_0.
+ * @param lazy                               Boolean variable which determine if opening the devices and allocating the calcs
+ *                                           is deferred to the first operation (or mlx_eco_prewarm()).
  * @param comp_done_func                     Function handle of the EC calculation completion.
  * @return                                   Pointer to an initialize EC context object if successful, else NULL.
  */
-struct eco_context *mlx_eco_init(void *coder, int k, int m, int use_vandermonde_matrix, void (*comp_done_func)(struct ibv_exp_ec_comp *));
+struct eco_context *mlx_eco_init(void *coder, int k, int m, int use_vandermonde_matrix, int queue_depth, const struct eco_device_attr *device_attr,
+		int lazy, void (*comp_done_func)(struct ibv_exp_ec_comp *));
 
 /**
- * Register buffers and update the alignment memory layout context for future encode/decode operations.
+ * Set up a lazy context now: open its devices, allocate its calcs and slots and calibrate its software threshold.
+ * Does nothing for a context which is already set up.
+ *
+ * @param eco_ctx                            Pointer to an initialized EC context.
+ * @return                                   0 successful, other fail.
+ */
+int mlx_eco_prewarm(struct eco_context *eco_ctx);
+
+/**
+ * Set up a lazy context on its first use.
+ *
+ * @param eco_ctx                            Pointer to an initialized EC context.
+ * @return                                   0 successful, other fail.
+ */
+static inline int mlx_eco_activate(struct eco_context *eco_ctx)
+{
+	if (__atomic_load_n(&eco_ctx->ready, __ATOMIC_ACQUIRE)) {
+		return 0;
+	}
+
+	return mlx_eco_prewarm(eco_ctx);
+}
+
+/**
+ * Allocate calcs ahead of the contexts which will use them. The calcs are kept idle on their devices (up to
+ * ECO_HCA_MAX_IDLE_CALCS per device) and taken by the next contexts created with the same attributes, which also
+ * skip the software threshold calibration. The calcs complete on the NUMA node of their device, and serve contexts
+ * created from any CPU.
+ *
+ * @param k                                  Number of data blocks.
+ * @param m                                  Number of code blocks.
+ * @param use_vandermonde_matrix             Boolean variable which determine the type of the encode matrix.
+ * @param queue_depth                        Maximum number of operations in flight per device (0 - default).
+ * @param device_attr                        Device selection, NULL for mlx5_0.
+ * @param num_calcs                          Number of calcs per device.
+ * @return                                   0 successful, other fail.
+ */
+int mlx_eco_prewarm_calcs(int k, int m, int use_vandermonde_matrix, int queue_depth, const struct eco_device_attr *device_attr, int num_calcs);
+
+/**
+ * Copy the HCA results of an operation out of its bounce buffers and return them to the device, called by the HCA
+ * completion before the operation completes.
+ *
+ * @param slot                               Slot of the operation.
+ * @param outputs                            Byte-map [k + m] of the blocks written by the HCA, NULL for the code blocks.
+ */
+void mlx_eco_copy_bounced(struct eco_slot *slot, const uint8_t *outputs);
+
+/**
+ * Register buffers and update the alignment memory layout context of a slot for future encode/decode operations.
  * Because the HW can perform encode/decode operations only on 64 bytes aligned buffers, we will register only the aligned part of the buffers.
  * This function is optional - but it is recommended to use for better performance.
+ * Blocks which cannot be registered within the budget of registered memory are copied into bounce buffers of the device.
+ *
+ * @param eco_context                        Pointer to an initialized EC context.
+ * @param slot                               Slot of the operation which will use the buffers.
+ * @param data                               Array of pointers to source input buffers.
+ * @param coding                             Array of pointers to coded output buffers.
+ * @param data_size                          Size of data array (must be equal to the initial amount of data blocks).
+ * @param coding_size                        Size of coding array (must be equal to the initial amount of code blocks).
+ * @param block_size                         Length of each block of data.
+ * @return                                   0 successful, other fail.
+ */
+int mlx_eco_register(struct eco_context *eco_ctx, struct eco_slot *slot, uint8_t **data, uint8_t **coding, int data_size, int coding_size, int block_size);
+
+/**
+ * Register buffers on every device of a context which stripes its operations across several devices, so the
+ * operations find them registered whichever device calculates them.
  *
  * @param eco_context                        Pointer to an initialized EC context.
  * @param data                               Array of pointers to source input buffers.
@@ -115,7 +458,249 @@ struct eco_context *mlx_eco_init(void *coder, int k, int m, int use_vandermonde_
  * @param block_size                         Length of each block of data.
  * @return                                   0 successful, other fail.
  */
-int mlx_eco_register(struct eco_context *eco_ctx, uint8_t **data, uint8_t **coding, int data_size, int coding_size, int block_size);
+int mlx_eco_register_devices(struct eco_context *eco_ctx, uint8_t **data, uint8_t **coding, int data_size, int coding_size, int block_size);
+
+/**
+ * Start an encode/decode operation made of several parts, each completed with mlx_eco_op_complete().
+ *
+ * @param eco_ctx                            Pointer to an initialized EC context.
+ * @param done_func                          Completion callback, NULL for synchronous operations.
+ * @param arg                                User argument of done_func.
+ * @param num_parts                          Number of parts of the operation.
+ * @param wait                               Boolean variable which determine if a slot should be waited for when all the slots are busy.
+ * @return                                   The slot of the operation, NULL if all the slots are busy and wait is 0.
+ */
+struct eco_slot *mlx_eco_op_begin(struct eco_context *eco_ctx, eco_coder_done_func done_func, void *arg, int num_parts, int wait);
+
+/**
+ * Complete one part of an operation. When the last part completes, the slot of an asynchronous operation is
+ * released and its completion callback is called, the slot of a synchronous operation is kept for mlx_eco_op_wait().
+ *
+ * @param eco_ctx                            Pointer to an initialized EC context.
+ * @param slot                               Slot of the operation.
+ * @param status                             Status of the part.
+ */
+void mlx_eco_op_complete(struct eco_context *eco_ctx, struct eco_slot *slot, int status);
+
+/**
+ * Drop an operation before any part of it was submitted to the HCA. The completion callback is not called.
+ *
+ * @param eco_ctx                            Pointer to an initialized EC context.
+ * @param slot                               Slot of the operation.
+ */
+void mlx_eco_op_abort(struct eco_context *eco_ctx, struct eco_slot *slot);
+
+/**
+ * Wait until a synchronous operation completes and release its slot, or, if slot is NULL, wait until all
+ * the asynchronous operations complete and their completion callbacks return (polled completions need not be reaped).
+ * Must not be called from a completion callback of the same context.
+ *
+ * @param eco_ctx                            Pointer to an initialized EC context.
+ * @param slot                               Slot of a synchronous operation, or NULL.
+ * @return                                   Status of the operation, or first failure of the asynchronous operations.
+ */
+int mlx_eco_op_wait(struct eco_context *eco_ctx, struct eco_slot *slot);
+
+/**
+ * Start an asynchronous operation whose completion is queued for mlx_eco_poll_completions() and signaled on the event fd.
+ * The slot of the operation is released only when its completion is polled.
+ *
+ * @param eco_ctx                            Pointer to an initialized EC context with an event fd.
+ * @param arg                                User argument reported with the completion.
+ * @param num_parts                          Number of parts of the operation.
+ * @return                                   The slot of the operation, NULL if all the slots are busy.
+ */
+struct eco_slot *mlx_eco_op_begin_event(struct eco_context *eco_ctx, void *arg, int num_parts);
+
+/**
+ * Get the event fd of a context, creating it on the first call. The fd becomes readable when operations started
+ * with mlx_eco_op_begin_event() complete, it is non-blocking and it is closed when the context is released.
+ *
+ * @param eco_ctx                            Pointer to an initialized EC context.
+ * @return                                   The file descriptor, negative on failure.
+ */
+int mlx_eco_get_event_fd(struct eco_context *eco_ctx);
+
+/**
+ * Reap completions of operations started with mlx_eco_op_begin_event() without blocking.
+ *
+ * @param eco_ctx                            Pointer to an initialized EC context.
+ * @param completions                        Output array of completions, in completion order.
+ * @param max_completions                    Size of completions array.
+ * @return                                   Number of reaped completions.
+ */
+int mlx_eco_poll_completions(struct eco_context *eco_ctx, struct eco_completion *completions, int max_completions);
+
+/**
+ * Set the strategy used by synchronous operations to wait for the HCA.
+ *
+ * @param eco_ctx                            Pointer to an initialized EC context.
+ * @param mode                               The wait strategy.
+ * @return                                   0 successful, other fail.
+ */
+int mlx_eco_set_wait_mode(struct eco_context *eco_ctx, enum eco_wait_mode mode);
+
+/**
+ * Start the next synchronous operation of a batch. When all the slots are busy the oldest pending
+ * operation of the batch is waited for, so a batch larger than the queue depth does not block on itself.
+ *
+ * @param eco_ctx                            Pointer to an initialized EC context.
+ * @param batch                              Batch with slots array of eco_ctx->queue_depth entries.
+ * @param num_parts                          Number of parts of the operation.
+ * @return                                   The slot of the operation.
+ */
+struct eco_slot *mlx_eco_batch_begin(struct eco_context *eco_ctx, struct eco_batch *batch, int num_parts);
+
+/**
+ * Forget the last operation of a batch after it was aborted.
+ *
+ * @param batch                              The batch.
+ */
+static inline void mlx_eco_batch_cancel(struct eco_batch *batch)
+{
+	batch->num_pending--;
+}
+
+/**
+ * Wait until all the pending operations of a batch complete.
+ *
+ * @param eco_ctx                            Pointer to an initialized EC context.
+ * @param batch                              The batch.
+ * @return                                   0 if all the operations of the batch succeeded, else the first failure.
+ */
+int mlx_eco_batch_wait(struct eco_context *eco_ctx, struct eco_batch *batch);
+
+/**
+ * Get the slot of an HCA completion context.
+ *
+ * @param comp                               Completion context of EC calculation.
+ * @return                                   The slot which owns the completion context.
+ */
+static inline struct eco_slot *mlx_eco_comp_slot(struct ibv_exp_ec_comp *comp)
+{
+	return (struct eco_slot *)((char *)comp - offsetof(struct eco_slot, comp.comp));
+}
+
+/**
+ * Check if a block should be calculated by the calling thread without the HCA and without registration.
+ *
+ * @param eco_ctx                            Pointer to an initialized EC context.
+ * @param block_size                         Length of each block of data.
+ * @return                                   Non-zero if the block should be calculated by the software engine only.
+ */
+static inline int mlx_eco_use_sw(struct eco_context *eco_ctx, int block_size)
+{
+	return eco_ctx->backend == ECO_BACKEND_SW || block_size < eco_ctx->sw_threshold;
+}
+
+/**
+ * Set the block size below which encode/decode run entirely on the calling thread.
+ * Tiny blocks are calculated faster by the CPU than the round trip to the HCA takes, so by default the threshold
+ * is calibrated at initialization by comparing both paths. The MLX_ECO_SW_THRESHOLD environment variable overrides it.
+ *
+ * @param eco_ctx                            Pointer to an initialized EC context.
+ * @param sw_threshold                       Block size in bytes (0 - always use the HCA for blocks of 64 bytes or more, negative - calibrate).
+ * @return                                   0 successful, other fail.
+ */
+int mlx_eco_set_sw_threshold(struct eco_context *eco_ctx, int sw_threshold);
+
+/**
+ * Allocate the blocks of a stripe from the huge page arena, registered on the devices of the context.
+ *
+ * @param eco_ctx                            Pointer to an initialized EC context.
+ * @param k                                  Number of data blocks.
+ * @param m                                  Number of code blocks.
+ * @param block_size                         The size of each block.
+ * @return                                   The stripe buffers if successful, else NULL.
+ */
+struct eco_stripe_buffers *mlx_eco_alloc_stripe_buffers(struct eco_context *eco_ctx, int k, int m, int block_size);
+
+/**
+ * Split large blocks between the HCA and CPU threads.
+ * The HCA calculates the 64 bytes aligned head of every block while the CPU threads calculate the rest,
+ * and the split point is adapted to the measured throughput of both paths.
+ * Supported only by contexts which use the HCA.
+ *
+ * @param eco_ctx                            Pointer to an initialized EC context.
+ * @param enable                             Boolean variable which determine if hybrid execution is enabled.
+ * @param num_threads                        Number of additional CPU threads (0 - only the calling thread helps the HCA).
+ * @param min_block_size                     Blocks smaller than this size are calculated by the HCA only (0 - use default).
+ * @return                                   0 successful, other fail.
+ */
+int mlx_eco_set_hybrid(struct eco_context *eco_ctx, int enable, int num_threads, int min_block_size);
+
+/**
+ * Check if a block should be split between the HCA and the CPU.
+ *
+ * @param eco_ctx                            Pointer to an initialized EC context.
+ * @param block_size                         Length of each block of data.
+ * @return                                   Non-zero if the block should be split.
+ */
+static inline int mlx_eco_hybrid_should_split(struct eco_context *eco_ctx, int block_size)
+{
+	return eco_ctx->hybrid.enabled && block_size >= eco_ctx->hybrid.min_block_size;
+}
+
+/**
+ * Take the hybrid CPU threads for a synchronous operation. The CPU threads calculate one operation at a time:
+ * while another thread of the context uses them, the block is split as without hybrid execution.
+ *
+ * @param eco_ctx                            Pointer to an initialized EC context.
+ * @param block_size                         Length of each block of data.
+ * @return                                   Non-zero if the block should be split, the CPU threads are then released with mlx_eco_hybrid_put().
+ */
+static inline int mlx_eco_hybrid_get(struct eco_context *eco_ctx, int block_size)
+{
+	if (!mlx_eco_hybrid_should_split(eco_ctx, block_size) || pthread_mutex_trylock(&eco_ctx->hybrid.mutex)) {
+		return 0;
+	}
+
+	// hybrid execution may have been disabled before the CPU threads were taken
+	if (!mlx_eco_hybrid_should_split(eco_ctx, block_size)) {
+		pthread_mutex_unlock(&eco_ctx->hybrid.mutex);
+		return 0;
+	}
+
+	return 1;
+}
+
+/**
+ * Release the hybrid CPU threads taken by mlx_eco_hybrid_get().
+ *
+ * @param eco_ctx                            Pointer to an initialized EC context.
+ */
+static inline void mlx_eco_hybrid_put(struct eco_context *eco_ctx)
+{
+	pthread_mutex_unlock(&eco_ctx->hybrid.mutex);
+}
+
+/**
+ * Calculate how many bytes of each block the HCA should calculate.
+ *
+ * @param eco_ctx                            Pointer to an initialized EC context.
+ * @param block_size                         Length of each block of data.
+ * @return                                   64 bytes aligned length of the head of each block calculated by the HCA.
+ */
+int mlx_eco_hybrid_split(struct eco_context *eco_ctx, int block_size);
+
+/**
+ * Run a software calculation on the calling thread, and on the hybrid CPU threads if job->num_parts > 1.
+ *
+ * @param job                                The software calculation.
+ * @return                                   Time it took in nanoseconds.
+ */
+uint64_t mlx_eco_run_sw(struct eco_sw_job *job);
+
+/**
+ * Update the measured throughput of both paths after a hybrid calculation.
+ *
+ * @param eco_ctx                            Pointer to an initialized EC context.
+ * @param hw_len                             Bytes of each block calculated by the HCA.
+ * @param hw_ns                              Time the HCA calculation took in nanoseconds.
+ * @param sw_len                             Bytes of each block calculated by the CPU threads.
+ * @param sw_ns                              Time the software calculation took in nanoseconds.
+ */
+void mlx_eco_hybrid_update(struct eco_context *eco_ctx, int hw_len, uint64_t hw_ns, int sw_len, uint64_t sw_ns);
 
 /**
  * Release all EC context resources.
@@ -125,4 +710,8 @@ int mlx_eco_register(struct eco_context *eco_ctx, uint8_t **data, uint8_t **codi
  */
 int mlx_eco_release(struct eco_context *eco_ctx);
 
+#ifdef __cplusplus
+}
+#endif
+
 #endif /* ECO_COMMON_H */
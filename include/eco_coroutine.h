@@ -0,0 +1,487 @@
+/*
+ ** Copyright (C) 2016 Mellanox Technologies
+ **
+ ** Licensed under the Apache License, Version 2.0 (the "License");
+ ** you may not use this file except in compliance with the License.
+ ** You may obtain a copy of the License at:
+ **
+ ** http://www.apache.org/licenses/LICENSE-2.0
+ **
+ ** Unless required by applicable law or agreed to in writing, software
+ ** distributed under the License is distributed on an "AS IS" BASIS,
+ ** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+ ** either express or implied. See the License for the specific language
+ ** governing permissions and  limitations under the License.
+ **
+ */
+
+#ifndef ECO_COROUTINE_H_
+#define ECO_COROUTINE_H_
+
+/**
+ * @file eco_coroutine.h
+ * @brief Header only C++20 coroutine layer over the EC encoder and decoder.
+ *
+ * Mellanox EC library used for Erasure Coding and RAID HW offload.
+ * co_await encoder.encode(stripe, block_size) submits the stripe with mlx_eco_encoder_encode_async() and suspends
+ * the coroutine until the completion callback of the library resumes it, so one thread can drive many stripes
+ * without blocking. Operations beyond the queue depth of the coder wait in a FIFO and are submitted from the
+ * completion callbacks of the previous ones.
+ *
+ * The coroutine is resumed in the completion context of the HCA (or in the awaiting thread when the operation
+ * completes before it could suspend): it should not block there, and should move to its own executor for long work.
+ */
+
+#if !defined(__cplusplus) || __cplusplus < 202002L
+#error "eco_coroutine.h requires C++20"
+#endif
+
+#include "eco_encoder.h"
+#include "eco_decoder.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <chrono>
+#include <coroutine>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <thread>
+
+namespace eco {
+
+namespace detail {
+
+class op_queue;
+
+/**
+ * Release of a coder destroyed by a coroutine resumed in one of its completion callbacks. The release waits for that
+ * callback to return, so it is left to the next thread outside of the completion callbacks of the coroutines: a
+ * completion of another coder, or the creation or release of a coder. Until then the coder keeps its device
+ * resources. The node is allocated with the coder, so handing the release over never fails.
+ */
+class deferred_release {
+public:
+	explicit deferred_release(int (*release)(void *)) noexcept : release_(release) {}
+
+	/* hand over the release of a coder */
+	static void push(std::unique_ptr<deferred_release> node, void *coder) noexcept
+	{
+		deferred_release *r = node.release();
+
+		r->coder_ = coder;
+		r->next_ = head_.load(std::memory_order_relaxed);
+		while (!head_.compare_exchange_weak(r->next_, r, std::memory_order_release, std::memory_order_relaxed));
+	}
+
+	/* release the handed over coders, unless the thread runs a completion callback */
+	static inline void run() noexcept;
+
+private:
+	int                           (*release_)(void *);
+	void                          *coder_ = nullptr;
+	deferred_release              *next_ = nullptr;
+
+	static inline std::atomic<deferred_release *> head_{nullptr};
+};
+
+/**
+ * Awaitable operation of a coder. Completes with 0 if successful, else the failure status of the library.
+ */
+class op {
+public:
+	op(const op &) = delete;
+	op &operator=(const op &) = delete;
+
+	bool await_ready() const noexcept { return false; }
+	inline bool await_suspend(std::coroutine_handle<> handle);
+	int await_resume() const noexcept { return status_; }
+
+protected:
+	explicit op(op_queue &queue) : queue_(queue) {}
+	virtual ~op() = default;
+
+	/* submit the operation with done() as completion callback, -EBUSY if the coder queue is full, -ENOBUFS if the
+	 * bounce buffers of the device are used */
+	virtual int submit() = 0;
+
+	static inline void done(void *arg, int status);
+
+private:
+	friend class op_queue;
+
+	/* the second of the completion and the suspension resumes the coroutine */
+	void finish(int status)
+	{
+		status_ = status;
+		if (ready_.exchange(true, std::memory_order_acq_rel)) {
+			handle_.resume();
+		}
+	}
+
+	op_queue                      &queue_;
+	std::coroutine_handle<>       handle_;
+	std::atomic<bool>             ready_{false};
+	int                           status_ = 0;
+};
+
+/**
+ * FIFO of the operations waiting for room in the queue of a coder.
+ * The submissions of a coder are serialized: the first thread which requests a drain submits for all the
+ * requests which arrive meanwhile (e.g. completions of the HCA, or operations completed inline by the software
+ * engine while they are submitted), so the coder is never entered by two threads at once.
+ */
+class op_queue {
+public:
+	void push(op *o)
+	{
+		{
+			std::lock_guard<std::mutex> lock(mutex_);
+			pending_.push_back(o);
+		}
+
+		drain();
+	}
+
+	void completed()
+	{
+		in_flight_.fetch_sub(1, std::memory_order_acq_rel);
+		drain();
+		deferred_release::run();
+	}
+
+	/* true while the thread runs a completion callback of the queue, its coder cannot be released from there */
+	bool in_callback() const noexcept { return completing_ == this; }
+
+	/* queue of the completion callback which resumes a coroutine on this thread */
+	static inline thread_local const op_queue *completing_ = nullptr;
+
+private:
+	void drain()
+	{
+		unsigned requests;
+
+		if (requests_.fetch_add(1, std::memory_order_acq_rel)) {
+			return;
+		}
+
+		do {
+			requests = requests_.load(std::memory_order_acquire);
+			submit_pending();
+		} while (requests_.fetch_sub(requests, std::memory_order_acq_rel) != requests);
+	}
+
+	/* submit the waiting operations until the coder queue is full */
+	void submit_pending()
+	{
+		std::chrono::microseconds backoff(1);
+
+		for (;;) {
+			op *o;
+
+			{
+				std::lock_guard<std::mutex> lock(mutex_);
+				if (pending_.empty()) {
+					return;
+				}
+				o = pending_.front();
+				pending_.pop_front();
+			}
+
+			/* counted before the submission, the operation may complete before it returns */
+			in_flight_.fetch_add(1, std::memory_order_acq_rel);
+
+			int err = o->submit();
+			if (err) {
+				in_flight_.fetch_sub(1, std::memory_order_acq_rel);
+			}
+
+			/* the next completion of the coder drains the queue again */
+			if (err == -EBUSY || (err == -ENOBUFS && in_flight_.load(std::memory_order_acquire))) {
+				std::lock_guard<std::mutex> lock(mutex_);
+				pending_.push_front(o);
+				return;
+			}
+
+			/* no completion of the coder will come, the buffers are released by the operations of other coders */
+			if (err == -ENOBUFS) {
+				{
+					std::lock_guard<std::mutex> lock(mutex_);
+					pending_.push_front(o);
+				}
+				std::this_thread::sleep_for(backoff);
+				backoff = std::min(backoff * 2, std::chrono::microseconds(1000));
+				continue;
+			}
+
+			if (err) {
+				o->finish(err);
+			}
+		}
+	}
+
+	std::mutex                    mutex_;
+	std::deque<op *>              pending_;
+	std::atomic<unsigned>         requests_{0};
+	std::atomic<unsigned>         in_flight_{0};
+};
+
+void deferred_release::run() noexcept
+{
+	deferred_release *r;
+
+	if (op_queue::completing_ || !head_.load(std::memory_order_relaxed)) {
+		return;
+	}
+
+	for (r = head_.exchange(nullptr, std::memory_order_acquire); r; ) {
+		deferred_release *next = r->next_;
+
+		r->release_(r->coder_);
+		delete r;
+		r = next;
+	}
+}
+
+bool op::await_suspend(std::coroutine_handle<> handle)
+{
+	handle_ = handle;
+	queue_.push(this);
+
+	return !ready_.exchange(true, std::memory_order_acq_rel);
+}
+
+void op::done(void *arg, int status)
+{
+	op *o = static_cast<op *>(arg);
+	op_queue &queue = o->queue_;
+
+	/* submit the waiting operations before resuming, the coroutine may destroy the operation */
+	queue.completed();
+
+	const op_queue *outer = op_queue::completing_;
+	op_queue::completing_ = &queue;
+	o->finish(status);
+	op_queue::completing_ = outer;
+}
+
+} /* namespace detail */
+
+/**
+ * Owning wrapper of an EC encoder with awaitable encode operations.
+ * Operations of one encoder may be awaited by many coroutines concurrently. The encoder must not be used directly
+ * while operations are awaited.
+ */
+class encoder {
+public:
+	class encode_op final : public detail::op {
+	public:
+		encode_op(encoder &coder, uint8_t **data, uint8_t **coding, int block_size)
+			: op(coder.queue_), coder_(coder), data_(data), coding_(coding), block_size_(block_size) {}
+
+	private:
+		int submit() override
+		{
+			struct eco_context *eco_ctx = coder_.get()->eco_ctx;
+
+			return mlx_eco_encoder_encode_async(coder_.get(), data_, coding_, eco_ctx->attr.k, eco_ctx->attr.m, block_size_,
+					done, static_cast<detail::op *>(this));
+		}
+
+		encoder                       &coder_;
+		uint8_t                       **data_;
+		uint8_t                       **coding_;
+		int                           block_size_;
+	};
+
+	/**
+	 * Initialize an EC encoder (see mlx_eco_encoder_init_attr()).
+	 *
+	 * @param attr                    Encoder attributes.
+	 */
+	explicit encoder(struct eco_encoder_attr attr)
+		: release_(std::make_unique<detail::deferred_release>(release))
+	{
+		detail::deferred_release::run();
+
+		encoder_ = mlx_eco_encoder_init_attr(&attr);
+		if (!encoder_) {
+			throw std::runtime_error("mlx_eco_encoder_init_attr failed");
+		}
+	}
+
+	/**
+	 * Initialize an EC encoder on the default device.
+	 *
+	 * @param k                       Number of data blocks.
+	 * @param m                       Number of code blocks.
+	 * @param use_vandermonde_matrix  0 for Cauchy coding matrix else for Vandermonde coding matrix.
+	 * @param queue_depth             Maximum number of operations in flight on the HCA (0 - default).
+	 */
+	encoder(int k, int m, int use_vandermonde_matrix = 0, int queue_depth = 0)
+		: encoder(make_attr(k, m, use_vandermonde_matrix, queue_depth)) {}
+
+	encoder(const encoder &) = delete;
+	encoder &operator=(const encoder &) = delete;
+
+	/*
+	 * Waits for the operations in flight, all the awaiting coroutines must be resumed before. When a coroutine
+	 * resumed by a completion of the encoder destroys it, the release waits for that callback to return, so it is
+	 * left to the next thread outside of the completion callbacks (see detail::deferred_release).
+	 */
+	~encoder()
+	{
+		if (queue_.in_callback()) {
+			detail::deferred_release::push(std::move(release_), encoder_);
+			return;
+		}
+
+		mlx_eco_encoder_release(encoder_);
+		detail::deferred_release::run();
+	}
+
+	struct eco_encoder *get() const noexcept { return encoder_; }
+
+	/**
+	 * Encode the data buffers of a stripe into its coding buffers.
+	 *
+	 * @param stripe                  Data and coding buffers, must stay valid until the operation completes.
+	 * @param block_size              Length of each block of data.
+	 * @return                        Awaitable which completes with 0 if successful, other fail.
+	 */
+	encode_op encode(const struct eco_stripe &stripe, int block_size)
+	{
+		return encode_op(*this, stripe.data, stripe.coding, block_size);
+	}
+
+private:
+	static struct eco_encoder_attr make_attr(int k, int m, int use_vandermonde_matrix, int queue_depth)
+	{
+		struct eco_encoder_attr attr = {};
+
+		attr.k = k;
+		attr.m = m;
+		attr.use_vandermonde_matrix = use_vandermonde_matrix;
+		attr.queue_depth = queue_depth;
+
+		return attr;
+	}
+
+	static int release(void *coder) { return mlx_eco_encoder_release(static_cast<struct eco_encoder *>(coder)); }
+
+	std::unique_ptr<detail::deferred_release> release_;
+	struct eco_encoder            *encoder_;
+	detail::op_queue              queue_;
+};
+
+/**
+ * Owning wrapper of an EC decoder with awaitable decode operations.
+ * Operations of one decoder may be awaited by many coroutines concurrently. The decoder must not be used directly
+ * while operations are awaited.
+ */
+class decoder {
+public:
+	class decode_op final : public detail::op {
+	public:
+		decode_op(decoder &coder, uint8_t **data, uint8_t **coding, int *erasures, int erasures_size, int block_size)
+			: op(coder.queue_), coder_(coder), data_(data), coding_(coding), erasures_(erasures),
+			  erasures_size_(erasures_size), block_size_(block_size) {}
+
+	private:
+		int submit() override
+		{
+			struct eco_context *eco_ctx = coder_.get()->eco_ctx;
+
+			return mlx_eco_decoder_decode_async(coder_.get(), data_, coding_, eco_ctx->attr.k, eco_ctx->attr.m, block_size_,
+					erasures_, erasures_size_, done, static_cast<detail::op *>(this));
+		}
+
+		decoder                       &coder_;
+		uint8_t                       **data_;
+		uint8_t                       **coding_;
+		int                           *erasures_;
+		int                           erasures_size_;
+		int                           block_size_;
+	};
+
+	/**
+	 * Initialize an EC decoder (see mlx_eco_decoder_init_attr()).
+	 *
+	 * @param attr                    Decoder attributes.
+	 */
+	explicit decoder(struct eco_decoder_attr attr)
+		: release_(std::make_unique<detail::deferred_release>(release))
+	{
+		detail::deferred_release::run();
+
+		decoder_ = mlx_eco_decoder_init_attr(&attr);
+		if (!decoder_) {
+			throw std::runtime_error("mlx_eco_decoder_init_attr failed");
+		}
+	}
+
+	/**
+	 * Initialize an EC decoder on the default device.
+	 *
+	 * @param k                       Number of data blocks.
+	 * @param m                       Number of code blocks.
+	 * @param use_vandermonde_matrix  0 for Cauchy coding matrix else for Vandermonde coding matrix.
+	 * @param queue_depth             Maximum number of operations in flight on the HCA (0 - default).
+	 */
+	decoder(int k, int m, int use_vandermonde_matrix = 0, int queue_depth = 0)
+		: decoder(make_attr(k, m, use_vandermonde_matrix, queue_depth)) {}
+
+	decoder(const decoder &) = delete;
+	decoder &operator=(const decoder &) = delete;
+
+	/* waits for the operations in flight, see ~encoder() */
+	~decoder()
+	{
+		if (queue_.in_callback()) {
+			detail::deferred_release::push(std::move(release_), decoder_);
+			return;
+		}
+
+		mlx_eco_decoder_release(decoder_);
+		detail::deferred_release::run();
+	}
+
+	struct eco_decoder *get() const noexcept { return decoder_; }
+
+	/**
+	 * Recover the erased blocks of a stripe.
+	 *
+	 * @param stripe                  Data and coding buffers and erasures, must stay valid until the operation completes.
+	 * @param block_size              Length of each block of data.
+	 * @return                        Awaitable which completes with 0 if successful, other fail.
+	 */
+	decode_op decode(const struct eco_stripe &stripe, int block_size)
+	{
+		return decode_op(*this, stripe.data, stripe.coding, stripe.erasures, stripe.erasures_size, block_size);
+	}
+
+private:
+	static struct eco_decoder_attr make_attr(int k, int m, int use_vandermonde_matrix, int queue_depth)
+	{
+		struct eco_decoder_attr attr = {};
+
+		attr.k = k;
+		attr.m = m;
+		attr.use_vandermonde_matrix = use_vandermonde_matrix;
+		attr.queue_depth = queue_depth;
+
+		return attr;
+	}
+
+	static int release(void *coder) { return mlx_eco_decoder_release(static_cast<struct eco_decoder *>(coder)); }
+
+	std::unique_ptr<detail::deferred_release> release_;
+	struct eco_decoder            *decoder_;
+	detail::op_queue              queue_;
+};
+
+} /* namespace eco */
+
+#endif /* ECO_COROUTINE_H_ */
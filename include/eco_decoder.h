@@ -30,22 +30,80 @@
  */
 
 #include "eco_common.h"
+#include "eco_matrix_cache.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
 
 /**
 * @eco_ctx                          Erasure Coding Offload context.
-* @int_decode_matrix                Registered buffer [k * k] of the decode matrix in int format used for Jerasure to calculate the decode matrix.
 * @u8_decode_matrix                 Registered buffer [k * m] of the decode matrix used for ibv_exp_ec_decode_sync method.
-* @int_erasures                     Pointer to byte-map of which blocks were erased and needs to be recovered - used for Jerasure.
 * @u8_erasures                      Pointer to byte-map of which blocks were erased and needs to be recovered - used for verbs decode method.
-* @survived                         Pointer to byte-map of which blocks were survived.
+* @erasures_mask                    Bitmask of the erasures the current decode matrix was generated for.
+* @matrix_cache                     LRU cache of decode matrices of recent erasure patterns, NULL if disabled.
+* @matrix_mutex                     Protects u8_decode_matrix, u8_erasures, erasures_mask and matrix_cache, so several threads may decode at once.
+* @table_index                      Index [2^(k+m)] of the precomputed decode matrices by erasure bitmask, NULL if not precomputed.
+* @table_matrices                   Contiguous buffer of the precomputed decode matrices, [k * m] bytes each.
+* @table_ready                      Set once all the decode matrices were precomputed.
+* @table_stop                       Set to stop the precompute thread.
+* @table_thread_running             Boolean variable which determine if table_thread should be joined.
+* @table_thread                     Thread precomputing the decode matrices in the background.
+* @pool_entry                       Slot of the decoder in the pool which created it (see eco_pool.h), else NULL.
 */
 struct eco_decoder {
 	struct eco_context          *eco_ctx;
-	int                         *int_decode_matrix;
 	uint8_t                     *u8_decode_matrix;
-	int                         *int_erasures;
 	uint8_t                     *u8_erasures;
-	int                         *survived;
+	uint32_t                    erasures_mask;
+	struct eco_matrix_cache     *matrix_cache;
+	pthread_mutex_t             matrix_mutex;
+	uint16_t                    *table_index;
+	uint8_t                     *table_matrices;
+	int                         table_ready;
+	int                         table_stop;
+	int                         table_thread_running;
+	pthread_t                   table_thread;
+	void                        *pool_entry;
+};
+
+/**
+ * Decode matrices precomputation modes.
+ *
+ * @ECO_DECODER_PRECOMPUTE_NONE           Decode matrices are generated on demand and cached.
+ * @ECO_DECODER_PRECOMPUTE_SYNC           All the decode matrices are generated by mlx_eco_decoder_init_attr().
+ * @ECO_DECODER_PRECOMPUTE_BACKGROUND     All the decode matrices are generated by a background thread, decode operations
+ *                                        generate their matrix on demand until it is done.
+ */
+enum eco_decoder_precompute {
+	ECO_DECODER_PRECOMPUTE_NONE,
+	ECO_DECODER_PRECOMPUTE_SYNC,
+	ECO_DECODER_PRECOMPUTE_BACKGROUND,
+};
+
+/**
+* @k                                Number of data blocks.
+* @m                                Number of code blocks.
+* @use_vandermonde_matrix           Boolean variable which determine the type of the encode matrix:
+*                                   0 for Cauchy coding matrix else for Vandermonde coding matrix.
+* @precompute                       Decode matrices precomputation mode.
+* @cache_size                       Maximum number of cached decode matrices (0 - default 64, negative - disabled).
+* @queue_depth                      Maximum number of asynchronous operations in flight per device (0 - default 2), up to the
+*                                   max_ec_calc_inflight_calcs capability of the device.
+* @device                           HCA selection (zeroed - mlx5_0). With ECO_DEVICE_ALL the operations are striped across
+*                                   all the EC capable devices and the queue depth is multiplied by their number.
+* @lazy                             Boolean variable which determine if the devices are opened and the HCA calculation
+*                                   engine is allocated by the first operation instead of mlx_eco_decoder_init_attr().
+*/
+struct eco_decoder_attr {
+	int                         k;
+	int                         m;
+	int                         use_vandermonde_matrix;
+	enum eco_decoder_precompute precompute;
+	int                         cache_size;
+	int                         queue_depth;
+	struct eco_device_attr      device;
+	int                         lazy;
 };
 
 /**
@@ -59,6 +117,16 @@ struct eco_decoder {
  */
 struct eco_decoder *mlx_eco_decoder_init(int k, int m, int use_vandermonde_matrix);
 
+/**
+ * Initialize verbs EC decoder object with extended attributes.
+ * Precomputing the decode matrices of all the erasure patterns of 1..m erasures makes every decode operation a table lookup
+ * (e.g. 1470 patterns for k = 10, m = 4). Zeroed attributes beside k and m give the same decoder as mlx_eco_decoder_init().
+ *
+ * @param attr                      Decoder attributes.
+ * @return                          Pointer to an initialize EC decoder object if successful, else NULL.
+ */
+struct eco_decoder *mlx_eco_decoder_init_attr(struct eco_decoder_attr *attr);
+
 /**
  * Register buffers and update the memory layout context for future encode/decode operations.
  * Because the HW can perform encode/decode operations only on 64 bytes aligned buffers, we will register only the aligned part of the buffers.
@@ -91,6 +159,7 @@ int mlx_eco_decoder_generate_decode_matrix(struct eco_decoder *eco_decoder, int
  * Decode a given set of data blocks and code_blocks and place into output recovery blocks.
  * Using mlx_eco_decoder_generate_decode_matrix() if the decode matrix is not compatible with the erasures.
  * Using mlx_eco_decoder_register() if the buffers are not registered.
+ * Several threads may decode with the same decoder at once, with the same or different erasures.
  *
  * @param eco_decoder               Pointer to an initialized EC decoder.
  * @param data                      Array of pointers to source input buffers.
@@ -104,6 +173,146 @@ int mlx_eco_decoder_generate_decode_matrix(struct eco_decoder *eco_decoder, int
  */
 int mlx_eco_decoder_decode(struct eco_decoder *eco_decoder, uint8_t **data, uint8_t **coding, int data_size, int coding_size, int block_size, int *erasures, int erasures_size);
 
+/**
+ * Submit the decoding of the erased blocks and return without waiting for it.
+ * done_func is called once the erased blocks are recovered - from the completion context of the HCA, or from the
+ * calling thread before this function returns for blocks calculated by the software engine. It should not block or
+ * run synchronous operations of the same coder,
+ * but it may submit the next operation. Up to queue_depth operations can be in flight per decoder.
+ * With a NULL done_func the completion is queued for mlx_eco_decoder_poll_completions() instead, and signaled on the
+ * event fd of the decoder (see mlx_eco_decoder_get_event_fd()).
+ *
+ * @param eco_decoder               Pointer to an initialized EC decoder.
+ * @param data                      Array of pointers to data buffers.
+ * @param coding                    Array of pointers to coding buffers.
+ * @param data_size                 Size of data array (must be equal to the initial amount of data blocks).
+ * @param coding_size               Size of coding array (must be equal to the initial amount of code blocks).
+ * @param block_size                Length of each block of data.
+ * @param erasures                  Array of erased blocks indices.
+ * @param erasures_size             Size of erasures array.
+ * @param done_func                 Completion callback, NULL to report the completion through the event fd.
+ * @param arg                       User argument passed to done_func.
+ * @return                          0 submitted, -EBUSY if queue_depth operations are in flight, -ENOBUFS if the bounce buffers are used by other operations, other fail (done_func is not called).
+ */
+int mlx_eco_decoder_decode_async(struct eco_decoder *eco_decoder, uint8_t **data, uint8_t **coding, int data_size, int coding_size, int block_size,
+		int *erasures, int erasures_size, eco_coder_done_func done_func, void *arg);
+
+/**
+ * Decode a batch of stripes, each with its own erasures: the stripes are submitted back to back to the HCA, up to the
+ * queue depth of the decoder, and waited for once, so the per call overhead is paid once for the whole batch.
+ *
+ * @param eco_decoder               Pointer to an initialized EC decoder.
+ * @param stripes                   Array of stripes (data and coding buffers and erasures of each stripe).
+ * @param num_stripes               Size of stripes array.
+ * @param data_size                 Size of the data array of each stripe (must be equal to the initial amount of data blocks).
+ * @param coding_size               Size of the coding array of each stripe (must be equal to the initial amount of code blocks).
+ * @param block_size                Length of each block of data.
+ * @return                          0 if all the stripes were decoded successfully, other fail.
+ */
+int mlx_eco_decoder_decode_batch(struct eco_decoder *eco_decoder, struct eco_stripe *stripes, int num_stripes, int data_size, int coding_size, int block_size);
+
+/**
+ * Get the event fd of the decoder, for epoll driven applications. The fd is non-blocking and becomes readable when
+ * asynchronous operations submitted without a completion callback complete, it is owned by the decoder.
+ *
+ * @param eco_decoder               Pointer to an initialized EC decoder.
+ * @return                          The file descriptor, negative on failure.
+ */
+int mlx_eco_decoder_get_event_fd(struct eco_decoder *eco_decoder);
+
+/**
+ * Reap the completions of asynchronous operations submitted without a completion callback, without blocking.
+ * The queue slot of an operation is released only when its completion is reaped.
+ *
+ * @param eco_decoder               Pointer to an initialized EC decoder.
+ * @param completions               Output array of completions (user argument and status of each operation).
+ * @param max_completions           Size of completions array.
+ * @return                          Number of reaped completions, negative on failure.
+ */
+int mlx_eco_decoder_poll_completions(struct eco_decoder *eco_decoder, struct eco_completion *completions, int max_completions);
+
+/**
+ * Wait until the in flight asynchronous operations of the decoder complete and their completion callbacks return.
+ *
+ * @param eco_decoder               Pointer to an initialized EC decoder.
+ * @return                          First failure of the asynchronous operations since the last wait, 0 if all succeeded.
+ */
+int mlx_eco_decoder_wait(struct eco_decoder *eco_decoder);
+
+/**
+ * Split the decoding of large blocks between the HCA and CPU threads.
+ * The HCA decodes the head of every block while the CPU threads decode the rest of it concurrently.
+ * The split point is adapted to the measured throughput of both paths.
+ *
+ * @param eco_decoder               Pointer to an initialized EC decoder.
+ * @param enable                    Boolean variable which determine if hybrid execution is enabled.
+ * @param num_threads               Number of additional CPU threads (0 - only the calling thread helps the HCA).
+ * @param min_block_size            Blocks smaller than this size are decoded by the HCA only (0 - 64KB).
+ * @return                          0 successful, other fail.
+ */
+int mlx_eco_decoder_set_hybrid(struct eco_decoder *eco_decoder, int enable, int num_threads, int min_block_size);
+
+/**
+ * Set the block size below which blocks are decoded by the calling thread without the HCA.
+ * By default the threshold is calibrated at initialization (or set by the MLX_ECO_SW_THRESHOLD environment variable).
+ *
+ * @param eco_decoder               Pointer to an initialized EC decoder.
+ * @param sw_threshold              Block size in bytes (0 - disable, negative - calibrate again).
+ * @return                          0 successful, other fail.
+ */
+int mlx_eco_decoder_set_sw_threshold(struct eco_decoder *eco_decoder, int sw_threshold);
+
+/**
+ * Set how synchronous operations wait for the HCA (default ECO_WAIT_ADAPTIVE).
+ * ECO_WAIT_ADAPTIVE busy polls for about twice the recent completion latency before it sleeps, so short operations
+ * complete without a scheduler wakeup while long ones do not burn the calling core.
+ *
+ * @param eco_decoder               Pointer to an initialized EC decoder.
+ * @param mode                      ECO_WAIT_BLOCK, ECO_WAIT_SPIN or ECO_WAIT_ADAPTIVE.
+ * @return                          0 successful, other fail.
+ */
+int mlx_eco_decoder_set_wait_mode(struct eco_decoder *eco_decoder, enum eco_wait_mode mode);
+
+/**
+ * Set the number of erasure patterns whose decode matrices are cached by the decoder (default 64).
+ * Decoding a pattern found in the cache skips the matrix inversion. Changing the size drops the cached matrices.
+ *
+ * @param eco_decoder               Pointer to an initialized EC decoder.
+ * @param cache_size                Maximum number of cached decode matrices (0 - cache only the last pattern).
+ * @return                          0 successful, other fail.
+ */
+int mlx_eco_decoder_set_cache_size(struct eco_decoder *eco_decoder, int cache_size);
+
+/**
+ * Get the decode matrix cache statistics.
+ *
+ * @param eco_decoder               Pointer to an initialized EC decoder.
+ * @param stats                     Filled with the cache statistics (all zero if the cache is disabled).
+ * @return                          0 successful, other fail.
+ */
+int mlx_eco_decoder_get_cache_stats(struct eco_decoder *eco_decoder, struct eco_matrix_cache_stats *stats);
+
+/**
+ * Set up a lazy decoder ahead of its first operation, so it does not pay for opening the devices.
+ *
+ * @param eco_decoder               Pointer to an initialized EC decoder.
+ * @return                          0 successful, other fail.
+ */
+int mlx_eco_decoder_prewarm(struct eco_decoder *eco_decoder);
+
+/**
+ * Allocate the blocks of a stripe from a huge page arena registered on the devices of the decoder, so its operations
+ * need no registration. The blocks are 64 bytes aligned, blocks whose size is a multiple of 64 bytes are calculated
+ * entirely by the HCA. Free them with mlx_eco_free_stripe_buffers().
+ *
+ * @param eco_decoder               Pointer to an initialized EC decoder.
+ * @param k                         Number of data blocks.
+ * @param m                         Number of code blocks.
+ * @param block_size                The size of each block.
+ * @return                          The stripe buffers if successful, else NULL.
+ */
+struct eco_stripe_buffers *mlx_eco_decoder_alloc_stripe_buffers(struct eco_decoder *eco_decoder, int k, int m, int block_size);
+
 /**
  * Release all EC decoder resources.
  *
@@ -112,4 +321,8 @@ int mlx_eco_decoder_decode(struct eco_decoder *eco_decoder, uint8_t **data, uint
  */
 int mlx_eco_decoder_release(struct eco_decoder *eco_decoder);
 
+#ifdef __cplusplus
+}
+#endif
+
 #endif /* ECO_DECODER_H_ */
@@ -0,0 +1,69 @@
+/*
+ ** Copyright (C) 2016 Mellanox Technologies
+ **
+ ** Licensed under the Apache License, Version 2.0 (the "License");
+ ** you may not use this file except in compliance with the License.
+ ** You may obtain a copy of the License at:
+ **
+ ** http://www.apache.org/licenses/LICENSE-2.0
+ **
+ ** Unless required by applicable law or agreed to in writing, software
+ ** distributed under the License is distributed on an "AS IS" BASIS,
+ ** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+ ** either express or implied. See the License for the specific language
+ ** governing permissions and  limitations under the License.
+ **
+ */
+#ifndef ECO_ENCODE_MATRIX_H_
+#define ECO_ENCODE_MATRIX_H_
+
+/**
+ * @file eco_encode_matrix.h
+ * @brief Define a process-wide cache of encode matrices shared by all the encoders and decoders.
+ *
+ * Mellanox EC library used for Erasure Coding and RAID HW offload.
+ * Erasure coding (EC) is a method of data protection in which data is broken into fragments,
+ * expanded and encoded with redundant data pieces and stored across a set of different locations or storage media.
+ * Every (k, m, matrix type) is generated once. Lookups are lock-free, so creating coders from many threads does not contend.
+ * Currently supported by mlx5 only.
+ */
+
+#include <stdint.h>
+
+/**
+ * Shared encode matrix.
+ *
+ * @k                             Number of data blocks.
+ * @m                             Number of code blocks.
+ * @use_vandermonde_matrix        Boolean variable which determine the type of the encode matrix.
+ * @ref_count                     Number of EC contexts using the matrix.
+ * @matrix                        Encode matrix [k x m] as given to the HCA.
+ */
+struct eco_encode_matrix {
+	int                           k;
+	int                           m;
+	int                           use_vandermonde_matrix;
+	int                           ref_count;
+	uint8_t                       matrix[];
+};
+
+/**
+ * Get the encode matrix of (k, m, matrix type), generating it on first use.
+ *
+ * @param k                       Number of data blocks.
+ * @param m                       Number of code blocks.
+ * @param use_vandermonde_matrix  Boolean variable which determine the type of the encode matrix:
+ *                                0 for Cauchy coding matrix else for Vandermonde coding matrix.
+ * @return                        Pointer to the shared encode matrix if successful, else NULL.
+ */
+struct eco_encode_matrix *eco_encode_matrix_get(int k, int m, int use_vandermonde_matrix);
+
+/**
+ * Release a reference taken by eco_encode_matrix_get().
+ * The matrix stays cached for the next coders of the same layout, it is freed when the library is unloaded.
+ *
+ * @param encode_matrix           Pointer to the shared encode matrix.
+ */
+void eco_encode_matrix_put(struct eco_encode_matrix *encode_matrix);
+
+#endif /* ECO_ENCODE_MATRIX_H_ */
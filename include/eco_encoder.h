@@ -31,11 +31,38 @@
 
 #include "eco_common.h"
 
+#ifdef __cplusplus
+extern "C" {
+#endif
+
 /**
 * @eco_ctx                               Erasure Coding Offload context.
+* @pool_entry                            Slot of the encoder in the pool which created it (see eco_pool.h), else NULL.
 */
 struct eco_encoder {
 	struct eco_context               *eco_ctx;
+	void                             *pool_entry;
+};
+
+/**
+* @k                                     Number of data blocks.
+* @m                                     Number of code blocks.
+* @use_vandermonde_matrix                Boolean variable which determine the type of the encode matrix:
+*                                        0 for Cauchy coding matrix else for Vandermonde coding matrix.
+* @queue_depth                           Maximum number of asynchronous operations in flight per device (0 - default 2), up to the
+*                                        max_ec_calc_inflight_calcs capability of the device.
+* @device                                HCA selection (zeroed - mlx5_0). With ECO_DEVICE_ALL the operations are striped across
+*                                        all the EC capable devices and the queue depth is multiplied by their number.
+* @lazy                                  Boolean variable which determine if the devices are opened and the HCA calculation
+*                                        engine is allocated by the first operation instead of mlx_eco_encoder_init_attr().
+*/
+struct eco_encoder_attr {
+	int                              k;
+	int                              m;
+	int                              use_vandermonde_matrix;
+	int                              queue_depth;
+	struct eco_device_attr           device;
+	int                              lazy;
 };
 
 /**
@@ -49,6 +76,16 @@ struct eco_encoder {
  */
 struct eco_encoder *mlx_eco_encoder_init(int k, int m, int use_vandermonde_matrix);
 
+/**
+ * Initialize verbs EC encoder object with extended attributes.
+ * A deeper queue lets a single encoder keep several stripes in flight on the HCA with mlx_eco_encoder_encode_async().
+ * Zeroed attributes beside k and m give the same encoder as mlx_eco_encoder_init().
+ *
+ * @param attr                           Encoder attributes.
+ * @return                               Pointer to an initialize EC encoder object if successful, else NULL.
+ */
+struct eco_encoder *mlx_eco_encoder_init_attr(struct eco_encoder_attr *attr);
+
 /**
  * Register buffers and update the memory layout context for future encode/decode operations.
  * Because the HW can perform encode/decode operations only on 64 bytes aligned buffers, we will register only the aligned part of the buffers.
@@ -67,6 +104,7 @@ int mlx_eco_encoder_register(struct eco_encoder *eco_encoder, uint8_t **data, ui
 /**
  * Generates blocks of encoded data from the data buffers and store them in the coding array.
  * Using mlx_eco_encoder_register() if the buffers are not registered.
+ * Several threads may encode with the same encoder at once, each operation uses its own slot of the queue.
  *
  * @param eco_encoder                    Pointer to an initialized EC encoder.
  * @param data                           Array of pointers to source input buffers.
@@ -78,6 +116,125 @@ int mlx_eco_encoder_register(struct eco_encoder *eco_encoder, uint8_t **data, ui
  */
 int mlx_eco_encoder_encode(struct eco_encoder *eco_encoder, uint8_t **data, uint8_t **coding, int data_size, int coding_size, int block_size);
 
+/**
+ * Submit the encoding of the data buffers into the coding array and return without waiting for it.
+ * done_func is called once the coding blocks are ready - from the completion context of the HCA, or from the
+ * calling thread before this function returns for blocks calculated by the software engine. It should not block or
+ * run synchronous operations of the same coder,
+ * but it may submit the next operation. Up to queue_depth operations can be in flight per encoder.
+ * With a NULL done_func the completion is queued for mlx_eco_encoder_poll_completions() instead, and signaled on the
+ * event fd of the encoder (see mlx_eco_encoder_get_event_fd()).
+ *
+ * @param eco_encoder                    Pointer to an initialized EC encoder.
+ * @param data                           Array of pointers to source input buffers.
+ * @param coding                         Array of pointers to coded output buffers.
+ * @param data_size                      Size of data array (must be equal to the initial amount of data blocks).
+ * @param coding_size                    Size of coding array (must be equal to the initial amount of code blocks).
+ * @param block_size                     Length of each block of data.
+ * @param done_func                      Completion callback, NULL to report the completion through the event fd.
+ * @param arg                            User argument passed to done_func.
+ * @return                               0 submitted, -EBUSY if queue_depth operations are in flight, -ENOBUFS if the bounce buffers are used by other operations, other fail (done_func is not called).
+ */
+int mlx_eco_encoder_encode_async(struct eco_encoder *eco_encoder, uint8_t **data, uint8_t **coding, int data_size, int coding_size, int block_size,
+		eco_coder_done_func done_func, void *arg);
+
+/**
+ * Encode a batch of stripes: the stripes are submitted back to back to the HCA, up to the queue depth of the encoder,
+ * and waited for once, so the per call overhead is paid once for the whole batch.
+ *
+ * @param eco_encoder                    Pointer to an initialized EC encoder.
+ * @param stripes                        Array of stripes (data and coding buffers of each stripe).
+ * @param num_stripes                    Size of stripes array.
+ * @param data_size                      Size of the data array of each stripe (must be equal to the initial amount of data blocks).
+ * @param coding_size                    Size of the coding array of each stripe (must be equal to the initial amount of code blocks).
+ * @param block_size                     Length of each block of data.
+ * @return                               0 if all the stripes were encoded successfully, other fail.
+ */
+int mlx_eco_encoder_encode_batch(struct eco_encoder *eco_encoder, struct eco_stripe *stripes, int num_stripes, int data_size, int coding_size, int block_size);
+
+/**
+ * Get the event fd of the encoder, for epoll driven applications. The fd is non-blocking and becomes readable when
+ * asynchronous operations submitted without a completion callback complete, it is owned by the encoder.
+ *
+ * @param eco_encoder                    Pointer to an initialized EC encoder.
+ * @return                               The file descriptor, negative on failure.
+ */
+int mlx_eco_encoder_get_event_fd(struct eco_encoder *eco_encoder);
+
+/**
+ * Reap the completions of asynchronous operations submitted without a completion callback, without blocking.
+ * The queue slot of an operation is released only when its completion is reaped.
+ *
+ * @param eco_encoder                    Pointer to an initialized EC encoder.
+ * @param completions                    Output array of completions (user argument and status of each operation).
+ * @param max_completions                Size of completions array.
+ * @return                               Number of reaped completions, negative on failure.
+ */
+int mlx_eco_encoder_poll_completions(struct eco_encoder *eco_encoder, struct eco_completion *completions, int max_completions);
+
+/**
+ * Wait until the in flight asynchronous operations of the encoder complete and their completion callbacks return.
+ *
+ * @param eco_encoder                    Pointer to an initialized EC encoder.
+ * @return                               First failure of the asynchronous operations since the last wait, 0 if all succeeded.
+ */
+int mlx_eco_encoder_wait(struct eco_encoder *eco_encoder);
+
+/**
+ * Split the encoding of large blocks between the HCA and CPU threads.
+ * The HCA encodes the head of every block while the CPU threads encode the rest of it concurrently.
+ * The split point is adapted to the measured throughput of both paths.
+ *
+ * @param eco_encoder                    Pointer to an initialized EC encoder.
+ * @param enable                         Boolean variable which determine if hybrid execution is enabled.
+ * @param num_threads                    Number of additional CPU threads (0 - only the calling thread helps the HCA).
+ * @param min_block_size                 Blocks smaller than this size are encoded by the HCA only (0 - 64KB).
+ * @return                               0 successful, other fail.
+ */
+int mlx_eco_encoder_set_hybrid(struct eco_encoder *eco_encoder, int enable, int num_threads, int min_block_size);
+
+/**
+ * Set the block size below which blocks are encoded by the calling thread without the HCA.
+ * By default the threshold is calibrated at initialization (or set by the MLX_ECO_SW_THRESHOLD environment variable).
+ *
+ * @param eco_encoder                    Pointer to an initialized EC encoder.
+ * @param sw_threshold                   Block size in bytes (0 - disable, negative - calibrate again).
+ * @return                               0 successful, other fail.
+ */
+int mlx_eco_encoder_set_sw_threshold(struct eco_encoder *eco_encoder, int sw_threshold);
+
+/**
+ * Set how synchronous operations wait for the HCA (default ECO_WAIT_ADAPTIVE).
+ * ECO_WAIT_ADAPTIVE busy polls for about twice the recent completion latency before it sleeps, so short operations
+ * complete without a scheduler wakeup while long ones do not burn the calling core.
+ *
+ * @param eco_encoder                    Pointer to an initialized EC encoder.
+ * @param mode                           ECO_WAIT_BLOCK, ECO_WAIT_SPIN or ECO_WAIT_ADAPTIVE.
+ * @return                               0 successful, other fail.
+ */
+int mlx_eco_encoder_set_wait_mode(struct eco_encoder *eco_encoder, enum eco_wait_mode mode);
+
+/**
+ * Set up a lazy encoder ahead of its first operation, so it does not pay for opening the devices.
+ *
+ * @param eco_encoder                    Pointer to an initialized EC encoder.
+ * @return                               0 successful, other fail.
+ */
+int mlx_eco_encoder_prewarm(struct eco_encoder *eco_encoder);
+
+/**
+ * Allocate the blocks of a stripe from a huge page arena registered on the devices of the encoder, so its operations
+ * need no registration. The blocks are 64 bytes aligned, blocks whose size is a multiple of 64 bytes are calculated
+ * entirely by the HCA. Free them with mlx_eco_free_stripe_buffers().
+ *
+ * @param eco_encoder                    Pointer to an initialized EC encoder.
+ * @param k                              Number of data blocks.
+ * @param m                              Number of code blocks.
+ * @param block_size                     The size of each block.
+ * @return                               The stripe buffers if successful, else NULL.
+ */
+struct eco_stripe_buffers *mlx_eco_encoder_alloc_stripe_buffers(struct eco_encoder *eco_encoder, int k, int m, int block_size);
+
 /**
  * Release all EC encoder resources.
  *
@@ -86,4 +243,8 @@ int mlx_eco_encoder_encode(struct eco_encoder *eco_encoder, uint8_t **data, uint
  */
 int mlx_eco_encoder_release(struct eco_encoder *eco_encoder);
 
+#ifdef __cplusplus
+}
+#endif
+
 #endif /* ECO_ENCODER_H_ */
@@ -0,0 +1,143 @@
+/*
+ ** Copyright (C) 2016 Mellanox Technologies
+ **
+ ** Licensed under the Apache License, Version 2.0 (the "License");
+ ** you may not use this file except in compliance with the License.
+ ** You may obtain a copy of the License at:
+ **
+ ** http://www.apache.org/licenses/LICENSE-2.0
+ **
+ ** Unless required by applicable law or agreed to in writing, software
+ ** distributed under the License is distributed on an "AS IS" BASIS,
+ ** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+ ** either express or implied. See the License for the specific language
+ ** governing permissions and  limitations under the License.
+ **
+ */
+
+#ifndef ECO_GF_H_
+#define ECO_GF_H_
+
+/**
+ * @file eco_gf.h
+ * @brief Software GF(2^4) region arithmetic used when the HCA can not (or should not) perform the calculation.
+ *
+ * Mellanox EC library used for Erasure Coding and RAID HW offload.
+ * The HCA treats every byte as two independent GF(2^4) symbols (high and low nibble) which are multiplied
+ * by the same 4-bit coefficient. The software engine follows the same convention, so its output is
+ * bit-identical to the output of ibv_exp_ec_encode_async/ibv_exp_ec_decode_async.
+ */
+
+#include <stdint.h>
+#include <stddef.h>
+
+/**
+ * Software kernel tiers, from the most portable to the fastest.
+ * The widest tier supported by the CPU is bound when the library is loaded.
+ *
+ * @ECO_GF_TIER_SCALAR            Byte-at-a-time lookup tables.
+ * @ECO_GF_TIER_SSSE3             16 bytes nibble-shuffle tables.
+ * @ECO_GF_TIER_AVX2              32 bytes nibble-shuffle tables.
+ * @ECO_GF_TIER_AVX512            64 bytes nibble-shuffle tables (AVX-512BW).
+ * @ECO_GF_TIER_GFNI              64 bytes GF(2) affine transformations (AVX-512BW + GFNI).
+ */
+enum eco_gf_tier {
+	ECO_GF_TIER_SCALAR,
+	ECO_GF_TIER_SSSE3,
+	ECO_GF_TIER_AVX2,
+	ECO_GF_TIER_AVX512,
+	ECO_GF_TIER_GFNI,
+	ECO_GF_TIER_MAX,
+};
+
+/**
+ * Get the kernel tier currently used by the software engine.
+ *
+ * @return                        The current tier.
+ */
+enum eco_gf_tier eco_gf_get_tier(void);
+
+/**
+ * Force the kernel tier used by the software engine (e.g. for benchmarking).
+ * The same can be done with the MLX_ECO_GF_TIER environment variable (scalar, ssse3, avx2, avx512 or gfni).
+ * Not thread safe with respect to running calculations - should be called before creating encoders/decoders.
+ *
+ * @param tier                    The requested tier.
+ * @return                        0 successful, other if the CPU does not support the tier.
+ */
+int eco_gf_set_tier(enum eco_gf_tier tier);
+
+/**
+ * Get the name of a kernel tier.
+ *
+ * @param tier                    The tier.
+ * @return                        Constant string with the tier name.
+ */
+const char *eco_gf_tier_name(enum eco_gf_tier tier);
+
+/**
+ * Multiply both nibbles of a byte by a GF(2^4) coefficient.
+ *
+ * @param x                       Byte holding two GF(2^4) symbols.
+ * @param y                       GF(2^4) coefficient (only the low nibble is used).
+ * @return                        The product.
+ */
+uint8_t eco_gf_mul(uint8_t x, uint8_t y);
+
+/**
+ * Multiply a set of input blocks by a coefficient matrix and store the result in the output blocks.
+ * out[i][offset..offset+len) = XOR over j of matrix[j * num_out + i] * in[j][offset..offset+len).
+ * The matrix uses the same [num_in x num_out] layout as the encode/decode matrices given to the HCA.
+ *
+ * @param matrix                  Coefficient matrix [num_in x num_out].
+ * @param num_in                  Number of input blocks.
+ * @param num_out                 Number of output blocks.
+ * @param in                      Array of pointers to input blocks.
+ * @param out                     Array of pointers to output blocks.
+ * @param offset                  Offset of the first byte to calculate in each block.
+ * @param len                     Number of bytes to calculate in each block.
+ */
+void eco_gf_mult_blocks(const uint8_t *matrix, int num_in, int num_out, uint8_t **in, uint8_t **out, size_t offset, size_t len);
+
+/**
+ * Encode a byte range of the data blocks into the coding blocks.
+ *
+ * @param encode_matrix           Encode matrix [k x m] as given to the HCA.
+ * @param k                       Number of data blocks.
+ * @param m                       Number of code blocks.
+ * @param data                    Array of pointers to source input buffers.
+ * @param coding                  Array of pointers to coded output buffers.
+ * @param offset                  Offset of the first byte to encode in each block.
+ * @param len                     Number of bytes to encode in each block.
+ */
+void eco_gf_encode(const uint8_t *encode_matrix, int k, int m, uint8_t **data, uint8_t **coding, size_t offset, size_t len);
+
+/**
+ * Decode a byte range of the erased blocks from the first k surviving blocks.
+ *
+ * @param decode_matrix           Decode matrix [k x num_erasures] as given to the HCA.
+ * @param k                       Number of data blocks.
+ * @param m                       Number of code blocks.
+ * @param erasures                Byte-map [k + m] of which blocks were erased and needs to be recovered.
+ * @param data                    Array of pointers to data buffers.
+ * @param coding                  Array of pointers to coding buffers.
+ * @param offset                  Offset of the first byte to decode in each block.
+ * @param len                     Number of bytes to decode in each block.
+ * @return                        0 successful, other fail.
+ */
+int eco_gf_decode(const uint8_t *decode_matrix, int k, int m, const uint8_t *erasures, uint8_t **data, uint8_t **coding, size_t offset, size_t len);
+
+/**
+ * Build the decode matrix of an erasure pattern by Gaussian elimination over GF(2^4), without allocations.
+ * The inputs are the first k surviving blocks and the outputs are the erased blocks, both in index order.
+ *
+ * @param encode_matrix           Encode matrix [k x m] as given to the HCA.
+ * @param k                       Number of data blocks.
+ * @param m                       Number of code blocks.
+ * @param erasures                Byte-map [k + m] of which blocks were erased and needs to be recovered.
+ * @param decode_matrix           Output decode matrix [k x num_erasures] as given to the HCA.
+ * @return                        0 successful, other if the erased blocks can not be recovered.
+ */
+int eco_gf_make_decode_matrix(const uint8_t *encode_matrix, int k, int m, const uint8_t *erasures, uint8_t *decode_matrix);
+
+#endif /* ECO_GF_H_ */
@@ -0,0 +1,248 @@
+/*
+ ** Copyright (C) 2016 Mellanox Technologies
+ **
+ ** Licensed under the Apache License, Version 2.0 (the "License");
+ ** you may not use this file except in compliance with the License.
+ ** You may obtain a copy of the License at:
+ **
+ ** http://www.apache.org/licenses/LICENSE-2.0
+ **
+ ** Unless required by applicable law or agreed to in writing, software
+ ** distributed under the License is distributed on an "AS IS" BASIS,
+ ** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+ ** either express or implied. See the License for the specific language
+ ** governing permissions and  limitations under the License.
+ **
+ */
+
+#ifndef ECO_HCA_H_
+#define ECO_HCA_H_
+
+/**
+ * @file eco_hca.h
+ * @brief Define a process-wide registry of opened HCAs shared by all the encoders and decoders.
+ *
+ * Mellanox EC library used for Erasure Coding and RAID HW offload.
+ * Every EC capable device is opened once, with one protection domain and one cache of registered memory regions,
+ * so creating a coder does not open the device again and a buffer registered by one coder is used by all the
+ * coders on the same device.
+ * Currently supported by mlx5 only.
+ */
+
+#include "eco_mr_index.h"
+#include <pthread.h>
+#include <infiniband/verbs_exp.h>
+
+#define ECO_HCA_MAX_BLOCKS 16
+#define ECO_HCA_MAX_IDLE_CALCS 8
+
+struct eco_hca_calc;
+
+/**
+ * Statistics of the registered memory of all the devices.
+ *
+ * @pinned_bytes                  Bytes of the registered regions and bounce pools.
+ * @budget                        Limit of the registered regions in bytes, 0 - unlimited.
+ * @registrations                 Number of registered regions.
+ * @evictions                     Number of regions deregistered to stay within the budget.
+ * @bounced                       Number of blocks staged through a bounce buffer.
+ * @invalidations                 Number of regions dropped because their pages were unmapped.
+ */
+struct eco_mr_stats {
+	uint64_t                      pinned_bytes;
+	uint64_t                      budget;
+	uint64_t                      registrations;
+	uint64_t                      evictions;
+	uint64_t                      bounced;
+	uint64_t                      invalidations;
+};
+
+/**
+ * Shared HCA.
+ *
+ * @device                        Verbs device.
+ * @context                       Verbs context of the opened device.
+ * @pd                            Protection domain shared by all the coders on the device.
+ * @max_inflight_calcs            max_ec_calc_inflight_calcs capability of the device.
+ * @numa_node                     NUMA node of the device, -1 if it is not known.
+ * @local_cpu                     First CPU of the NUMA node of the device, -1 if it is not known.
+ * @mrs_lock                      Protects mrs, lookups share it.
+ * @mrs                           Memory regions registered on pd.
+ * @lru_mutex                     Protects lru and the links of the regions in it, taken after mrs_lock.
+ * @lru                           Regions of mrs which may have no users, from the least recently queued.
+ * @bounce_mutex                  Serializes the creation and release of the bounce pool.
+ * @bounce_mr                     Registered bounce pool, NULL until a buffer could not be registered.
+ * @bounce_size                   Size of every bounce buffer.
+ * @bounce_free                   Bitmap of the free bounce buffers.
+ * @bounce_releases               Number of releases of bounce buffers, futex word of the operations waiting for them.
+ * @bounce_waiters                Number of operations waiting for bounce buffers.
+ * @calcs_mutex                   Protects idle_calcs and num_idle_calcs.
+ * @idle_calcs                    Calculation engines of released contexts, kept warm for the next contexts.
+ * @num_idle_calcs                Number of idle calculation engines.
+ * @sw_thresholds                 Calibrated software thresholds + 1 by k and m, 0 until calibrated.
+ * @ref_count                     Number of EC contexts using the device, protected by the registry lock.
+ * @next                          Next opened device.
+ */
+struct eco_hca {
+	struct ibv_device             *device;
+	struct ibv_context            *context;
+	struct ibv_pd                 *pd;
+	int                           max_inflight_calcs;
+	int                           numa_node;
+	int                           local_cpu;
+	pthread_rwlock_t              mrs_lock;
+	struct eco_mr_index           mrs;
+	pthread_mutex_t               lru_mutex;
+	struct list_head              lru;
+	pthread_mutex_t               bounce_mutex;
+	struct ibv_mr                 *bounce_mr;
+	size_t                        bounce_size;
+	uint64_t                      bounce_free;
+	uint32_t                      bounce_releases;
+	int                           bounce_waiters;
+	pthread_mutex_t               calcs_mutex;
+	struct eco_hca_calc           *idle_calcs;
+	int                           num_idle_calcs;
+	int                           sw_thresholds[ECO_HCA_MAX_BLOCKS + 1][ECO_HCA_MAX_BLOCKS + 1];
+	int                           ref_count;
+	struct eco_hca                *next;
+};
+
+/**
+ * Get the shared HCA of a device, opening it on first use.
+ *
+ * @param device                  Verbs device.
+ * @return                        Pointer to the shared HCA if successful, NULL if the device is not EC capable.
+ */
+struct eco_hca *eco_hca_get(struct ibv_device *device);
+
+/**
+ * Release a reference taken by eco_hca_get().
+ * The device stays opened for the next coders together with its memory regions and bounce pool, so a buffer
+ * registered by a released coder is not registered again by the next one. The regions are released by the budget
+ * and by mlx_eco_invalidate_memory(), opened devices are closed when the library is unloaded.
+ *
+ * @param hca                     Pointer to the shared HCA.
+ */
+void eco_hca_put(struct eco_hca *hca);
+
+/**
+ * Find a memory region of the device which contains a buffer, registering the buffer if there is none, and take a
+ * reference and a use on it. When the registered regions of all the devices would exceed the budget, the least
+ * recently used regions without users of any device are deregistered first, each in O(1) amortized.
+ *
+ * @param hca                     Pointer to the shared HCA.
+ * @param buffer                  The address of the buffer.
+ * @param length                  The size of the buffer.
+ * @param mr                      Returns the memory region.
+ * @return                        0 successful, -ENOSPC if the budget is exhausted, -ENOMEM if the registration failed.
+ */
+int eco_hca_get_mr(struct eco_hca *hca, void *buffer, size_t length, struct eco_mr **mr);
+
+/**
+ * Take a use on a region the caller holds a reference on, for an operation which reuses the sges it cached.
+ *
+ * @param hca                     Pointer to the shared HCA of the region.
+ * @param mr                      The memory region.
+ * @return                        0 successful, -1 if the region was evicted or invalidated and must be looked up again.
+ */
+int eco_hca_use_mr(struct eco_hca *hca, struct eco_mr *mr);
+
+/**
+ * End a use taken by eco_hca_get_mr() or eco_hca_use_mr() once the operation completed, the region may be evicted
+ * when it has no users. An invalidated region is deregistered with its last user.
+ *
+ * @param hca                     Pointer to the shared HCA of the region.
+ * @param mr                      The memory region.
+ */
+void eco_hca_unuse_mr(struct eco_hca *hca, struct eco_mr *mr);
+
+/**
+ * Release a reference taken by eco_hca_get_mr(), after its use ended.
+ *
+ * @param mr                      The memory region.
+ */
+void eco_hca_put_mr(struct eco_mr *mr);
+
+/**
+ * Take buffers of the bounce pool of the device, used for the blocks which cannot be registered. All the buffers of
+ * an operation are taken at once, so operations waiting for buffers never hold some of them.
+ * The pool is registered on first use, its size is set by MLX_ECO_BOUNCE_BUFFERS and MLX_ECO_BOUNCE_BUFFER_SIZE.
+ *
+ * @param hca                     Pointer to the shared HCA.
+ * @param length                  Size of every block.
+ * @param num_buffers             Number of buffers.
+ * @param buffers                 Returns the bounce buffers.
+ * @param lkey                    Returns the local key of the buffers.
+ * @param wait                    Boolean variable which determine if the call should wait for buffers used by other operations.
+ * @return                        0 successful, -ENOBUFS if the buffers are used and wait is 0, -ENOMEM if the blocks do not fit the pool.
+ */
+int eco_hca_get_bounce(struct eco_hca *hca, size_t length, int num_buffers, uint8_t **buffers, uint32_t *lkey, int wait);
+
+/**
+ * Return a buffer taken by eco_hca_get_bounce().
+ *
+ * @param hca                     Pointer to the shared HCA.
+ * @param buffer                  The bounce buffer.
+ */
+void eco_hca_put_bounce(struct eco_hca *hca, void *buffer);
+
+/**
+ * Set the limit of the registered memory of all the devices. By default the limit is read from MLX_ECO_MR_BUDGET,
+ * else it is 3/4 of RLIMIT_MEMLOCK (unlimited if RLIMIT_MEMLOCK is, or if the process has CAP_IPC_LOCK). Lowering it
+ * evicts on the next registrations, the least recently used regions of any device first.
+ *
+ * @param budget                  Limit in bytes, 0 - unlimited.
+ */
+void mlx_eco_set_mr_budget(size_t budget);
+
+/**
+ * Drop the registrations of an address range of all the devices, before its pages are unmapped or replaced.
+ * This is the supported way to keep the registrations valid: applications call it before they release registered
+ * buffers (free() of a block the allocator may unmap or trim, munmap(), ...). With MLX_ECO_MEM_HOOKS=1 the library
+ * calls it from its hooks of munmap(), mremap(), madvise() and brk()/sbrk() when it is linked to the application or
+ * preloaded, but not when it is loaded with dlopen() (e.g. from Java), and the calls of libc itself are never seen.
+ * Ranges outside the registered addresses return without taking any lock. The dropped regions are
+ * deregistered at once, or when the last operation in flight which uses them completes.
+ *
+ * @param addr                    The start of the range.
+ * @param length                  The size of the range.
+ */
+void mlx_eco_invalidate_memory(void *addr, size_t length);
+
+/**
+ * Get the statistics of the registered memory.
+ *
+ * @param stats                   Filled with the current statistics.
+ */
+void mlx_eco_get_mr_stats(struct eco_mr_stats *stats);
+
+/**
+ * Find the NUMA node of a CPU from the nodeN entry of its sysfs directory.
+ *
+ * @param cpu                     The CPU.
+ * @return                        The NUMA node, -1 if it is not known.
+ */
+int eco_hca_cpu_numa_node(int cpu);
+
+/**
+ * Get a calculation engine on the device, reusing an idle one created with the same attributes if there is one.
+ * Engines whose completion CPU is on the same NUMA node as attr->affinity_hint are reused.
+ *
+ * @param hca                     Pointer to the shared HCA.
+ * @param attr                    Calculation engine attributes.
+ * @return                        The calculation engine if successful, else NULL.
+ */
+struct ibv_exp_ec_calc *eco_hca_get_calc(struct eco_hca *hca, struct ibv_exp_ec_calc_init_attr *attr);
+
+/**
+ * Release a calculation engine taken by eco_hca_get_calc(). Up to ECO_HCA_MAX_IDLE_CALCS engines are kept idle
+ * for the next contexts, the oldest ones are deallocated.
+ *
+ * @param hca                     Pointer to the shared HCA.
+ * @param calc                    The calculation engine, without operations in flight.
+ * @param attr                    Attributes the engine was created with.
+ */
+void eco_hca_put_calc(struct eco_hca *hca, struct ibv_exp_ec_calc *calc, struct ibv_exp_ec_calc_init_attr *attr);
+
+#endif /* ECO_HCA_H_ */
@@ -0,0 +1,95 @@
+/*
+ ** Copyright (C) 2016 Mellanox Technologies
+ **
+ ** Licensed under the Apache License, Version 2.0 (the "License");
+ ** you may not use this file except in compliance with the License.
+ ** You may obtain a copy of the License at:
+ **
+ ** http://www.apache.org/licenses/LICENSE-2.0
+ **
+ ** Unless required by applicable law or agreed to in writing, software
+ ** distributed under the License is distributed on an "AS IS" BASIS,
+ ** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+ ** either express or implied. See the License for the specific language
+ ** governing permissions and  limitations under the License.
+ **
+ */
+#ifndef ECO_MATRIX_CACHE_H_
+#define ECO_MATRIX_CACHE_H_
+
+/**
+ * @file eco_matrix_cache.h
+ * @brief Define a bounded LRU cache of decode matrices keyed by erasure bitmask.
+ *
+ * Mellanox EC library used for Erasure Coding and RAID HW offload.
+ * Erasure coding (EC) is a method of data protection in which data is broken into fragments,
+ * expanded and encoded with redundant data pieces and stored across a set of different locations or storage media.
+ * Since k + m <= 16, the set of erased blocks fits in a 16-bit mask which is used as a perfect hash key.
+ * Currently supported by mlx5 only.
+ */
+
+#include <stdint.h>
+
+struct eco_matrix_cache;
+
+/**
+ * Cache statistics.
+ *
+ * @hits                          Number of lookups which found a matrix.
+ * @misses                        Number of lookups which did not find a matrix.
+ * @evictions                     Number of matrices dropped to make room for new ones.
+ * @num_entries                   Number of matrices currently in the cache.
+ * @capacity                      Maximum number of matrices in the cache.
+ */
+struct eco_matrix_cache_stats {
+	uint64_t                      hits;
+	uint64_t                      misses;
+	uint64_t                      evictions;
+	int                           num_entries;
+	int                           capacity;
+};
+
+/**
+ * Create a matrix cache.
+ *
+ * @param capacity                Maximum number of matrices in the cache.
+ * @param matrix_size             Size in bytes of every matrix.
+ * @return                        Pointer to the cache object if successful, else NULL.
+ */
+struct eco_matrix_cache *eco_matrix_cache_create(int capacity, int matrix_size);
+
+/**
+ * Find the matrix of an erasure mask and mark it as the most recently used one.
+ *
+ * @param cache                   Pointer to the cache object.
+ * @param mask                    Bitmask of the erased blocks.
+ * @return                        Pointer to the cached matrix, else NULL.
+ */
+const uint8_t *eco_matrix_cache_lookup(struct eco_matrix_cache *cache, uint32_t mask);
+
+/**
+ * Add an entry for an erasure mask, evicting the least recently used entry if the cache is full.
+ * The caller fills the returned matrix. The mask must not be in the cache already.
+ *
+ * @param cache                   Pointer to the cache object.
+ * @param mask                    Bitmask of the erased blocks.
+ * @return                        Pointer to the matrix of the new entry.
+ */
+uint8_t *eco_matrix_cache_insert(struct eco_matrix_cache *cache, uint32_t mask);
+
+/**
+ * Get the cache statistics.
+ *
+ * @param cache                   Pointer to the cache object.
+ * @param stats                   Filled with the current statistics.
+ */
+void eco_matrix_cache_get_stats(struct eco_matrix_cache *cache, struct eco_matrix_cache_stats *stats);
+
+/**
+ * Release the cache and all its matrices.
+ *
+ * @param cache                   Pointer to the cache object.
+ */
+void eco_matrix_cache_destroy(struct eco_matrix_cache *cache);
+
+#endif /* ECO_MATRIX_CACHE_H_ */
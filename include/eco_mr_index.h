@@ -0,0 +1,152 @@
+/*
+ ** Copyright (C) 2016 Mellanox Technologies
+ **
+ ** Licensed under the Apache License, Version 2.0 (the "License");
+ ** you may not use this file except in compliance with the License.
+ ** You may obtain a copy of the License at:
+ **
+ ** http://www.apache.org/licenses/LICENSE-2.0
+ **
+ ** Unless required by applicable law or agreed to in writing, software
+ ** distributed under the License is distributed on an "AS IS" BASIS,
+ ** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+ ** either express or implied. See the License for the specific language
+ ** governing permissions and  limitations under the License.
+ **
+ */
+
+#ifndef ECO_MR_INDEX_H_
+#define ECO_MR_INDEX_H_
+
+/**
+ * @file eco_mr_index.h
+ * @brief Define an index of registered memory regions keyed by address range.
+ *
+ * Mellanox EC library used for Erasure Coding and RAID HW offload.
+ * The regions are kept in an array sorted by start address, where every entry also holds the highest end address of
+ * the entries up to it. A lookup binary searches the last region starting at or below the buffer and walks back only
+ * while an earlier region may still reach the end of the buffer, so finding the region which contains a buffer takes
+ * O(log n) for regions which do not nest.
+ * Currently supported by mlx5 only.
+ */
+
+#include "list.h"
+#include <stdint.h>
+#include <stddef.h>
+#include <infiniband/verbs.h>
+
+/**
+ * Registered memory region.
+ *
+ * @mr                            The verbs memory region.
+ * @refs                          One reference while the region is registered, and one of every slot whose cached
+ *                                sges point into the region. The structure is freed with the last one.
+ * @users                         Number of operations in flight which use the region, -1 once it is deregistered.
+ *                                A region is evicted only when it has no users.
+ * @lru                           Link in the LRU list of the device, from the least recently queued region.
+ * @linked                        Set while the region is in the LRU list. An eviction which finds the region used
+ *                                unlinks it, and its last user queues it again.
+ * @last_use                      Tick of the last time the region was queued at the tail of the LRU list.
+ * @referenced                    Set by the uses since the region was queued, an eviction queues it again instead.
+ * @invalid                       Set when the region was evicted or its pages were unmapped, the slots register their
+ *                                blocks again.
+ */
+struct eco_mr {
+	struct ibv_mr                 *mr;
+	int                           refs;
+	int                           users;
+	struct list_head              lru;
+	int                           linked;
+	uint64_t                      last_use;
+	int                           referenced;
+	int                           invalid;
+};
+
+/**
+ * Index entry.
+ *
+ * @start                         First address of the region.
+ * @end                           Address after the last byte of the region.
+ * @max_end                       Highest end of this entry and the entries before it.
+ * @mr                            The registered memory region.
+ */
+struct eco_mr_index_entry {
+	uintptr_t                     start;
+	uintptr_t                     end;
+	uintptr_t                     max_end;
+	struct eco_mr                 *mr;
+};
+
+/**
+ * Index of memory regions. A zeroed index is empty.
+ *
+ * @entries                       Entries sorted by start address.
+ * @num_entries                   Number of entries.
+ * @capacity                      Number of allocated entries.
+ */
+struct eco_mr_index {
+	struct eco_mr_index_entry     *entries;
+	int                           num_entries;
+	int                           capacity;
+};
+
+/**
+ * Initialize an empty index.
+ *
+ * @param index                   Pointer to an allocated index.
+ */
+void eco_mr_index_init(struct eco_mr_index *index);
+
+/**
+ * Find a memory region which contains the whole buffer (addr + length).
+ *
+ * @param index                   Pointer to the index.
+ * @param addr                    The address of the buffer.
+ * @param length                  The size of the buffer.
+ * @return                        The region which contains the whole buffer, else NULL.
+ */
+struct eco_mr *eco_mr_index_find(struct eco_mr_index *index, void *addr, size_t length);
+
+/**
+ * Find a memory region which overlaps an address range.
+ *
+ * @param index                   Pointer to the index.
+ * @param addr                    The start of the range.
+ * @param length                  The size of the range.
+ * @return                        A region which contains at least one byte of the range, else NULL.
+ */
+struct eco_mr *eco_mr_index_find_overlap(struct eco_mr_index *index, void *addr, size_t length);
+
+/**
+ * Add a memory region to the index.
+ *
+ * @param index                   Pointer to the index.
+ * @param mr                      Pointer to the region.
+ * @return                        0 successful, other fail.
+ */
+int eco_mr_index_insert(struct eco_mr_index *index, struct eco_mr *mr);
+
+/**
+ * Remove a memory region from the index, the caller deregisters it.
+ *
+ * @param index                   Pointer to the index.
+ * @param mr                      Pointer to a region of the index.
+ */
+void eco_mr_index_remove(struct eco_mr_index *index, struct eco_mr *mr);
+
+/**
+ * Deregister all the memory regions of the index and empty it.
+ *
+ * @param index                   Pointer to the index.
+ * @return                        Number of bytes of the deregistered regions.
+ */
+size_t eco_mr_index_clear(struct eco_mr_index *index);
+
+/**
+ * Deregister all the memory regions of the index and release it.
+ *
+ * @param index                   Pointer to the index.
+ */
+void eco_mr_index_destroy(struct eco_mr_index *index);
+
+#endif /* ECO_MR_INDEX_H_ */
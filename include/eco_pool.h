@@ -0,0 +1,125 @@
+/*
+ ** Copyright (C) 2016 Mellanox Technologies
+ **
+ ** Licensed under the Apache License, Version 2.0 (the "License");
+ ** you may not use this file except in compliance with the License.
+ ** You may obtain a copy of the License at:
+ **
+ ** http://www.apache.org/licenses/LICENSE-2.0
+ **
+ ** Unless required by applicable law or agreed to in writing, software
+ ** distributed under the License is distributed on an "AS IS" BASIS,
+ ** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+ ** either express or implied. See the License for the specific language
+ ** governing permissions and  limitations under the License.
+ **
+ */
+
+#ifndef ECO_POOL_H_
+#define ECO_POOL_H_
+
+/**
+ * @file eco_pool.h
+ * @brief Define a thread-safe pool of encoders or decoders shared by the threads of an application.
+ *
+ * Mellanox EC library used for Erasure Coding and RAID HW offload.
+ * An encoder/decoder is used by a single thread at a time. Instead of creating a coder per thread, threads check a
+ * coder out of the pool for their operations and check it back in. Checkout and checkin are lock-free, the pool
+ * creates coders on demand up to its maximum size and releases the idle coders above its idle limit.
+ */
+
+#include "eco_encoder.h"
+#include "eco_decoder.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Type of the coders of a pool.
+ *
+ * @ECO_POOL_ENCODER              The pool holds encoders.
+ * @ECO_POOL_DECODER              The pool holds decoders.
+ */
+enum eco_pool_type {
+	ECO_POOL_ENCODER,
+	ECO_POOL_DECODER,
+};
+
+/**
+ * @type                          Type of the coders.
+ * @encoder                       Attributes of the encoders (ECO_POOL_ENCODER).
+ * @decoder                       Attributes of the decoders (ECO_POOL_DECODER).
+ * @min_coders                    Number of coders created with the pool and kept until it is destroyed.
+ * @max_coders                    Maximum number of coders (0 - default 64).
+ * @max_idle                      Checked in coders are released while more than max_idle coders are idle,
+ *                                never below min_coders (0 - idle coders are kept).
+ */
+struct eco_pool_attr {
+	enum eco_pool_type            type;
+	struct eco_encoder_attr       encoder;
+	struct eco_decoder_attr       decoder;
+	int                           min_coders;
+	int                           max_coders;
+	int                           max_idle;
+};
+
+struct eco_pool;
+
+/**
+ * Create a pool of encoders or decoders.
+ *
+ * @param attr                    Pool attributes.
+ * @return                        Pointer to the pool if successful, else NULL.
+ */
+struct eco_pool *mlx_eco_pool_create(struct eco_pool_attr *attr);
+
+/**
+ * Check an encoder out of the pool, creating one if all the created encoders are in use.
+ *
+ * @param pool                    Pointer to a pool of encoders.
+ * @param wait                    Boolean variable which determine if the call should wait for a checkin when
+ *                                max_coders encoders are in use.
+ * @return                        An encoder used exclusively by the caller until it is checked in, NULL if none is available.
+ */
+struct eco_encoder *mlx_eco_pool_checkout_encoder(struct eco_pool *pool, int wait);
+
+/**
+ * Return an encoder to the pool. Its asynchronous operations must be completed.
+ *
+ * @param pool                    Pointer to a pool of encoders.
+ * @param eco_encoder             Encoder checked out of the pool.
+ */
+void mlx_eco_pool_checkin_encoder(struct eco_pool *pool, struct eco_encoder *eco_encoder);
+
+/**
+ * Check a decoder out of the pool, creating one if all the created decoders are in use.
+ *
+ * @param pool                    Pointer to a pool of decoders.
+ * @param wait                    Boolean variable which determine if the call should wait for a checkin when
+ *                                max_coders decoders are in use.
+ * @return                        A decoder used exclusively by the caller until it is checked in, NULL if none is available.
+ */
+struct eco_decoder *mlx_eco_pool_checkout_decoder(struct eco_pool *pool, int wait);
+
+/**
+ * Return a decoder to the pool. Its asynchronous operations must be completed.
+ *
+ * @param pool                    Pointer to a pool of decoders.
+ * @param eco_decoder             Decoder checked out of the pool.
+ */
+void mlx_eco_pool_checkin_decoder(struct eco_pool *pool, struct eco_decoder *eco_decoder);
+
+/**
+ * Release the pool and its coders. All the coders must be checked in.
+ *
+ * @param pool                    Pointer to a pool.
+ * @return                        0 successful, other fail.
+ */
+int mlx_eco_pool_destroy(struct eco_pool *pool);
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* ECO_POOL_H_ */
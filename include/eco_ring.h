@@ -0,0 +1,246 @@
+/*
+ ** Copyright (C) 2016 Mellanox Technologies
+ **
+ ** Licensed under the Apache License, Version 2.0 (the "License");
+ ** you may not use this file except in compliance with the License.
+ ** You may obtain a copy of the License at:
+ **
+ ** http://www.apache.org/licenses/LICENSE-2.0
+ **
+ ** Unless required by applicable law or agreed to in writing, software
+ ** distributed under the License is distributed on an "AS IS" BASIS,
+ ** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+ ** either express or implied. See the License for the specific language
+ ** governing permissions and  limitations under the License.
+ **
+ */
+
+#ifndef ECO_RING_H_
+#define ECO_RING_H_
+
+/**
+ * @file eco_ring.h
+ * @brief Submission and completion rings driven by a library progress thread.
+ *
+ * Mellanox EC library used for Erasure Coding and RAID HW offload.
+ * The application fills encode/decode descriptors in the submission ring and reaps results from the completion
+ * ring directly in memory - a library thread moves the descriptors to the HCA, so no library call is made per
+ * operation. Both rings are single producer / single consumer: the application must use a ring from one thread
+ * at a time, and must not use the encoder/decoder of a ring directly while the ring exists.
+ */
+
+#include "eco_encoder.h"
+#include "eco_decoder.h"
+
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+/**
+ * Operation of a submission ring entry.
+ *
+ * @ECO_RING_OP_ENCODE            Encode the data buffers into the coding buffers.
+ * @ECO_RING_OP_DECODE            Recover the erased blocks.
+ */
+enum eco_ring_op {
+	ECO_RING_OP_ENCODE,
+	ECO_RING_OP_DECODE,
+};
+
+/**
+ * Submission ring entry. The buffers and the arrays pointed by the entry must stay valid until the operation
+ * completes, the entry itself may be reused as soon as it is consumed.
+ *
+ * @op                            Operation.
+ * @block_size                    Length of each block of data.
+ * @data                          Array of pointers to data buffers.
+ * @coding                        Array of pointers to coding buffers.
+ * @erasures                      Array of erased blocks indices (decode only).
+ * @erasures_size                 Size of erasures array (decode only).
+ * @user_data                     User value reported in the completion ring entry.
+ */
+struct eco_sqe {
+	enum eco_ring_op              op;
+	int                           block_size;
+	uint8_t                       **data;
+	uint8_t                       **coding;
+	int                           *erasures;
+	int                           erasures_size;
+	void                          *user_data;
+};
+
+/**
+ * Completion ring entry.
+ *
+ * @user_data                     User value of the submission ring entry.
+ * @status                        0 successful, other fail.
+ */
+struct eco_cqe {
+	void                          *user_data;
+	int                           status;
+};
+
+/**
+ * Submission ring flags, set by the progress thread.
+ *
+ * @ECO_RING_NEED_WAKEUP          The progress thread sleeps and must be woken by mlx_eco_ring_wakeup().
+ * @ECO_RING_CQ_WAIT              The progress thread sleeps until completion ring entries are seen, it is woken by
+ *                                mlx_eco_ring_cqe_seen().
+ */
+enum {
+	ECO_RING_NEED_WAKEUP = 1 << 0,
+	ECO_RING_CQ_WAIT     = 1 << 1,
+};
+
+struct eco_ring_req;
+
+/**
+ * Submission and completion rings. The head of a ring is advanced by its consumer and the tail by its producer,
+ * the counters run freely and are masked to index the entries.
+ *
+ * @sqes                          Submission ring entries.
+ * @sq_entries                    Number of submission ring entries (power of 2).
+ * @sq_head                       Next entry consumed by the progress thread.
+ * @sq_tail                       Next entry published to the progress thread by the application.
+ * @sqe_tail                      Next entry returned by mlx_eco_ring_get_sqe(), private to the application.
+ * @sq_flags                      ECO_RING_* flags, the progress thread sleeps on this word.
+ * @cqes                          Completion ring entries.
+ * @cq_entries                    Number of completion ring entries (power of 2), also the maximum number of operations in flight.
+ * @cq_head                       Next entry reaped by the application.
+ * @cq_tail                       Next entry filled by the library.
+ * @cq_waiting                    Number of threads sleeping on cq_tail, the application in mlx_eco_ring_wait_cqe() and the progress thread while the queue of a coder is full.
+ * @encoder                       Encoder executing the encode entries, may be NULL.
+ * @decoder                       Decoder executing the decode entries, may be NULL.
+ * @reqs                          Per operation completion contexts [cq_entries].
+ * @free_reqs                     List of the unused completion contexts, protected by cq_mutex.
+ * @num_submitted                 Number of entries consumed by the progress thread.
+ * @cq_mutex                      Serializes the completion callbacks of the encoder and the decoder.
+ * @thread                        The progress thread.
+ * @stop                          Boolean variable which determine if the progress thread should exit.
+ */
+struct eco_ring {
+	struct eco_sqe                *sqes;
+	uint32_t                      sq_entries;
+	uint32_t                      sq_head;
+	uint32_t                      sq_tail;
+	uint32_t                      sqe_tail;
+	uint32_t                      sq_flags;
+	struct eco_cqe                *cqes;
+	uint32_t                      cq_entries;
+	uint32_t                      cq_head;
+	uint32_t                      cq_tail;
+	uint32_t                      cq_waiting;
+	struct eco_encoder            *encoder;
+	struct eco_decoder            *decoder;
+	struct eco_ring_req           *reqs;
+	struct eco_ring_req           *free_reqs;
+	uint32_t                      num_submitted;
+	pthread_mutex_t               cq_mutex;
+	pthread_t                     thread;
+	int                           stop;
+};
+
+/**
+ * Create submission and completion rings and start their progress thread.
+ * The completion ring has twice the entries of the submission ring, and the progress thread consumes a submission
+ * entry only when its completion is sure to find room, so the completion ring never overflows.
+ *
+ * @param encoder                 Encoder executing the encode entries, may be NULL.
+ * @param decoder                 Decoder executing the decode entries, may be NULL.
+ * @param entries                 Number of submission ring entries (rounded up to a power of 2).
+ * @return                        Pointer to the rings if successful, else NULL.
+ */
+struct eco_ring *mlx_eco_ring_create(struct eco_encoder *encoder, struct eco_decoder *decoder, unsigned entries);
+
+/**
+ * Wake the progress thread after it set ECO_RING_NEED_WAKEUP or ECO_RING_CQ_WAIT. Called by mlx_eco_ring_submit()
+ * and mlx_eco_ring_cqe_seen() when needed.
+ *
+ * @param ring                    Pointer to the rings.
+ */
+void mlx_eco_ring_wakeup(struct eco_ring *ring);
+
+/**
+ * Sleep until the completion ring is not empty.
+ *
+ * @param ring                    Pointer to the rings.
+ * @return                        The oldest completion ring entry.
+ */
+struct eco_cqe *mlx_eco_ring_wait_cqe(struct eco_ring *ring);
+
+/**
+ * Stop the progress thread once it consumed the submitted entries, wait until they complete and release the rings.
+ * Entries which do not fit in a full completion ring are dropped. The encoder and the decoder are not released.
+ *
+ * @param ring                    Pointer to the rings.
+ * @return                        0 successful, other fail.
+ */
+int mlx_eco_ring_destroy(struct eco_ring *ring);
+
+/**
+ * Get the next free submission ring entry.
+ *
+ * @param ring                    Pointer to the rings.
+ * @return                        The entry to fill, NULL if the submission ring is full.
+ */
+static inline struct eco_sqe *mlx_eco_ring_get_sqe(struct eco_ring *ring)
+{
+	uint32_t head = __atomic_load_n(&ring->sq_head, __ATOMIC_ACQUIRE);
+
+	if (ring->sqe_tail - head == ring->sq_entries) {
+		return NULL;
+	}
+
+	return &ring->sqes[ring->sqe_tail++ & (ring->sq_entries - 1)];
+}
+
+/**
+ * Publish the entries got by mlx_eco_ring_get_sqe() since the last call, waking the progress thread only if it sleeps.
+ *
+ * @param ring                    Pointer to the rings.
+ */
+static inline void mlx_eco_ring_submit(struct eco_ring *ring)
+{
+	__atomic_store_n(&ring->sq_tail, ring->sqe_tail, __ATOMIC_SEQ_CST);
+
+	if (__atomic_load_n(&ring->sq_flags, __ATOMIC_SEQ_CST) & ECO_RING_NEED_WAKEUP) {
+		mlx_eco_ring_wakeup(ring);
+	}
+}
+
+/**
+ * Get the oldest completion ring entry without blocking.
+ *
+ * @param ring                    Pointer to the rings.
+ * @return                        The entry, NULL if the completion ring is empty.
+ */
+static inline struct eco_cqe *mlx_eco_ring_peek_cqe(struct eco_ring *ring)
+{
+	if (ring->cq_head == __atomic_load_n(&ring->cq_tail, __ATOMIC_ACQUIRE)) {
+		return NULL;
+	}
+
+	return &ring->cqes[ring->cq_head & (ring->cq_entries - 1)];
+}
+
+/**
+ * Release the oldest completion ring entry(ies) after they were read, waking the progress thread only if it waits
+ * for room in the completion ring.
+ *
+ * @param ring                    Pointer to the rings.
+ * @param num_entries             Number of entries to release.
+ */
+static inline void mlx_eco_ring_cqe_seen(struct eco_ring *ring, unsigned num_entries)
+{
+	__atomic_store_n(&ring->cq_head, ring->cq_head + num_entries, __ATOMIC_SEQ_CST);
+
+	if (__atomic_load_n(&ring->sq_flags, __ATOMIC_SEQ_CST) & ECO_RING_CQ_WAIT) {
+		mlx_eco_ring_wakeup(ring);
+	}
+}
+
+#ifdef __cplusplus
+}
+#endif
+
+#endif /* ECO_RING_H_ */
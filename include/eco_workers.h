@@ -0,0 +1,68 @@
+/*
+ ** Copyright (C) 2016 Mellanox Technologies
+ **
+ ** Licensed under the Apache License, Version 2.0 (the "License");
+ ** you may not use this file except in compliance with the License.
+ ** You may obtain a copy of the License at:
+ **
+ ** http://www.apache.org/licenses/LICENSE-2.0
+ **
+ ** Unless required by applicable law or agreed to in writing, software
+ ** distributed under the License is distributed on an "AS IS" BASIS,
+ ** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+ ** either express or implied. See the License for the specific language
+ ** governing permissions and  limitations under the License.
+ **
+ */
+
+#ifndef ECO_WORKERS_H_
+#define ECO_WORKERS_H_
+
+/**
+ * @file eco_workers.h
+ * @brief Define a small set of CPU threads used to run software calculations in parallel with the HCA.
+ *
+ * Mellanox EC library used for Erasure Coding and RAID HW offload.
+ * Erasure coding (EC) is a method of data protection in which data is broken into fragments,
+ * expanded and encoded with redundant data pieces and stored across a set of different locations or storage media.
+ * Currently supported by mlx5 only.
+ */
+
+#include <pthread.h>
+
+struct eco_workers;
+
+/**
+ * Function run by every thread of a job.
+ *
+ * @param arg                     The job argument.
+ * @param index                   Index of the running thread: 0 for the calling thread, 1..num_threads for the workers.
+ */
+typedef void (*eco_workers_func)(void *arg, int index);
+
+/**
+ * Create worker threads.
+ *
+ * @param num_threads             Number of worker threads (not including the calling thread).
+ * @return                        Pointer to the workers object if successful, else NULL.
+ */
+struct eco_workers *eco_workers_create(int num_threads);
+
+/**
+ * Run a job on all the worker threads and on the calling thread, and wait until all of them are done.
+ * Only one job can run at a time.
+ *
+ * @param workers                 Pointer to the workers object.
+ * @param func                    Function to run.
+ * @param arg                     Argument passed to func.
+ */
+void eco_workers_run(struct eco_workers *workers, eco_workers_func func, void *arg);
+
+/**
+ * Stop and release the worker threads.
+ *
+ * @param workers                 Pointer to the workers object.
+ */
+void eco_workers_destroy(struct eco_workers *workers);
+
+#endif /* ECO_WORKERS_H_ */
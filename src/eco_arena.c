@@ -0,0 +1,509 @@
+/*
+ ** Copyright (C) 2016 Mellanox Technologies
+ **
+ ** Licensed under the Apache License, Version 2.0 (the "License");
+ ** you may not use this file except in compliance with the License.
+ ** You may obtain a copy of the License at:
+ **
+ ** http://www.apache.org/licenses/LICENSE-2.0
+ **
+ ** Unless required by applicable law or agreed to in writing, software
+ ** distributed under the License is distributed on an "AS IS" BASIS,
+ ** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+ ** either express or implied. See the License for the specific language
+ ** governing permissions and  limitations under the License.
+ **
+ */
+
+#include "../include/eco_common.h"
+#include "../include/eco_arena.h"
+#include <errno.h>
+#include <sys/mman.h>
+
+#ifndef MAP_HUGE_SHIFT
+#define MAP_HUGE_SHIFT 26
+#endif
+
+#define ARENA_PAGE_2MB (1UL << 21)
+#define ARENA_PAGE_1GB (1UL << 30)
+#define ARENA_DEFAULT_CHUNK_SIZE ARENA_PAGE_2MB
+#define ARENA_MAX_EMPTY_CHUNKS 1
+
+#define ARENA_ROUND_UP(length, size) (((length) + (size) - 1) & ~((size) - 1))
+
+/**
+ * Free range of a chunk.
+ *
+ * @offset                       Offset of the range in the chunk.
+ * @length                       Size of the range.
+ * @next                         Next free range, by offset.
+ */
+struct eco_arena_extent {
+	size_t                         offset;
+	size_t                         length;
+	struct eco_arena_extent        *next;
+};
+
+/**
+ * Registration of a chunk on a device.
+ *
+ * @hca                          The device, referenced until the chunk is unmapped.
+ * @mr                           The memory region of the whole chunk.
+ * @next                         Next registration of the chunk.
+ */
+struct eco_arena_reg {
+	struct eco_hca                 *hca;
+	struct eco_mr                  *mr;
+	struct eco_arena_reg           *next;
+};
+
+/**
+ * Mapped chunk of the arena.
+ *
+ * @addr                         First address of the chunk.
+ * @length                       Size of the chunk.
+ * @page_size                    Size of the huge pages, 0 for transparent huge pages.
+ * @used                         Bytes allocated from the chunk.
+ * @free_extents                 Free ranges of the chunk, by offset.
+ * @regs                         Registrations of the chunk.
+ * @refs                         Number of registrations in progress, the chunk is not unmapped until they are done.
+ * @next                         Next chunk of the arena.
+ */
+struct eco_arena_chunk {
+	uint8_t                        *addr;
+	size_t                         length;
+	size_t                         page_size;
+	size_t                         used;
+	struct eco_arena_extent        *free_extents;
+	struct eco_arena_reg           *regs;
+	int                            refs;
+	struct eco_arena_chunk         *next;
+};
+
+static pthread_mutex_t arena_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+// Chunks of the arena, protected by arena_mutex.
+static struct eco_arena_chunk *arena_chunks;
+
+// Chunks without allocations kept mapped and registered, so a stripe freed and allocated again does not remap and
+// register a chunk. Up to ARENA_MAX_EMPTY_CHUNKS, the next chunks which are emptied are unmapped.
+static int arena_empty_chunks;
+
+/**
+ * Size of a new chunk: the stripe rounded to 2MB, at least MLX_ECO_ARENA_CHUNK_SIZE.
+ *
+ * @param length                 Size of the stripe which does not fit the existing chunks.
+ * @return                       Size of the chunk.
+ */
+static size_t util_eco_arena_chunk_size(size_t length)
+{
+	const char *env = getenv("MLX_ECO_ARENA_CHUNK_SIZE");
+	long long chunk_size = env ? strtoll(env, NULL, 0) : 0;
+
+	if (chunk_size <= 0) {
+		chunk_size = ARENA_DEFAULT_CHUNK_SIZE;
+	}
+
+	if ((size_t) chunk_size > length) {
+		length = chunk_size;
+	}
+
+	return ARENA_ROUND_UP(length, ARENA_PAGE_2MB);
+}
+
+/**
+ * Map a chunk, with 1GB pages if it is a multiple of 1GB, else with 2MB pages. When no huge pages are reserved, the
+ * chunk is 2MB aligned memory backed by transparent huge pages.
+ *
+ * @param chunk                  The chunk, length is set.
+ * @return                       0 successful, other fail.
+ */
+static int util_eco_arena_map(struct eco_arena_chunk *chunk)
+{
+	size_t head;
+	uint8_t *addr;
+
+	if (!(chunk->length & (ARENA_PAGE_1GB - 1))) {
+		addr = mmap(NULL, chunk->length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | (30 << MAP_HUGE_SHIFT), -1, 0);
+		if (addr != MAP_FAILED) {
+			chunk->addr = addr;
+			chunk->page_size = ARENA_PAGE_1GB;
+			return 0;
+		}
+	}
+
+	addr = mmap(NULL, chunk->length, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_HUGETLB | (21 << MAP_HUGE_SHIFT), -1, 0);
+	if (addr != MAP_FAILED) {
+		chunk->addr = addr;
+		chunk->page_size = ARENA_PAGE_2MB;
+		return 0;
+	}
+
+	// map 2MB more and trim both ends to a 2MB boundary, so the kernel can back the whole chunk with huge pages
+	addr = mmap(NULL, chunk->length + ARENA_PAGE_2MB, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	if (addr == MAP_FAILED) {
+		return -1;
+	}
+
+	head = ARENA_ROUND_UP((uintptr_t) addr, ARENA_PAGE_2MB) - (uintptr_t) addr;
+	if (head) {
+		munmap(addr, head);
+	}
+	munmap(addr + head + chunk->length, ARENA_PAGE_2MB - head);
+
+	chunk->addr = addr + head;
+	chunk->page_size = 0;
+	madvise(chunk->addr, chunk->length, MADV_HUGEPAGE);
+
+	return 0;
+}
+
+static struct eco_arena_chunk *util_eco_arena_new_chunk(size_t length)
+{
+	struct eco_arena_chunk *chunk;
+
+	chunk = calloc(1, sizeof(*chunk));
+	if (!chunk) {
+		err_log("eco_arena_alloc: Failed to allocate chunk\n");
+		return NULL;
+	}
+
+	chunk->free_extents = calloc(1, sizeof(*chunk->free_extents));
+	if (!chunk->free_extents) {
+		err_log("eco_arena_alloc: Failed to allocate extent\n");
+		goto extent_error;
+	}
+
+	chunk->length = util_eco_arena_chunk_size(length);
+	if (util_eco_arena_map(chunk)) {
+		err_log("eco_arena_alloc: Failed to map %lu bytes\n", (unsigned long) chunk->length);
+		goto map_error;
+	}
+
+	chunk->free_extents->length = chunk->length;
+
+	dbg_log("eco_arena_alloc: Mapped chunk %p of %lu bytes, page size %lu\n", chunk->addr, (unsigned long) chunk->length, (unsigned long) chunk->page_size);
+
+	chunk->next = arena_chunks;
+	arena_chunks = chunk;
+	arena_empty_chunks++;
+
+	return chunk;
+
+map_error:
+	free(chunk->free_extents);
+extent_error:
+	free(chunk);
+
+	return NULL;
+}
+
+/**
+ * Unmap a chunk without allocations, and drop its registrations.
+ *
+ * @param chunk                  The chunk, unlinked from the arena.
+ */
+static void util_eco_arena_release_chunk(struct eco_arena_chunk *chunk)
+{
+	struct eco_arena_extent *extent;
+	struct eco_arena_reg *reg;
+
+	dbg_log("eco_arena_free: Unmapping chunk %p of %lu bytes\n", chunk->addr, (unsigned long) chunk->length);
+
+	while ((reg = chunk->regs)) {
+		chunk->regs = reg->next;
+		eco_hca_unuse_mr(reg->hca, reg->mr);
+		eco_hca_put_mr(reg->mr);
+		eco_hca_put(reg->hca);
+		free(reg);
+	}
+
+	// the region is no longer used by the arena, but may still be cached by the slots
+	mlx_eco_invalidate_memory(chunk->addr, chunk->length);
+
+	while ((extent = chunk->free_extents)) {
+		chunk->free_extents = extent->next;
+		free(extent);
+	}
+
+	munmap(chunk->addr, chunk->length);
+	free(chunk);
+}
+
+/**
+ * Make the whole of a chunk without allocations a single free range, to keep it for the next allocations.
+ *
+ * @param chunk                  The chunk.
+ * @return                       0 successful, other fail.
+ */
+static int util_eco_arena_reset(struct eco_arena_chunk *chunk)
+{
+	struct eco_arena_extent *extent;
+
+	if (!chunk->free_extents) {
+		chunk->free_extents = calloc(1, sizeof(*chunk->free_extents));
+		if (!chunk->free_extents) {
+			return -ENOMEM;
+		}
+	}
+
+	while ((extent = chunk->free_extents->next)) {
+		chunk->free_extents->next = extent->next;
+		free(extent);
+	}
+
+	chunk->free_extents->offset = 0;
+	chunk->free_extents->length = chunk->length;
+
+	return 0;
+}
+
+/**
+ * Keep a chunk whose allocations were all freed for the next allocations, or unmap it if ARENA_MAX_EMPTY_CHUNKS
+ * empty chunks are kept. The arena mutex must be held, and the chunk counted in arena_empty_chunks.
+ *
+ * @param link                   Link of the chunk in the arena.
+ */
+static void util_eco_arena_empty(struct eco_arena_chunk **link)
+{
+	struct eco_arena_chunk *chunk = *link;
+
+	// a chunk whose reset failed has no free range, so nothing is taken from it until it is unmapped
+	if (util_eco_arena_reset(chunk) || arena_empty_chunks > ARENA_MAX_EMPTY_CHUNKS) {
+		// checked again by the registration in progress when it is done
+		if (chunk->refs) {
+			return;
+		}
+
+		*link = chunk->next;
+		arena_empty_chunks--;
+		util_eco_arena_release_chunk(chunk);
+	}
+}
+
+/**
+ * Take a range from the first free range of a chunk which fits it.
+ *
+ * @param chunk                  The chunk.
+ * @param length                 Size of the range, a multiple of 64 bytes.
+ * @return                       The range if successful, NULL if the chunk has no free range of this size.
+ */
+static uint8_t *util_eco_arena_take(struct eco_arena_chunk *chunk, size_t length)
+{
+	struct eco_arena_extent **link, *extent;
+	uint8_t *addr;
+
+	for (link = &chunk->free_extents; (extent = *link); link = &extent->next) {
+		if (extent->length < length) {
+			continue;
+		}
+
+		if (!chunk->used) {
+			arena_empty_chunks--;
+		}
+
+		addr = chunk->addr + extent->offset;
+		extent->offset += length;
+		extent->length -= length;
+		if (!extent->length) {
+			*link = extent->next;
+			free(extent);
+		}
+
+		chunk->used += length;
+
+		return addr;
+	}
+
+	return NULL;
+}
+
+/**
+ * Find the chunk of an allocation, the arena mutex must be held.
+ *
+ * @param addr                   Memory returned by eco_arena_alloc().
+ * @param link                   Returns the link of the chunk in the arena, NULL if not needed.
+ * @return                       The chunk, NULL if the memory is not from the arena.
+ */
+static struct eco_arena_chunk *util_eco_arena_find(void *addr, struct eco_arena_chunk ***link)
+{
+	struct eco_arena_chunk **chunk_link, *chunk;
+
+	for (chunk_link = &arena_chunks; (chunk = *chunk_link); chunk_link = &chunk->next) {
+		if ((uint8_t *) addr >= chunk->addr && (uint8_t *) addr < chunk->addr + chunk->length) {
+			if (link) {
+				*link = chunk_link;
+			}
+			return chunk;
+		}
+	}
+
+	return NULL;
+}
+
+void *eco_arena_alloc(size_t length)
+{
+	struct eco_arena_chunk *chunk;
+	uint8_t *addr = NULL;
+
+	length = ARENA_ROUND_UP(length, ECO_ARENA_ALIGNMENT);
+
+	pthread_mutex_lock(&arena_mutex);
+
+	for (chunk = arena_chunks; chunk && !addr; chunk = chunk->next) {
+		addr = util_eco_arena_take(chunk, length);
+	}
+
+	if (!addr) {
+		chunk = util_eco_arena_new_chunk(length);
+		if (chunk) {
+			addr = util_eco_arena_take(chunk, length);
+		}
+	}
+
+	pthread_mutex_unlock(&arena_mutex);
+
+	return addr;
+}
+
+int eco_arena_register(void *addr, struct eco_hca *hca)
+{
+	struct eco_arena_chunk **link, *chunk;
+	struct eco_arena_reg *reg, *other;
+	int err;
+
+	pthread_mutex_lock(&arena_mutex);
+
+	chunk = util_eco_arena_find(addr, NULL);
+	if (!chunk) {
+		err_log("eco_arena_register: %p is not allocated from the arena\n", addr);
+		pthread_mutex_unlock(&arena_mutex);
+		return -EINVAL;
+	}
+
+	for (reg = chunk->regs; reg && reg->hca != hca; reg = reg->next);
+	if (reg) {
+		pthread_mutex_unlock(&arena_mutex);
+		return 0;
+	}
+
+	// the registration of a whole chunk is long, the other allocations do not wait for it
+	chunk->refs++;
+
+	pthread_mutex_unlock(&arena_mutex);
+
+	reg = calloc(1, sizeof(*reg));
+	if (!reg) {
+		err_log("eco_arena_register: Failed to allocate registration\n");
+		err = -ENOMEM;
+		goto relink;
+	}
+
+	// the region keeps its use until the chunk is unmapped, so it is never evicted
+	err = eco_hca_get_mr(hca, chunk->addr, chunk->length, &reg->mr);
+	if (err) {
+		err_log("eco_arena_register: Failed to register chunk of %lu bytes (%d)\n", (unsigned long) chunk->length, err);
+		free(reg);
+		reg = NULL;
+		goto relink;
+	}
+
+	// the device is referenced while a chunk is registered on it
+	reg->hca = eco_hca_get(hca->device);
+
+relink:
+	pthread_mutex_lock(&arena_mutex);
+
+	chunk->refs--;
+
+	// another thread may have registered the chunk on the device meanwhile
+	for (other = chunk->regs; reg && other && other->hca != hca; other = other->next);
+	if (reg && !other) {
+		reg->next = chunk->regs;
+		chunk->regs = reg;
+		reg = NULL;
+	}
+
+	// all the allocations of the chunk may have been freed meanwhile
+	if (!chunk->used && !chunk->refs && util_eco_arena_find(chunk->addr, &link))
+		util_eco_arena_empty(link);
+
+	pthread_mutex_unlock(&arena_mutex);
+
+	if (reg) {
+		eco_hca_unuse_mr(reg->hca, reg->mr);
+		eco_hca_put_mr(reg->mr);
+		eco_hca_put(reg->hca);
+		free(reg);
+	}
+
+	return err;
+}
+
+void eco_arena_free(void *addr, size_t length)
+{
+	struct eco_arena_chunk **link, *chunk;
+	struct eco_arena_extent **extent_link, *extent, *prev = NULL, *new_extent;
+	size_t offset;
+
+	length = ARENA_ROUND_UP(length, ECO_ARENA_ALIGNMENT);
+
+	pthread_mutex_lock(&arena_mutex);
+
+	chunk = util_eco_arena_find(addr, &link);
+	if (!chunk) {
+		err_log("eco_arena_free: %p is not allocated from the arena\n", addr);
+		goto out;
+	}
+
+	chunk->used -= length;
+	if (!chunk->used) {
+		arena_empty_chunks++;
+		util_eco_arena_empty(link);
+		goto out;
+	}
+
+	offset = (uint8_t *) addr - chunk->addr;
+	for (extent_link = &chunk->free_extents; (extent = *extent_link) && extent->offset < offset; extent_link = &extent->next) {
+		prev = extent;
+	}
+
+	// merge with the free ranges on both sides
+	if (prev && prev->offset + prev->length == offset) {
+		prev->length += length;
+		if (extent && offset + length == extent->offset) {
+			prev->length += extent->length;
+			prev->next = extent->next;
+			free(extent);
+		}
+	} else if (extent && offset + length == extent->offset) {
+		extent->offset = offset;
+		extent->length += length;
+	} else {
+		new_extent = malloc(sizeof(*new_extent));
+		if (!new_extent) {
+			err_log("eco_arena_free: Failed to allocate extent, %lu bytes are lost until the chunk is unmapped\n", (unsigned long) length);
+			goto out;
+		}
+
+		new_extent->offset = offset;
+		new_extent->length = length;
+		new_extent->next = extent;
+		*extent_link = new_extent;
+	}
+
+out:
+	pthread_mutex_unlock(&arena_mutex);
+}
+
+void mlx_eco_free_stripe_buffers(struct eco_stripe_buffers *buffers)
+{
+	dbg_log("mlx_eco_free_stripe_buffers: buffers = %p\n", buffers);
+
+	if (!buffers) {
+		return;
+	}
+
+	eco_arena_free(buffers->data[0], buffers->length);
+	free(buffers);
+}
@@ -16,81 +16,22 @@
  */
 
 #include "../include/eco_common.h"
-#include <jerasure/reed_sol.h>
-#include <jerasure/cauchy.h>
-
-#define MAX_INFLIGHT_CALCS 2
-
-pthread_mutex_t matrix_generator_mutex; // Jerasure's encode matrix allocation is not thread safe.
-
-/**
- * Print matrix in uint8_t format.
- *
- * @param m                         Buffer contains the matrix.
- * @param rows                      Number of rows in the matrix.
- * @param cols                      Number of columns in the matrix.
- */
-static void util_mlx_eco_print_matrix_u8(uint8_t *m, int rows, int cols)
-{
-	int i, j;
-
-	dbg_log("Printing u8 matrix %p\n", m);
-	for (i = 0; i < rows; i++) {
-		for (j = 0; j < cols; j++) {
-			if (j != 0)
-				dbg_log(" ");
-
-			dbg_log("%#x  ", m[i*cols+j]);
-		}
-		dbg_log("\n");
-	}
-}
-
-/**
- * Allocate encode matrix using Jerasure library.
- *
- * @param k                         Number of data blocks.
- * @param m                         Number of code blocks.
- * @param use_vandermonde_matrix    Boolean variable which determine the type of the encode matrix:
- *                                  0 for Cauchy coding matrix else for Vandermonde coding matrix -
- * @return                          Pointer to an initialize encode matrix if successful, else NULL.
- */
-static uint8_t *util_mlx_eco_alloc_encode_matrix(struct eco_context *eco_ctx, int k, int m, int use_vandermonde_matrix)
-{
-	dbg_log("alloc_encode_matrix: k = %d, m = %d, use_vandermonde_matrix = %d\n", k, m, use_vandermonde_matrix);
-
-	int *rs_mat;
-	uint8_t *res;
-	int i,j;
-
-	res = calloc(k * m, sizeof(uint8_t));
-	if (!res) {
-		err_log("alloc_encode_matrix: failed to allocate encode matrix\n");
-		return NULL;
-	}
-
-	pthread_mutex_lock(&matrix_generator_mutex);
-	rs_mat = use_vandermonde_matrix ? reed_sol_vandermonde_coding_matrix(k, m, W) : cauchy_original_coding_matrix(k, m, W);
-	pthread_mutex_unlock(&matrix_generator_mutex);
-
-	if (!rs_mat) {
-		err_log("alloc_encode_matrix: failed to allocate reed sol matrix\n");
-		free(res);
-		return NULL;
-	}
-
-	for (i = 0; i < m; i++)
-		for (j = 0; j < k; j++)
-			res[j*m+i] = (uint8_t)rs_mat[i*k+j];
-
-	util_mlx_eco_print_matrix_u8(res, k, m);
-
-	eco_ctx->int_encode_matrix = rs_mat;
-
-	dbg_log("alloc_encode_matrix: completed successfully - k = %d, m = %d, use_vandermonde_matrix = %d\n", k, m, use_vandermonde_matrix);
-
-	return res;
-}
+#include <linux/futex.h>
+#include <errno.h>
+#include <sched.h>
+#include <sys/eventfd.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#define DEFAULT_QUEUE_DEPTH 2
+#define HYBRID_DEFAULT_MIN_BLOCK_SIZE (64 * 1024)
+#define HYBRID_MIN_SHARE 0.0625
+#define HYBRID_RATE_WEIGHT 0.25
+#define SW_THRESHOLD_MAX (16 * 1024)
+#define SW_CALIBRATION_ROUNDS 8
+#define WAIT_SPIN_MIN_NS 1000
+#define WAIT_SPIN_MAX_NS 50000
+#define WAIT_LATENCY_WEIGHT 8
 
 /**
  * Initialize ibv_exp_ec_mem object before allocating the calc
@@ -180,61 +121,43 @@ static inline void util_mlx_eco_update_sge(struct ibv_sge *sge, uint8_t *addr, u
 	sge->lkey = lkey;
 }
 
-/**
- * Register a new buffer, add it to the mr_list and update an input sge with the mr value.
- * The method assumes that the size of the buffer is equal to eco_ctx->alignment_mem.block_size
- *
- * @param eco_ctx                    Pointer to an initialized EC context.
- * @param buffer                     Pointer to a source buffer
- * @param sge                        Pointer to a source sge.
- * @return                           0 successful, other fail.
- */
-static inline int utill_mlx_eco_alloc_mr(struct eco_context *eco_ctx, uint8_t *buffer, struct ibv_sge *sge)
-{
-	dbg_log("utill_mlx_eco_alloc_mr: eco_ctx = %p , buffer = %p block_size = %d\n", eco_ctx, buffer, eco_ctx->alignment_mem.block_size);
-
-	struct ibv_mr *mr;
-	int block_size = eco_ctx->alignment_mem.block_size;
-
-	mr = ibv_reg_mr(eco_ctx->calc->pd, buffer, block_size, IBV_ACCESS_LOCAL_WRITE);
-	if (!mr) {
-		err_log("utill_mlx_eco_alloc_mr: Failed to allocate data MR\n");
-		return -ENOMEM;
-	}
-
-	util_mlx_eco_update_sge(sge, buffer, block_size, mr->lkey);
-	eco_list_add(&eco_ctx->mrs_list, mr);
-
-	dbg_log("utill_mlx_eco_alloc_mr: completed successfully - eco_ctx = %p , buffer = %p block_size = %d\n", eco_ctx, buffer, block_size);
-
-	return 0;
-}
-
 /**
  * Register buffers and update the memory layout context for future encode/decode operations.
  * Because register a new memory region is a expensive method, at first we check if each sge contains the buffer data.
- * else, we check if we already register the buffer using the mr list.
+ * else, we check if the buffer is already registered on the device - by this context or by another one.
  * else, we will register a mr for this buffer.
+ * A block which cannot be registered is left for a bounce buffer if num_bounced is given.
  *
- * @param eco_ctx                    Pointer to an initialized EC context.
+ * @param device                     Pointer to the device which calculates with the sges.
  * @param buffers_array              Pointer to an array of input buffers
+ * @param block_size                 The size of each buffer.
  * @param sges                       Pointer to an continuous array of sge.
+ * @param blocks                     Registrations of the sges, a reference and a use are held on the region of every sge.
  * @param num_sges                   The size of the sges array.
  * @param buffers_array_size         The size of the buffers array.
+ * @param num_bounced                Incremented for every block left for a bounce buffer, NULL if the blocks must be registered.
  * @return                           0 successful, other fail.
  */
-static int utill_mlx_eco_alloc_mrs(struct eco_context *eco_ctx, uint8_t **buffers_array, struct ibv_sge *sges, int *num_sges, int buffers_array_size)
+static int utill_mlx_eco_alloc_mrs(struct eco_device *device, uint8_t **buffers_array, uint32_t block_size, struct ibv_sge *sges, struct eco_slot_block *blocks,
+		int *num_sges, int buffers_array_size, int *num_bounced)
 {
-	dbg_log("utill_mlx_eco_alloc_mrs: eco_ctx = %p , buffers_array = %p block_size = %d buffers_array_size = %d\n", eco_ctx, buffers_array, eco_ctx->alignment_mem.block_size, buffers_array_size);
+	dbg_log("utill_mlx_eco_alloc_mrs: device = %p , buffers_array = %p block_size = %d buffers_array_size = %d\n", device, buffers_array, block_size, buffers_array_size);
 
 	int i, err;
-	uint32_t block_size = eco_ctx->alignment_mem.block_size;
 	uint64_t buffer_addres_u64;
-	struct ibv_mr * mr;
+	struct eco_mr *mr;
 
-	for (i = 0 ; i < buffers_array_size ; i++, sges++){
+	for (i = 0 ; i < buffers_array_size ; i++, sges++, blocks++){
 		buffer_addres_u64 = (uint64_t)buffers_array[i];
 
+		// The mr was evicted, or its pages were unmapped and the same address may be backed by other pages now
+		if (blocks->mr && eco_hca_use_mr(device->hca, blocks->mr)) {
+			eco_hca_put_mr(blocks->mr);
+			blocks->mr = NULL;
+			util_mlx_eco_update_sge(sges, NULL, 0, 0);
+		}
+		blocks->used = !!blocks->mr;
+
 		// The values of the sge and the values of the buffer are equal
 		if (sges->addr == buffer_addres_u64 && sges->length == block_size) {
 			continue;
@@ -247,359 +170,1620 @@ static int utill_mlx_eco_alloc_mrs(struct eco_context *eco_ctx, uint8_t **buffer
 			continue;
 		}
 
-		// else search for the mr in the list or call reg_mr
-		mr = eco_list_get_mr(&eco_ctx->mrs_list, buffers_array[i], block_size);
-		if (mr) {
-			util_mlx_eco_update_sge(sges, buffers_array[i], block_size, mr->lkey);
-		} else {
-			err = utill_mlx_eco_alloc_mr(eco_ctx, buffers_array[i], sges);
-			if (err) {
-				return err;
-			}
+		if (blocks->mr) {
+			eco_hca_unuse_mr(device->hca, blocks->mr);
+			eco_hca_put_mr(blocks->mr);
+			blocks->mr = NULL;
+			blocks->used = 0;
+		}
+
+		// else search for the mr in the shared cache of the device or call reg_mr
+		err = eco_hca_get_mr(device->hca, buffers_array[i], block_size, &mr);
+		if (!err) {
+			blocks->mr = mr;
+			blocks->used = 1;
+			util_mlx_eco_update_sge(sges, buffers_array[i], block_size, mr->mr->lkey);
+			continue;
 		}
+
+		if (!num_bounced) {
+			return err;
+		}
+
+		// the block is staged through a bounce buffer once all the blocks of the operation are known
+		blocks->buffer = buffers_array[i];
+		(*num_bounced)++;
+		util_mlx_eco_update_sge(sges, NULL, 0, 0);
 	}
 
 	*num_sges = buffers_array_size;
-	dbg_log("utill_mlx_eco_alloc_mrs: completed successfully - eco_ctx = %p , buffers_array = %p block_size = %d buffers_array_size = %d\n", eco_ctx, buffers_array, block_size, buffers_array_size);
+	dbg_log("utill_mlx_eco_alloc_mrs: completed successfully - device = %p , buffers_array = %p block_size = %d buffers_array_size = %d\n", device, buffers_array, block_size, buffers_array_size);
 
 	return 0;
 }
 
 /**
- * Set the comp context.
+ * Copy the blocks which could not be registered into bounce buffers of the device of the slot.
+ * Synchronous operations wait for the buffers used by other operations, asynchronous ones fail with -ENOBUFS.
  *
- * @param coder                      Pointer to an encoder/decoder.
- * @param comp                       Pointer to the comp context.
- * @param is_remainder_comp          Boolean variable which determine the type of the completion context.
- * @param comp_done_func             Pointer to the comp_done_func.
+ * @param eco_ctx                    Pointer to an initialized EC context.
+ * @param slot                       Slot of the operation, with num_bounced blocks left for bounce buffers.
+ * @return                           0 successful, other fail.
  */
-static void util_mlx_eco_set_comp(void *coder, struct eco_coder_comp *comp, int is_remainder_comp, void (*comp_done_func)(struct ibv_exp_ec_comp *))
+static int util_mlx_eco_get_bounced(struct eco_context *eco_ctx, struct eco_slot *slot)
 {
-	comp->comp.done = comp_done_func;
-	comp->eco_coder = coder;
-	comp->is_remainder_comp = is_remainder_comp;
+	int i, j, err, k = eco_ctx->attr.k;
+	uint8_t *buffers[W * W];
+	struct ibv_sge *sge;
+	uint32_t lkey;
+
+	err = eco_hca_get_bounce(slot->device->hca, slot->mem.block_size, slot->num_bounced, buffers, &lkey, !slot->done_func && !slot->event);
+	if (err) {
+		for (i = 0; i < k + eco_ctx->attr.m; i++) {
+			slot->blocks[i].buffer = NULL;
+		}
+		slot->num_bounced = 0;
+		return err;
+	}
+
+	for (i = 0, j = 0; i < k + eco_ctx->attr.m; i++) {
+		if (!slot->blocks[i].buffer) {
+			continue;
+		}
+
+		slot->blocks[i].bounce = buffers[j++];
+		memcpy(slot->blocks[i].bounce, slot->blocks[i].buffer, slot->mem.block_size);
+
+		sge = i < k ? &slot->mem.data_blocks[i] : &slot->mem.code_blocks[i - k];
+		util_mlx_eco_update_sge(sge, slot->blocks[i].bounce, slot->mem.block_size, lkey);
+	}
+
+	return 0;
 }
 
 /**
- * Initialize the remainder from 64 bytes mem object before allocating the calc
+ * Return the bounce buffers of an operation, and reset their sges so the next operation registers its blocks again.
  *
- * @param eco_ctx                    Pointer to an encoder/decoder.
- * @param pd                         Verbs protection domain.
- * @param k                          Number of data blocks.
- * @param m                          Number of code blocks.
+ * @param eco_ctx                    Pointer to an initialized EC context.
+ * @param slot                       Slot of the operation.
  */
-static int util_mlx_eco_init_remainder_mem(struct eco_context *eco_ctx, struct ibv_pd *pd, int k, int m)
+static void util_mlx_eco_put_bounced(struct eco_context *eco_ctx, struct eco_slot *slot)
 {
-	int i, err;
+	int i, k = eco_ctx->attr.k;
+	struct ibv_sge *sge;
 
-	eco_ctx->remainder_buffers = calloc(k + m, 64);
-	if (!eco_ctx->remainder_buffers) {
-		err_log("mlx_eco_init: Failed to allocate alignment buffers\n");
-		err = -ENOMEM;
-		goto remainder_buffers_error;
-	}
-	err = util_mlx_eco_init_mem(&eco_ctx->remainder_mem, k, m);
-	if (err) {
-		goto init_eco_mem_error;
-	}
+	for (i = 0; i < k + eco_ctx->attr.m; i++) {
+		if (!slot->blocks[i].buffer) {
+			continue;
+		}
 
-	eco_ctx->remainder_mem.block_size = 64;
+		// NULL if the registration of a later block failed before the buffers were taken
+		if (slot->blocks[i].bounce) {
+			eco_hca_put_bounce(slot->device->hca, slot->blocks[i].bounce);
+			slot->blocks[i].bounce = NULL;
+		}
+		slot->blocks[i].buffer = NULL;
 
-	eco_ctx->remainder_mr = ibv_reg_mr(pd, eco_ctx->remainder_buffers, (k + m) * 64, IBV_ACCESS_LOCAL_WRITE);
-	if (!eco_ctx->remainder_mr) {
-		err_log("mlx_eco_init: Failed to allocate alignment MR\n");
-		err = -ENOMEM;
-		goto remainder_mr_error;
+		sge = i < k ? &slot->mem.data_blocks[i] : &slot->mem.code_blocks[i - k];
+		util_mlx_eco_update_sge(sge, NULL, 0, 0);
 	}
 
+	slot->num_bounced = 0;
+}
 
-	for (i = 0 ; i < k ; i++) {
-		util_mlx_eco_update_sge(&eco_ctx->remainder_mem.data_blocks[i], eco_ctx->remainder_buffers + i * 64, 64, eco_ctx->remainder_mr->lkey);
-	}
+/**
+ * End the uses of the regions of a completed operation, so they may be evicted while the slot is idle. The slot keeps
+ * its references and sges, and takes new uses when its next operation reuses them.
+ *
+ * @param eco_ctx                    Pointer to an initialized EC context.
+ * @param slot                       Slot of the operation.
+ */
+static void util_mlx_eco_end_mr_uses(struct eco_context *eco_ctx, struct eco_slot *slot)
+{
+	int i;
 
-	for (i = 0 ; i < m ; i++) {
-		util_mlx_eco_update_sge(&eco_ctx->remainder_mem.code_blocks[i], eco_ctx->remainder_buffers + ((k + i) * 64), 64, eco_ctx->remainder_mr->lkey);
+	for (i = 0; i < eco_ctx->attr.k + eco_ctx->attr.m; i++) {
+		if (slot->blocks[i].used) {
+			eco_hca_unuse_mr(slot->device->hca, slot->blocks[i].mr);
+			slot->blocks[i].used = 0;
+		}
 	}
-
-	return 0;
-
-remainder_mr_error:
-	free(eco_ctx->remainder_mem.code_blocks);
-	free(eco_ctx->remainder_mem.data_blocks);
-init_eco_mem_error:
-	free(eco_ctx->remainder_buffers);
-remainder_buffers_error:
-
-	return err;
 }
 
-struct eco_context *mlx_eco_init(void *coder, int k, int m, int use_vandermonde_matrix, void (*comp_done_func)(struct ibv_exp_ec_comp *))
+void mlx_eco_copy_bounced(struct eco_slot *slot, const uint8_t *outputs)
 {
-	dbg_log("mlx_eco_init: k = %d, m = %d, use_vandermonde_matrix = %d\n", k , m, use_vandermonde_matrix);
-
-	struct eco_context *eco_ctx;
-	struct ibv_context *ibv_context;
-	struct ibv_device *device;
-	struct ibv_pd *pd;
-	struct ibv_exp_device_attr dattr;
-	uint8_t *encode_matrix;
-	int err;
+	int i, k = slot->eco_ctx->attr.k, m = slot->eco_ctx->attr.m;
 
-	// 4-bit field allows us to redundancy blocks as long as k + m <= 16
-	if (k + m > W * W) {
-		err_log("mlx_eco_init: 4-bit field allows us to redundancy blocks as long as k + m <= 16\n");
-		return NULL;
+	if (!slot->num_bounced) {
+		return;
 	}
 
-	// find device mlx5_0
-	device = util_mlx_eco_find_device("mlx5_0");
-	if (!device) {
-		goto find_device_error;
+	// only the head of the blocks calculated by the HCA, the CPU writes the rest directly to the user buffers
+	for (i = 0; i < k + m; i++) {
+		if (slot->blocks[i].bounce && (outputs ? outputs[i] : i >= k)) {
+			memcpy(slot->blocks[i].buffer, slot->blocks[i].bounce, slot->mem.block_size);
+		}
 	}
 
-	// open device
-	ibv_context = ibv_open_device(device);
-	if (!ibv_context) {
-		err_log("mlx_eco_init: Couldn't get context for %s\n", ibv_get_device_name(device));
-		goto open_device_error;
-	}
+	// returned before the operation completes, so a caller which polls the completions never waits for its own buffers
+	util_mlx_eco_put_bounced(slot->eco_ctx, slot);
+}
 
-	// allocate pd
-	pd = ibv_alloc_pd(ibv_context);
-	if (!pd) {
-		err_log("mlx_eco_init: Failed to allocate PD\n");
-		goto allocate_pd_error;
-	}
+/**
+ * Set the comp context.
+ *
+ * @param coder                      Pointer to an encoder/decoder.
+ * @param comp                       Pointer to the comp context.
+ * @param comp_done_func             Pointer to the comp_done_func.
+ */
+static void util_mlx_eco_set_comp(void *coder, struct eco_coder_comp *comp, void (*comp_done_func)(struct ibv_exp_ec_comp *))
+{
+	comp->comp.done = comp_done_func;
+	comp->eco_coder = coder;
+}
 
-	// query device for EC offload capabilities.
-	memset(&dattr, 0, sizeof(dattr));
-	dattr.comp_mask = IBV_EXP_DEVICE_ATTR_EXP_CAP_FLAGS | IBV_EXP_DEVICE_ATTR_EC_CAPS;
-	if (ibv_exp_query_device(ibv_context, &dattr)) {
-		err_log("mlx_eco_init: Couldn't query device for EC offload caps.\n");
-		goto query_device_error;
-	}
+/**
+ * Take a reference on the shared HCA of a device and choose the CPU which handles the completions of the calc of
+ * the context on it: the calling CPU if it is on the NUMA node of the device, else the first CPU of that node.
+ *
+ * @param device                     The device.
+ * @param eco_dev                    Filled with the shared HCA and the affinity hint.
+ * @return                           0 successful, other fail.
+ */
+static int util_mlx_eco_open_device(struct ibv_device *device, struct eco_device *eco_dev)
+{
+	int cpu = sched_getcpu();
 
-	if (!(dattr.exp_device_cap_flags & IBV_EXP_DEVICE_EC_OFFLOAD)) {
-		err_log("mlx_eco_init: EC offload not supported by driver.\n");
-		goto query_device_error;
+	eco_dev->hca = eco_hca_get(device);
+	if (!eco_dev->hca) {
+		return -1;
 	}
 
-	dbg_log("mlx_eco_init: EC offload supported by driver.\n");
-	dbg_log("mlx_eco_init: max_ec_calc_inflight_calcs %d\n", dattr.ec_caps.max_ec_calc_inflight_calcs);
-	dbg_log("mlx_eco_init: max_data_vector_count %d\n", dattr.ec_caps.max_ec_data_vector_count);
+	eco_dev->calc = NULL;
 
-	// allocate ec context
-	eco_ctx = calloc(1, sizeof(*eco_ctx));
-	if (!eco_ctx) {
-		err_log("mlx_eco_init: Failed to allocate EC context\n");
-		goto calloc_context_error;
+	if (eco_dev->hca->numa_node < 0) {
+		eco_dev->affinity_hint = 0;
+	} else if (eco_hca_cpu_numa_node(cpu) == eco_dev->hca->numa_node) {
+		eco_dev->affinity_hint = cpu;
+	} else {
+		eco_dev->affinity_hint = eco_dev->hca->local_cpu < 0 ? 0 : eco_dev->hca->local_cpu;
 	}
-	memset(eco_ctx, 0, sizeof(*eco_ctx));
 
-	encode_matrix = util_mlx_eco_alloc_encode_matrix(eco_ctx, k, m, use_vandermonde_matrix);
-	if (!encode_matrix) {
-		goto encode_matrix_error;
-	}
+	return 0;
+}
 
-	err = util_mlx_eco_init_remainder_mem(eco_ctx, pd, k, m);
-	if (err) {
-		goto init_remainder_mem_error;
-	}
+/**
+ * Open the EC capable device(s) selected by the device attributes.
+ *
+ * @param device_attr                Device selection, NULL for mlx5_0.
+ * @param num_devices                Filled with the number of opened devices.
+ * @return                           Array of opened devices if successful, else NULL.
+ */
+static struct eco_device *util_mlx_eco_open_devices(const struct eco_device_attr *device_attr, int *num_devices)
+{
+	enum eco_device_select select = device_attr ? device_attr->select : ECO_DEVICE_DEFAULT;
+	struct ibv_device **dev_list, *device;
+	struct eco_device *devices;
+	int i, count = 0, node, n = 0;
+
+	if (select == ECO_DEVICE_DEFAULT) {
+		device = util_mlx_eco_find_device(device_attr && device_attr->name ? device_attr->name : "mlx5_0");
+		if (!device) {
+			return NULL;
+		}
 
-	// set cacl initial attributes
-	eco_ctx->attr.comp_mask = IBV_EXP_EC_CALC_ATTR_MAX_INFLIGHT |
-			IBV_EXP_EC_CALC_ATTR_K |
-			IBV_EXP_EC_CALC_ATTR_M |
-			IBV_EXP_EC_CALC_ATTR_W |
-			IBV_EXP_EC_CALC_ATTR_MAX_DATA_SGE |
-			IBV_EXP_EC_CALC_ATTR_MAX_CODE_SGE |
-			IBV_EXP_EC_CALC_ATTR_ENCODE_MAT |
-			IBV_EXP_EC_CALC_ATTR_AFFINITY |
-			IBV_EXP_EC_CALC_ATTR_POLLING;
-	eco_ctx->attr.max_inflight_calcs = MAX_INFLIGHT_CALCS;
-	eco_ctx->attr.k = k;
-	eco_ctx->attr.m = m;
-	eco_ctx->attr.w = W;
-	eco_ctx->attr.max_data_sge = k;
-	eco_ctx->attr.max_code_sge = m;
-	eco_ctx->attr.affinity_hint = 0;
-	eco_ctx->attr.encode_matrix = encode_matrix;
+		devices = calloc(1, sizeof(*devices));
+		if (!devices) {
+			err_log("mlx_eco_init: Failed to allocate devices\n");
+			return NULL;
+		}
 
-	err = util_mlx_eco_init_mem(&eco_ctx->alignment_mem, k, m);
-	if (err) {
-		goto init_alignment_mem_error;
-	}
+		if (util_mlx_eco_open_device(device, devices)) {
+			free(devices);
+			return NULL;
+		}
 
-	err = pthread_mutex_init(&eco_ctx->async_mutex, NULL);
-	if (err) {
-		err_log("mlx_eco_init: Failed to init EC async_mutex\n");
-		goto async_mutex_error;
-	}
+		*num_devices = 1;
 
-	err = pthread_cond_init(&eco_ctx->async_cond, NULL);
-	if (err) {
-		err_log("mlx_eco_init: Failed to init EC async_cond\n");
-		goto async_cond_error;
+		return devices;
 	}
 
-	eco_ctx->calc = ibv_exp_alloc_ec_calc(pd, &eco_ctx->attr);
-	if (!eco_ctx->calc) {
-		err_log("mlx_eco_init: Failed to allocate EC calc\n");
-		goto calc_alloc_error;
+	dev_list = ibv_get_device_list(&count);
+	if (!dev_list) {
+		err_log("mlx_eco_init: Failed to get IB devices list\n");
+		return NULL;
 	}
 
-	init_eco_list(&eco_ctx->mrs_list);
-
-	eco_ctx->async_ref_count = 0;
+	devices = calloc(count ? count : 1, sizeof(*devices));
+	if (!devices) {
+		err_log("mlx_eco_init: Failed to allocate devices\n");
+		goto out;
+	}
 
-	util_mlx_eco_set_comp(coder, &eco_ctx->alignment_comp, 0, comp_done_func);
-	util_mlx_eco_set_comp(coder, &eco_ctx->remainder_comp, 1, comp_done_func);
+	if (select == ECO_DEVICE_NUMA_LOCAL) {
+		// keep the first EC capable device until one on the NUMA node of the calling thread is found
+		node = eco_hca_cpu_numa_node(sched_getcpu());
+		for (i = 0; dev_list[i] && !(n && node >= 0 && devices[0].hca->numa_node == node); i++) {
+			if (util_mlx_eco_open_device(dev_list[i], &devices[n])) {
+				continue;
+			}
 
-	dbg_log("mlx_eco_init: Completed successfully - eco_ctx = %p, k = %d, m = %d, use_vandermonde_matrix = %d\n", eco_ctx, k , m, use_vandermonde_matrix);
+			if (!n) {
+				n = 1;
+			} else if (devices[1].hca->numa_node == node) {
+				eco_hca_put(devices[0].hca);
+				devices[0] = devices[1];
+			} else {
+				eco_hca_put(devices[1].hca);
+			}
+		}
+	} else {
+		for (i = 0; dev_list[i]; i++) {
+			if (!util_mlx_eco_open_device(dev_list[i], &devices[n])) {
+				n++;
+			}
+		}
+	}
 
-	return eco_ctx;
+	if (!n) {
+		err_log("mlx_eco_init: No EC capable IB device found\n");
+		free(devices);
+		devices = NULL;
+	}
 
-calc_alloc_error:
-	pthread_cond_destroy(&eco_ctx->async_cond);
-async_cond_error:
-	pthread_mutex_destroy(&eco_ctx->async_mutex);
-async_mutex_error:
-	free(eco_ctx->alignment_mem.code_blocks);
-	free(eco_ctx->alignment_mem.data_blocks);
-init_alignment_mem_error:
-	ibv_dereg_mr(eco_ctx->remainder_mr);
-	free(eco_ctx->remainder_mem.code_blocks);
-	free(eco_ctx->remainder_mem.data_blocks);
-	free(eco_ctx->remainder_buffers);
-init_remainder_mem_error:
-	free(encode_matrix);
-	free(eco_ctx->int_encode_matrix);
-encode_matrix_error:
-	free(eco_ctx);
-calloc_context_error:
-query_device_error:
-	ibv_dealloc_pd(pd);
-allocate_pd_error:
-	ibv_close_device(ibv_context);
-open_device_error:
-find_device_error:
+	*num_devices = n;
 
-	err_log("mlx_eco_init: Failed during EC initialization - k = %d, m = %d, use_vandermonde_matrix = %d\n", k , m, use_vandermonde_matrix);
+out:
+	ibv_free_device_list(dev_list);
 
-	return NULL;
+	return devices;
 }
 
-int mlx_eco_register(struct eco_context *eco_ctx, uint8_t **data, uint8_t **coding, int data_size, int coding_size, int block_size)
+/**
+ * Release the devices of a context, their calcs must be deallocated before.
+ *
+ * @param devices                    Array of opened devices.
+ * @param num_devices                Number of devices.
+ */
+static void util_mlx_eco_close_devices(struct eco_device *devices, int num_devices)
 {
-	dbg_log("mlx_eco_register: eco_ctx = %p , data = %p, coding = %p, block_size = %d\n", eco_ctx, data, coding, block_size);
-
-	int err;
+	int i;
 
-	if (!eco_ctx) {
-		err_log("mlx_eco_register: Got invalid EC context - cannot perform register_mem\n");
-		return -1;
+	for (i = 0; i < num_devices; i++) {
+		eco_hca_put(devices[i].hca);
 	}
 
-	if (block_size <= 0) {
-		err_log("mlx_eco_register: Got invalid block size - %d\n", block_size);
-		return -1;
-	}
+	free(devices);
+}
 
-	eco_ctx->block_size = block_size;
+/**
+ * Read the requested calculation engine from the MLX_ECO_BACKEND environment variable.
+ *
+ * @param allow_fallback             Set to 0 if the HCA is explicitly required.
+ * @return                           ECO_BACKEND_SW if the software engine is explicitly required, else ECO_BACKEND_HW.
+ */
+static enum eco_backend util_mlx_eco_requested_backend(int *allow_fallback)
+{
+	const char *backend = getenv("MLX_ECO_BACKEND");
 
-	if (block_size < 64) {
-		goto success;
-	}
+	*allow_fallback = 1;
 
-	eco_ctx->alignment_mem.block_size = block_size - (block_size % 64);
+	if (!backend)
+		return ECO_BACKEND_HW;
 
-	err = utill_mlx_eco_alloc_mrs(eco_ctx, data, eco_ctx->alignment_mem.data_blocks, &eco_ctx->alignment_mem.num_data_sge, data_size);
-	if (err) {
-		return err;
-	}
+	if (!strcmp(backend, "sw"))
+		return ECO_BACKEND_SW;
 
-	err = utill_mlx_eco_alloc_mrs(eco_ctx, coding, eco_ctx->alignment_mem.code_blocks, &eco_ctx->alignment_mem.num_code_sge, coding_size);
-	if (err) {
-		return err;
-	}
+	if (!strcmp(backend, "hw"))
+		*allow_fallback = 0;
 
-success:
+	return ECO_BACKEND_HW;
+}
 
-	dbg_log("mlx_eco_register: completed successfully - eco_ctx = %p , data = %p, coding = %p, block_size = %d\n", eco_ctx, data, coding, block_size);
+/**
+ * Completion handler of the calibration calculations, the eco_coder of the comp is the slot of the calculation.
+ *
+ * @param comp                       Completion context of EC calculation.
+ */
+static void util_mlx_eco_calibration_comp_done(struct ibv_exp_ec_comp *comp)
+{
+	struct eco_coder_comp *coder_comp = (void *)comp - offsetof(struct eco_coder_comp, comp);
+	struct eco_slot *slot = coder_comp->eco_coder;
 
-	return 0;
+	mlx_eco_op_complete(slot->eco_ctx, slot, (int)comp->status);
 }
 
-int mlx_eco_release(struct eco_context *eco_ctx)
+/**
+ * Measure the best round trip of an HCA encode, including the completion wakeup of the calling thread.
+ *
+ * @param eco_ctx                    Pointer to an initialized EC context.
+ * @param mem                        Memory layout of a stripe registered on the first device.
+ * @return                           Time in nanoseconds, 0 on failure.
+ */
+static uint64_t util_mlx_eco_measure_hw(struct eco_context *eco_ctx, struct ibv_exp_ec_mem *mem)
 {
-	dbg_log("mlx_eco_release: eco_ctx = %p \n", eco_ctx);
+	struct eco_coder_comp comp;
+	struct eco_slot *slot;
+	uint64_t start, ns, best = 0;
+	int i, err;
 
-	if (!eco_ctx) {
-		err_log("mlx_eco_release: got null eco_context\n");
-		return -1;
-	}
+	comp.comp.done = util_mlx_eco_calibration_comp_done;
 
-	struct ibv_pd *pd = eco_ctx->calc->pd;
-	struct ibv_context *ibv_context = pd->context;
+	for (i = 0; i < SW_CALIBRATION_ROUNDS; i++) {
+		slot = mlx_eco_op_begin(eco_ctx, NULL, NULL, 1, 1);
+		comp.eco_coder = slot;
 
-	if (eco_ctx->calc) {
-		ibv_exp_dealloc_ec_calc(eco_ctx->calc);
-		eco_ctx->calc = NULL;
-	}
+		start = mlx_eco_time_ns();
+		err = ibv_exp_ec_encode_async(eco_ctx->devices[0].calc, mem, &comp.comp);
+		if (err) {
+			mlx_eco_op_abort(eco_ctx, slot);
+			return 0;
+		}
 
-	 pthread_mutex_destroy(&eco_ctx->async_mutex);
-	 pthread_cond_destroy(&eco_ctx->async_cond);
+		err = mlx_eco_op_wait(eco_ctx, slot);
+		ns = mlx_eco_time_ns() - start;
+		if (err) {
+			return 0;
+		}
 
-	if (eco_ctx->alignment_mem.code_blocks) {
-		free(eco_ctx->alignment_mem.code_blocks);
-		eco_ctx->alignment_mem.code_blocks = NULL;
+		if (!best || ns < best) {
+			best = ns;
+		}
 	}
 
-	if (eco_ctx->alignment_mem.data_blocks) {
-		free(eco_ctx->alignment_mem.data_blocks);
-		eco_ctx->alignment_mem.data_blocks = NULL;
-	}
+	return best;
+}
+
+/**
+ * Measure the best time of a software encode on the calling thread.
+ *
+ * @param eco_ctx                    Pointer to an initialized EC context.
+ * @param data                       Array of pointers to source input buffers.
+ * @param coding                     Array of pointers to coded output buffers.
+ * @param block_size                 Length of each block of data.
+ * @return                           Time in nanoseconds.
+ */
+static uint64_t util_mlx_eco_measure_sw(struct eco_context *eco_ctx, uint8_t **data, uint8_t **coding, int block_size)
+{
+	uint64_t start, ns, best = 0;
+	int i;
+
+	for (i = 0; i < SW_CALIBRATION_ROUNDS; i++) {
+		start = mlx_eco_time_ns();
+		eco_gf_encode(eco_ctx->attr.encode_matrix, eco_ctx->attr.k, eco_ctx->attr.m, data, coding, 0, block_size);
+		ns = mlx_eco_time_ns() - start;
+
+		if (!best || ns < best) {
+			best = ns;
+		}
+	}
+
+	return best;
+}
+
+/**
+ * Find the smallest block size (power of 2, up to SW_THRESHOLD_MAX) at which the HCA encodes a stripe faster than the calling thread.
+ * A scratch stripe is registered once for the calibration and released at the end of it.
+ *
+ * @param eco_ctx                    Pointer to an initialized EC context which uses the HCA.
+ * @return                           The calibrated threshold, 64 if the calibration failed.
+ */
+static int util_mlx_eco_calibrate_sw_threshold(struct eco_context *eco_ctx)
+{
+	int i, k = eco_ctx->attr.k, m = eco_ctx->attr.m, block_size, threshold = 64;
+	uint8_t *buffer, *blocks[k + m];
+	struct ibv_exp_ec_mem mem;
+	uint64_t hw_ns, sw_ns;
+	struct ibv_mr *mr;
+
+	if (posix_memalign((void **)&buffer, 64, (k + m) * SW_THRESHOLD_MAX)) {
+		goto alloc_buffer_error;
+	}
+	memset(buffer, 0, (k + m) * SW_THRESHOLD_MAX);
+
+	mr = ibv_reg_mr(eco_ctx->devices[0].hca->pd, buffer, (k + m) * SW_THRESHOLD_MAX, IBV_ACCESS_LOCAL_WRITE);
+	if (!mr) {
+		goto reg_mr_error;
+	}
+
+	if (util_mlx_eco_init_mem(&mem, k, m)) {
+		goto init_mem_error;
+	}
+
+	for (block_size = 64; block_size < SW_THRESHOLD_MAX; block_size *= 2) {
+		for (i = 0; i < k + m; i++) {
+			blocks[i] = buffer + i * block_size;
+			util_mlx_eco_update_sge(i < k ? &mem.data_blocks[i] : &mem.code_blocks[i - k], blocks[i], block_size, mr->lkey);
+		}
+		mem.block_size = block_size;
+
+		hw_ns = util_mlx_eco_measure_hw(eco_ctx, &mem);
+		if (!hw_ns) {
+			break;
+		}
+
+		sw_ns = util_mlx_eco_measure_sw(eco_ctx, blocks, blocks + k, block_size);
+
+		dbg_log("calibrate_sw_threshold: block_size = %d, hw_ns = %lu, sw_ns = %lu\n", block_size, hw_ns, sw_ns);
+
+		threshold = block_size;
+		if (hw_ns <= sw_ns) {
+			break;
+		}
+		threshold = block_size * 2;
+	}
+
+	free(mem.code_blocks);
+	free(mem.data_blocks);
+init_mem_error:
+	ibv_dereg_mr(mr);
+reg_mr_error:
+	free(buffer);
+alloc_buffer_error:
+
+	return threshold;
+}
+
+/**
+ * Read the software threshold from the MLX_ECO_SW_THRESHOLD environment variable.
+ *
+ * @return                           The requested threshold, negative if it should be calibrated.
+ */
+static int util_mlx_eco_requested_sw_threshold(void)
+{
+	const char *threshold = getenv("MLX_ECO_SW_THRESHOLD");
+
+	if (!threshold)
+		return -1;
+
+	return strtol(threshold, NULL, 0);
+}
+
+/**
+ * Free the ring of operation slots.
+ *
+ * @param eco_ctx                    Pointer to an EC context.
+ */
+static void util_mlx_eco_free_slots(struct eco_context *eco_ctx)
+{
+	int i, j;
+
+	if (!eco_ctx->slots) {
+		return;
+	}
+
+	for (i = 0; i < eco_ctx->queue_depth; i++) {
+		util_mlx_eco_end_mr_uses(eco_ctx, &eco_ctx->slots[i]);
+		for (j = 0; j < eco_ctx->attr.k + eco_ctx->attr.m; j++) {
+			if (eco_ctx->slots[i].blocks[j].mr) {
+				eco_hca_put_mr(eco_ctx->slots[i].blocks[j].mr);
+			}
+		}
+		free(eco_ctx->slots[i].mem.code_blocks);
+		free(eco_ctx->slots[i].mem.data_blocks);
+	}
+
+	free(eco_ctx->slots);
+	eco_ctx->slots = NULL;
+}
+
+/**
+ * Allocate the ring of operation slots, each with its own sges and completion context.
+ *
+ * @param eco_ctx                    Pointer to an EC context with queue_depth set.
+ * @param coder                      Pointer to an encoder/decoder.
+ * @param comp_done_func             Function handle of the EC calculation completion.
+ * @return                           0 successful, other fail.
+ */
+static int util_mlx_eco_alloc_slots(struct eco_context *eco_ctx, void *coder, void (*comp_done_func)(struct ibv_exp_ec_comp *))
+{
+	struct eco_slot *slot;
+	int i, err;
+
+	eco_ctx->slots = calloc(eco_ctx->queue_depth, sizeof(*eco_ctx->slots));
+	if (!eco_ctx->slots) {
+		err_log("mlx_eco_init: Failed to allocate %d operation slots\n", eco_ctx->queue_depth);
+		return -ENOMEM;
+	}
+
+	for (i = 0; i < eco_ctx->queue_depth; i++) {
+		slot = &eco_ctx->slots[i];
+		slot->eco_ctx = eco_ctx;
+		// consecutive slots belong to different devices, so the operations are striped across the devices
+		slot->device = eco_ctx->devices ? &eco_ctx->devices[i % eco_ctx->num_devices] : NULL;
+		util_mlx_eco_set_comp(coder, &slot->comp, comp_done_func);
+
+		err = util_mlx_eco_init_mem(&slot->mem, eco_ctx->attr.k, eco_ctx->attr.m);
+		if (err) {
+			util_mlx_eco_free_slots(eco_ctx);
+			return err;
+		}
+	}
+
+	return 0;
+}
+
+/**
+ * Set the block size below which operations run on the calling thread, the context must be set up.
+ * The calibrated threshold of a (k, m) is shared by all the contexts on the same device.
+ *
+ * @param eco_ctx                    Pointer to an initialized EC context.
+ * @param sw_threshold               Block size in bytes, negative - calibrate.
+ * @param cached                     Boolean variable which determine if a threshold calibrated by another context is used.
+ */
+static void util_mlx_eco_set_sw_threshold(struct eco_context *eco_ctx, int sw_threshold, int cached)
+{
+	int *calibrated;
+
+	if (sw_threshold < 0 && eco_ctx->backend == ECO_BACKEND_HW) {
+		calibrated = &eco_ctx->devices[0].hca->sw_thresholds[eco_ctx->attr.k][eco_ctx->attr.m];
+
+		sw_threshold = cached ? __atomic_load_n(calibrated, __ATOMIC_RELAXED) - 1 : -1;
+		if (sw_threshold < 0) {
+			sw_threshold = util_mlx_eco_calibrate_sw_threshold(eco_ctx);
+			__atomic_store_n(calibrated, sw_threshold + 1, __ATOMIC_RELAXED);
+		}
+	} else if (sw_threshold < 0) {
+		sw_threshold = 0;
+	}
+
+	eco_ctx->sw_threshold = sw_threshold;
+}
+
+/**
+ * Open the devices of a context, and allocate its calcs and operation slots.
+ * Called by mlx_eco_init(), or by the first operation of a lazy context.
+ *
+ * @param eco_ctx                    Pointer to an EC context which is not set up.
+ * @return                           0 successful, other fail.
+ */
+static int util_mlx_eco_setup(struct eco_context *eco_ctx)
+{
+	struct eco_device *devices = NULL;
+	enum eco_backend backend;
+	int i, err, allow_fallback, num_devices = 0, queue_depth = eco_ctx->attr.max_inflight_calcs;
+
+	backend = util_mlx_eco_requested_backend(&allow_fallback);
+	if (backend == ECO_BACKEND_HW) {
+		devices = util_mlx_eco_open_devices(&eco_ctx->setup_device, &num_devices);
+		if (!devices) {
+			if (!allow_fallback) {
+				return -ENODEV;
+			}
+
+			dbg_log("mlx_eco_init: EC offload is not available - using the software engine\n");
+			backend = ECO_BACKEND_SW;
+		} else {
+			for (i = 0; i < num_devices; i++) {
+				if (queue_depth > devices[i].hca->max_inflight_calcs) {
+					err_log("mlx_eco_init: Warning queue depth %d is above the device limit - using %d\n", queue_depth, devices[i].hca->max_inflight_calcs);
+					queue_depth = devices[i].hca->max_inflight_calcs;
+				}
+			}
+		}
+	}
+
+	eco_ctx->backend = backend;
+	eco_ctx->devices = devices;
+	eco_ctx->num_devices = num_devices;
+	eco_ctx->queue_depth = queue_depth * (num_devices ? num_devices : 1);
+	eco_ctx->attr.max_inflight_calcs = queue_depth;
+
+	err = util_mlx_eco_alloc_slots(eco_ctx, eco_ctx->setup_coder, eco_ctx->setup_comp_done);
+	if (err) {
+		goto alloc_slots_error;
+	}
+
+	if (backend == ECO_BACKEND_SW) {
+		return 0;
+	}
+
+	for (i = 0; i < num_devices; i++) {
+		eco_ctx->attr.affinity_hint = devices[i].affinity_hint;
+
+		// an engine released by a previous context with the same attributes is reused
+		devices[i].calc = eco_hca_get_calc(devices[i].hca, &eco_ctx->attr);
+		if (!devices[i].calc) {
+			err_log("mlx_eco_init: Failed to allocate EC calc\n");
+			err = -ENOMEM;
+			goto calc_alloc_error;
+		}
+	}
+
+	util_mlx_eco_set_sw_threshold(eco_ctx, util_mlx_eco_requested_sw_threshold(), 1);
+
+	return 0;
+
+calc_alloc_error:
+	while (i--) {
+		eco_ctx->attr.affinity_hint = devices[i].affinity_hint;
+		eco_hca_put_calc(devices[i].hca, devices[i].calc, &eco_ctx->attr);
+		devices[i].calc = NULL;
+	}
+	util_mlx_eco_free_slots(eco_ctx);
+alloc_slots_error:
+	if (devices) {
+		util_mlx_eco_close_devices(devices, num_devices);
+	}
+	eco_ctx->devices = NULL;
+	eco_ctx->num_devices = 0;
+
+	return err;
+}
+
+struct eco_context *mlx_eco_init(void *coder, int k, int m, int use_vandermonde_matrix, int queue_depth, const struct eco_device_attr *device_attr,
+		int lazy, void (*comp_done_func)(struct ibv_exp_ec_comp *))
+{
+	dbg_log("mlx_eco_init: k = %d, m = %d, use_vandermonde_matrix = %d, queue_depth = %d, lazy = %d\n", k , m, use_vandermonde_matrix, queue_depth, lazy);
+
+	struct eco_context *eco_ctx;
+	struct eco_encode_matrix *encode_matrix;
+	int err;
+
+	if (queue_depth <= 0) {
+		queue_depth = DEFAULT_QUEUE_DEPTH;
+	}
+
+	// 4-bit field allows us to redundancy blocks as long as k + m <= 16
+	if (k + m > W * W) {
+		err_log("mlx_eco_init: 4-bit field allows us to redundancy blocks as long as k + m <= 16\n");
+		return NULL;
+	}
+
+	// allocate ec context
+	eco_ctx = calloc(1, sizeof(*eco_ctx));
+	if (!eco_ctx) {
+		err_log("mlx_eco_init: Failed to allocate EC context\n");
+		goto calloc_context_error;
+	}
+	memset(eco_ctx, 0, sizeof(*eco_ctx));
+
+	eco_ctx->event_fd = -1;
+	eco_ctx->wait.mode = ECO_WAIT_ADAPTIVE;
+	eco_ctx->wait.spin_ns = WAIT_SPIN_MAX_NS;
+	eco_ctx->setup_coder = coder;
+	eco_ctx->setup_comp_done = comp_done_func;
+
+	if (device_attr) {
+		eco_ctx->setup_device = *device_attr;
+		if (device_attr->name) {
+			eco_ctx->setup_device.name = strdup(device_attr->name);
+			if (!eco_ctx->setup_device.name) {
+				err_log("mlx_eco_init: Failed to copy the device name\n");
+				goto device_name_error;
+			}
+		}
+	}
+
+	encode_matrix = eco_encode_matrix_get(k, m, use_vandermonde_matrix);
+	if (!encode_matrix) {
+		goto encode_matrix_error;
+	}
+	eco_ctx->encode_matrix = encode_matrix;
+
+	// set cacl initial attributes
+	eco_ctx->attr.comp_mask = IBV_EXP_EC_CALC_ATTR_MAX_INFLIGHT |
+			IBV_EXP_EC_CALC_ATTR_K |
+			IBV_EXP_EC_CALC_ATTR_M |
+			IBV_EXP_EC_CALC_ATTR_W |
+			IBV_EXP_EC_CALC_ATTR_MAX_DATA_SGE |
+			IBV_EXP_EC_CALC_ATTR_MAX_CODE_SGE |
+			IBV_EXP_EC_CALC_ATTR_ENCODE_MAT |
+			IBV_EXP_EC_CALC_ATTR_AFFINITY |
+			IBV_EXP_EC_CALC_ATTR_POLLING;
+	eco_ctx->attr.max_inflight_calcs = queue_depth;
+	eco_ctx->attr.k = k;
+	eco_ctx->attr.m = m;
+	eco_ctx->attr.w = W;
+	eco_ctx->attr.max_data_sge = k;
+	eco_ctx->attr.max_code_sge = m;
+	eco_ctx->attr.affinity_hint = 0;
+	eco_ctx->attr.encode_matrix = encode_matrix->matrix;
+
+	err = pthread_mutex_init(&eco_ctx->async_mutex, NULL);
+	if (err) {
+		err_log("mlx_eco_init: Failed to init EC async_mutex\n");
+		goto async_mutex_error;
+	}
+
+	err = pthread_cond_init(&eco_ctx->async_cond, NULL);
+	if (err) {
+		err_log("mlx_eco_init: Failed to init EC async_cond\n");
+		goto async_cond_error;
+	}
+
+	err = pthread_mutex_init(&eco_ctx->hybrid.mutex, NULL);
+	if (err) {
+		err_log("mlx_eco_init: Failed to init EC hybrid mutex\n");
+		goto hybrid_mutex_error;
+	}
+
+	err = pthread_mutex_init(&eco_ctx->setup_mutex, NULL);
+	if (err) {
+		err_log("mlx_eco_init: Failed to init EC setup mutex\n");
+		goto setup_mutex_error;
+	}
+
+	// a lazy context opens its devices with the first operation, or with mlx_eco_prewarm()
+	if (!lazy) {
+		err = util_mlx_eco_setup(eco_ctx);
+		if (err) {
+			goto setup_error;
+		}
+		eco_ctx->ready = 1;
+	}
+
+	dbg_log("mlx_eco_init: Completed successfully - eco_ctx = %p, k = %d, m = %d, use_vandermonde_matrix = %d, backend = %d\n", eco_ctx, k , m, use_vandermonde_matrix, eco_ctx->backend);
+
+	return eco_ctx;
+
+setup_error:
+	pthread_mutex_destroy(&eco_ctx->setup_mutex);
+setup_mutex_error:
+	pthread_mutex_destroy(&eco_ctx->hybrid.mutex);
+hybrid_mutex_error:
+	pthread_cond_destroy(&eco_ctx->async_cond);
+async_cond_error:
+	pthread_mutex_destroy(&eco_ctx->async_mutex);
+async_mutex_error:
+	eco_encode_matrix_put(encode_matrix);
+encode_matrix_error:
+	free((char *)eco_ctx->setup_device.name);
+device_name_error:
+	free(eco_ctx);
+calloc_context_error:
+
+	err_log("mlx_eco_init: Failed during EC initialization - k = %d, m = %d, use_vandermonde_matrix = %d\n", k , m, use_vandermonde_matrix);
+
+	return NULL;
+}
+
+int mlx_eco_prewarm(struct eco_context *eco_ctx)
+{
+	int err = 0;
+
+	if (!eco_ctx) {
+		err_log("mlx_eco_prewarm: Got invalid EC context\n");
+		return -1;
+	}
+
+	pthread_mutex_lock(&eco_ctx->setup_mutex);
+
+	if (!eco_ctx->ready) {
+		err = util_mlx_eco_setup(eco_ctx);
+		if (err) {
+			err_log("mlx_eco_prewarm: Failed to set up EC context (%d)\n", err);
+		} else {
+			__atomic_store_n(&eco_ctx->ready, 1, __ATOMIC_RELEASE);
+		}
+	}
+
+	pthread_mutex_unlock(&eco_ctx->setup_mutex);
+
+	return err;
+}
+
+int mlx_eco_prewarm_calcs(int k, int m, int use_vandermonde_matrix, int queue_depth, const struct eco_device_attr *device_attr, int num_calcs)
+{
+	dbg_log("mlx_eco_prewarm_calcs: k = %d, m = %d, use_vandermonde_matrix = %d, queue_depth = %d, num_calcs = %d\n", k, m, use_vandermonde_matrix, queue_depth, num_calcs);
+
+	struct eco_context *contexts[ECO_HCA_MAX_IDLE_CALCS];
+	int i, n, err = 0;
+
+	if (num_calcs < 0) {
+		err_log("mlx_eco_prewarm_calcs: Got invalid number of calcs - %d\n", num_calcs);
+		return -1;
+	}
+
+	// more idle calcs than a device keeps would be deallocated right away
+	if (num_calcs > ECO_HCA_MAX_IDLE_CALCS) {
+		num_calcs = ECO_HCA_MAX_IDLE_CALCS;
+	}
+
+	// the calcs of the released contexts stay idle on their devices, and the software threshold stays calibrated
+	for (n = 0; n < num_calcs; n++) {
+		contexts[n] = mlx_eco_init(NULL, k, m, use_vandermonde_matrix, queue_depth, device_attr, 0, NULL);
+		if (!contexts[n]) {
+			err = -1;
+			break;
+		}
+	}
+
+	for (i = 0; i < n; i++) {
+		mlx_eco_release(contexts[i]);
+	}
+
+	return err;
+}
+
+int mlx_eco_register(struct eco_context *eco_ctx, struct eco_slot *slot, uint8_t **data, uint8_t **coding, int data_size, int coding_size, int block_size)
+{
+	dbg_log("mlx_eco_register: eco_ctx = %p , data = %p, coding = %p, block_size = %d\n", eco_ctx, data, coding, block_size);
+
+	int err;
+
+	if (!eco_ctx) {
+		err_log("mlx_eco_register: Got invalid EC context - cannot perform register_mem\n");
+		return -1;
+	}
+
+	if (block_size <= 0) {
+		err_log("mlx_eco_register: Got invalid block size - %d\n", block_size);
+		return -1;
+	}
+
+	// the software engine works directly on the user buffers
+	if (block_size < 64 || eco_ctx->backend == ECO_BACKEND_SW) {
+		goto success;
+	}
+
+	slot->mem.block_size = block_size - (block_size % 64);
+
+	err = utill_mlx_eco_alloc_mrs(slot->device, data, slot->mem.block_size, slot->mem.data_blocks, slot->blocks, &slot->mem.num_data_sge, data_size, &slot->num_bounced);
+	if (err) {
+		return err;
+	}
+
+	err = utill_mlx_eco_alloc_mrs(slot->device, coding, slot->mem.block_size, slot->mem.code_blocks, slot->blocks + data_size, &slot->mem.num_code_sge, coding_size, &slot->num_bounced);
+	if (err) {
+		return err;
+	}
+
+	if (slot->num_bounced) {
+		err = util_mlx_eco_get_bounced(eco_ctx, slot);
+		if (err) {
+			return err;
+		}
+	}
+
+success:
+
+	dbg_log("mlx_eco_register: completed successfully - eco_ctx = %p , data = %p, coding = %p, block_size = %d\n", eco_ctx, data, coding, block_size);
+
+	return 0;
+}
+
+int mlx_eco_register_devices(struct eco_context *eco_ctx, uint8_t **data, uint8_t **coding, int data_size, int coding_size, int block_size)
+{
+	dbg_log("mlx_eco_register_devices: eco_ctx = %p , data = %p, coding = %p, block_size = %d\n", eco_ctx, data, coding, block_size);
+
+	struct ibv_sge sges[W * W];
+	struct eco_slot_block blocks[W * W];
+	int i, j, num_sges, err = 0;
+
+	if (mlx_eco_activate(eco_ctx)) {
+		return -1;
+	}
+
+	block_size -= block_size % 64;
+	if (block_size <= 0 || eco_ctx->backend == ECO_BACKEND_SW) {
+		return 0;
+	}
+
+	for (i = 0; i < eco_ctx->num_devices && !err; i++) {
+		memset(sges, 0, sizeof(sges));
+		memset(blocks, 0, sizeof(blocks));
+
+		err = utill_mlx_eco_alloc_mrs(&eco_ctx->devices[i], data, block_size, sges, blocks, &num_sges, data_size, NULL);
+		if (!err) {
+			err = utill_mlx_eco_alloc_mrs(&eco_ctx->devices[i], coding, block_size, sges + data_size, blocks + data_size, &num_sges, coding_size, NULL);
+		}
+
+		// the regions stay registered for the slots, which take their own references
+		for (j = 0; j < data_size + coding_size; j++) {
+			if (blocks[j].mr) {
+				eco_hca_unuse_mr(eco_ctx->devices[i].hca, blocks[j].mr);
+				eco_hca_put_mr(blocks[j].mr);
+			}
+		}
+	}
+
+	return err;
+}
+
+struct eco_slot *mlx_eco_op_begin(struct eco_context *eco_ctx, eco_coder_done_func done_func, void *arg, int num_parts, int wait)
+{
+	struct eco_slot *slot;
+	int i;
+
+	pthread_mutex_lock(&eco_ctx->async_mutex);
+
+	while (eco_ctx->busy_slots == eco_ctx->queue_depth) {
+		if (!wait) {
+			pthread_mutex_unlock(&eco_ctx->async_mutex);
+			return NULL;
+		}
+		pthread_cond_wait(&eco_ctx->async_cond, &eco_ctx->async_mutex);
+	}
+
+	// slots are taken in ring order, a slot held by a synchronous operation may be skipped
+	for (i = eco_ctx->next_slot; eco_ctx->slots[i].busy; i = (i + 1) % eco_ctx->queue_depth);
+	eco_ctx->next_slot = (i + 1) % eco_ctx->queue_depth;
+	eco_ctx->busy_slots++;
+
+	slot = &eco_ctx->slots[i];
+	slot->busy = 1;
+	slot->sleeping = 0;
+	slot->completing = 1;
+	slot->event = 0;
+	__atomic_store_n(&slot->ref_count, num_parts, __ATOMIC_RELAXED);
+	slot->done_func = done_func;
+	slot->done_arg = arg;
+	slot->status = 0;
+
+	pthread_mutex_unlock(&eco_ctx->async_mutex);
+
+	return slot;
+}
+
+/**
+ * Release the slot of an operation, the async mutex must be held.
+ *
+ * @param eco_ctx                    Pointer to an initialized EC context.
+ * @param slot                       Slot of the operation.
+ */
+static void util_mlx_eco_release_slot(struct eco_context *eco_ctx, struct eco_slot *slot)
+{
+	if (slot->num_bounced) {
+		util_mlx_eco_put_bounced(eco_ctx, slot);
+	}
+	util_mlx_eco_end_mr_uses(eco_ctx, slot);
+
+	slot->busy = 0;
+	slot->done_func = NULL;
+	eco_ctx->busy_slots--;
+	pthread_cond_broadcast(&eco_ctx->async_cond);
+}
+
+/**
+ * Queue the completion of an event operation and signal the event fd.
+ *
+ * @param eco_ctx                    Pointer to an initialized EC context.
+ * @param slot                       Slot of the completed operation.
+ */
+static void util_mlx_eco_event_complete(struct eco_context *eco_ctx, struct eco_slot *slot)
+{
+	uint64_t one = 1;
+
+	pthread_mutex_lock(&eco_ctx->async_mutex);
+
+	slot->next_completed = NULL;
+	if (eco_ctx->completed_tail) {
+		eco_ctx->completed_tail->next_completed = slot;
+	} else {
+		eco_ctx->completed_head = slot;
+	}
+	eco_ctx->completed_tail = slot;
+	eco_ctx->num_completed++;
+
+	if (slot->status && !eco_ctx->status) {
+		eco_ctx->status = slot->status;
+	}
+
+	// signaled after the completion is queued, so a poller never misses it (at worst it finds the queue empty),
+	// and under the lock, since mlx_eco_op_wait() may return and the context be released once it is queued
+	if (write(eco_ctx->event_fd, &one, sizeof(one)) != sizeof(one)) {
+		err_log("mlx_eco_op_complete: Failed to signal the event fd %d %m\n", eco_ctx->event_fd);
+	}
+
+	// wakes mlx_eco_op_wait(), which does not wait for the completion to be polled
+	pthread_cond_broadcast(&eco_ctx->async_cond);
+
+	pthread_mutex_unlock(&eco_ctx->async_mutex);
+}
+
+void mlx_eco_op_complete(struct eco_context *eco_ctx, struct eco_slot *slot, int status)
+{
+	// read before the last part completes, a synchronous waiter may release the slot and reuse it after that
+	eco_coder_done_func done_func = slot->done_func;
+	void *arg = slot->done_arg;
+	int event = slot->event;
+	int no_status = 0;
+
+	if (status) {
+		__atomic_compare_exchange_n(&slot->status, &no_status, status, 0, __ATOMIC_RELAXED, __ATOMIC_RELAXED);
+	}
+
+	if (__atomic_sub_fetch(&slot->ref_count, 1, __ATOMIC_SEQ_CST)) {
+		return;
+	}
+
+	if (event) {
+		util_mlx_eco_event_complete(eco_ctx, slot);
+		return;
+	}
+
+	if (!done_func) {
+		// the slot of a synchronous operation is released by its waiter, which may spin or sleep on ref_count
+		if (__atomic_load_n(&slot->sleeping, __ATOMIC_SEQ_CST)) {
+			syscall(SYS_futex, &slot->ref_count, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+		}
+
+		// the last access to the slot, the waiter may release it from now on
+		__atomic_store_n(&slot->completing, 0, __ATOMIC_RELEASE);
+		return;
+	}
+
+	pthread_mutex_lock(&eco_ctx->async_mutex);
+
+	status = slot->status;
+	if (status && !eco_ctx->status) {
+		eco_ctx->status = status;
+	}
+
+	util_mlx_eco_release_slot(eco_ctx, slot);
+	eco_ctx->async_callbacks++;
 
-	if (eco_ctx->remainder_mem.code_blocks) {
-		free(eco_ctx->remainder_mem.code_blocks);
-		eco_ctx->remainder_mem.code_blocks = NULL;
+	pthread_mutex_unlock(&eco_ctx->async_mutex);
+
+	// called without the lock, so the callback may submit the next operation
+	done_func(arg, status);
+
+	pthread_mutex_lock(&eco_ctx->async_mutex);
+	if (!--eco_ctx->async_callbacks) {
+		pthread_cond_broadcast(&eco_ctx->async_cond);
+	}
+	pthread_mutex_unlock(&eco_ctx->async_mutex);
+}
+
+void mlx_eco_op_abort(struct eco_context *eco_ctx, struct eco_slot *slot)
+{
+	pthread_mutex_lock(&eco_ctx->async_mutex);
+
+	util_mlx_eco_release_slot(eco_ctx, slot);
+
+	pthread_mutex_unlock(&eco_ctx->async_mutex);
+}
+
+/**
+ * Hint the CPU that the calling thread busy polls.
+ */
+static inline void util_mlx_eco_cpu_relax(void)
+{
+#if defined(__x86_64__) || defined(__i386__)
+	__builtin_ia32_pause();
+#endif
+}
+
+/**
+ * Busy poll the completion of a synchronous operation.
+ *
+ * @param slot                       Slot of the operation.
+ * @param spin_ns                    Maximum time to poll, 0 for no limit.
+ * @return                           Non-zero if the operation completed.
+ */
+static int util_mlx_eco_spin_slot(struct eco_slot *slot, uint64_t spin_ns)
+{
+	uint64_t deadline = spin_ns ? mlx_eco_time_ns() + spin_ns : 0;
+	int i;
+
+	for (;;) {
+		// read the clock once every few polls, the poll itself is a single load
+		for (i = 0; i < 64; i++) {
+			if (!__atomic_load_n(&slot->ref_count, __ATOMIC_ACQUIRE)) {
+				return 1;
+			}
+			util_mlx_eco_cpu_relax();
+		}
+
+		if (deadline && mlx_eco_time_ns() >= deadline) {
+			return 0;
+		}
+	}
+}
+
+/**
+ * Sleep on the futex word of a synchronous operation until it completes.
+ *
+ * @param slot                       Slot of the operation.
+ */
+static void util_mlx_eco_sleep_slot(struct eco_slot *slot)
+{
+	int ref_count;
+
+	__atomic_store_n(&slot->sleeping, 1, __ATOMIC_SEQ_CST);
+
+	while ((ref_count = __atomic_load_n(&slot->ref_count, __ATOMIC_SEQ_CST))) {
+		syscall(SYS_futex, &slot->ref_count, FUTEX_WAIT_PRIVATE, ref_count, NULL, NULL, 0);
+	}
+}
+
+/**
+ * Update the busy poll interval of ECO_WAIT_ADAPTIVE from the latency of the last completion: short operations
+ * are polled for twice their average latency, operations longer than the poll limit go to sleep almost at once.
+ *
+ * @param wait                       Wait state of the context.
+ * @param latency_ns                 Time the waiter waited for the completion.
+ */
+static void util_mlx_eco_wait_update(struct eco_wait *wait, uint64_t latency_ns)
+{
+	// concurrent waiters may lose each other's samples, the average only steers the poll interval
+	uint64_t average = __atomic_load_n(&wait->latency_ns, __ATOMIC_RELAXED), spin_ns;
+
+	average += ((int64_t)latency_ns - (int64_t)average) / WAIT_LATENCY_WEIGHT;
+
+	if (average > WAIT_SPIN_MAX_NS) {
+		spin_ns = WAIT_SPIN_MIN_NS;
+	} else if (average * 2 < WAIT_SPIN_MIN_NS) {
+		spin_ns = WAIT_SPIN_MIN_NS;
+	} else {
+		spin_ns = average * 2 > WAIT_SPIN_MAX_NS ? WAIT_SPIN_MAX_NS : average * 2;
+	}
+
+	__atomic_store_n(&wait->latency_ns, average, __ATOMIC_RELAXED);
+	__atomic_store_n(&wait->spin_ns, spin_ns, __ATOMIC_RELAXED);
+}
+
+/**
+ * Wait for the completion of a synchronous operation with the wait strategy of the context.
+ *
+ * @param eco_ctx                    Pointer to an initialized EC context.
+ * @param slot                       Slot of the operation.
+ */
+static void util_mlx_eco_wait_slot(struct eco_context *eco_ctx, struct eco_slot *slot)
+{
+	struct eco_wait *wait = &eco_ctx->wait;
+	uint64_t start;
+
+	if (!__atomic_load_n(&slot->ref_count, __ATOMIC_ACQUIRE)) {
+		return;
 	}
 
-	if (eco_ctx->remainder_mem.data_blocks) {
-		free(eco_ctx->remainder_mem.data_blocks);
-		eco_ctx->remainder_mem.data_blocks = NULL;
+	switch (wait->mode) {
+	case ECO_WAIT_SPIN:
+		util_mlx_eco_spin_slot(slot, 0);
+		break;
+	case ECO_WAIT_ADAPTIVE:
+		start = mlx_eco_time_ns();
+		if (!util_mlx_eco_spin_slot(slot, __atomic_load_n(&wait->spin_ns, __ATOMIC_RELAXED))) {
+			util_mlx_eco_sleep_slot(slot);
+		}
+		util_mlx_eco_wait_update(wait, mlx_eco_time_ns() - start);
+		break;
+	default:
+		util_mlx_eco_sleep_slot(slot);
+		break;
 	}
+}
+
+int mlx_eco_op_wait(struct eco_context *eco_ctx, struct eco_slot *slot)
+{
+	int status;
 
-	if (eco_ctx->remainder_buffers) {
-		free(eco_ctx->remainder_buffers);
-		eco_ctx->remainder_buffers = NULL;
+	if (slot) {
+		util_mlx_eco_wait_slot(eco_ctx, slot);
+
+		// the completing thread may still wake the futex of the slot, at most for the time of a system call
+		while (__atomic_load_n(&slot->completing, __ATOMIC_ACQUIRE)) {
+			util_mlx_eco_cpu_relax();
+		}
+		status = slot->status;
+
+		pthread_mutex_lock(&eco_ctx->async_mutex);
+		util_mlx_eco_release_slot(eco_ctx, slot);
+		pthread_mutex_unlock(&eco_ctx->async_mutex);
+
+		return status;
 	}
 
-	if (eco_ctx->remainder_mr) {
-		ibv_dereg_mr(eco_ctx->remainder_mr);
-		eco_ctx->remainder_mr = NULL;
+	pthread_mutex_lock(&eco_ctx->async_mutex);
+
+	while (eco_ctx->busy_slots > eco_ctx->num_completed || eco_ctx->async_callbacks) {
+		pthread_cond_wait(&eco_ctx->async_cond, &eco_ctx->async_mutex);
 	}
+	status = eco_ctx->status;
+	eco_ctx->status = 0;
 
-	if (eco_ctx->attr.encode_matrix) {
-		free(eco_ctx->attr.encode_matrix);
-		eco_ctx->attr.encode_matrix = NULL;
+	pthread_mutex_unlock(&eco_ctx->async_mutex);
+
+	return status;
+}
+
+struct eco_slot *mlx_eco_op_begin_event(struct eco_context *eco_ctx, void *arg, int num_parts)
+{
+	struct eco_slot *slot;
+
+	slot = mlx_eco_op_begin(eco_ctx, NULL, arg, num_parts, 0);
+	if (slot) {
+		slot->event = 1;
+	}
+
+	return slot;
+}
+
+int mlx_eco_get_event_fd(struct eco_context *eco_ctx)
+{
+	int fd;
+
+	if (!eco_ctx) {
+		err_log("mlx_eco_get_event_fd: Got invalid EC context\n");
+		return -1;
+	}
+
+	pthread_mutex_lock(&eco_ctx->async_mutex);
+
+	if (eco_ctx->event_fd < 0) {
+		eco_ctx->event_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+		if (eco_ctx->event_fd < 0) {
+			err_log("mlx_eco_get_event_fd: Failed to create eventfd %m\n");
+		}
+	}
+	fd = eco_ctx->event_fd;
+
+	pthread_mutex_unlock(&eco_ctx->async_mutex);
+
+	return fd;
+}
+
+int mlx_eco_poll_completions(struct eco_context *eco_ctx, struct eco_completion *completions, int max_completions)
+{
+	struct eco_slot *slot;
+	uint64_t count;
+	int n = 0;
+
+	if (eco_ctx->event_fd < 0) {
+		return 0;
+	}
+
+	pthread_mutex_lock(&eco_ctx->async_mutex);
+
+	// consume the signal first, it is raised again below if completions are left in the queue
+	if (read(eco_ctx->event_fd, &count, sizeof(count)) < 0 && errno != EAGAIN) {
+		err_log("mlx_eco_poll_completions: Failed to read the event fd %d %m\n", eco_ctx->event_fd);
+	}
+
+	while (n < max_completions && eco_ctx->completed_head) {
+		slot = eco_ctx->completed_head;
+		eco_ctx->completed_head = slot->next_completed;
+		if (!eco_ctx->completed_head) {
+			eco_ctx->completed_tail = NULL;
+		}
+		eco_ctx->num_completed--;
+
+		completions[n].arg = slot->done_arg;
+		completions[n].status = slot->status;
+		n++;
+
+		util_mlx_eco_release_slot(eco_ctx, slot);
+	}
+
+	count = 1;
+	if (eco_ctx->completed_head && write(eco_ctx->event_fd, &count, sizeof(count)) != sizeof(count)) {
+		err_log("mlx_eco_poll_completions: Failed to signal the event fd %d %m\n", eco_ctx->event_fd);
+	}
+
+	pthread_mutex_unlock(&eco_ctx->async_mutex);
+
+	return n;
+}
+
+int mlx_eco_set_wait_mode(struct eco_context *eco_ctx, enum eco_wait_mode mode)
+{
+	dbg_log("mlx_eco_set_wait_mode: eco_ctx = %p, mode = %d\n", eco_ctx, mode);
+
+	if (!eco_ctx) {
+		err_log("mlx_eco_set_wait_mode: Got invalid EC context\n");
+		return -1;
+	}
+
+	if (mode != ECO_WAIT_BLOCK && mode != ECO_WAIT_SPIN && mode != ECO_WAIT_ADAPTIVE) {
+		err_log("mlx_eco_set_wait_mode: Got invalid wait mode - %d\n", mode);
+		return -1;
+	}
+
+	eco_ctx->wait.mode = mode;
+
+	return 0;
+}
+
+/**
+ * Wait for the oldest pending operation of a batch.
+ *
+ * @param eco_ctx                    Pointer to an initialized EC context.
+ * @param batch                      Batch with at least one pending operation.
+ */
+static void util_mlx_eco_batch_wait_first(struct eco_context *eco_ctx, struct eco_batch *batch)
+{
+	int status;
+
+	status = mlx_eco_op_wait(eco_ctx, batch->slots[batch->first]);
+	if (status && !batch->status) {
+		batch->status = status;
+	}
+
+	batch->first = (batch->first + 1) % eco_ctx->queue_depth;
+	batch->num_pending--;
+}
+
+struct eco_slot *mlx_eco_batch_begin(struct eco_context *eco_ctx, struct eco_batch *batch, int num_parts)
+{
+	struct eco_slot *slot;
+
+	while (!(slot = mlx_eco_op_begin(eco_ctx, NULL, NULL, num_parts, 0))) {
+		// the remaining slots are used by asynchronous operations
+		if (!batch->num_pending) {
+			slot = mlx_eco_op_begin(eco_ctx, NULL, NULL, num_parts, 1);
+			break;
+		}
+
+		util_mlx_eco_batch_wait_first(eco_ctx, batch);
 	}
 
-	if (eco_ctx->int_encode_matrix) {
-		free(eco_ctx->int_encode_matrix);
-		eco_ctx->int_encode_matrix = NULL;
+	batch->slots[(batch->first + batch->num_pending) % eco_ctx->queue_depth] = slot;
+	batch->num_pending++;
+
+	return slot;
+}
+
+int mlx_eco_batch_wait(struct eco_context *eco_ctx, struct eco_batch *batch)
+{
+	while (batch->num_pending) {
+		util_mlx_eco_batch_wait_first(eco_ctx, batch);
+	}
+
+	return batch->status;
+}
+
+int mlx_eco_set_sw_threshold(struct eco_context *eco_ctx, int sw_threshold)
+{
+	dbg_log("mlx_eco_set_sw_threshold: eco_ctx = %p, sw_threshold = %d\n", eco_ctx, sw_threshold);
+
+	if (!eco_ctx) {
+		err_log("mlx_eco_set_sw_threshold: Got invalid EC context\n");
+		return -1;
+	}
+
+	if (mlx_eco_activate(eco_ctx)) {
+		return -1;
+	}
+
+	util_mlx_eco_set_sw_threshold(eco_ctx, sw_threshold, 0);
+
+	dbg_log("mlx_eco_set_sw_threshold: completed successfully - eco_ctx = %p, sw_threshold = %d\n", eco_ctx, sw_threshold);
+
+	return 0;
+}
+
+struct eco_stripe_buffers *mlx_eco_alloc_stripe_buffers(struct eco_context *eco_ctx, int k, int m, int block_size)
+{
+	dbg_log("mlx_eco_alloc_stripe_buffers: eco_ctx = %p, k = %d, m = %d, block_size = %d\n", eco_ctx, k, m, block_size);
+
+	struct eco_stripe_buffers *buffers;
+	size_t stride;
+	uint8_t *blocks;
+	int i;
+
+	if (!eco_ctx || k != eco_ctx->attr.k || m != eco_ctx->attr.m || block_size <= 0) {
+		err_log("mlx_eco_alloc_stripe_buffers: Got invalid parameters - k = %d, m = %d, block_size = %d\n", k, m, block_size);
+		return NULL;
+	}
+
+	// the devices of a lazy context are known once it is set up
+	if (mlx_eco_activate(eco_ctx)) {
+		return NULL;
+	}
+
+	buffers = calloc(1, sizeof(*buffers) + (k + m) * sizeof(*buffers->data));
+	if (!buffers) {
+		err_log("mlx_eco_alloc_stripe_buffers: Failed to allocate stripe buffers\n");
+		return NULL;
+	}
+
+	stride = (block_size + ECO_ARENA_ALIGNMENT - 1) & ~(size_t) (ECO_ARENA_ALIGNMENT - 1);
+	buffers->length = stride * (k + m);
+
+	blocks = eco_arena_alloc(buffers->length);
+	if (!blocks) {
+		err_log("mlx_eco_alloc_stripe_buffers: Failed to allocate %lu bytes from the arena\n", (unsigned long) buffers->length);
+		goto alloc_error;
+	}
+
+	for (i = 0; i < eco_ctx->num_devices; i++) {
+		if (eco_arena_register(blocks, eco_ctx->devices[i].hca)) {
+			goto register_error;
+		}
+	}
+
+	buffers->data = (uint8_t **) (buffers + 1);
+	buffers->coding = buffers->data + k;
+	for (i = 0; i < k + m; i++) {
+		buffers->data[i] = blocks + i * stride;
+	}
+	buffers->k = k;
+	buffers->m = m;
+	buffers->block_size = block_size;
+
+	return buffers;
+
+register_error:
+	eco_arena_free(blocks, buffers->length);
+alloc_error:
+	free(buffers);
+
+	return NULL;
+}
+
+int mlx_eco_set_hybrid(struct eco_context *eco_ctx, int enable, int num_threads, int min_block_size)
+{
+	dbg_log("mlx_eco_set_hybrid: eco_ctx = %p, enable = %d, num_threads = %d, min_block_size = %d\n", eco_ctx, enable, num_threads, min_block_size);
+
+	struct eco_hybrid *hybrid;
+
+	if (!eco_ctx) {
+		err_log("mlx_eco_set_hybrid: Got invalid EC context\n");
+		return -1;
+	}
+
+	if (mlx_eco_activate(eco_ctx)) {
+		return -1;
+	}
+
+	if (eco_ctx->backend != ECO_BACKEND_HW) {
+		err_log("mlx_eco_set_hybrid: Hybrid execution requires EC offload\n");
+		return -1;
+	}
+
+	if (num_threads < 0 || min_block_size < 0) {
+		err_log("mlx_eco_set_hybrid: Got invalid parameters - num_threads = %d, min_block_size = %d\n", num_threads, min_block_size);
+		return -1;
+	}
+
+	hybrid = &eco_ctx->hybrid;
+
+	// wait for the operation which uses the CPU threads
+	pthread_mutex_lock(&hybrid->mutex);
+	hybrid->enabled = 0;
+
+	if (hybrid->workers) {
+		eco_workers_destroy(hybrid->workers);
+		hybrid->workers = NULL;
+	}
+
+	if (!enable) {
+		pthread_mutex_unlock(&hybrid->mutex);
+		return 0;
+	}
+
+	if (num_threads) {
+		hybrid->workers = eco_workers_create(num_threads);
+		if (!hybrid->workers) {
+			err_log("mlx_eco_set_hybrid: Failed to create CPU threads\n");
+			pthread_mutex_unlock(&hybrid->mutex);
+			return -ENOMEM;
+		}
+	}
+
+	hybrid->num_threads = num_threads + 1;
+	hybrid->min_block_size = min_block_size ? min_block_size : HYBRID_DEFAULT_MIN_BLOCK_SIZE;
+	// start with an even split per thread, the measurements will correct it
+	hybrid->hw_rate = 1.0;
+	hybrid->sw_rate = 1.0;
+	hybrid->enabled = 1;
+	pthread_mutex_unlock(&hybrid->mutex);
+
+	dbg_log("mlx_eco_set_hybrid: completed successfully - eco_ctx = %p, enable = %d, num_threads = %d, min_block_size = %d\n", eco_ctx, enable, num_threads, hybrid->min_block_size);
+
+	return 0;
+}
+
+int mlx_eco_hybrid_split(struct eco_context *eco_ctx, int block_size)
+{
+	struct eco_hybrid *hybrid = &eco_ctx->hybrid;
+	double hw_share = hybrid->hw_rate / (hybrid->hw_rate + hybrid->sw_rate * hybrid->num_threads);
+
+	// keep both paths busy so their throughput keeps being measured
+	if (hw_share < HYBRID_MIN_SHARE) {
+		hw_share = HYBRID_MIN_SHARE;
+	} else if (hw_share > 1 - HYBRID_MIN_SHARE) {
+		hw_share = 1 - HYBRID_MIN_SHARE;
+	}
+
+	return (int)(block_size * hw_share) & ~63;
+}
+
+/**
+ * Calculate the part of a software job which belongs to a single CPU thread.
+ *
+ * @param arg                        Pointer to the eco_sw_job.
+ * @param index                      Index of the CPU thread.
+ */
+static void util_mlx_eco_sw_job_part(void *arg, int index)
+{
+	struct eco_sw_job *job = arg;
+	struct eco_context *eco_ctx = job->eco_ctx;
+	int part_size = ((job->len + job->num_parts - 1) / job->num_parts + 63) & ~63;
+	int offset = index * part_size, len;
+
+	if (offset >= job->len) {
+		return;
+	}
+
+	len = job->len - offset < part_size ? job->len - offset : part_size;
+
+	if (job->erasures) {
+		eco_gf_decode(job->matrix, eco_ctx->attr.k, eco_ctx->attr.m, job->erasures, job->data, job->coding, job->offset + offset, len);
+	} else {
+		eco_gf_encode(job->matrix, eco_ctx->attr.k, eco_ctx->attr.m, job->data, job->coding, job->offset + offset, len);
+	}
+}
+
+uint64_t mlx_eco_run_sw(struct eco_sw_job *job)
+{
+	uint64_t start = mlx_eco_time_ns();
+
+	if (job->num_parts > 1) {
+		eco_workers_run(job->eco_ctx->hybrid.workers, util_mlx_eco_sw_job_part, job);
+	} else {
+		util_mlx_eco_sw_job_part(job, 0);
+	}
+
+	return mlx_eco_time_ns() - start;
+}
+
+void mlx_eco_hybrid_update(struct eco_context *eco_ctx, int hw_len, uint64_t hw_ns, int sw_len, uint64_t sw_ns)
+{
+	struct eco_hybrid *hybrid = &eco_ctx->hybrid;
+
+	if (hw_len && hw_ns) {
+		hybrid->hw_rate += HYBRID_RATE_WEIGHT * ((double)hw_len / hw_ns - hybrid->hw_rate);
+	}
+
+	if (sw_len && sw_ns) {
+		hybrid->sw_rate += HYBRID_RATE_WEIGHT * ((double)sw_len / hybrid->num_threads / sw_ns - hybrid->sw_rate);
+	}
+
+	dbg_log("mlx_eco_hybrid_update: eco_ctx = %p, hw_rate = %f, sw_rate = %f\n", eco_ctx, hybrid->hw_rate, hybrid->sw_rate);
+}
+
+int mlx_eco_release(struct eco_context *eco_ctx)
+{
+	dbg_log("mlx_eco_release: eco_ctx = %p \n", eco_ctx);
+
+	if (!eco_ctx) {
+		err_log("mlx_eco_release: got null eco_context\n");
+		return -1;
+	}
+
+	int i;
+
+	if (eco_ctx->hybrid.workers) {
+		eco_workers_destroy(eco_ctx->hybrid.workers);
+		eco_ctx->hybrid.workers = NULL;
+	}
+
+	mlx_eco_op_wait(eco_ctx, NULL);
+
+	// the calcs are kept warm for the next contexts
+	for (i = 0; i < eco_ctx->num_devices; i++) {
+		eco_ctx->attr.affinity_hint = eco_ctx->devices[i].affinity_hint;
+		eco_hca_put_calc(eco_ctx->devices[i].hca, eco_ctx->devices[i].calc, &eco_ctx->attr);
+		eco_ctx->devices[i].calc = NULL;
+	}
+
+	pthread_mutex_destroy(&eco_ctx->async_mutex);
+	pthread_cond_destroy(&eco_ctx->async_cond);
+	pthread_mutex_destroy(&eco_ctx->hybrid.mutex);
+	pthread_mutex_destroy(&eco_ctx->setup_mutex);
+
+	if (eco_ctx->event_fd >= 0) {
+		close(eco_ctx->event_fd);
+		eco_ctx->event_fd = -1;
 	}
 
-	eco_list_delete_all(&eco_ctx->mrs_list);
+	util_mlx_eco_free_slots(eco_ctx);
 
-	if (pd) {
-		ibv_dealloc_pd(pd);
+	if (eco_ctx->encode_matrix) {
+		eco_encode_matrix_put(eco_ctx->encode_matrix);
+		eco_ctx->encode_matrix = NULL;
+		eco_ctx->attr.encode_matrix = NULL;
 	}
 
-	if (pd->context) {
-		ibv_close_device(ibv_context);
+	if (eco_ctx->devices) {
+		util_mlx_eco_close_devices(eco_ctx->devices, eco_ctx->num_devices);
+		eco_ctx->devices = NULL;
 	}
 
+	free((char *)eco_ctx->setup_device.name);
 	free(eco_ctx);
 
 	dbg_log("mlx_eco_release: completed successfully - eco_ctx = %p \n", eco_ctx);
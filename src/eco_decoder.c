@@ -17,11 +17,8 @@
 
 #include "../include/eco_decoder.h"
 
-#define LOG_TABLE 0, 1, 4, 2, 8, 5, 10, 3, 14, 9, 7, 6, 13, 11, 12
-#define ILOG_TABLE 1, 2, 4, 8, 3, 6, 12, 11, 5, 10, 7, 14, 15, 13, 9
-
-const uint8_t gf_w4_log[]={LOG_TABLE};
-const uint8_t gf_w4_ilog[]={ILOG_TABLE};
+#define DECODER_DEFAULT_CACHE_SIZE 64
+#define DECODER_TABLE_NONE 0xffff
 
 /**
  * Print matrix in uint8_t format.
@@ -46,63 +43,73 @@ static void util_mlx_eco_print_matrix_u8(uint8_t *m, int rows, int cols)
 	}
 }
 
-static uint8_t util_mlx_eco_gf_w4_mul(uint8_t x, uint8_t y)
+/**
+ * Check that the erasures are at most m distinct block indices in [0, k + m), before they index the byte-map and
+ * the bitmask of the erasure pattern.
+ *
+ * @param eco_decoder               Pointer to an initialized EC decoder.
+ * @param erasures                  Array of erased blocks indices.
+ * @param erasures_size             Size of erasures array.
+ * @return                          0 valid, other fail.
+ */
+static int util_mlx_eco_decoder_check_erasures(struct eco_decoder *eco_decoder, int *erasures, int erasures_size)
 {
-	int log_x, log_y, log_r;
-
-	if (!x || !y)
-		return 0;
+	int i, k = eco_decoder->eco_ctx->attr.k, m = eco_decoder->eco_ctx->attr.m;
+	uint32_t mask = 0;
 
-	log_x = gf_w4_log[x - 1];
-	log_y = gf_w4_log[y - 1];
-	log_r = (log_x + log_y) % 15;
+	if (erasures_size < 0 || erasures_size > m) {
+		err_log("util_mlx_eco_decoder_check_erasures: Got invalid number of erasures - %d\n", erasures_size);
+		return -1;
+	}
 
-	return gf_w4_ilog[log_r];
-}
+	if (erasures_size && !erasures) {
+		err_log("util_mlx_eco_decoder_check_erasures: Got null erasures\n");
+		return -1;
+	}
 
-static uint8_t util_mlx_eco_galois_w4_mult(uint8_t x, uint8_t y4)
-{
-	uint8_t r_h, r_l;
+	for (i = 0 ; i < erasures_size ; i++) {
+		if (erasures[i] < 0 || erasures[i] >= k + m) {
+			err_log("util_mlx_eco_decoder_check_erasures: Got invalid erased block %d\n", erasures[i]);
+			return -1;
+		}
 
-	r_h = util_mlx_eco_gf_w4_mul(x >> 4, y4 & 0xf);
-	r_l = util_mlx_eco_gf_w4_mul(x & 0xf, y4 & 0xf);
+		if (mask & (1u << erasures[i])) {
+			err_log("util_mlx_eco_decoder_check_erasures: Got block %d erased twice\n", erasures[i]);
+			return -1;
+		}
+		mask |= 1u << erasures[i];
+	}
 
-	return (r_h << 4) | r_l;
+	return 0;
 }
 
-static int util_mlx_eco_should_update_decode_matrix(struct eco_decoder *eco_decoder, int *erasures, int erasures_size)
+static uint32_t util_mlx_eco_erasures_mask(int *erasures, int erasures_size)
 {
-	uint32_t input_erasures = 0, last_erasures = 0;
-	int i, total_blocks = eco_decoder->eco_ctx->attr.k + eco_decoder->eco_ctx->attr.m;
+	uint32_t mask = 0;
+	int i;
 
 	for (i = 0 ; i < erasures_size ; i++) {
-		input_erasures |= (1 << erasures[i]);
-	}
-
-	for (i = 0 ; i < total_blocks ; i++) {
-		last_erasures |= eco_decoder->int_erasures[i] << i;
+		mask |= 1u << erasures[i];
 	}
 
-	return input_erasures != last_erasures ? 1 : 0;
+	return mask;
 }
 
-static int util_mlx_eco_extract_erasures(struct eco_decoder *eco_decoder, int *erasures, int erasures_size)
+static int util_mlx_eco_extract_erasures(struct eco_decoder *eco_decoder, int *erasures, int erasures_size, uint8_t *u8_erasures)
 {
     dbg_log("util_mlx_eco_extract_erasures: eco_decoder = %p , erasures = %p erasures_size = %d\n", eco_decoder, erasures, erasures_size);
 
 	int i, total_blocks = eco_decoder->eco_ctx->attr.k + eco_decoder->eco_ctx->attr.m;
 
-	memset(eco_decoder->int_erasures, 0, sizeof(int) * total_blocks);
-	memset(eco_decoder->u8_erasures, 0, sizeof(uint8_t) * total_blocks);
+	memset(u8_erasures, 0, sizeof(uint8_t) * total_blocks);
 
 	for (i = 0 ; i < erasures_size ; i++) {
-		eco_decoder->int_erasures[erasures[i]] = 1;
-		eco_decoder->u8_erasures[erasures[i]] = 1;
+		u8_erasures[erasures[i]] = 1;
 	}
 
 	dbg_log("util_mlx_eco_extract_erasures: erasures: [");
 	for (i = 0; i < total_blocks; i++)
-		dbg_log(" %d ", eco_decoder->int_erasures[i]);
+		dbg_log(" %d ", u8_erasures[i]);
 	dbg_log("]\n");
 
 	dbg_log("util_mlx_eco_extract_erasures completed successfully: ! eco_decoder = %p , erasures = %p erasures_size = %d\n", eco_decoder, erasures, erasures_size);
@@ -110,107 +117,276 @@ static int util_mlx_eco_extract_erasures(struct eco_decoder *eco_decoder, int *e
 	return 0;
 }
 
-static int util_mlx_eco_create_decode_matrix(struct eco_decoder *eco_decoder, int *erasures_arr, int num_erasures)
+/**
+ * Generate the decode matrix of an erasure pattern.
+ *
+ * @param eco_ctx                   Pointer to an initialized EC context.
+ * @param u8_erasures               Byte-map [k + m] of the erased blocks.
+ * @param u8_decode_matrix          Output buffer [k * m] of the decode matrix used by the verbs decode method.
+ * @return                          0 successful, other fail.
+ */
+static int util_mlx_eco_create_decode_matrix(struct eco_context *eco_ctx, const uint8_t *u8_erasures, uint8_t *u8_decode_matrix)
 {
-	int i, j, p, s, l = 0, data_erasures = 0, k = eco_decoder->eco_ctx->attr.k, m = eco_decoder->eco_ctx->attr.m;
-	int err;
-
-	dbg_log("util_mlx_eco_create_decode_matrix: ! eco_decoder = %p , num_erasures = %d\n", eco_decoder, num_erasures);
+	int k = eco_ctx->attr.k, m = eco_ctx->attr.m;
 
-	for (i = 0; i < k; i++) {
-		if (eco_decoder->int_erasures[i])
-			data_erasures++;
-	}
+	dbg_log("util_mlx_eco_create_decode_matrix: ! eco_ctx = %p\n", eco_ctx);
 
-	memset(eco_decoder->int_decode_matrix, 0, sizeof(int) * k * k);
-	memset(eco_decoder->survived, 0, sizeof(int) * (k + m));
-	memset(eco_decoder->u8_decode_matrix, 0, m * k);
+	memset(u8_decode_matrix, 0, m * k);
 
-	err = jerasure_make_decoding_matrix(k, data_erasures, W, eco_decoder->eco_ctx->int_encode_matrix, eco_decoder->int_erasures, eco_decoder->int_decode_matrix, eco_decoder->survived);
-	if (err) {
-		err_log("util_mlx_eco_create_decode_matrix: Jerasure failed making decoding matrix\n");
+	if (eco_gf_make_decode_matrix(eco_ctx->attr.encode_matrix, k, m, u8_erasures, u8_decode_matrix)) {
+		err_log("util_mlx_eco_create_decode_matrix: Failed making decoding matrix\n");
 		return -1;
 	}
 
-	for (i = 0; i < k; i++) {
-		if (eco_decoder->int_erasures[i]) {
-			for (j = 0; j < k; j++)
-				eco_decoder->u8_decode_matrix[j*num_erasures+l] = (uint8_t)eco_decoder->int_decode_matrix[i*k+j];
-			l++;
+	util_mlx_eco_print_matrix_u8(u8_decode_matrix, k, m);
+
+	dbg_log("util_mlx_eco_create_decode_matrix completed successfully: ! eco_ctx = %p\n", eco_ctx);
+
+	return 0;
+}
+
+/**
+ * Generate the decode matrices of all the erasure patterns into the precomputed table.
+ * Runs on the initializing thread or on the precompute thread, and stops early if the decoder is released.
+ *
+ * @param eco_decoder               Pointer to an EC decoder with an allocated precomputed table.
+ * @return                          0 successful, other fail.
+ */
+static int util_mlx_eco_decoder_precompute(struct eco_decoder *eco_decoder)
+{
+	struct eco_context *eco_ctx = eco_decoder->eco_ctx;
+	int k = eco_ctx->attr.k, m = eco_ctx->attr.m, i, err;
+	uint32_t mask, num_masks = 1 << (k + m);
+	uint8_t u8_erasures[k + m];
+	uint16_t index = 0;
+
+	for (mask = 1; mask < num_masks; mask++) {
+		if (__builtin_popcount(mask) > m) {
+			continue;
 		}
-	}
 
-	for (p = l; p < num_erasures; p++) {
-		for (i = 0; i < k; i++) {
-			s = 0;
-			for (j = 0; j < k; j++) {
-				s ^= util_mlx_eco_galois_w4_mult(eco_decoder->int_decode_matrix[j * k + i], eco_decoder->eco_ctx->int_encode_matrix[k * (erasures_arr[p] - k) + j]);
-			}
-			eco_decoder->u8_decode_matrix[i*num_erasures+l] = (uint8_t)s;
+		if (__atomic_load_n(&eco_decoder->table_stop, __ATOMIC_RELAXED)) {
+			return -ECANCELED;
+		}
+
+		for (i = 0; i < k + m; i++) {
+			u8_erasures[i] = (mask >> i) & 1;
 		}
-		l++;
+
+		err = util_mlx_eco_create_decode_matrix(eco_ctx, u8_erasures, eco_decoder->table_matrices + index * k * m);
+		if (err) {
+			return err;
+		}
+
+		eco_decoder->table_index[mask] = index++;
 	}
 
-	util_mlx_eco_print_matrix_u8(eco_decoder->u8_decode_matrix, k, l);
+	// publish the table to the decode path
+	__atomic_store_n(&eco_decoder->table_ready, 1, __ATOMIC_RELEASE);
 
-	dbg_log("util_mlx_eco_create_decode_matrix completed successfully: ! eco_decoder = %p , num_erasures = %d\n", eco_decoder, num_erasures);
+	dbg_log("util_mlx_eco_decoder_precompute: completed successfully - eco_decoder = %p, num_patterns = %d\n", eco_decoder, index);
 
 	return 0;
 }
 
-static inline void util_mlx_eco_decoder_prepare_remainder_data(struct eco_decoder *eco_decoder, uint8_t **data, uint8_t **coding, int remainder, int aligned_block_size)
+static void *util_mlx_eco_decoder_precompute_thread(void *arg)
 {
-	int i;
-	struct eco_context *eco_context = eco_decoder->eco_ctx;
-	eco_context->data = data;
-	eco_context->coding = coding;
+	util_mlx_eco_decoder_precompute(arg);
+
+	return NULL;
+}
+
+/**
+ * Allocate the precomputed table: an index of 2^(k+m) entries and one [k x m] matrix per erasure pattern of 1..m erasures.
+ *
+ * @param eco_decoder               Pointer to an initialized EC decoder.
+ * @return                          0 successful, other fail.
+ */
+static int util_mlx_eco_decoder_alloc_table(struct eco_decoder *eco_decoder)
+{
+	int k = eco_decoder->eco_ctx->attr.k, m = eco_decoder->eco_ctx->attr.m;
+	uint32_t mask, num_masks = 1 << (k + m), num_patterns = 0;
 
-	for (i = 0 ; i < eco_context->attr.k ; i++) {
-		if (!eco_decoder->u8_erasures[i]) {
-			memcpy((void *)eco_context->remainder_mem.data_blocks[i].addr, data[i] + aligned_block_size , remainder);
+	for (mask = 1; mask < num_masks; mask++) {
+		if (__builtin_popcount(mask) <= m) {
+			num_patterns++;
 		}
 	}
 
-	for (i = 0 ; i < eco_context->attr.m ; i++) {
-		if (!eco_decoder->u8_erasures[i + eco_context->attr.k]) {
-			memcpy((void *)eco_context->remainder_mem.code_blocks[i].addr, coding[i] + aligned_block_size, remainder);
-		}
+	eco_decoder->table_index = malloc(num_masks * sizeof(*eco_decoder->table_index));
+	if (!eco_decoder->table_index) {
+		goto alloc_index_error;
+	}
+	memset(eco_decoder->table_index, 0xff, num_masks * sizeof(*eco_decoder->table_index));
+
+	eco_decoder->table_matrices = calloc(num_patterns, k * m);
+	if (!eco_decoder->table_matrices) {
+		goto alloc_matrices_error;
+	}
+
+	return 0;
+
+alloc_matrices_error:
+	free(eco_decoder->table_index);
+	eco_decoder->table_index = NULL;
+alloc_index_error:
+	err_log("util_mlx_eco_decoder_alloc_table: Failed to allocate table of %u decode matrices\n", num_patterns);
+
+	return -ENOMEM;
+}
+
+/**
+ * Find the precomputed decode matrix of an erasure pattern.
+ *
+ * @param eco_decoder               Pointer to an initialized EC decoder.
+ * @param mask                      Bitmask of the erased blocks.
+ * @return                          Pointer to the decode matrix, NULL if the table is not ready.
+ */
+static inline const uint8_t *util_mlx_eco_decoder_lookup_table(struct eco_decoder *eco_decoder, uint32_t mask)
+{
+	uint16_t index;
+
+	if (!eco_decoder->table_index || !__atomic_load_n(&eco_decoder->table_ready, __ATOMIC_ACQUIRE)) {
+		return NULL;
+	}
+
+	index = eco_decoder->table_index[mask];
+	if (index == DECODER_TABLE_NONE) {
+		return NULL;
 	}
+
+	return eco_decoder->table_matrices + index * eco_decoder->eco_ctx->attr.k * eco_decoder->eco_ctx->attr.m;
 }
 
 static void util_mlx_eco_decoder_comp_done(struct ibv_exp_ec_comp *comp)
 {
-	struct eco_coder_comp *coder_comp = (void *)comp - offsetof(struct eco_coder_comp, comp);
-	struct eco_decoder *eco_decoder = (struct eco_decoder *)coder_comp->eco_coder;
+	struct eco_slot *slot = mlx_eco_comp_slot(comp);
+
+	slot->hw_done_ns = mlx_eco_time_ns();
+
+	mlx_eco_copy_bounced(slot, slot->erasures);
+	mlx_eco_op_complete(slot->eco_ctx, slot, (int)comp->status);
+}
+
+/**
+ * Decode the first hw_len bytes of every block on the HCA while the CPU decodes the rest of it.
+ * Without hybrid execution hw_len is the 64 bytes aligned part of the block, so the CPU only decodes the
+ * remainder from 64 bytes - directly on the user buffers while the aligned part is in flight.
+ * The operation must have been started with one part for the HCA (if hw_len is not 0) and one part for the CPU.
+ * The decode matrix is copied into the slot, so the decoder may generate the matrix of the next operation while this one is in flight.
+ *
+ * @param eco_decoder                Pointer to an initialized EC decoder.
+ * @param slot                       Slot of the operation, with registered buffers.
+ * @param u8_erasures                Byte-map [k + m] of the erased blocks of the operation.
+ * @param u8_decode_matrix           Decode matrix [k * m] of the operation.
+ * @param data                       Array of pointers to data buffers.
+ * @param coding                     Array of pointers to coding buffers.
+ * @param block_size                 Length of each block of data.
+ * @param hw_len                     64 bytes aligned length of the head of each block decoded by the HCA.
+ * @param hybrid                     Boolean variable which determine if the hybrid CPU threads share the software part.
+ * @param wait                       Boolean variable which determine if the HCA completion should be waited for.
+ * @return                           0 successful, other fail.
+ */
+static int util_mlx_eco_decoder_decode_split(struct eco_decoder *eco_decoder, struct eco_slot *slot, const uint8_t *u8_erasures, const uint8_t *u8_decode_matrix,
+		uint8_t **data, uint8_t **coding, int block_size, int hw_len, int hybrid, int wait)
+{
 	struct eco_context *eco_context = eco_decoder->eco_ctx;
-	int i, remainder = eco_context->block_size % 64, aligned_block_size = eco_context->block_size - remainder;
+	int k = eco_context->attr.k, m = eco_context->attr.m;
+	struct eco_sw_job job;
+	uint64_t hw_start = 0, sw_ns = 0;
+	int err;
 
-	if (coder_comp->is_remainder_comp) {
-		for (i = 0 ; i < eco_context->attr.k ; i++) {
-			if (eco_decoder->u8_erasures[i]) {
-				memcpy(eco_context->data[i] + aligned_block_size, (void *)eco_context->remainder_mem.data_blocks[i].addr, remainder);
-			}
-		}
+	memcpy(slot->erasures, u8_erasures, k + m);
+	memcpy(slot->decode_matrix, u8_decode_matrix, k * m);
 
-		for (i = 0 ; i < eco_context->attr.m ; i++) {
-			if (eco_decoder->u8_erasures[eco_context->attr.k + i]) {
-				memcpy(eco_context->coding[i] + aligned_block_size, (void *)eco_context->remainder_mem.code_blocks[i].addr, remainder);
-			}
+	if (hw_len) {
+		// The sges describe the whole aligned blocks, the HCA calculates only the first hw_len bytes of them
+		slot->mem.block_size = hw_len;
+		hw_start = mlx_eco_time_ns();
+		err = ibv_exp_ec_decode_async(slot->device->calc, &slot->mem, slot->erasures, slot->decode_matrix, &slot->comp.comp);
+		if (err) {
+			mlx_eco_op_abort(eco_context, slot);
+			return err;
 		}
 	}
 
-	pthread_mutex_lock(&eco_context->async_mutex);
+	if (block_size > hw_len) {
+		job.eco_ctx = eco_context;
+		job.matrix = slot->decode_matrix;
+		job.erasures = slot->erasures;
+		job.data = data;
+		job.coding = coding;
+		job.offset = hw_len;
+		job.len = block_size - hw_len;
+		job.num_parts = hybrid ? eco_context->hybrid.num_threads : 1;
+		sw_ns = mlx_eco_run_sw(&job);
+	}
+
+	mlx_eco_op_complete(eco_context, slot, 0);
+
+	if (!wait) {
+		return 0;
+	}
+
+	err = mlx_eco_op_wait(eco_context, slot);
+	if (err) {
+		return err;
+	}
 
-	if (!--eco_context->async_ref_count) {
-		pthread_cond_signal(&eco_context->async_cond);
+	if (hybrid) {
+		mlx_eco_hybrid_update(eco_context, hw_len, slot->hw_done_ns - hw_start, block_size - hw_len, sw_ns);
 	}
 
-	pthread_mutex_unlock(&eco_context->async_mutex);
+	return 0;
+}
+
+/**
+ * Check the decode parameters.
+ *
+ * @param eco_decoder                Pointer to an initialized EC decoder.
+ * @param data_size                  Size of data array.
+ * @param coding_size                Size of coding array.
+ * @param block_size                 Length of each block of data.
+ * @return                           0 valid, other invalid.
+ */
+static int util_mlx_eco_decoder_check_params(struct eco_decoder *eco_decoder, int data_size, int coding_size, int block_size)
+{
+	if (!eco_decoder) {
+		err_log("mlx_eco_decoder_decode: Got invalid EC decoder - cannot decode data\n");
+		return -1;
+	}
+
+	if (data_size != eco_decoder->eco_ctx->attr.k || coding_size != eco_decoder->eco_ctx->attr.m) {
+		err_log("mlx_eco_decoder_decode: Warning got different parameters then expected - got k=%d, m=%d - expected data_size=%d coding_size=%d\n", data_size, coding_size, eco_decoder->eco_ctx->attr.k, eco_decoder->eco_ctx->attr.m);
+		return -1;
+	}
+
+	if (block_size <= 0) {
+		err_log("mlx_eco_decoder_decode: Got invalid block size - %d\n", block_size);
+		return -1;
+	}
+
+	return mlx_eco_activate(eco_decoder->eco_ctx);
 }
 
 struct eco_decoder *mlx_eco_decoder_init(int k, int m, int use_vandermonde_matrix)
 {
-	dbg_log("mlx_eco_decoder_init: k = %d, m = %d, use_vandermonde_matrix = %d\n", k , m, use_vandermonde_matrix);
+	struct eco_decoder_attr attr;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.k = k;
+	attr.m = m;
+	attr.use_vandermonde_matrix = use_vandermonde_matrix;
+
+	return mlx_eco_decoder_init_attr(&attr);
+}
+
+struct eco_decoder *mlx_eco_decoder_init_attr(struct eco_decoder_attr *attr)
+{
+	int k = attr->k, m = attr->m, use_vandermonde_matrix = attr->use_vandermonde_matrix;
+	int cache_size = attr->cache_size ? attr->cache_size : DECODER_DEFAULT_CACHE_SIZE;
+
+	dbg_log("mlx_eco_decoder_init: k = %d, m = %d, use_vandermonde_matrix = %d, precompute = %d, cache_size = %d, queue_depth = %d\n", k , m, use_vandermonde_matrix, attr->precompute, cache_size, attr->queue_depth);
 
 	struct eco_decoder *eco_decoder;
 
@@ -220,11 +396,7 @@ struct eco_decoder *mlx_eco_decoder_init(int k, int m, int use_vandermonde_matri
 		goto allocate_decoder_error;
 	}
 
-	eco_decoder->int_decode_matrix = calloc(k * k, sizeof(int));
-	if (!eco_decoder->int_decode_matrix) {
-		err_log("mlx_eco_decoder_init: Failed to allocate int_decode_matrix\n");
-		goto allocate_int_decode_matrix_error;
-	}
+	pthread_mutex_init(&eco_decoder->matrix_mutex, NULL);
 
 	eco_decoder->u8_decode_matrix = calloc(m * k, sizeof(uint8_t));
 	if (!eco_decoder->u8_decode_matrix) {
@@ -232,45 +404,56 @@ struct eco_decoder *mlx_eco_decoder_init(int k, int m, int use_vandermonde_matri
 		goto allocate_u8_decode_matrix_error;
 	}
 
-	eco_decoder->int_erasures = calloc(k + m, sizeof(int));
-	if (!eco_decoder->int_erasures) {
-		err_log("mlx_eco_decoder_init: Failed to allocated int_erasures buffer\n");
-		goto allocate_int_erasures_error;
-	}
-
 	eco_decoder->u8_erasures = calloc(k + m, sizeof(uint8_t));
 	if (!eco_decoder->u8_erasures) {
 		err_log("mlx_eco_decoder_init: Failed to allocated u8_erasures buffer\n");
 		goto allocate_u8_erasures_error;
 	}
 
-	eco_decoder->survived = calloc(k + m, sizeof(int));
-	if (!eco_decoder->survived) {
-		err_log("failed to allocated survived buffer\n");
-		goto allocate_survived_error;
+	if (cache_size > 0) {
+		eco_decoder->matrix_cache = eco_matrix_cache_create(cache_size, k * m);
+		if (!eco_decoder->matrix_cache) {
+			err_log("mlx_eco_decoder_init: Failed to allocate decode matrix cache\n");
+			goto allocate_matrix_cache_error;
+		}
 	}
 
-	eco_decoder->eco_ctx = mlx_eco_init(eco_decoder, k, m, use_vandermonde_matrix, util_mlx_eco_decoder_comp_done);
+	eco_decoder->eco_ctx = mlx_eco_init(eco_decoder, k, m, use_vandermonde_matrix, attr->queue_depth, &attr->device, attr->lazy, util_mlx_eco_decoder_comp_done);
 	if (!eco_decoder->eco_ctx) {
 		err_log("mlx_eco_decoder_init: Failed to initialize eco_decoder\n");
 		goto decoder_initialize_error;
 	}
 
+	if (attr->precompute != ECO_DECODER_PRECOMPUTE_NONE) {
+		if (util_mlx_eco_decoder_alloc_table(eco_decoder)) {
+			goto precompute_error;
+		}
+
+		if (attr->precompute == ECO_DECODER_PRECOMPUTE_BACKGROUND &&
+				!pthread_create(&eco_decoder->table_thread, NULL, util_mlx_eco_decoder_precompute_thread, eco_decoder)) {
+			eco_decoder->table_thread_running = 1;
+		} else if (util_mlx_eco_decoder_precompute(eco_decoder)) {
+			err_log("mlx_eco_decoder_init: Failed to precompute the decode matrices\n");
+			goto precompute_error;
+		}
+	}
+
 	dbg_log("mlx_eco_decoder_init: Completed successfully - eco_ctx = %p, k = %d, m = %d, use_vandermonde_matrix = %d\n", eco_decoder, k , m, use_vandermonde_matrix);
 
 	return eco_decoder;
 
+precompute_error:
+	free(eco_decoder->table_matrices);
+	free(eco_decoder->table_index);
+	mlx_eco_release(eco_decoder->eco_ctx);
 decoder_initialize_error:
-	free(eco_decoder->survived);
-allocate_survived_error:
+	eco_matrix_cache_destroy(eco_decoder->matrix_cache);
+allocate_matrix_cache_error:
 	free(eco_decoder->u8_erasures);
 allocate_u8_erasures_error:
-	free(eco_decoder->int_erasures);
-allocate_int_erasures_error:
 	free(eco_decoder->u8_decode_matrix);
 allocate_u8_decode_matrix_error:
-	free(eco_decoder->int_decode_matrix);
-allocate_int_decode_matrix_error:
+	pthread_mutex_destroy(&eco_decoder->matrix_mutex);
 	free(eco_decoder);
 allocate_decoder_error:
 
@@ -283,26 +466,149 @@ int mlx_eco_decoder_register(struct eco_decoder *eco_decoder, uint8_t **data, ui
 {
 	dbg_log("mlx_eco_decoder_register: eco_decoder = %p , block_size = %d, data = %p, data_size = %d, coding = %p, coding_size = %d\n", eco_decoder, block_size , data, data_size, coding, coding_size);
 
+	struct eco_slot *slot;
 	int err;
-	err = mlx_eco_register(eco_decoder->eco_ctx, data, coding, data_size, coding_size, block_size);
+
+	if (!eco_decoder) {
+		err_log("mlx_eco_decoder_register: got null eco_decoder\n");
+		return -1;
+	}
+
+	if (mlx_eco_activate(eco_decoder->eco_ctx)) {
+		return -1;
+	}
+
+	// register into the memory layout context of the next free slot
+	slot = mlx_eco_op_begin(eco_decoder->eco_ctx, NULL, NULL, 0, 1);
+	err = mlx_eco_register(eco_decoder->eco_ctx, slot, data, coding, data_size, coding_size, block_size);
+	mlx_eco_op_abort(eco_decoder->eco_ctx, slot);
+
+	// a striped decoder may calculate with the buffers on any of its devices
+	if (!err && eco_decoder->eco_ctx->num_devices > 1) {
+		err = mlx_eco_register_devices(eco_decoder->eco_ctx, data, coding, data_size, coding_size, block_size);
+	}
 
 	dbg_log("mlx_eco_decoder_register: completed with result = %d, eco_decoder = %p , block_size = %d, data = %p, data_size = %d, coding = %p, coding_size = %d\n", err, eco_decoder, block_size , data, data_size, coding, coding_size);
 
 	return err;
 }
 
+/**
+ * Generate the decode matrix of an erasure pattern into u8_decode_matrix and u8_erasures of the decoder.
+ * The matrix mutex must be held.
+ *
+ * @param eco_decoder               Pointer to an initialized EC decoder.
+ * @param mask                      Bitmask of the erased blocks.
+ * @param erasures                  Array of erased blocks indices.
+ * @param erasures_size             Size of erasures array.
+ * @return                          0 successful, other fail.
+ */
+static int util_mlx_eco_decoder_generate_locked(struct eco_decoder *eco_decoder, uint32_t mask, int *erasures, int erasures_size)
+{
+	int k = eco_decoder->eco_ctx->attr.k, m = eco_decoder->eco_ctx->attr.m, err;
+	const uint8_t *matrix;
+
+	matrix = util_mlx_eco_decoder_lookup_table(eco_decoder, mask);
+	if (!matrix && eco_decoder->matrix_cache) {
+		matrix = eco_matrix_cache_lookup(eco_decoder->matrix_cache, mask);
+	}
+
+	if (matrix) {
+		if (mask != eco_decoder->erasures_mask) {
+			util_mlx_eco_extract_erasures(eco_decoder, erasures, erasures_size, eco_decoder->u8_erasures);
+			memcpy(eco_decoder->u8_decode_matrix, matrix, k * m);
+			eco_decoder->erasures_mask = mask;
+		}
+		return 0;
+	}
+
+	if (!eco_decoder->matrix_cache && mask == eco_decoder->erasures_mask) {
+		return 0;
+	}
+
+	util_mlx_eco_extract_erasures(eco_decoder, erasures, erasures_size, eco_decoder->u8_erasures);
+	err = util_mlx_eco_create_decode_matrix(eco_decoder->eco_ctx, eco_decoder->u8_erasures, eco_decoder->u8_decode_matrix);
+	if (err) {
+		// the erasures byte-maps do not match the decode matrix anymore
+		eco_decoder->erasures_mask = ~0U;
+		return err;
+	}
+	eco_decoder->erasures_mask = mask;
+
+	if (eco_decoder->matrix_cache) {
+		memcpy(eco_matrix_cache_insert(eco_decoder->matrix_cache, mask), eco_decoder->u8_decode_matrix, k * m);
+	}
+
+	return 0;
+}
+
+/**
+ * Get the erasures byte-map and the decode matrix of a single operation into buffers owned by the operation,
+ * so threads decoding different erasure patterns at once do not overwrite each other's matrix.
+ * Precomputed matrices are read without locking.
+ *
+ * @param eco_decoder               Pointer to an initialized EC decoder.
+ * @param erasures                  Array of erased blocks indices.
+ * @param erasures_size             Size of erasures array.
+ * @param u8_erasures               Output byte-map [k + m] of the erased blocks.
+ * @param u8_decode_matrix          Output buffer [k * m] of the decode matrix.
+ * @return                          0 successful, other fail.
+ */
+static int util_mlx_eco_decoder_get_matrix(struct eco_decoder *eco_decoder, int *erasures, int erasures_size, uint8_t *u8_erasures, uint8_t *u8_decode_matrix)
+{
+	int k = eco_decoder->eco_ctx->attr.k, m = eco_decoder->eco_ctx->attr.m, err;
+	const uint8_t *matrix;
+	uint32_t mask;
+
+	err = util_mlx_eco_decoder_check_erasures(eco_decoder, erasures, erasures_size);
+	if (err) {
+		return err;
+	}
+
+	mask = util_mlx_eco_erasures_mask(erasures, erasures_size);
+
+	matrix = util_mlx_eco_decoder_lookup_table(eco_decoder, mask);
+	if (matrix) {
+		util_mlx_eco_extract_erasures(eco_decoder, erasures, erasures_size, u8_erasures);
+		memcpy(u8_decode_matrix, matrix, k * m);
+		return 0;
+	}
+
+	pthread_mutex_lock(&eco_decoder->matrix_mutex);
+
+	err = util_mlx_eco_decoder_generate_locked(eco_decoder, mask, erasures, erasures_size);
+	if (!err) {
+		memcpy(u8_erasures, eco_decoder->u8_erasures, k + m);
+		memcpy(u8_decode_matrix, eco_decoder->u8_decode_matrix, k * m);
+	}
+
+	pthread_mutex_unlock(&eco_decoder->matrix_mutex);
+
+	return err;
+}
+
 int mlx_eco_decoder_generate_decode_matrix(struct eco_decoder *eco_decoder, int *erasures, int erasures_size)
 {
 	dbg_log("mlx_eco_decoder_generate_decode_matrix: eco_decoder = %p , erasures = %p, erasures_size = %d\n", eco_decoder, erasures, erasures_size);
 
+	int err;
+
 	if (!eco_decoder) {
 		err_log("mlx_eco_decoder_generate_decode_matrix: got null eco_decoder\n");
 		return -1;
 	}
 
-	if (util_mlx_eco_should_update_decode_matrix(eco_decoder, erasures, erasures_size)) {
-		util_mlx_eco_extract_erasures(eco_decoder, erasures, erasures_size);
-		util_mlx_eco_create_decode_matrix(eco_decoder, erasures, erasures_size);
+	err = util_mlx_eco_decoder_check_erasures(eco_decoder, erasures, erasures_size);
+	if (err) {
+		return err;
+	}
+
+	pthread_mutex_lock(&eco_decoder->matrix_mutex);
+	err = util_mlx_eco_decoder_generate_locked(eco_decoder, util_mlx_eco_erasures_mask(erasures, erasures_size), erasures, erasures_size);
+	pthread_mutex_unlock(&eco_decoder->matrix_mutex);
+
+	if (err) {
+		return err;
 	}
 
 	dbg_log("mlx_eco_decoder_generate_decode_matrix: completed successfully: eco_decoder = %p , erasures = %p, erasures_size = %d\n", eco_decoder, erasures, erasures_size);
@@ -315,72 +621,354 @@ int mlx_eco_decoder_decode(struct eco_decoder *eco_decoder, uint8_t **data, uint
 	dbg_log("mlx_eco_decoder_decode: eco_decoder = %p , block_size = %d, data = %p, data_size = %d, coding = %p, coding_size = %d, erasures = %p, erasures_size = %d\n", eco_decoder, block_size , data, data_size, coding, coding_size, erasures, erasures_size);
 
 	struct eco_context *eco_context;
-	int err, remainder = block_size % 64, aligned_block_size = block_size - remainder;
+	struct eco_slot *slot;
+	uint8_t u8_erasures[W * W], u8_decode_matrix[W * W * W * W];
+	int err, hybrid, hw_len, aligned_block_size = block_size - (block_size % 64);
 
-	if (!eco_decoder) {
-		err_log("mlx_eco_decoder_decode: Got invalid EC decoder - cannot decode data\n");
-		return -1;
+	err = util_mlx_eco_decoder_check_params(eco_decoder, data_size, coding_size, block_size);
+	if (err) {
+		return err;
 	}
 
 	eco_context = eco_decoder->eco_ctx;
 
-	if (data_size != eco_context->attr.k || coding_size != eco_context->attr.m) {
-		err_log("mlx_eco_decoder_decode: Warning got different parameters then expected - got k=%d, m=%d - expected data_size=%d coding_size=%d\n", data_size, coding_size, eco_context->attr.k, eco_context->attr.m);
-		return -1;
-	}
-
-	err = mlx_eco_decoder_generate_decode_matrix(eco_decoder, erasures, erasures_size);
+	err = util_mlx_eco_decoder_get_matrix(eco_decoder, erasures, erasures_size, u8_erasures, u8_decode_matrix);
 	if (err) {
 		err_log("mlx_eco_decoder_decode: generate decode matrix failed\n");
 		return err;
 	}
 
-	err = mlx_eco_register(eco_context, data, coding, data_size, coding_size, block_size);
+	// tiny blocks are decoded by the calling thread faster than the round trip to the HCA
+	if (mlx_eco_use_sw(eco_context, block_size)) {
+		err = eco_gf_decode(u8_decode_matrix, data_size, coding_size, u8_erasures, data, coding, 0, block_size);
+		if (err) {
+			err_log("mlx_eco_decoder_decode: Not enough surviving blocks to decode\n");
+			return err;
+		}
+
+		dbg_log("mlx_eco_decoder_decode: completed successfully in software - eco_decoder = %p , block_size = %d, data = %p, data_size = %d, coding = %p, coding_size = %d, erasures = %p, erasures_size = %d\n", eco_decoder, block_size , data, data_size, coding, coding_size, erasures, erasures_size);
+
+		return 0;
+	}
+
+	hybrid = mlx_eco_hybrid_get(eco_context, block_size);
+	hw_len = hybrid ? mlx_eco_hybrid_split(eco_context, block_size) : aligned_block_size;
+
+	// wait for a free slot if the asynchronous operations use all of them
+	slot = mlx_eco_op_begin(eco_context, NULL, NULL, hw_len ? 2 : 1, 1);
+
+	err = mlx_eco_register(eco_context, slot, data, coding, data_size, coding_size, block_size);
 	if (err) {
 		err_log("mlx_eco_decoder_decode: MR allocation failed\n");
+		mlx_eco_op_abort(eco_context, slot);
+		goto hybrid_put;
+	}
+
+	err = util_mlx_eco_decoder_decode_split(eco_decoder, slot, u8_erasures, u8_decode_matrix, data, coding, block_size, hw_len, hybrid, 1);
+	if (err) {
+		err_log("mlx_eco_decoder_decode: Failed ibv_exp_ec_decode (%d) %m\n", err);
+		goto hybrid_put;
+	}
+
+	dbg_log("mlx_eco_decoder_decode: completed successfully - eco_decoder = %p , block_size = %d, data = %p, data_size = %d, coding = %p, coding_size = %d, erasures = %p, erasures_size = %d\n", eco_decoder, block_size , data, data_size, coding, coding_size, erasures, erasures_size);
+
+hybrid_put:
+	if (hybrid) {
+		mlx_eco_hybrid_put(eco_context);
+	}
+
+	return err;
+}
+
+int mlx_eco_decoder_decode_async(struct eco_decoder *eco_decoder, uint8_t **data, uint8_t **coding, int data_size, int coding_size, int block_size,
+		int *erasures, int erasures_size, eco_coder_done_func done_func, void *arg)
+{
+	dbg_log("mlx_eco_decoder_decode_async: eco_decoder = %p , block_size = %d, data = %p, data_size = %d, coding = %p, coding_size = %d, erasures = %p, erasures_size = %d\n", eco_decoder, block_size , data, data_size, coding, coding_size, erasures, erasures_size);
+
+	struct eco_context *eco_context;
+	struct eco_slot *slot;
+	uint8_t u8_erasures[W * W], u8_decode_matrix[W * W * W * W];
+	int err, hw_len = block_size - (block_size % 64);
+
+	err = util_mlx_eco_decoder_check_params(eco_decoder, data_size, coding_size, block_size);
+	if (err) {
+		return err;
+	}
+
+	eco_context = eco_decoder->eco_ctx;
+
+	if (!done_func && eco_context->event_fd < 0) {
+		err_log("mlx_eco_decoder_decode_async: Got null completion callback without an event fd\n");
+		return -1;
+	}
+
+	err = util_mlx_eco_decoder_get_matrix(eco_decoder, erasures, erasures_size, u8_erasures, u8_decode_matrix);
+	if (err) {
+		err_log("mlx_eco_decoder_decode_async: generate decode matrix failed\n");
 		return err;
 	}
 
-	pthread_mutex_lock(&eco_context->async_mutex);
+	if (mlx_eco_use_sw(eco_context, block_size)) {
+		// the completion of an operation without callback is still reported through the event fd
+		slot = done_func ? NULL : mlx_eco_op_begin_event(eco_context, arg, 1);
+		if (!done_func && !slot) {
+			return -EBUSY;
+		}
 
-	if (remainder) {
-		util_mlx_eco_decoder_prepare_remainder_data(eco_decoder, data, coding, remainder, aligned_block_size);
-		err = ibv_exp_ec_decode_async(eco_context->calc, &eco_context->remainder_mem, eco_decoder->u8_erasures, eco_decoder->u8_decode_matrix, &eco_context->remainder_comp.comp);
+		err = eco_gf_decode(u8_decode_matrix, data_size, coding_size, u8_erasures, data, coding, 0, block_size);
 		if (err) {
-			goto decode_error;
+			err_log("mlx_eco_decoder_decode_async: Not enough surviving blocks to decode\n");
+			if (slot) {
+				mlx_eco_op_abort(eco_context, slot);
+			}
+			return err;
+		}
+
+		if (slot) {
+			mlx_eco_op_complete(eco_context, slot, 0);
+		} else {
+			done_func(arg, 0);
 		}
-		eco_context->async_ref_count++;
+		return 0;
+	}
+
+	if (done_func) {
+		slot = mlx_eco_op_begin(eco_context, done_func, arg, hw_len ? 2 : 1, 0);
+	} else {
+		slot = mlx_eco_op_begin_event(eco_context, arg, hw_len ? 2 : 1);
+	}
+	if (!slot) {
+		return -EBUSY;
+	}
+
+	err = mlx_eco_register(eco_context, slot, data, coding, data_size, coding_size, block_size);
+	if (err) {
+		// -ENOBUFS if the bounce buffers are used by other operations, the caller retries it as a full queue
+		if (err != -ENOBUFS) {
+			err_log("mlx_eco_decoder_decode_async: MR allocation failed\n");
+		}
+		mlx_eco_op_abort(eco_context, slot);
+		return err;
+	}
+
+	// the CPU part is only the remainder from 64 bytes, so hybrid execution does not apply
+	err = util_mlx_eco_decoder_decode_split(eco_decoder, slot, u8_erasures, u8_decode_matrix, data, coding, block_size, hw_len, 0, 0);
+	if (err) {
+		err_log("mlx_eco_decoder_decode_async: Failed ibv_exp_ec_decode (%d) %m\n", err);
+		return err;
+	}
+
+	dbg_log("mlx_eco_decoder_decode_async: submitted successfully - eco_decoder = %p , block_size = %d\n", eco_decoder, block_size);
+
+	return 0;
+}
+
+int mlx_eco_decoder_decode_batch(struct eco_decoder *eco_decoder, struct eco_stripe *stripes, int num_stripes, int data_size, int coding_size, int block_size)
+{
+	dbg_log("mlx_eco_decoder_decode_batch: eco_decoder = %p , stripes = %p, num_stripes = %d, data_size = %d, coding_size = %d, block_size = %d\n", eco_decoder, stripes, num_stripes, data_size, coding_size, block_size);
+
+	struct eco_context *eco_context;
+	struct eco_batch batch;
+	struct eco_slot *slot;
+	uint8_t u8_erasures[W * W], u8_decode_matrix[W * W * W * W];
+	int i, err, status, hw_len = block_size - (block_size % 64);
+
+	err = util_mlx_eco_decoder_check_params(eco_decoder, data_size, coding_size, block_size);
+	if (err) {
+		return err;
+	}
+
+	if (!stripes || num_stripes < 0) {
+		err_log("mlx_eco_decoder_decode_batch: Got invalid stripes array - %p, num_stripes = %d\n", stripes, num_stripes);
+		return -1;
 	}
 
-	if (aligned_block_size) {
-		err = ibv_exp_ec_decode_async(eco_context->calc, &eco_context->alignment_mem, eco_decoder->u8_erasures, eco_decoder->u8_decode_matrix, &eco_context->alignment_comp.comp);
+	eco_context = eco_decoder->eco_ctx;
+
+	struct eco_slot *pending[eco_context->queue_depth];
+
+	memset(&batch, 0, sizeof(batch));
+	batch.slots = pending;
+
+	for (i = 0; i < num_stripes; i++) {
+		err = util_mlx_eco_decoder_get_matrix(eco_decoder, stripes[i].erasures, stripes[i].erasures_size, u8_erasures, u8_decode_matrix);
+		if (err) {
+			err_log("mlx_eco_decoder_decode_batch: generate decode matrix failed for stripe %d\n", i);
+			break;
+		}
+
+		if (mlx_eco_use_sw(eco_context, block_size)) {
+			err = eco_gf_decode(u8_decode_matrix, data_size, coding_size, u8_erasures, stripes[i].data, stripes[i].coding, 0, block_size);
+			if (err) {
+				err_log("mlx_eco_decoder_decode_batch: Not enough surviving blocks to decode stripe %d\n", i);
+				break;
+			}
+			continue;
+		}
+
+		slot = mlx_eco_batch_begin(eco_context, &batch, hw_len ? 2 : 1);
+
+		err = mlx_eco_register(eco_context, slot, stripes[i].data, stripes[i].coding, data_size, coding_size, block_size);
 		if (err) {
-			goto decode_error;
+			err_log("mlx_eco_decoder_decode_batch: MR allocation failed for stripe %d\n", i);
+			mlx_eco_op_abort(eco_context, slot);
+			mlx_eco_batch_cancel(&batch);
+			break;
+		}
+
+		err = util_mlx_eco_decoder_decode_split(eco_decoder, slot, u8_erasures, u8_decode_matrix, stripes[i].data, stripes[i].coding, block_size, hw_len, 0, 0);
+		if (err) {
+			err_log("mlx_eco_decoder_decode_batch: Failed ibv_exp_ec_decode of stripe %d (%d) %m\n", i, err);
+			mlx_eco_batch_cancel(&batch);
+			break;
 		}
-		eco_context->async_ref_count++;
 	}
 
-	pthread_cond_wait(&eco_context->async_cond, &eco_context->async_mutex);
-	pthread_mutex_unlock(&eco_context->async_mutex);
+	status = mlx_eco_batch_wait(eco_context, &batch);
+
+	dbg_log("mlx_eco_decoder_decode_batch: completed with result = %d, status = %d - eco_decoder = %p , num_stripes = %d\n", err, status, eco_decoder, num_stripes);
+
+	return err ? err : status;
+}
 
-	if ((err = (int)eco_context->alignment_comp.comp.status | (int)eco_context->remainder_comp.comp.status)) {
-		goto decode_error;
+int mlx_eco_decoder_wait(struct eco_decoder *eco_decoder)
+{
+	if (!eco_decoder) {
+		err_log("mlx_eco_decoder_wait: got null eco_decoder\n");
+		return -1;
 	}
 
-	dbg_log("mlx_eco_decoder_decode: completed successfully - eco_decoder = %p , block_size = %d, data = %p, data_size = %d, coding = %p, coding_size = %d, erasures = %p, erasures_size = %d\n", eco_decoder, block_size , data, data_size, coding, coding_size, erasures, erasures_size);
+	return mlx_eco_op_wait(eco_decoder->eco_ctx, NULL);
+}
+
+int mlx_eco_decoder_get_event_fd(struct eco_decoder *eco_decoder)
+{
+	if (!eco_decoder) {
+		err_log("mlx_eco_decoder_get_event_fd: got null eco_decoder\n");
+		return -1;
+	}
+
+	return mlx_eco_get_event_fd(eco_decoder->eco_ctx);
+}
+
+int mlx_eco_decoder_poll_completions(struct eco_decoder *eco_decoder, struct eco_completion *completions, int max_completions)
+{
+	if (!eco_decoder || !completions || max_completions < 0) {
+		err_log("mlx_eco_decoder_poll_completions: got invalid parameters - eco_decoder = %p, completions = %p, max_completions = %d\n", eco_decoder, completions, max_completions);
+		return -1;
+	}
+
+	return mlx_eco_poll_completions(eco_decoder->eco_ctx, completions, max_completions);
+}
+
+int mlx_eco_decoder_set_hybrid(struct eco_decoder *eco_decoder, int enable, int num_threads, int min_block_size)
+{
+	if (!eco_decoder) {
+		err_log("mlx_eco_decoder_set_hybrid: got null eco_decoder\n");
+		return -1;
+	}
+
+	return mlx_eco_set_hybrid(eco_decoder->eco_ctx, enable, num_threads, min_block_size);
+}
+
+int mlx_eco_decoder_set_sw_threshold(struct eco_decoder *eco_decoder, int sw_threshold)
+{
+	if (!eco_decoder) {
+		err_log("mlx_eco_decoder_set_sw_threshold: got null eco_decoder\n");
+		return -1;
+	}
+
+	return mlx_eco_set_sw_threshold(eco_decoder->eco_ctx, sw_threshold);
+}
+
+int mlx_eco_decoder_set_wait_mode(struct eco_decoder *eco_decoder, enum eco_wait_mode mode)
+{
+	if (!eco_decoder) {
+		err_log("mlx_eco_decoder_set_wait_mode: got null eco_decoder\n");
+		return -1;
+	}
+
+	return mlx_eco_set_wait_mode(eco_decoder->eco_ctx, mode);
+}
+
+int mlx_eco_decoder_set_cache_size(struct eco_decoder *eco_decoder, int cache_size)
+{
+	dbg_log("mlx_eco_decoder_set_cache_size: eco_decoder = %p, cache_size = %d\n", eco_decoder, cache_size);
+
+	struct eco_matrix_cache *matrix_cache = NULL;
+	int k, m;
+
+	if (!eco_decoder) {
+		err_log("mlx_eco_decoder_set_cache_size: got null eco_decoder\n");
+		return -1;
+	}
+
+	if (cache_size < 0) {
+		err_log("mlx_eco_decoder_set_cache_size: Got invalid cache size - %d\n", cache_size);
+		return -1;
+	}
+
+	k = eco_decoder->eco_ctx->attr.k;
+	m = eco_decoder->eco_ctx->attr.m;
+
+	// there are no more than 2^(k+m) erasure patterns
+	if (cache_size > 1 << (k + m)) {
+		cache_size = 1 << (k + m);
+	}
+
+	if (cache_size) {
+		matrix_cache = eco_matrix_cache_create(cache_size, k * m);
+		if (!matrix_cache) {
+			return -ENOMEM;
+		}
+	}
+
+	pthread_mutex_lock(&eco_decoder->matrix_mutex);
+	eco_matrix_cache_destroy(eco_decoder->matrix_cache);
+	eco_decoder->matrix_cache = matrix_cache;
+	pthread_mutex_unlock(&eco_decoder->matrix_mutex);
+
+	dbg_log("mlx_eco_decoder_set_cache_size: completed successfully - eco_decoder = %p, cache_size = %d\n", eco_decoder, cache_size);
 
 	return 0;
+}
 
-decode_error:
+int mlx_eco_decoder_get_cache_stats(struct eco_decoder *eco_decoder, struct eco_matrix_cache_stats *stats)
+{
+	if (!eco_decoder || !stats) {
+		err_log("mlx_eco_decoder_get_cache_stats: got null eco_decoder or stats\n");
+		return -1;
+	}
 
-	if (eco_context->async_ref_count) {
-		pthread_cond_wait(&eco_context->async_cond, &eco_context->async_mutex);
+	pthread_mutex_lock(&eco_decoder->matrix_mutex);
+	if (eco_decoder->matrix_cache) {
+		eco_matrix_cache_get_stats(eco_decoder->matrix_cache, stats);
+	} else {
+		memset(stats, 0, sizeof(*stats));
 	}
+	pthread_mutex_unlock(&eco_decoder->matrix_mutex);
 
-	pthread_mutex_unlock(&eco_context->async_mutex);
+	return 0;
+}
 
-	err_log("mlx_eco_decoder_decode: Failed ibv_exp_ec_decode (%d) %m\n", err);
-	return err;
+int mlx_eco_decoder_prewarm(struct eco_decoder *eco_decoder)
+{
+	if (!eco_decoder) {
+		err_log("mlx_eco_decoder_prewarm: got null eco_decoder\n");
+		return -1;
+	}
+
+	return mlx_eco_prewarm(eco_decoder->eco_ctx);
+}
+
+struct eco_stripe_buffers *mlx_eco_decoder_alloc_stripe_buffers(struct eco_decoder *eco_decoder, int k, int m, int block_size)
+{
+	if (!eco_decoder) {
+		err_log("mlx_eco_decoder_alloc_stripe_buffers: got null eco_decoder\n");
+		return NULL;
+	}
+
+	return mlx_eco_alloc_stripe_buffers(eco_decoder->eco_ctx, k, m, block_size);
 }
 
 int mlx_eco_decoder_release(struct eco_decoder *eco_decoder)
@@ -394,14 +982,30 @@ int mlx_eco_decoder_release(struct eco_decoder *eco_decoder)
 		return -1;
 	}
 
+	if (eco_decoder->table_thread_running) {
+		__atomic_store_n(&eco_decoder->table_stop, 1, __ATOMIC_RELAXED);
+		pthread_join(eco_decoder->table_thread, NULL);
+		eco_decoder->table_thread_running = 0;
+	}
+
+	if (eco_decoder->table_matrices) {
+		free(eco_decoder->table_matrices);
+		eco_decoder->table_matrices = NULL;
+	}
+
+	if (eco_decoder->table_index) {
+		free(eco_decoder->table_index);
+		eco_decoder->table_index = NULL;
+	}
+
 	if(eco_decoder->eco_ctx) {
 		err = mlx_eco_release(eco_decoder->eco_ctx);
 		eco_decoder->eco_ctx = NULL;
 	}
 
-	if(eco_decoder->survived) {
-		free(eco_decoder->survived);
-		eco_decoder->survived = NULL;
+	if (eco_decoder->matrix_cache) {
+		eco_matrix_cache_destroy(eco_decoder->matrix_cache);
+		eco_decoder->matrix_cache = NULL;
 	}
 
 	if(eco_decoder->u8_erasures) {
@@ -409,21 +1013,12 @@ int mlx_eco_decoder_release(struct eco_decoder *eco_decoder)
 		eco_decoder->u8_erasures = NULL;
 	}
 
-	if(eco_decoder->int_erasures) {
-		free(eco_decoder->int_erasures);
-		eco_decoder->int_erasures = NULL;
-	}
-
 	if (eco_decoder->u8_decode_matrix) {
 		free(eco_decoder->u8_decode_matrix);
 		eco_decoder->u8_decode_matrix = NULL;
 	}
 
-	if (eco_decoder->int_decode_matrix) {
-		free(eco_decoder->int_decode_matrix);
-		eco_decoder->int_decode_matrix = NULL;
-	}
-
+	pthread_mutex_destroy(&eco_decoder->matrix_mutex);
 	free(eco_decoder);
 
 	dbg_log("mlx_eco_decoder_release: completed with result = %d, eco_decoder = %p\n", err, eco_decoder);
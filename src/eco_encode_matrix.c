@@ -0,0 +1,134 @@
+/*
+ ** Copyright (C) 2016 Mellanox Technologies
+ **
+ ** Licensed under the Apache License, Version 2.0 (the "License");
+ ** you may not use this file except in compliance with the License.
+ ** You may obtain a copy of the License at:
+ **
+ ** http://www.apache.org/licenses/LICENSE-2.0
+ **
+ ** Unless required by applicable law or agreed to in writing, software
+ ** distributed under the License is distributed on an "AS IS" BASIS,
+ ** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+ ** either express or implied. See the License for the specific language
+ ** governing permissions and  limitations under the License.
+ **
+ */
+
+#include "../include/eco_common.h"
+#include "../include/eco_encode_matrix.h"
+#include <jerasure/reed_sol.h>
+#include <jerasure/cauchy.h>
+
+#define ENCODE_MATRIX_MAX_BLOCKS (W * W)
+#define ENCODE_MATRIX_SLOTS (2 * ENCODE_MATRIX_MAX_BLOCKS * ENCODE_MATRIX_MAX_BLOCKS)
+
+static pthread_mutex_t matrix_generator_mutex = PTHREAD_MUTEX_INITIALIZER; // Jerasure's encode matrix allocation is not thread safe.
+
+// Published matrices, written once by compare and swap and read without locks.
+static struct eco_encode_matrix *encode_matrices[ENCODE_MATRIX_SLOTS];
+
+static inline struct eco_encode_matrix **util_eco_encode_matrix_slot(int k, int m, int use_vandermonde_matrix)
+{
+	return &encode_matrices[((!!use_vandermonde_matrix * ENCODE_MATRIX_MAX_BLOCKS) + k) * ENCODE_MATRIX_MAX_BLOCKS + m];
+}
+
+/**
+ * Generate encode matrix using Jerasure library.
+ *
+ * @param k                         Number of data blocks.
+ * @param m                         Number of code blocks.
+ * @param use_vandermonde_matrix    Boolean variable which determine the type of the encode matrix:
+ *                                  0 for Cauchy coding matrix else for Vandermonde coding matrix -
+ * @return                          Pointer to a new encode matrix if successful, else NULL.
+ */
+static struct eco_encode_matrix *util_eco_encode_matrix_generate(int k, int m, int use_vandermonde_matrix)
+{
+	dbg_log("encode_matrix_generate: k = %d, m = %d, use_vandermonde_matrix = %d\n", k, m, use_vandermonde_matrix);
+
+	struct eco_encode_matrix *res;
+	int *rs_mat;
+	int i,j;
+
+	res = calloc(1, sizeof(*res) + k * m);
+	if (!res) {
+		err_log("encode_matrix_generate: failed to allocate encode matrix\n");
+		return NULL;
+	}
+
+	pthread_mutex_lock(&matrix_generator_mutex);
+	rs_mat = use_vandermonde_matrix ? reed_sol_vandermonde_coding_matrix(k, m, W) : cauchy_original_coding_matrix(k, m, W);
+	pthread_mutex_unlock(&matrix_generator_mutex);
+
+	if (!rs_mat) {
+		err_log("encode_matrix_generate: failed to allocate reed sol matrix\n");
+		free(res);
+		return NULL;
+	}
+
+	for (i = 0; i < m; i++)
+		for (j = 0; j < k; j++)
+			res->matrix[j*m+i] = (uint8_t)rs_mat[i*k+j];
+
+	free(rs_mat);
+
+	res->k = k;
+	res->m = m;
+	res->use_vandermonde_matrix = !!use_vandermonde_matrix;
+
+	dbg_log("encode_matrix_generate: completed successfully - k = %d, m = %d, use_vandermonde_matrix = %d\n", k, m, use_vandermonde_matrix);
+
+	return res;
+}
+
+struct eco_encode_matrix *eco_encode_matrix_get(int k, int m, int use_vandermonde_matrix)
+{
+	struct eco_encode_matrix **slot, *encode_matrix, *expected = NULL;
+
+	if (k <= 0 || m <= 0 || k + m > ENCODE_MATRIX_MAX_BLOCKS) {
+		err_log("eco_encode_matrix_get: Got invalid parameters - k = %d, m = %d\n", k, m);
+		return NULL;
+	}
+
+	slot = util_eco_encode_matrix_slot(k, m, use_vandermonde_matrix);
+
+	encode_matrix = __atomic_load_n(slot, __ATOMIC_ACQUIRE);
+	if (!encode_matrix) {
+		encode_matrix = util_eco_encode_matrix_generate(k, m, use_vandermonde_matrix);
+		if (!encode_matrix) {
+			return NULL;
+		}
+
+		// another thread may have published the same layout meanwhile - use the first one
+		if (!__atomic_compare_exchange_n(slot, &expected, encode_matrix, 0, __ATOMIC_ACQ_REL, __ATOMIC_ACQUIRE)) {
+			free(encode_matrix);
+			encode_matrix = expected;
+		}
+	}
+
+	__atomic_add_fetch(&encode_matrix->ref_count, 1, __ATOMIC_RELAXED);
+
+	return encode_matrix;
+}
+
+void eco_encode_matrix_put(struct eco_encode_matrix *encode_matrix)
+{
+	if (encode_matrix) {
+		__atomic_sub_fetch(&encode_matrix->ref_count, 1, __ATOMIC_RELAXED);
+	}
+}
+
+/**
+ * Free the cached matrices when the library is unloaded.
+ */
+static void __attribute__((destructor)) util_eco_encode_matrix_cleanup(void)
+{
+	int i;
+
+	for (i = 0; i < ENCODE_MATRIX_SLOTS; i++) {
+		if (encode_matrices[i] && !encode_matrices[i]->ref_count) {
+			free(encode_matrices[i]);
+			encode_matrices[i] = NULL;
+		}
+	}
+}
@@ -17,42 +17,126 @@
 
 #include "../include/eco_encoder.h"
 
-static inline void util_mlx_eco_encoder_prepare_remainder_data(struct eco_context *eco_context, uint8_t **data, uint8_t **coding, int remainder, int aligned_block_size)
+static void util_mlx_eco_encoder_comp_done(struct ibv_exp_ec_comp *comp)
 {
-	int i;
-	eco_context->coding = coding;
+	struct eco_slot *slot = mlx_eco_comp_slot(comp);
 
-	for (i = 0 ; i < eco_context->attr.k ; i++) {
-		memcpy((void *)eco_context->remainder_mem.data_blocks[i].addr, data[i] + aligned_block_size, remainder);
-	}
+	slot->hw_done_ns = mlx_eco_time_ns();
+
+	mlx_eco_copy_bounced(slot, NULL);
+	mlx_eco_op_complete(slot->eco_ctx, slot, (int)comp->status);
 }
 
-static void util_mlx_eco_encoder_comp_done(struct ibv_exp_ec_comp *comp)
+/**
+ * Encode the first hw_len bytes of every block on the HCA while the CPU encodes the rest of it.
+ * Without hybrid execution hw_len is the 64 bytes aligned part of the block, so the CPU only encodes the
+ * remainder from 64 bytes - directly on the user buffers while the aligned part is in flight.
+ * The operation must have been started with one part for the HCA (if hw_len is not 0) and one part for the CPU.
+ *
+ * @param eco_context                Pointer to an initialized EC context.
+ * @param slot                       Slot of the operation, with registered buffers.
+ * @param data                       Array of pointers to source input buffers.
+ * @param coding                     Array of pointers to coded output buffers.
+ * @param block_size                 Length of each block of data.
+ * @param hw_len                     64 bytes aligned length of the head of each block encoded by the HCA.
+ * @param hybrid                     Boolean variable which determine if the hybrid CPU threads share the software part.
+ * @param wait                       Boolean variable which determine if the HCA completion should be waited for.
+ * @return                           0 successful, other fail.
+ */
+static int util_mlx_eco_encoder_encode_split(struct eco_context *eco_context, struct eco_slot *slot, uint8_t **data, uint8_t **coding, int block_size, int hw_len, int hybrid, int wait)
 {
-	struct eco_coder_comp *coder_comp = (void *)comp - offsetof(struct eco_coder_comp, comp);
-	struct eco_context *eco_context = ((struct eco_encoder *)coder_comp->eco_coder)->eco_ctx;
-	int i, remainder = eco_context->block_size % 64, aligned_block_size = eco_context->block_size - remainder;
+	struct eco_sw_job job;
+	uint64_t hw_start = 0, sw_ns = 0;
+	int err;
 
-	if (coder_comp->is_remainder_comp) {
-		for (i = 0 ; i < eco_context->attr.m ; i++) {
-			memcpy(eco_context->coding[i] + aligned_block_size, (void *)eco_context->remainder_mem.code_blocks[i].addr, remainder);
+	if (hw_len) {
+		// The sges describe the whole aligned blocks, the HCA calculates only the first hw_len bytes of them
+		slot->mem.block_size = hw_len;
+		hw_start = mlx_eco_time_ns();
+		err = ibv_exp_ec_encode_async(slot->device->calc, &slot->mem, &slot->comp.comp);
+		if (err) {
+			mlx_eco_op_abort(eco_context, slot);
+			return err;
 		}
 	}
 
-	pthread_mutex_lock(&eco_context->async_mutex);
+	if (block_size > hw_len) {
+		job.eco_ctx = eco_context;
+		job.matrix = eco_context->attr.encode_matrix;
+		job.erasures = NULL;
+		job.data = data;
+		job.coding = coding;
+		job.offset = hw_len;
+		job.len = block_size - hw_len;
+		job.num_parts = hybrid ? eco_context->hybrid.num_threads : 1;
+		sw_ns = mlx_eco_run_sw(&job);
+	}
+
+	mlx_eco_op_complete(eco_context, slot, 0);
+
+	if (!wait) {
+		return 0;
+	}
+
+	err = mlx_eco_op_wait(eco_context, slot);
+	if (err) {
+		return err;
+	}
 
-	if (!--eco_context->async_ref_count) {
-		pthread_cond_signal(&eco_context->async_cond);
+	if (hybrid) {
+		mlx_eco_hybrid_update(eco_context, hw_len, slot->hw_done_ns - hw_start, block_size - hw_len, sw_ns);
 	}
 
-	pthread_mutex_unlock(&eco_context->async_mutex);
+	return 0;
+}
+
+/**
+ * Check the encode parameters.
+ *
+ * @param eco_encoder                Pointer to an initialized EC encoder.
+ * @param data_size                  Size of data array.
+ * @param coding_size                Size of coding array.
+ * @param block_size                 Length of each block of data.
+ * @return                           0 valid, other invalid.
+ */
+static int util_mlx_eco_encoder_check_params(struct eco_encoder *eco_encoder, int data_size, int coding_size, int block_size)
+{
+	if (!eco_encoder) {
+		err_log("mlx_eco_encoder_encode: Got invalid EC encoder - cannot encode data\n");
+		return -1;
+	}
+
+	if (data_size != eco_encoder->eco_ctx->attr.k || coding_size != eco_encoder->eco_ctx->attr.m) {
+		err_log("mlx_eco_encoder_encode: Warning got different parameters then expected - got k=%d, m=%d - expected data_size=%d coding_size=%d\n", data_size, coding_size, eco_encoder->eco_ctx->attr.k, eco_encoder->eco_ctx->attr.m);
+		return -1;
+	}
+
+	if (block_size <= 0) {
+		err_log("mlx_eco_encoder_encode: Got invalid block size - %d\n", block_size);
+		return -1;
+	}
+
+	return mlx_eco_activate(eco_encoder->eco_ctx);
 }
 
 struct eco_encoder *mlx_eco_encoder_init(int k, int m, int use_vandermonde_matrix)
 {
-	dbg_log("mlx_eco_encoder_init: k = %d, m = %d, use_vandermonde_matrix = %d\n", k , m, use_vandermonde_matrix);
+	struct eco_encoder_attr attr;
+
+	memset(&attr, 0, sizeof(attr));
+	attr.k = k;
+	attr.m = m;
+	attr.use_vandermonde_matrix = use_vandermonde_matrix;
+
+	return mlx_eco_encoder_init_attr(&attr);
+}
+
+struct eco_encoder *mlx_eco_encoder_init_attr(struct eco_encoder_attr *attr)
+{
+	dbg_log("mlx_eco_encoder_init_attr: k = %d, m = %d, use_vandermonde_matrix = %d, queue_depth = %d\n", attr->k, attr->m, attr->use_vandermonde_matrix, attr->queue_depth);
 
 	struct eco_encoder *eco_encoder;
+	int k = attr->k, m = attr->m, use_vandermonde_matrix = attr->use_vandermonde_matrix;
 
 	eco_encoder = calloc(1, sizeof(*eco_encoder));
 	if (!eco_encoder) {
@@ -60,7 +144,7 @@ struct eco_encoder *mlx_eco_encoder_init(int k, int m, int use_vandermonde_matri
 		goto allocate_encoder_error;
 	}
 
-	eco_encoder->eco_ctx = mlx_eco_init(eco_encoder, k, m, use_vandermonde_matrix, util_mlx_eco_encoder_comp_done);
+	eco_encoder->eco_ctx = mlx_eco_init(eco_encoder, k, m, use_vandermonde_matrix, attr->queue_depth, &attr->device, attr->lazy, util_mlx_eco_encoder_comp_done);
 	if (!eco_encoder->eco_ctx) {
 		err_log("mlx_eco_encoder_init: Failed to initialize eco_encoder\n");
 		goto encoder_initialize_error;
@@ -83,8 +167,27 @@ int mlx_eco_encoder_register(struct eco_encoder *eco_encoder, uint8_t **data, ui
 {
 	dbg_log("mlx_eco_encoder_register: eco_encoder = %p , block_size = %d, data = %p, data_size = %d, coding = %p, coding_size = %d\n", eco_encoder, block_size , data, data_size, coding, coding_size);
 
+	struct eco_slot *slot;
 	int err;
-	err = mlx_eco_register(eco_encoder->eco_ctx, data, coding, data_size, coding_size, block_size);
+
+	if (!eco_encoder) {
+		err_log("mlx_eco_encoder_register: got null eco_encoder\n");
+		return -1;
+	}
+
+	if (mlx_eco_activate(eco_encoder->eco_ctx)) {
+		return -1;
+	}
+
+	// register into the memory layout context of the next free slot
+	slot = mlx_eco_op_begin(eco_encoder->eco_ctx, NULL, NULL, 0, 1);
+	err = mlx_eco_register(eco_encoder->eco_ctx, slot, data, coding, data_size, coding_size, block_size);
+	mlx_eco_op_abort(eco_encoder->eco_ctx, slot);
+
+	// a striped encoder may calculate with the buffers on any of its devices
+	if (!err && eco_encoder->eco_ctx->num_devices > 1) {
+		err = mlx_eco_register_devices(eco_encoder->eco_ctx, data, coding, data_size, coding_size, block_size);
+	}
 
 	dbg_log("mlx_eco_encoder_register: completed with result = %d, eco_encoder = %p , block_size = %d, data = %p, data_size = %d, coding = %p, coding_size = %d\n", err, eco_encoder, block_size , data, data_size, coding, coding_size);
 
@@ -96,65 +199,263 @@ int mlx_eco_encoder_encode(struct eco_encoder *eco_encoder, uint8_t **data, uint
 	dbg_log("mlx_eco_encoder_encode: eco_encoder = %p , block_size = %d, data = %p, data_size = %d, coding = %p, coding_size = %d\n", eco_encoder, block_size , data, data_size, coding, coding_size);
 
 	struct eco_context *eco_context;
-	int err, remainder = block_size % 64, aligned_block_size = block_size - remainder;
+	struct eco_slot *slot;
+	int err, hybrid, hw_len, aligned_block_size = block_size - (block_size % 64);
 
-	if (!eco_encoder) {
-		err_log("mlx_eco_encoder_encode: Got invalid EC encoder - cannot encode data\n");
-		return -1;
+	err = util_mlx_eco_encoder_check_params(eco_encoder, data_size, coding_size, block_size);
+	if (err) {
+		return err;
 	}
 
 	eco_context = eco_encoder->eco_ctx;
 
-	if (data_size != eco_context->attr.k || coding_size != eco_context->attr.m) {
-		err_log("mlx_eco_encoder_encode: Warning got different parameters then expected - got k=%d, m=%d - expected data_size=%d coding_size=%d\n", data_size, coding_size, eco_context->attr.k, eco_context->attr.m);
-		return -1;
+	// tiny blocks are encoded by the calling thread faster than the round trip to the HCA
+	if (mlx_eco_use_sw(eco_context, block_size)) {
+		eco_gf_encode(eco_context->attr.encode_matrix, data_size, coding_size, data, coding, 0, block_size);
+
+		dbg_log("mlx_eco_encoder_encode: completed successfully in software - eco_encoder = %p , block_size = %d, data = %p, data_size = %d, coding = %p, coding_size = %d\n", eco_encoder, block_size , data, data_size, coding, coding_size);
+
+		return 0;
 	}
 
-	err = mlx_eco_register(eco_context, data, coding, data_size, coding_size, block_size);
+	hybrid = mlx_eco_hybrid_get(eco_context, block_size);
+	hw_len = hybrid ? mlx_eco_hybrid_split(eco_context, block_size) : aligned_block_size;
+
+	// wait for a free slot if the asynchronous operations use all of them
+	slot = mlx_eco_op_begin(eco_context, NULL, NULL, hw_len ? 2 : 1, 1);
+
+	err = mlx_eco_register(eco_context, slot, data, coding, data_size, coding_size, block_size);
 	if (err) {
 		err_log("mlx_eco_encoder_encode: MR allocation failed\n");
+		mlx_eco_op_abort(eco_context, slot);
+		goto hybrid_put;
+	}
+
+	err = util_mlx_eco_encoder_encode_split(eco_context, slot, data, coding, block_size, hw_len, hybrid, 1);
+	if (err) {
+		err_log("mlx_eco_encoder_encode: Failed ibv_exp_ec_encode (%d) %m\n", err);
+		goto hybrid_put;
+	}
+
+	dbg_log("mlx_eco_encoder_encode: completed successfully - eco_encoder = %p , block_size = %d, data = %p, data_size = %d, coding = %p, coding_size = %d\n", eco_encoder, block_size , data, data_size, coding, coding_size);
+
+hybrid_put:
+	if (hybrid) {
+		mlx_eco_hybrid_put(eco_context);
+	}
+
+	return err;
+}
+
+int mlx_eco_encoder_encode_async(struct eco_encoder *eco_encoder, uint8_t **data, uint8_t **coding, int data_size, int coding_size, int block_size,
+		eco_coder_done_func done_func, void *arg)
+{
+	dbg_log("mlx_eco_encoder_encode_async: eco_encoder = %p , block_size = %d, data = %p, data_size = %d, coding = %p, coding_size = %d\n", eco_encoder, block_size , data, data_size, coding, coding_size);
+
+	struct eco_context *eco_context;
+	struct eco_slot *slot;
+	int err, hw_len = block_size - (block_size % 64);
+
+	err = util_mlx_eco_encoder_check_params(eco_encoder, data_size, coding_size, block_size);
+	if (err) {
 		return err;
 	}
 
-	pthread_mutex_lock(&eco_context->async_mutex);
+	eco_context = eco_encoder->eco_ctx;
 
-	if (remainder) {
-		util_mlx_eco_encoder_prepare_remainder_data(eco_context, data, coding, remainder, aligned_block_size);
-		err = ibv_exp_ec_encode_async(eco_context->calc, &eco_context->remainder_mem, &eco_context->remainder_comp.comp);
-		if (err) {
-			goto encode_error;
+	if (!done_func && eco_context->event_fd < 0) {
+		err_log("mlx_eco_encoder_encode_async: Got null completion callback without an event fd\n");
+		return -1;
+	}
+
+	if (mlx_eco_use_sw(eco_context, block_size)) {
+		if (done_func) {
+			eco_gf_encode(eco_context->attr.encode_matrix, data_size, coding_size, data, coding, 0, block_size);
+			done_func(arg, 0);
+			return 0;
 		}
-		eco_context->async_ref_count++;
+
+		// the completion is still reported through the event fd
+		slot = mlx_eco_op_begin_event(eco_context, arg, 1);
+		if (!slot) {
+			return -EBUSY;
+		}
+
+		eco_gf_encode(eco_context->attr.encode_matrix, data_size, coding_size, data, coding, 0, block_size);
+		mlx_eco_op_complete(eco_context, slot, 0);
+		return 0;
 	}
 
-	if (aligned_block_size) {
-		err = ibv_exp_ec_encode_async(eco_context->calc, &eco_context->alignment_mem, &eco_context->alignment_comp.comp);
+	if (done_func) {
+		slot = mlx_eco_op_begin(eco_context, done_func, arg, hw_len ? 2 : 1, 0);
+	} else {
+		slot = mlx_eco_op_begin_event(eco_context, arg, hw_len ? 2 : 1);
+	}
+	if (!slot) {
+		return -EBUSY;
+	}
+
+	err = mlx_eco_register(eco_context, slot, data, coding, data_size, coding_size, block_size);
+	if (err) {
+		// -ENOBUFS if the bounce buffers are used by other operations, the caller retries it as a full queue
+		if (err != -ENOBUFS) {
+			err_log("mlx_eco_encoder_encode_async: MR allocation failed\n");
+		}
+		mlx_eco_op_abort(eco_context, slot);
+		return err;
+	}
+
+	// the CPU part is only the remainder from 64 bytes, so hybrid execution does not apply
+	err = util_mlx_eco_encoder_encode_split(eco_context, slot, data, coding, block_size, hw_len, 0, 0);
+	if (err) {
+		err_log("mlx_eco_encoder_encode_async: Failed ibv_exp_ec_encode (%d) %m\n", err);
+		return err;
+	}
+
+	dbg_log("mlx_eco_encoder_encode_async: submitted successfully - eco_encoder = %p , block_size = %d\n", eco_encoder, block_size);
+
+	return 0;
+}
+
+int mlx_eco_encoder_encode_batch(struct eco_encoder *eco_encoder, struct eco_stripe *stripes, int num_stripes, int data_size, int coding_size, int block_size)
+{
+	dbg_log("mlx_eco_encoder_encode_batch: eco_encoder = %p , stripes = %p, num_stripes = %d, data_size = %d, coding_size = %d, block_size = %d\n", eco_encoder, stripes, num_stripes, data_size, coding_size, block_size);
+
+	struct eco_context *eco_context;
+	struct eco_batch batch;
+	struct eco_slot *slot;
+	int i, err, status, hw_len = block_size - (block_size % 64);
+
+	err = util_mlx_eco_encoder_check_params(eco_encoder, data_size, coding_size, block_size);
+	if (err) {
+		return err;
+	}
+
+	if (!stripes || num_stripes < 0) {
+		err_log("mlx_eco_encoder_encode_batch: Got invalid stripes array - %p, num_stripes = %d\n", stripes, num_stripes);
+		return -1;
+	}
+
+	eco_context = eco_encoder->eco_ctx;
+
+	if (mlx_eco_use_sw(eco_context, block_size)) {
+		for (i = 0; i < num_stripes; i++) {
+			eco_gf_encode(eco_context->attr.encode_matrix, data_size, coding_size, stripes[i].data, stripes[i].coding, 0, block_size);
+		}
+
+		return 0;
+	}
+
+	struct eco_slot *pending[eco_context->queue_depth];
+
+	memset(&batch, 0, sizeof(batch));
+	batch.slots = pending;
+
+	// the CPU encodes the remainder of a stripe while the aligned parts of the previous stripes are in flight
+	for (i = 0; i < num_stripes; i++) {
+		slot = mlx_eco_batch_begin(eco_context, &batch, hw_len ? 2 : 1);
+
+		err = mlx_eco_register(eco_context, slot, stripes[i].data, stripes[i].coding, data_size, coding_size, block_size);
 		if (err) {
-			goto encode_error;
+			err_log("mlx_eco_encoder_encode_batch: MR allocation failed for stripe %d\n", i);
+			mlx_eco_op_abort(eco_context, slot);
+			mlx_eco_batch_cancel(&batch);
+			break;
+		}
+
+		err = util_mlx_eco_encoder_encode_split(eco_context, slot, stripes[i].data, stripes[i].coding, block_size, hw_len, 0, 0);
+		if (err) {
+			err_log("mlx_eco_encoder_encode_batch: Failed ibv_exp_ec_encode of stripe %d (%d) %m\n", i, err);
+			mlx_eco_batch_cancel(&batch);
+			break;
 		}
-		eco_context->async_ref_count++;
 	}
 
-	pthread_cond_wait(&eco_context->async_cond, &eco_context->async_mutex);
-	pthread_mutex_unlock(&eco_context->async_mutex);
+	status = mlx_eco_batch_wait(eco_context, &batch);
+
+	dbg_log("mlx_eco_encoder_encode_batch: completed with result = %d, status = %d - eco_encoder = %p , num_stripes = %d\n", err, status, eco_encoder, num_stripes);
 
-	if ((err = (int)eco_context->alignment_comp.comp.status | (int)eco_context->remainder_comp.comp.status)) {
-		goto encode_error;
+	return err ? err : status;
+}
+
+int mlx_eco_encoder_wait(struct eco_encoder *eco_encoder)
+{
+	if (!eco_encoder) {
+		err_log("mlx_eco_encoder_wait: got null eco_encoder\n");
+		return -1;
 	}
 
-	dbg_log("mlx_eco_encoder_encode: completed successfully - eco_encoder = %p , block_size = %d, data = %p, data_size = %d, coding = %p, coding_size = %d\n", eco_encoder, block_size , data, data_size, coding, coding_size);
+	return mlx_eco_op_wait(eco_encoder->eco_ctx, NULL);
+}
 
-	return 0;
+int mlx_eco_encoder_get_event_fd(struct eco_encoder *eco_encoder)
+{
+	if (!eco_encoder) {
+		err_log("mlx_eco_encoder_get_event_fd: got null eco_encoder\n");
+		return -1;
+	}
 
-encode_error:
+	return mlx_eco_get_event_fd(eco_encoder->eco_ctx);
+}
 
-	if (eco_context->async_ref_count) {
-		pthread_cond_wait(&eco_context->async_cond, &eco_context->async_mutex);
+int mlx_eco_encoder_poll_completions(struct eco_encoder *eco_encoder, struct eco_completion *completions, int max_completions)
+{
+	if (!eco_encoder || !completions || max_completions < 0) {
+		err_log("mlx_eco_encoder_poll_completions: got invalid parameters - eco_encoder = %p, completions = %p, max_completions = %d\n", eco_encoder, completions, max_completions);
+		return -1;
 	}
-	pthread_mutex_unlock(&eco_context->async_mutex);
 
-	err_log("mlx_eco_encoder_encode: Failed ibv_exp_ec_encode (%d) %m\n", err);
-	return err;
+	return mlx_eco_poll_completions(eco_encoder->eco_ctx, completions, max_completions);
+}
+
+int mlx_eco_encoder_set_hybrid(struct eco_encoder *eco_encoder, int enable, int num_threads, int min_block_size)
+{
+	if (!eco_encoder) {
+		err_log("mlx_eco_encoder_set_hybrid: got null eco_encoder\n");
+		return -1;
+	}
+
+	return mlx_eco_set_hybrid(eco_encoder->eco_ctx, enable, num_threads, min_block_size);
+}
+
+int mlx_eco_encoder_set_sw_threshold(struct eco_encoder *eco_encoder, int sw_threshold)
+{
+	if (!eco_encoder) {
+		err_log("mlx_eco_encoder_set_sw_threshold: got null eco_encoder\n");
+		return -1;
+	}
+
+	return mlx_eco_set_sw_threshold(eco_encoder->eco_ctx, sw_threshold);
+}
+
+int mlx_eco_encoder_set_wait_mode(struct eco_encoder *eco_encoder, enum eco_wait_mode mode)
+{
+	if (!eco_encoder) {
+		err_log("mlx_eco_encoder_set_wait_mode: got null eco_encoder\n");
+		return -1;
+	}
+
+	return mlx_eco_set_wait_mode(eco_encoder->eco_ctx, mode);
+}
+
+int mlx_eco_encoder_prewarm(struct eco_encoder *eco_encoder)
+{
+	if (!eco_encoder) {
+		err_log("mlx_eco_encoder_prewarm: got null eco_encoder\n");
+		return -1;
+	}
+
+	return mlx_eco_prewarm(eco_encoder->eco_ctx);
+}
+
+struct eco_stripe_buffers *mlx_eco_encoder_alloc_stripe_buffers(struct eco_encoder *eco_encoder, int k, int m, int block_size)
+{
+	if (!eco_encoder) {
+		err_log("mlx_eco_encoder_alloc_stripe_buffers: got null eco_encoder\n");
+		return NULL;
+	}
+
+	return mlx_eco_alloc_stripe_buffers(eco_encoder->eco_ctx, k, m, block_size);
 }
 
 int mlx_eco_encoder_release(struct eco_encoder *eco_encoder)
@@ -0,0 +1,595 @@
+/*
+ ** Copyright (C) 2016 Mellanox Technologies
+ **
+ ** Licensed under the Apache License, Version 2.0 (the "License");
+ ** you may not use this file except in compliance with the License.
+ ** You may obtain a copy of the License at:
+ **
+ ** http://www.apache.org/licenses/LICENSE-2.0
+ **
+ ** Unless required by applicable law or agreed to in writing, software
+ ** distributed under the License is distributed on an "AS IS" BASIS,
+ ** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+ ** either express or implied. See the License for the specific language
+ ** governing permissions and  limitations under the License.
+ **
+ */
+
+#include "../include/eco_common.h"
+#include <immintrin.h>
+
+#define GF_W4_POLY 0x13
+#define GF_MAX_BLOCKS 16
+#define GF_OUTPUT_GROUP 4
+
+typedef void (*eco_gf_kernel)(const uint8_t *matrix, int num_in, int num_out, uint8_t **in, uint8_t **out, size_t offset, size_t len);
+
+static uint8_t gf_w4_mul_table[16][16];
+static uint8_t gf_w4_inv_table[16];
+static uint8_t gf_w4_byte_table[16][256];
+static uint8_t gf_w4_lo_table[16][64] __attribute__((aligned(64)));
+static uint8_t gf_w4_hi_table[16][64] __attribute__((aligned(64)));
+static uint64_t gf_w4_affine_table[16];
+
+static const char *gf_tier_names[ECO_GF_TIER_MAX] = {"scalar", "ssse3", "avx2", "avx512", "gfni"};
+
+static eco_gf_kernel gf_kernels[ECO_GF_TIER_MAX];
+static enum eco_gf_tier gf_best_tier;
+static enum eco_gf_tier gf_tier;
+static eco_gf_kernel gf_kernel;
+
+/**
+ * Multiply two GF(2^4) symbols using the HCA field polynomial x^4 + x + 1.
+ *
+ * @param x                         GF(2^4) symbol.
+ * @param y                         GF(2^4) symbol.
+ * @return                          The product.
+ */
+static uint8_t util_eco_gf_w4_mul(uint8_t x, uint8_t y)
+{
+	uint8_t r = 0;
+
+	x &= 0xf;
+	y &= 0xf;
+
+	while (y) {
+		if (y & 1)
+			r ^= x;
+		y >>= 1;
+		x <<= 1;
+		if (x & 0x10)
+			x ^= GF_W4_POLY;
+	}
+
+	return r;
+}
+
+uint8_t eco_gf_mul(uint8_t x, uint8_t y)
+{
+	return gf_w4_byte_table[y & 0xf][x];
+}
+
+/**
+ * Calculate a byte range using a byte-at-a-time lookup table per coefficient.
+ */
+static void util_eco_gf_mult_blocks_scalar(const uint8_t *matrix, int num_in, int num_out, uint8_t **in, uint8_t **out, size_t offset, size_t len)
+{
+	const uint8_t *table, *src;
+	uint8_t *dst;
+	size_t p;
+	int i, j;
+
+	for (i = 0; i < num_out; i++) {
+		dst = out[i] + offset;
+
+		table = gf_w4_byte_table[matrix[i] & 0xf];
+		src = in[0] + offset;
+		for (p = 0; p < len; p++)
+			dst[p] = table[src[p]];
+
+		for (j = 1; j < num_in; j++) {
+			table = gf_w4_byte_table[matrix[j * num_out + i] & 0xf];
+			src = in[j] + offset;
+			for (p = 0; p < len; p++)
+				dst[p] ^= table[src[p]];
+		}
+	}
+}
+
+/**
+ * Calculate up to GF_OUTPUT_GROUP outputs at once with 16 bytes nibble-shuffle tables.
+ * Every input vector is loaded once and multiplied into all the accumulators of the group.
+ *
+ * @return                          The number of bytes calculated (a multiple of 16).
+ */
+static inline __attribute__((always_inline, target("ssse3")))
+size_t util_eco_gf_ssse3_group(const uint8_t *matrix, int num_in, int num_out, uint8_t **in, uint8_t **out, size_t offset, size_t len, int first, const int group)
+{
+	const __m128i mask = _mm_set1_epi8(0x0f);
+	const __m128i *lo_tables[GF_MAX_BLOCKS][GF_OUTPUT_GROUP], *hi_tables[GF_MAX_BLOCKS][GF_OUTPUT_GROUP];
+	__m128i acc[GF_OUTPUT_GROUP], v, lo, hi;
+	size_t p, done = len & ~(size_t)15;
+	int j, t;
+
+	for (j = 0; j < num_in; j++) {
+		for (t = 0; t < group; t++) {
+			lo_tables[j][t] = (const __m128i *)gf_w4_lo_table[matrix[j * num_out + first + t] & 0xf];
+			hi_tables[j][t] = (const __m128i *)gf_w4_hi_table[matrix[j * num_out + first + t] & 0xf];
+		}
+	}
+
+	for (p = offset; p < offset + done; p += 16) {
+		for (t = 0; t < group; t++)
+			acc[t] = _mm_setzero_si128();
+
+		for (j = 0; j < num_in; j++) {
+			v = _mm_loadu_si128((const __m128i *)(in[j] + p));
+			lo = _mm_and_si128(v, mask);
+			hi = _mm_and_si128(_mm_srli_epi64(v, 4), mask);
+			for (t = 0; t < group; t++) {
+				acc[t] = _mm_xor_si128(acc[t], _mm_shuffle_epi8(_mm_load_si128(lo_tables[j][t]), lo));
+				acc[t] = _mm_xor_si128(acc[t], _mm_shuffle_epi8(_mm_load_si128(hi_tables[j][t]), hi));
+			}
+		}
+
+		for (t = 0; t < group; t++)
+			_mm_storeu_si128((__m128i *)(out[first + t] + p), acc[t]);
+	}
+
+	return done;
+}
+
+static __attribute__((target("ssse3")))
+void util_eco_gf_mult_blocks_ssse3(const uint8_t *matrix, int num_in, int num_out, uint8_t **in, uint8_t **out, size_t offset, size_t len)
+{
+	size_t done = 0;
+	int first;
+
+	for (first = 0; first < num_out; first += GF_OUTPUT_GROUP) {
+		switch (num_out - first) {
+		case 1:
+			done = util_eco_gf_ssse3_group(matrix, num_in, num_out, in, out, offset, len, first, 1);
+			break;
+		case 2:
+			done = util_eco_gf_ssse3_group(matrix, num_in, num_out, in, out, offset, len, first, 2);
+			break;
+		case 3:
+			done = util_eco_gf_ssse3_group(matrix, num_in, num_out, in, out, offset, len, first, 3);
+			break;
+		default:
+			done = util_eco_gf_ssse3_group(matrix, num_in, num_out, in, out, offset, len, first, 4);
+			break;
+		}
+	}
+
+	if (done < len)
+		util_eco_gf_mult_blocks_scalar(matrix, num_in, num_out, in, out, offset + done, len - done);
+}
+
+/**
+ * AVX2 version of util_eco_gf_ssse3_group() working on 32 bytes vectors.
+ *
+ * @return                          The number of bytes calculated (a multiple of 32).
+ */
+static inline __attribute__((always_inline, target("avx2")))
+size_t util_eco_gf_avx2_group(const uint8_t *matrix, int num_in, int num_out, uint8_t **in, uint8_t **out, size_t offset, size_t len, int first, const int group)
+{
+	const __m256i mask = _mm256_set1_epi8(0x0f);
+	const __m256i *lo_tables[GF_MAX_BLOCKS][GF_OUTPUT_GROUP], *hi_tables[GF_MAX_BLOCKS][GF_OUTPUT_GROUP];
+	__m256i acc[GF_OUTPUT_GROUP], v, lo, hi;
+	size_t p, done = len & ~(size_t)31;
+	int j, t;
+
+	for (j = 0; j < num_in; j++) {
+		for (t = 0; t < group; t++) {
+			lo_tables[j][t] = (const __m256i *)gf_w4_lo_table[matrix[j * num_out + first + t] & 0xf];
+			hi_tables[j][t] = (const __m256i *)gf_w4_hi_table[matrix[j * num_out + first + t] & 0xf];
+		}
+	}
+
+	for (p = offset; p < offset + done; p += 32) {
+		for (t = 0; t < group; t++)
+			acc[t] = _mm256_setzero_si256();
+
+		for (j = 0; j < num_in; j++) {
+			v = _mm256_loadu_si256((const __m256i *)(in[j] + p));
+			lo = _mm256_and_si256(v, mask);
+			hi = _mm256_and_si256(_mm256_srli_epi64(v, 4), mask);
+			for (t = 0; t < group; t++) {
+				acc[t] = _mm256_xor_si256(acc[t], _mm256_shuffle_epi8(_mm256_load_si256(lo_tables[j][t]), lo));
+				acc[t] = _mm256_xor_si256(acc[t], _mm256_shuffle_epi8(_mm256_load_si256(hi_tables[j][t]), hi));
+			}
+		}
+
+		for (t = 0; t < group; t++)
+			_mm256_storeu_si256((__m256i *)(out[first + t] + p), acc[t]);
+	}
+
+	return done;
+}
+
+static __attribute__((target("avx2")))
+void util_eco_gf_mult_blocks_avx2(const uint8_t *matrix, int num_in, int num_out, uint8_t **in, uint8_t **out, size_t offset, size_t len)
+{
+	size_t done = 0;
+	int first;
+
+	for (first = 0; first < num_out; first += GF_OUTPUT_GROUP) {
+		switch (num_out - first) {
+		case 1:
+			done = util_eco_gf_avx2_group(matrix, num_in, num_out, in, out, offset, len, first, 1);
+			break;
+		case 2:
+			done = util_eco_gf_avx2_group(matrix, num_in, num_out, in, out, offset, len, first, 2);
+			break;
+		case 3:
+			done = util_eco_gf_avx2_group(matrix, num_in, num_out, in, out, offset, len, first, 3);
+			break;
+		default:
+			done = util_eco_gf_avx2_group(matrix, num_in, num_out, in, out, offset, len, first, 4);
+			break;
+		}
+	}
+
+	if (done < len)
+		util_eco_gf_mult_blocks_scalar(matrix, num_in, num_out, in, out, offset + done, len - done);
+}
+
+/**
+ * AVX-512BW version of util_eco_gf_ssse3_group() working on 64 bytes vectors.
+ * The last partial vector is calculated with masked loads and stores, so the whole range is always done.
+ *
+ * @return                          The number of bytes calculated.
+ */
+static inline __attribute__((always_inline, target("avx512f,avx512bw")))
+size_t util_eco_gf_avx512_group(const uint8_t *matrix, int num_in, int num_out, uint8_t **in, uint8_t **out, size_t offset, size_t len, int first, const int group)
+{
+	const __m512i mask = _mm512_set1_epi8(0x0f);
+	const __m512i *lo_tables[GF_MAX_BLOCKS][GF_OUTPUT_GROUP], *hi_tables[GF_MAX_BLOCKS][GF_OUTPUT_GROUP];
+	__m512i acc[GF_OUTPUT_GROUP], v, lo, hi;
+	__mmask64 bytes_mask;
+	size_t p;
+	int j, t;
+
+	for (j = 0; j < num_in; j++) {
+		for (t = 0; t < group; t++) {
+			lo_tables[j][t] = (const __m512i *)gf_w4_lo_table[matrix[j * num_out + first + t] & 0xf];
+			hi_tables[j][t] = (const __m512i *)gf_w4_hi_table[matrix[j * num_out + first + t] & 0xf];
+		}
+	}
+
+	for (p = offset; p < offset + len; p += 64) {
+		bytes_mask = offset + len - p >= 64 ? ~0ULL : (1ULL << (offset + len - p)) - 1;
+
+		for (t = 0; t < group; t++)
+			acc[t] = _mm512_setzero_si512();
+
+		for (j = 0; j < num_in; j++) {
+			v = _mm512_maskz_loadu_epi8(bytes_mask, in[j] + p);
+			lo = _mm512_and_si512(v, mask);
+			hi = _mm512_and_si512(_mm512_srli_epi64(v, 4), mask);
+			for (t = 0; t < group; t++) {
+				acc[t] = _mm512_xor_si512(acc[t], _mm512_shuffle_epi8(_mm512_load_si512(lo_tables[j][t]), lo));
+				acc[t] = _mm512_xor_si512(acc[t], _mm512_shuffle_epi8(_mm512_load_si512(hi_tables[j][t]), hi));
+			}
+		}
+
+		for (t = 0; t < group; t++)
+			_mm512_mask_storeu_epi8(out[first + t] + p, bytes_mask, acc[t]);
+	}
+
+	return len;
+}
+
+static __attribute__((target("avx512f,avx512bw")))
+void util_eco_gf_mult_blocks_avx512(const uint8_t *matrix, int num_in, int num_out, uint8_t **in, uint8_t **out, size_t offset, size_t len)
+{
+	int first;
+
+	for (first = 0; first < num_out; first += GF_OUTPUT_GROUP) {
+		switch (num_out - first) {
+		case 1:
+			util_eco_gf_avx512_group(matrix, num_in, num_out, in, out, offset, len, first, 1);
+			break;
+		case 2:
+			util_eco_gf_avx512_group(matrix, num_in, num_out, in, out, offset, len, first, 2);
+			break;
+		case 3:
+			util_eco_gf_avx512_group(matrix, num_in, num_out, in, out, offset, len, first, 3);
+			break;
+		default:
+			util_eco_gf_avx512_group(matrix, num_in, num_out, in, out, offset, len, first, 4);
+			break;
+		}
+	}
+}
+
+/**
+ * AVX-512 + GFNI version of util_eco_gf_avx512_group().
+ * Multiplying both nibbles of a byte by a constant is linear over GF(2), so each coefficient is a single
+ * 8x8 bit matrix and the whole multiplication is one GF2P8AFFINEQB instruction.
+ *
+ * @return                          The number of bytes calculated.
+ */
+static inline __attribute__((always_inline, target("avx512f,avx512bw,gfni")))
+size_t util_eco_gf_gfni_group(const uint8_t *matrix, int num_in, int num_out, uint8_t **in, uint8_t **out, size_t offset, size_t len, int first, const int group)
+{
+	const uint64_t *affine[GF_MAX_BLOCKS][GF_OUTPUT_GROUP];
+	__m512i acc[GF_OUTPUT_GROUP], v;
+	__mmask64 bytes_mask;
+	size_t p;
+	int j, t;
+
+	for (j = 0; j < num_in; j++)
+		for (t = 0; t < group; t++)
+			affine[j][t] = &gf_w4_affine_table[matrix[j * num_out + first + t] & 0xf];
+
+	for (p = offset; p < offset + len; p += 64) {
+		bytes_mask = offset + len - p >= 64 ? ~0ULL : (1ULL << (offset + len - p)) - 1;
+
+		for (t = 0; t < group; t++)
+			acc[t] = _mm512_setzero_si512();
+
+		for (j = 0; j < num_in; j++) {
+			v = _mm512_maskz_loadu_epi8(bytes_mask, in[j] + p);
+			for (t = 0; t < group; t++)
+				acc[t] = _mm512_xor_si512(acc[t], _mm512_gf2p8affine_epi64_epi8(v, _mm512_set1_epi64(*affine[j][t]), 0));
+		}
+
+		for (t = 0; t < group; t++)
+			_mm512_mask_storeu_epi8(out[first + t] + p, bytes_mask, acc[t]);
+	}
+
+	return len;
+}
+
+static __attribute__((target("avx512f,avx512bw,gfni")))
+void util_eco_gf_mult_blocks_gfni(const uint8_t *matrix, int num_in, int num_out, uint8_t **in, uint8_t **out, size_t offset, size_t len)
+{
+	int first;
+
+	for (first = 0; first < num_out; first += GF_OUTPUT_GROUP) {
+		switch (num_out - first) {
+		case 1:
+			util_eco_gf_gfni_group(matrix, num_in, num_out, in, out, offset, len, first, 1);
+			break;
+		case 2:
+			util_eco_gf_gfni_group(matrix, num_in, num_out, in, out, offset, len, first, 2);
+			break;
+		case 3:
+			util_eco_gf_gfni_group(matrix, num_in, num_out, in, out, offset, len, first, 3);
+			break;
+		default:
+			util_eco_gf_gfni_group(matrix, num_in, num_out, in, out, offset, len, first, 4);
+			break;
+		}
+	}
+}
+
+/**
+ * Build the GF2P8AFFINEQB bit matrix of a coefficient.
+ * Row (7 - i) of the matrix selects the input bits which contribute to output bit i.
+ *
+ * @param c                         GF(2^4) coefficient.
+ * @return                          The 8x8 bit matrix.
+ */
+static uint64_t util_eco_gf_affine_matrix(uint8_t c)
+{
+	uint64_t affine = 0;
+	uint8_t row;
+	int i, j;
+
+	for (i = 0; i < 8; i++) {
+		row = 0;
+		for (j = 0; j < 8; j++)
+			if (gf_w4_byte_table[c][1 << j] & (1 << i))
+				row |= 1 << j;
+		affine |= (uint64_t)row << (8 * (7 - i));
+	}
+
+	return affine;
+}
+
+/**
+ * Build the multiplication tables, probe the CPU features and bind the widest supported kernel.
+ * The MLX_ECO_GF_TIER environment variable may force a lower tier (scalar, ssse3, avx2, avx512 or gfni).
+ * Called once when the library is loaded.
+ */
+static void __attribute__((constructor)) util_eco_gf_init(void)
+{
+	const char *forced_tier;
+	int c, x;
+
+	for (c = 0; c < 16; c++) {
+		for (x = 0; x < 16; x++) {
+			gf_w4_mul_table[c][x] = util_eco_gf_w4_mul(c, x);
+			if (gf_w4_mul_table[c][x] == 1)
+				gf_w4_inv_table[c] = x;
+		}
+
+		for (x = 0; x < 256; x++)
+			gf_w4_byte_table[c][x] = (util_eco_gf_w4_mul(x >> 4, c) << 4) | util_eco_gf_w4_mul(x & 0xf, c);
+
+		for (x = 0; x < 64; x++) {
+			gf_w4_lo_table[c][x] = util_eco_gf_w4_mul(x & 0xf, c);
+			gf_w4_hi_table[c][x] = util_eco_gf_w4_mul(x & 0xf, c) << 4;
+		}
+
+		gf_w4_affine_table[c] = util_eco_gf_affine_matrix(c);
+	}
+
+	__builtin_cpu_init();
+
+	gf_kernels[ECO_GF_TIER_SCALAR] = util_eco_gf_mult_blocks_scalar;
+	gf_best_tier = ECO_GF_TIER_SCALAR;
+
+	if (__builtin_cpu_supports("ssse3")) {
+		gf_kernels[ECO_GF_TIER_SSSE3] = util_eco_gf_mult_blocks_ssse3;
+		gf_best_tier = ECO_GF_TIER_SSSE3;
+	}
+
+	if (__builtin_cpu_supports("avx2")) {
+		gf_kernels[ECO_GF_TIER_AVX2] = util_eco_gf_mult_blocks_avx2;
+		gf_best_tier = ECO_GF_TIER_AVX2;
+	}
+
+	if (__builtin_cpu_supports("avx512f") && __builtin_cpu_supports("avx512bw")) {
+		gf_kernels[ECO_GF_TIER_AVX512] = util_eco_gf_mult_blocks_avx512;
+		gf_best_tier = ECO_GF_TIER_AVX512;
+
+		if (__builtin_cpu_supports("gfni")) {
+			gf_kernels[ECO_GF_TIER_GFNI] = util_eco_gf_mult_blocks_gfni;
+			gf_best_tier = ECO_GF_TIER_GFNI;
+		}
+	}
+
+	gf_tier = gf_best_tier;
+	gf_kernel = gf_kernels[gf_tier];
+
+	forced_tier = getenv("MLX_ECO_GF_TIER");
+	if (forced_tier) {
+		for (c = 0; c < ECO_GF_TIER_MAX; c++)
+			if (!strcmp(forced_tier, gf_tier_names[c]))
+				break;
+
+		if (c == ECO_GF_TIER_MAX || eco_gf_set_tier(c))
+			err_log("eco_gf: MLX_ECO_GF_TIER=%s is not supported - using %s\n", forced_tier, gf_tier_names[gf_tier]);
+	}
+
+	dbg_log("eco_gf: using %s kernels\n", gf_tier_names[gf_tier]);
+}
+
+enum eco_gf_tier eco_gf_get_tier(void)
+{
+	return gf_tier;
+}
+
+int eco_gf_set_tier(enum eco_gf_tier tier)
+{
+	if (tier >= ECO_GF_TIER_MAX || !gf_kernels[tier])
+		return -1;
+
+	gf_tier = tier;
+	gf_kernel = gf_kernels[tier];
+
+	return 0;
+}
+
+const char *eco_gf_tier_name(enum eco_gf_tier tier)
+{
+	return tier < ECO_GF_TIER_MAX ? gf_tier_names[tier] : "unknown";
+}
+
+void eco_gf_mult_blocks(const uint8_t *matrix, int num_in, int num_out, uint8_t **in, uint8_t **out, size_t offset, size_t len)
+{
+	if (!len || !num_out)
+		return;
+
+	gf_kernel(matrix, num_in, num_out, in, out, offset, len);
+}
+
+void eco_gf_encode(const uint8_t *encode_matrix, int k, int m, uint8_t **data, uint8_t **coding, size_t offset, size_t len)
+{
+	eco_gf_mult_blocks(encode_matrix, k, m, data, coding, offset, len);
+}
+
+int eco_gf_decode(const uint8_t *decode_matrix, int k, int m, const uint8_t *erasures, uint8_t **data, uint8_t **coding, size_t offset, size_t len)
+{
+	uint8_t *in[GF_MAX_BLOCKS], *out[GF_MAX_BLOCKS];
+	int i, num_in = 0, num_out = 0;
+
+	// The decode matrix is built from the first k surviving blocks, the same ones the HCA uses.
+	for (i = 0; i < k + m; i++) {
+		uint8_t *block = i < k ? data[i] : coding[i - k];
+
+		if (erasures[i])
+			out[num_out++] = block;
+		else if (num_in < k)
+			in[num_in++] = block;
+	}
+
+	if (num_in < k)
+		return -1;
+
+	eco_gf_mult_blocks(decode_matrix, k, num_out, in, out, offset, len);
+
+	return 0;
+}
+
+int eco_gf_make_decode_matrix(const uint8_t *encode_matrix, int k, int m, const uint8_t *erasures, uint8_t *decode_matrix)
+{
+	uint8_t a[GF_MAX_BLOCKS][GF_MAX_BLOCKS], inv[GF_MAX_BLOCKS][GF_MAX_BLOCKS], tmp, c;
+	int i, j, r, p, l = 0, num_in = 0, num_out = 0;
+
+	memset(a, 0, sizeof(a));
+	memset(inv, 0, sizeof(inv));
+
+	// Generator rows of the first k surviving blocks: identity rows for data blocks, encode matrix columns for code blocks.
+	for (i = 0; i < k + m && num_in < k; i++) {
+		if (erasures[i])
+			continue;
+
+		for (j = 0; j < k; j++)
+			a[num_in][j] = i < k ? (i == j) : encode_matrix[j * m + i - k];
+
+		inv[num_in][num_in] = 1;
+		num_in++;
+	}
+
+	if (num_in < k)
+		return -1;
+
+	// Gauss-Jordan elimination of a, applying the same row operations to inv.
+	for (j = 0; j < k; j++) {
+		for (p = j; p < k && !a[p][j]; p++);
+		if (p == k)
+			return -1;
+
+		if (p != j) {
+			for (r = 0; r < k; r++) {
+				tmp = a[p][r]; a[p][r] = a[j][r]; a[j][r] = tmp;
+				tmp = inv[p][r]; inv[p][r] = inv[j][r]; inv[j][r] = tmp;
+			}
+		}
+
+		c = gf_w4_inv_table[a[j][j]];
+		for (r = 0; r < k; r++) {
+			a[j][r] = gf_w4_mul_table[c][a[j][r]];
+			inv[j][r] = gf_w4_mul_table[c][inv[j][r]];
+		}
+
+		for (p = 0; p < k; p++) {
+			c = a[p][j];
+			if (p == j || !c)
+				continue;
+
+			for (r = 0; r < k; r++) {
+				a[p][r] ^= gf_w4_mul_table[c][a[j][r]];
+				inv[p][r] ^= gf_w4_mul_table[c][inv[j][r]];
+			}
+		}
+	}
+
+	for (i = 0; i < k + m; i++)
+		if (erasures[i])
+			num_out++;
+
+	// Row i of inv recovers data block i from the survivors, a code block is its encode matrix column applied to those rows.
+	for (i = 0; i < k + m; i++) {
+		if (!erasures[i])
+			continue;
+
+		for (r = 0; r < k; r++) {
+			if (i < k) {
+				c = inv[i][r];
+			} else {
+				for (j = 0, c = 0; j < k; j++)
+					c ^= gf_w4_mul_table[encode_matrix[j * m + i - k]][inv[j][r]];
+			}
+			decode_matrix[r * num_out + l] = c;
+		}
+		l++;
+	}
+
+	return 0;
+}
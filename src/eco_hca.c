@@ -0,0 +1,1014 @@
+/*
+ ** Copyright (C) 2016 Mellanox Technologies
+ **
+ ** Licensed under the Apache License, Version 2.0 (the "License");
+ ** you may not use this file except in compliance with the License.
+ ** You may obtain a copy of the License at:
+ **
+ ** http://www.apache.org/licenses/LICENSE-2.0
+ **
+ ** Unless required by applicable law or agreed to in writing, software
+ ** distributed under the License is distributed on an "AS IS" BASIS,
+ ** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+ ** either express or implied. See the License for the specific language
+ ** governing permissions and  limitations under the License.
+ **
+ */
+
+#include "../include/eco_common.h"
+#include "../include/eco_hca.h"
+#include <ctype.h>
+#include <dirent.h>
+#include <errno.h>
+#include <limits.h>
+#include <linux/capability.h>
+#include <linux/futex.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+/**
+ * Idle calculation engine of a shared HCA.
+ *
+ * @calc                            Verbs erasure coding engine context.
+ * @k                               Number of data blocks of the engine.
+ * @m                               Number of code blocks of the engine.
+ * @max_inflight_calcs              Queue depth of the engine.
+ * @affinity_hint                   Completion CPU of the engine.
+ * @numa_node                       NUMA node of the completion CPU, -1 if it is not known.
+ * @encode_matrix                   Copy of the encode matrix [k * m] of the engine.
+ * @next                            Next idle engine, from the most to the least recently released.
+ */
+struct eco_hca_calc {
+	struct ibv_exp_ec_calc          *calc;
+	int                             k;
+	int                             m;
+	uint32_t                        max_inflight_calcs;
+	int                             affinity_hint;
+	int                             numa_node;
+	uint8_t                         encode_matrix[ECO_HCA_MAX_BLOCKS * ECO_HCA_MAX_BLOCKS];
+	struct eco_hca_calc             *next;
+};
+
+#define HCA_BOUNCE_DEFAULT_BUFFERS 16
+#define HCA_BOUNCE_MAX_BUFFERS 64
+#define HCA_BOUNCE_DEFAULT_SIZE (1 << 20)
+
+static pthread_mutex_t hca_registry_mutex = PTHREAD_MUTEX_INITIALIZER;
+
+// Opened devices, changed under hca_registry_mutex. Devices are closed only at unload, so the memory hooks walk it without the lock.
+static struct eco_hca *hca_registry;
+
+// Registered memory of all the devices, the budget is read once.
+static pthread_once_t mr_budget_once = PTHREAD_ONCE_INIT;
+static struct eco_mr_stats mr_stats;
+
+// Counter of the LRU queueings of all the devices, orders the regions of different devices from the least recently used.
+static uint64_t mrs_tick;
+
+// Lowest start and highest end of the regions ever registered, filters the invalidations of unrelated memory.
+static uintptr_t mrs_low = UINTPTR_MAX;
+static uintptr_t mrs_high;
+
+// Number of MR locks held by the thread. The memory it releases while it holds one is the library's own, and is not invalidated.
+static __thread int mrs_locks_held;
+
+static void util_eco_hca_rdlock_mrs(struct eco_hca *hca)
+{
+	mrs_locks_held++;
+	pthread_rwlock_rdlock(&hca->mrs_lock);
+}
+
+static void util_eco_hca_wrlock_mrs(struct eco_hca *hca)
+{
+	mrs_locks_held++;
+	pthread_rwlock_wrlock(&hca->mrs_lock);
+}
+
+static void util_eco_hca_unlock_mrs(struct eco_hca *hca)
+{
+	pthread_rwlock_unlock(&hca->mrs_lock);
+	mrs_locks_held--;
+}
+
+/**
+ * Read the first integer of a sysfs attribute of a device.
+ *
+ * @param device                    The device.
+ * @param attribute                 Attribute path relative to the device directory.
+ * @return                          The value, -1 if it is not available.
+ */
+static int util_eco_hca_read_attr(struct ibv_device *device, const char *attribute)
+{
+	char path[IBV_SYSFS_PATH_MAX + 32];
+	FILE *file;
+	int value;
+
+	snprintf(path, sizeof(path), "%s/device/%s", device->ibdev_path, attribute);
+
+	file = fopen(path, "r");
+	if (!file) {
+		return -1;
+	}
+
+	if (fscanf(file, "%d", &value) != 1) {
+		value = -1;
+	}
+	fclose(file);
+
+	return value;
+}
+
+int eco_hca_cpu_numa_node(int cpu)
+{
+	char path[64];
+	struct dirent *entry;
+	DIR *dir;
+	int node = -1;
+
+	if (cpu < 0) {
+		return -1;
+	}
+
+	snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d", cpu);
+
+	dir = opendir(path);
+	if (!dir) {
+		return -1;
+	}
+
+	while ((entry = readdir(dir))) {
+		if (!strncmp(entry->d_name, "node", 4) && isdigit(entry->d_name[4])) {
+			node = atoi(entry->d_name + 4);
+			break;
+		}
+	}
+	closedir(dir);
+
+	return node;
+}
+
+/**
+ * Open an EC capable device and allocate a protection domain on it.
+ *
+ * @param device                    The device.
+ * @return                          Pointer to a new shared HCA if successful, else NULL.
+ */
+static struct eco_hca *util_eco_hca_open(struct ibv_device *device)
+{
+	struct ibv_exp_device_attr dattr;
+	struct eco_hca *hca;
+
+	hca = calloc(1, sizeof(*hca));
+	if (!hca) {
+		err_log("eco_hca_get: Failed to allocate HCA\n");
+		return NULL;
+	}
+
+	// open device
+	hca->context = ibv_open_device(device);
+	if (!hca->context) {
+		err_log("eco_hca_get: Couldn't get context for %s\n", ibv_get_device_name(device));
+		goto open_device_error;
+	}
+
+	// allocate pd
+	hca->pd = ibv_alloc_pd(hca->context);
+	if (!hca->pd) {
+		err_log("eco_hca_get: Failed to allocate PD\n");
+		goto allocate_pd_error;
+	}
+
+	// query device for EC offload capabilities.
+	memset(&dattr, 0, sizeof(dattr));
+	dattr.comp_mask = IBV_EXP_DEVICE_ATTR_EXP_CAP_FLAGS | IBV_EXP_DEVICE_ATTR_EC_CAPS;
+	if (ibv_exp_query_device(hca->context, &dattr)) {
+		err_log("eco_hca_get: Couldn't query device for EC offload caps.\n");
+		goto query_device_error;
+	}
+
+	if (!(dattr.exp_device_cap_flags & IBV_EXP_DEVICE_EC_OFFLOAD)) {
+		err_log("eco_hca_get: EC offload not supported by driver of %s.\n", ibv_get_device_name(device));
+		goto query_device_error;
+	}
+
+	dbg_log("eco_hca_get: EC offload supported by driver of %s.\n", ibv_get_device_name(device));
+	dbg_log("eco_hca_get: max_ec_calc_inflight_calcs %d\n", dattr.ec_caps.max_ec_calc_inflight_calcs);
+	dbg_log("eco_hca_get: max_data_vector_count %d\n", dattr.ec_caps.max_ec_data_vector_count);
+
+	hca->device = device;
+	hca->max_inflight_calcs = dattr.ec_caps.max_ec_calc_inflight_calcs;
+	hca->numa_node = util_eco_hca_read_attr(device, "numa_node");
+	hca->local_cpu = util_eco_hca_read_attr(device, "local_cpulist");
+	pthread_rwlock_init(&hca->mrs_lock, NULL);
+	eco_mr_index_init(&hca->mrs);
+	pthread_mutex_init(&hca->lru_mutex, NULL);
+	INIT_LIST_HEAD(&hca->lru);
+	pthread_mutex_init(&hca->bounce_mutex, NULL);
+	pthread_mutex_init(&hca->calcs_mutex, NULL);
+
+	return hca;
+
+query_device_error:
+	ibv_dealloc_pd(hca->pd);
+allocate_pd_error:
+	ibv_close_device(hca->context);
+open_device_error:
+	free(hca);
+
+	return NULL;
+}
+
+/**
+ * Deregister the memory regions and the bounce pool of a device which is closed.
+ *
+ * @param hca                       The device.
+ */
+static void util_eco_hca_release_memory(struct eco_hca *hca)
+{
+	size_t length;
+	void *buffer;
+
+	util_eco_hca_wrlock_mrs(hca);
+	length = eco_mr_index_clear(&hca->mrs);
+	INIT_LIST_HEAD(&hca->lru);
+	util_eco_hca_unlock_mrs(hca);
+
+	pthread_mutex_lock(&hca->bounce_mutex);
+	if (hca->bounce_mr) {
+		buffer = hca->bounce_mr->addr;
+		length += hca->bounce_mr->length;
+		ibv_dereg_mr(hca->bounce_mr);
+		free(buffer);
+		hca->bounce_mr = NULL;
+	}
+	pthread_mutex_unlock(&hca->bounce_mutex);
+
+	__atomic_fetch_sub(&mr_stats.pinned_bytes, length, __ATOMIC_RELAXED);
+}
+
+struct eco_hca *eco_hca_get(struct ibv_device *device)
+{
+	struct eco_hca *hca;
+
+	pthread_mutex_lock(&hca_registry_mutex);
+
+	for (hca = hca_registry; hca; hca = hca->next) {
+		if (!strcmp(ibv_get_device_name(hca->device), ibv_get_device_name(device))) {
+			break;
+		}
+	}
+
+	if (!hca) {
+		hca = util_eco_hca_open(device);
+		if (hca) {
+			hca->next = hca_registry;
+			__atomic_store_n(&hca_registry, hca, __ATOMIC_RELEASE);
+		}
+	}
+
+	if (hca) {
+		hca->ref_count++;
+	}
+
+	pthread_mutex_unlock(&hca_registry_mutex);
+
+	return hca;
+}
+
+void eco_hca_put(struct eco_hca *hca)
+{
+	if (!hca) {
+		return;
+	}
+
+	// the regions stay registered for the next coders, the budget and the invalidations release them
+	pthread_mutex_lock(&hca_registry_mutex);
+	hca->ref_count--;
+	pthread_mutex_unlock(&hca_registry_mutex);
+}
+
+/**
+ * Check if the process may lock memory beyond RLIMIT_MEMLOCK.
+ *
+ * @return                          1 if the process has CAP_IPC_LOCK, else 0.
+ */
+static int util_eco_hca_has_ipc_lock(void)
+{
+	struct __user_cap_header_struct header = {_LINUX_CAPABILITY_VERSION_3, 0};
+	struct __user_cap_data_struct data[_LINUX_CAPABILITY_U32S_3];
+
+	if (syscall(SYS_capget, &header, data)) {
+		return 0;
+	}
+
+	return !!(data[CAP_TO_INDEX(CAP_IPC_LOCK)].effective & CAP_TO_MASK(CAP_IPC_LOCK));
+}
+
+static void util_eco_hca_init_mr_budget(void)
+{
+	const char *budget = getenv("MLX_ECO_MR_BUDGET");
+	struct rlimit limit;
+
+	if (budget) {
+		mr_stats.budget = strtoull(budget, NULL, 0);
+	} else if (!util_eco_hca_has_ipc_lock() && !getrlimit(RLIMIT_MEMLOCK, &limit) && limit.rlim_cur != RLIM_INFINITY) {
+		// leave room for the bounce pools and the other users of locked memory
+		mr_stats.budget = limit.rlim_cur / 4 * 3;
+	}
+
+	dbg_log("eco_hca: Registered memory budget %lu bytes\n", (unsigned long) mr_stats.budget);
+}
+
+/**
+ * Find a memory region which contains a buffer and take a reference and a use on it, the MR lock must be held.
+ *
+ * @param hca                       The device.
+ * @param buffer                    The address of the buffer.
+ * @param length                    The size of the buffer.
+ * @return                          The memory region, NULL if the buffer is not registered.
+ */
+static struct eco_mr *util_eco_hca_find_mr(struct eco_hca *hca, void *buffer, size_t length)
+{
+	struct eco_mr *mr = eco_mr_index_find(&hca->mrs, buffer, length);
+
+	// the regions of the index are deregistered only under the write lock, so users is not negative
+	if (mr) {
+		__atomic_fetch_add(&mr->refs, 1, __ATOMIC_RELAXED);
+		__atomic_fetch_add(&mr->users, 1, __ATOMIC_SEQ_CST);
+		__atomic_store_n(&mr->referenced, 1, __ATOMIC_RELAXED);
+	}
+
+	return mr;
+}
+
+/**
+ * Claim a region without users for its deregistration, operations can no longer take a use on it.
+ *
+ * @param mr                        The memory region.
+ * @return                          1 if the region is claimed, 0 if it has users or was claimed already.
+ */
+static int util_eco_hca_claim_mr(struct eco_mr *mr)
+{
+	int no_users = 0;
+
+	return __atomic_compare_exchange_n(&mr->users, &no_users, -1, 0, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST);
+}
+
+/**
+ * Deregister a claimed region, removed from the index and the LRU list, and drop the reference of its registration.
+ *
+ * @param mr                        The memory region.
+ */
+static void util_eco_hca_dereg_mr(struct eco_mr *mr)
+{
+	__atomic_fetch_sub(&mr_stats.pinned_bytes, mr->mr->length, __ATOMIC_RELAXED);
+	ibv_dereg_mr(mr->mr);
+	mr->mr = NULL;
+	eco_hca_put_mr(mr);
+}
+
+/**
+ * Queue a region at the tail of the LRU list of its device, the LRU mutex must be held.
+ *
+ * @param hca                       The device.
+ * @param mr                        The memory region, linked or not.
+ */
+static void util_eco_hca_queue_mr(struct eco_hca *hca, struct eco_mr *mr)
+{
+	mr->last_use = __atomic_add_fetch(&mrs_tick, 1, __ATOMIC_RELAXED);
+	__atomic_store_n(&mr->referenced, 0, __ATOMIC_RELAXED);
+	__atomic_store_n(&mr->linked, 1, __ATOMIC_SEQ_CST);
+	list_move_tail(&mr->lru, &hca->lru);
+}
+
+/**
+ * Unlink a region from the LRU list of its device, the LRU mutex must be held.
+ *
+ * @param mr                        The memory region.
+ */
+static void util_eco_hca_unlink_mr(struct eco_mr *mr)
+{
+	__atomic_store_n(&mr->linked, 0, __ATOMIC_SEQ_CST);
+	list_del_init(&mr->lru);
+}
+
+/**
+ * Take the least recently used region without users of a device out of its index, for its eviction. The regions
+ * used since they were queued get a second chance at the tail, the regions with users are unlinked until their last
+ * user queues them again, so every region is passed over at most once per use.
+ *
+ * @param hca                       The device.
+ * @return                          The claimed region, NULL if all the regions of the device are used.
+ */
+static struct eco_mr *util_eco_hca_evict_lru(struct eco_hca *hca)
+{
+	struct eco_mr *mr, *lru = NULL;
+
+	util_eco_hca_wrlock_mrs(hca);
+	pthread_mutex_lock(&hca->lru_mutex);
+
+	while (!list_empty(&hca->lru)) {
+		mr = list_first_entry(&hca->lru, struct eco_mr, lru);
+
+		// cleared before users is read again, so a last user which still saw the link is seen here
+		if (__atomic_load_n(&mr->users, __ATOMIC_SEQ_CST)) {
+			__atomic_store_n(&mr->linked, 0, __ATOMIC_SEQ_CST);
+			if (__atomic_load_n(&mr->users, __ATOMIC_SEQ_CST)) {
+				util_eco_hca_unlink_mr(mr);
+				continue;
+			}
+			__atomic_store_n(&mr->linked, 1, __ATOMIC_SEQ_CST);
+		}
+
+		if (__atomic_load_n(&mr->referenced, __ATOMIC_RELAXED)) {
+			util_eco_hca_queue_mr(hca, mr);
+			continue;
+		}
+
+		// an operation took a use on its cached region meanwhile, it is unlinked on the next pass
+		if (!util_eco_hca_claim_mr(mr)) {
+			continue;
+		}
+
+		// the slots which cache the region see the flag on their next operation
+		util_eco_hca_unlink_mr(mr);
+		__atomic_store_n(&mr->invalid, 1, __ATOMIC_SEQ_CST);
+		lru = mr;
+		break;
+	}
+
+	pthread_mutex_unlock(&hca->lru_mutex);
+
+	if (lru) {
+		eco_mr_index_remove(&hca->mrs, lru);
+	}
+
+	util_eco_hca_unlock_mrs(hca);
+
+	return lru;
+}
+
+/**
+ * Deregister the least recently used region without users of all the devices, since the budget is shared by them.
+ * No MR lock may be held: the devices are locked one at a time, so registrations which evict on each other's device
+ * never deadlock and no device is skipped.
+ *
+ * @return                          0 successful, -1 if all the regions are used.
+ */
+static int util_eco_hca_evict_mr(void)
+{
+	struct eco_hca *hca, *lru_hca;
+	uint64_t lru_tick = 0;
+	struct eco_mr *mr;
+
+	for (;;) {
+		lru_hca = NULL;
+
+		// the device whose list starts with the least recently queued region
+		for (hca = __atomic_load_n(&hca_registry, __ATOMIC_ACQUIRE); hca; hca = hca->next) {
+			pthread_mutex_lock(&hca->lru_mutex);
+			if (!list_empty(&hca->lru)) {
+				mr = list_first_entry(&hca->lru, struct eco_mr, lru);
+				if (!lru_hca || mr->last_use < lru_tick) {
+					lru_hca = hca;
+					lru_tick = mr->last_use;
+				}
+			}
+			pthread_mutex_unlock(&hca->lru_mutex);
+		}
+
+		if (!lru_hca) {
+			return -1;
+		}
+
+		// the list of the device is left empty if all its regions are used, the next pass takes another device
+		mr = util_eco_hca_evict_lru(lru_hca);
+		if (mr) {
+			break;
+		}
+	}
+
+	dbg_log("eco_hca_get_mr: Evicting MR %p length %lu of %s\n", mr->mr->addr, (unsigned long) mr->mr->length, ibv_get_device_name(lru_hca->device));
+
+	__atomic_fetch_add(&mr_stats.evictions, 1, __ATOMIC_RELAXED);
+	util_eco_hca_dereg_mr(mr);
+
+	return 0;
+}
+
+/**
+ * Reserve the bytes of a registration within the budget, evicting regions until they fit. No MR lock may be held.
+ *
+ * @param length                    The size of the registration.
+ * @return                          0 successful, -ENOSPC if the budget is exhausted.
+ */
+static int util_eco_hca_reserve(size_t length)
+{
+	uint64_t budget = __atomic_load_n(&mr_stats.budget, __ATOMIC_RELAXED);
+
+	// reserve the bytes first, so concurrent registrations on other devices see them
+	if (__atomic_add_fetch(&mr_stats.pinned_bytes, length, __ATOMIC_RELAXED) > budget && budget) {
+		while (__atomic_load_n(&mr_stats.pinned_bytes, __ATOMIC_RELAXED) > budget) {
+			if (util_eco_hca_evict_mr()) {
+				dbg_log("eco_hca_get_mr: Registered memory budget of %lu bytes is exhausted\n", (unsigned long) budget);
+				__atomic_fetch_sub(&mr_stats.pinned_bytes, length, __ATOMIC_RELAXED);
+				return -ENOSPC;
+			}
+		}
+	}
+
+	return 0;
+}
+
+/**
+ * Extend the range of the registered regions to a new region.
+ *
+ * @param start                     The start of the region.
+ * @param end                       The end of the region.
+ */
+static void util_eco_hca_extend_bounds(uintptr_t start, uintptr_t end)
+{
+	uintptr_t bound = __atomic_load_n(&mrs_low, __ATOMIC_RELAXED);
+
+	while (start < bound && !__atomic_compare_exchange_n(&mrs_low, &bound, start, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+
+	bound = __atomic_load_n(&mrs_high, __ATOMIC_RELAXED);
+	while (end > bound && !__atomic_compare_exchange_n(&mrs_high, &bound, end, 1, __ATOMIC_RELAXED, __ATOMIC_RELAXED));
+}
+
+/**
+ * Register a buffer whose bytes are reserved, the MR lock must be held for writing. The region is queued in the LRU
+ * list by its first user which ends its use.
+ *
+ * @param hca                       The device.
+ * @param buffer                    The address of the buffer.
+ * @param length                    The size of the buffer.
+ * @param mr                        Returns the memory region, with a reference and a use.
+ * @return                          0 successful, -ENOMEM if the registration failed.
+ */
+static int util_eco_hca_reg_mr(struct eco_hca *hca, void *buffer, size_t length, struct eco_mr **mr)
+{
+	struct eco_mr *new_mr;
+
+	new_mr = calloc(1, sizeof(*new_mr));
+	if (!new_mr) {
+		err_log("eco_hca_get_mr: Failed to allocate MR\n");
+		goto alloc_error;
+	}
+
+	new_mr->mr = ibv_reg_mr(hca->pd, buffer, length, IBV_ACCESS_LOCAL_WRITE);
+	if (!new_mr->mr) {
+		err_log("eco_hca_get_mr: Failed to register MR\n");
+		goto reg_error;
+	}
+
+	// the reference of the registration and the one of the caller, who uses it
+	new_mr->refs = 2;
+	new_mr->users = 1;
+	INIT_LIST_HEAD(&new_mr->lru);
+
+	if (eco_mr_index_insert(&hca->mrs, new_mr)) {
+		err_log("eco_hca_get_mr: Failed to add MR to the index\n");
+		goto insert_error;
+	}
+
+	__atomic_fetch_add(&mr_stats.registrations, 1, __ATOMIC_RELAXED);
+	util_eco_hca_extend_bounds((uintptr_t) buffer, (uintptr_t) buffer + length);
+	*mr = new_mr;
+
+	return 0;
+
+insert_error:
+	ibv_dereg_mr(new_mr->mr);
+reg_error:
+	free(new_mr);
+alloc_error:
+
+	return -ENOMEM;
+}
+
+int eco_hca_get_mr(struct eco_hca *hca, void *buffer, size_t length, struct eco_mr **mr)
+{
+	int err, registered = 0;
+
+	pthread_once(&mr_budget_once, util_eco_hca_init_mr_budget);
+
+	util_eco_hca_rdlock_mrs(hca);
+	*mr = util_eco_hca_find_mr(hca, buffer, length);
+	util_eco_hca_unlock_mrs(hca);
+
+	if (*mr) {
+		return 0;
+	}
+
+	// evicts before the MR lock is taken
+	err = util_eco_hca_reserve(length);
+	if (err) {
+		return err;
+	}
+
+	util_eco_hca_wrlock_mrs(hca);
+
+	// another thread may have registered the buffer meanwhile
+	*mr = util_eco_hca_find_mr(hca, buffer, length);
+	if (!*mr) {
+		err = util_eco_hca_reg_mr(hca, buffer, length, mr);
+		registered = !err;
+	}
+
+	util_eco_hca_unlock_mrs(hca);
+
+	if (!registered) {
+		__atomic_fetch_sub(&mr_stats.pinned_bytes, length, __ATOMIC_RELAXED);
+	}
+
+	return err;
+}
+
+int eco_hca_use_mr(struct eco_hca *hca, struct eco_mr *mr)
+{
+	int users = __atomic_load_n(&mr->users, __ATOMIC_SEQ_CST);
+
+	do {
+		if (users < 0) {
+			return -1;
+		}
+	} while (!__atomic_compare_exchange_n(&mr->users, &users, users + 1, 1, __ATOMIC_SEQ_CST, __ATOMIC_SEQ_CST));
+
+	// invalidated before the use was taken, its pages may be unmapped
+	if (__atomic_load_n(&mr->invalid, __ATOMIC_SEQ_CST)) {
+		eco_hca_unuse_mr(hca, mr);
+		return -1;
+	}
+
+	__atomic_store_n(&mr->referenced, 1, __ATOMIC_RELAXED);
+
+	return 0;
+}
+
+void eco_hca_unuse_mr(struct eco_hca *hca, struct eco_mr *mr)
+{
+	if (__atomic_sub_fetch(&mr->users, 1, __ATOMIC_SEQ_CST)) {
+		return;
+	}
+
+	// an invalidated region is deregistered by the last of its users, or by the invalidation if it had none
+	if (__atomic_load_n(&mr->invalid, __ATOMIC_SEQ_CST)) {
+		if (util_eco_hca_claim_mr(mr)) {
+			util_eco_hca_dereg_mr(mr);
+		}
+		return;
+	}
+
+	// new, or unlinked by an eviction which found it used
+	if (!__atomic_load_n(&mr->linked, __ATOMIC_SEQ_CST)) {
+		pthread_mutex_lock(&hca->lru_mutex);
+		if (!mr->linked && !__atomic_load_n(&mr->invalid, __ATOMIC_SEQ_CST)) {
+			util_eco_hca_queue_mr(hca, mr);
+		}
+		pthread_mutex_unlock(&hca->lru_mutex);
+	}
+}
+
+void eco_hca_put_mr(struct eco_mr *mr)
+{
+	// the registration holds a reference until the region is deregistered
+	if (!__atomic_sub_fetch(&mr->refs, 1, __ATOMIC_ACQ_REL)) {
+		free(mr);
+	}
+}
+
+/**
+ * Drop the regions of a device which overlap an address range.
+ *
+ * @param hca                       The device.
+ * @param addr                      The start of the range.
+ * @param length                    The size of the range.
+ */
+static void util_eco_hca_invalidate(struct eco_hca *hca, void *addr, size_t length)
+{
+	struct eco_mr *mr;
+
+	util_eco_hca_rdlock_mrs(hca);
+	mr = eco_mr_index_find_overlap(&hca->mrs, addr, length);
+	util_eco_hca_unlock_mrs(hca);
+
+	if (!mr) {
+		return;
+	}
+
+	util_eco_hca_wrlock_mrs(hca);
+
+	while ((mr = eco_mr_index_find_overlap(&hca->mrs, addr, length))) {
+		dbg_log("mlx_eco_invalidate_memory: Dropping MR %p length %lu of %s\n", mr->mr->addr, (unsigned long) mr->mr->length, ibv_get_device_name(hca->device));
+
+		// the slots which cache the region see the flag on their next operation
+		eco_mr_index_remove(&hca->mrs, mr);
+		pthread_mutex_lock(&hca->lru_mutex);
+		util_eco_hca_unlink_mr(mr);
+		__atomic_store_n(&mr->invalid, 1, __ATOMIC_SEQ_CST);
+		pthread_mutex_unlock(&hca->lru_mutex);
+		__atomic_fetch_add(&mr_stats.invalidations, 1, __ATOMIC_RELAXED);
+		if (util_eco_hca_claim_mr(mr)) {
+			util_eco_hca_dereg_mr(mr);
+		}
+	}
+
+	util_eco_hca_unlock_mrs(hca);
+}
+
+void mlx_eco_invalidate_memory(void *addr, size_t length)
+{
+	uintptr_t start = (uintptr_t) addr;
+	struct eco_hca *hca;
+
+	// the memory released by the library itself while it holds an MR lock, e.g. by ibv_dereg_mr()
+	if (mrs_locks_held || !length) {
+		return;
+	}
+
+	// most of the released memory was never registered, it is filtered without any lock
+	if (start >= __atomic_load_n(&mrs_high, __ATOMIC_RELAXED) || start + length <= __atomic_load_n(&mrs_low, __ATOMIC_RELAXED)) {
+		return;
+	}
+
+	for (hca = __atomic_load_n(&hca_registry, __ATOMIC_ACQUIRE); hca; hca = hca->next) {
+		util_eco_hca_invalidate(hca, addr, length);
+	}
+}
+
+/**
+ * Read a size from an environment variable.
+ *
+ * @param name                      Name of the variable.
+ * @param default_value             Value used if the variable is not set or not positive.
+ * @return                          The size.
+ */
+static size_t util_eco_hca_env_size(const char *name, size_t default_value)
+{
+	const char *value = getenv(name);
+	long long size;
+
+	if (!value) {
+		return default_value;
+	}
+
+	size = strtoll(value, NULL, 0);
+
+	return size > 0 ? (size_t) size : default_value;
+}
+
+/**
+ * Register the bounce pool of a device, the bounce mutex must be held.
+ *
+ * @param hca                       The device.
+ * @return                          0 successful, other fail.
+ */
+static int util_eco_hca_alloc_bounce(struct eco_hca *hca)
+{
+	size_t num_buffers, size;
+	struct ibv_mr *mr;
+	void *buffer;
+
+	num_buffers = util_eco_hca_env_size("MLX_ECO_BOUNCE_BUFFERS", HCA_BOUNCE_DEFAULT_BUFFERS);
+	if (num_buffers > HCA_BOUNCE_MAX_BUFFERS) {
+		num_buffers = HCA_BOUNCE_MAX_BUFFERS;
+	}
+
+	// the HCA calculates only 64 bytes aligned blocks
+	size = util_eco_hca_env_size("MLX_ECO_BOUNCE_BUFFER_SIZE", HCA_BOUNCE_DEFAULT_SIZE);
+	size = (size + 63) & ~(size_t) 63;
+
+	if (posix_memalign(&buffer, 4096, num_buffers * size)) {
+		err_log("eco_hca_get_bounce: Failed to allocate bounce pool\n");
+		return -1;
+	}
+
+	hca->bounce_size = size;
+	hca->bounce_free = num_buffers == 64 ? ~0ULL : (1ULL << num_buffers) - 1;
+
+	mr = ibv_reg_mr(hca->pd, buffer, num_buffers * size, IBV_ACCESS_LOCAL_WRITE);
+	if (!mr) {
+		err_log("eco_hca_get_bounce: Failed to register bounce pool\n");
+		free(buffer);
+		return -1;
+	}
+
+	// published after the pool is set up, the fast path of eco_hca_get_bounce() reads it without the mutex
+	__atomic_store_n(&hca->bounce_mr, mr, __ATOMIC_RELEASE);
+
+	__atomic_fetch_add(&mr_stats.pinned_bytes, num_buffers * size, __ATOMIC_RELAXED);
+
+	dbg_log("eco_hca_get_bounce: Registered %lu bounce buffers of %lu bytes on %s\n", (unsigned long) num_buffers, (unsigned long) size, ibv_get_device_name(hca->device));
+
+	return 0;
+}
+
+int eco_hca_get_bounce(struct eco_hca *hca, size_t length, int num_buffers, uint8_t **buffers, uint32_t *lkey, int wait)
+{
+	uint64_t free_buffers, taken, rest;
+	uint32_t releases;
+	struct ibv_mr *mr;
+	int i;
+
+	mr = __atomic_load_n(&hca->bounce_mr, __ATOMIC_ACQUIRE);
+	if (!mr) {
+		pthread_mutex_lock(&hca->bounce_mutex);
+		if (!hca->bounce_mr) {
+			util_eco_hca_alloc_bounce(hca);
+		}
+		mr = hca->bounce_mr;
+		pthread_mutex_unlock(&hca->bounce_mutex);
+
+		if (!mr) {
+			return -ENOMEM;
+		}
+	}
+
+	if (length > hca->bounce_size || (size_t) num_buffers * hca->bounce_size > mr->length) {
+		err_log("eco_hca_get_bounce: %d blocks of %lu bytes do not fit the bounce pool\n", num_buffers, (unsigned long) length);
+		return -ENOMEM;
+	}
+
+	for (;;) {
+		// read before the bitmap, so a release after it is seen by the futex
+		releases = __atomic_load_n(&hca->bounce_releases, __ATOMIC_SEQ_CST);
+		free_buffers = __atomic_load_n(&hca->bounce_free, __ATOMIC_SEQ_CST);
+
+		while (__builtin_popcountll(free_buffers) >= num_buffers) {
+			// the lowest num_buffers free buffers
+			for (taken = 0, rest = free_buffers, i = 0; i < num_buffers; i++) {
+				taken |= rest & -rest;
+				rest &= rest - 1;
+			}
+
+			if (__atomic_compare_exchange_n(&hca->bounce_free, &free_buffers, free_buffers & ~taken, 1,
+					__ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE)) {
+				for (i = 0; taken; i++, taken &= taken - 1) {
+					buffers[i] = (uint8_t *) mr->addr + __builtin_ctzll(taken) * hca->bounce_size;
+				}
+
+				__atomic_fetch_add(&mr_stats.bounced, num_buffers, __ATOMIC_RELAXED);
+				*lkey = mr->lkey;
+
+				return 0;
+			}
+		}
+
+		if (!wait) {
+			return -ENOBUFS;
+		}
+
+		__atomic_fetch_add(&hca->bounce_waiters, 1, __ATOMIC_SEQ_CST);
+		syscall(SYS_futex, &hca->bounce_releases, FUTEX_WAIT_PRIVATE, releases, NULL, NULL, 0);
+		__atomic_fetch_sub(&hca->bounce_waiters, 1, __ATOMIC_SEQ_CST);
+	}
+}
+
+void eco_hca_put_bounce(struct eco_hca *hca, void *buffer)
+{
+	int i = ((uint8_t *) buffer - (uint8_t *) hca->bounce_mr->addr) / hca->bounce_size;
+
+	__atomic_fetch_or(&hca->bounce_free, 1ULL << i, __ATOMIC_SEQ_CST);
+
+	__atomic_fetch_add(&hca->bounce_releases, 1, __ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&hca->bounce_waiters, __ATOMIC_SEQ_CST)) {
+		syscall(SYS_futex, &hca->bounce_releases, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+	}
+}
+
+void mlx_eco_set_mr_budget(size_t budget)
+{
+	pthread_once(&mr_budget_once, util_eco_hca_init_mr_budget);
+
+	__atomic_store_n(&mr_stats.budget, budget, __ATOMIC_RELAXED);
+}
+
+void mlx_eco_get_mr_stats(struct eco_mr_stats *stats)
+{
+	pthread_once(&mr_budget_once, util_eco_hca_init_mr_budget);
+
+	stats->pinned_bytes = __atomic_load_n(&mr_stats.pinned_bytes, __ATOMIC_RELAXED);
+	stats->budget = __atomic_load_n(&mr_stats.budget, __ATOMIC_RELAXED);
+	stats->registrations = __atomic_load_n(&mr_stats.registrations, __ATOMIC_RELAXED);
+	stats->evictions = __atomic_load_n(&mr_stats.evictions, __ATOMIC_RELAXED);
+	stats->bounced = __atomic_load_n(&mr_stats.bounced, __ATOMIC_RELAXED);
+	stats->invalidations = __atomic_load_n(&mr_stats.invalidations, __ATOMIC_RELAXED);
+}
+
+/**
+ * Check if an idle engine can serve a context. The completion CPU only matters by its NUMA node, the contexts
+ * choose the calling CPU when it is local to the device, so an exact match would rarely reuse an engine.
+ *
+ * @param idle                    The idle engine.
+ * @param attr                    Calculation engine attributes of the context.
+ * @param numa_node               NUMA node of attr->affinity_hint, -1 if it is not known.
+ * @return                        1 if the engine matches, else 0.
+ */
+static int util_eco_hca_calc_match(struct eco_hca_calc *idle, struct ibv_exp_ec_calc_init_attr *attr, int numa_node)
+{
+	if (numa_node < 0 ? idle->affinity_hint != attr->affinity_hint : idle->numa_node != numa_node) {
+		return 0;
+	}
+
+	return idle->k == attr->k && idle->m == attr->m && idle->max_inflight_calcs == attr->max_inflight_calcs &&
+			!memcmp(idle->encode_matrix, attr->encode_matrix, attr->k * attr->m);
+}
+
+struct ibv_exp_ec_calc *eco_hca_get_calc(struct eco_hca *hca, struct ibv_exp_ec_calc_init_attr *attr)
+{
+	struct eco_hca_calc **link, *idle;
+	struct ibv_exp_ec_calc *calc;
+	int numa_node = eco_hca_cpu_numa_node(attr->affinity_hint);
+
+	pthread_mutex_lock(&hca->calcs_mutex);
+
+	for (link = &hca->idle_calcs; (idle = *link); link = &idle->next) {
+		if (util_eco_hca_calc_match(idle, attr, numa_node)) {
+			*link = idle->next;
+			hca->num_idle_calcs--;
+			break;
+		}
+	}
+
+	pthread_mutex_unlock(&hca->calcs_mutex);
+
+	if (idle) {
+		dbg_log("eco_hca_get_calc: Reusing idle calc %p of %s\n", idle->calc, ibv_get_device_name(hca->device));
+		calc = idle->calc;
+		free(idle);
+		return calc;
+	}
+
+	return ibv_exp_alloc_ec_calc(hca->pd, attr);
+}
+
+void eco_hca_put_calc(struct eco_hca *hca, struct ibv_exp_ec_calc *calc, struct ibv_exp_ec_calc_init_attr *attr)
+{
+	struct eco_hca_calc **link, *idle, *oldest = NULL;
+
+	if (attr->k * attr->m > ECO_HCA_MAX_BLOCKS * ECO_HCA_MAX_BLOCKS || !(idle = malloc(sizeof(*idle)))) {
+		ibv_exp_dealloc_ec_calc(calc);
+		return;
+	}
+
+	idle->calc = calc;
+	idle->k = attr->k;
+	idle->m = attr->m;
+	idle->max_inflight_calcs = attr->max_inflight_calcs;
+	idle->affinity_hint = attr->affinity_hint;
+	idle->numa_node = eco_hca_cpu_numa_node(attr->affinity_hint);
+	memcpy(idle->encode_matrix, attr->encode_matrix, attr->k * attr->m);
+
+	pthread_mutex_lock(&hca->calcs_mutex);
+
+	idle->next = hca->idle_calcs;
+	hca->idle_calcs = idle;
+
+	if (++hca->num_idle_calcs > ECO_HCA_MAX_IDLE_CALCS) {
+		for (link = &hca->idle_calcs; (*link)->next; link = &(*link)->next);
+		oldest = *link;
+		*link = NULL;
+		hca->num_idle_calcs--;
+	}
+
+	pthread_mutex_unlock(&hca->calcs_mutex);
+
+	if (oldest) {
+		ibv_exp_dealloc_ec_calc(oldest->calc);
+		free(oldest);
+	}
+}
+
+/**
+ * Close the unused devices when the library is unloaded.
+ */
+static void __attribute__((destructor)) util_eco_hca_cleanup(void)
+{
+	struct eco_hca **link = &hca_registry, *hca;
+	struct eco_hca_calc *idle;
+
+	while ((hca = *link)) {
+		if (hca->ref_count) {
+			link = &hca->next;
+			continue;
+		}
+
+		*link = hca->next;
+		while ((idle = hca->idle_calcs)) {
+			hca->idle_calcs = idle->next;
+			ibv_exp_dealloc_ec_calc(idle->calc);
+			free(idle);
+		}
+		pthread_mutex_destroy(&hca->calcs_mutex);
+		util_eco_hca_release_memory(hca);
+		eco_mr_index_destroy(&hca->mrs);
+		pthread_mutex_destroy(&hca->lru_mutex);
+		pthread_rwlock_destroy(&hca->mrs_lock);
+		pthread_mutex_destroy(&hca->bounce_mutex);
+		ibv_dealloc_pd(hca->pd);
+		ibv_close_device(hca->context);
+		free(hca);
+	}
+}
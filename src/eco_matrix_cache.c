@@ -0,0 +1,176 @@
+/*
+ ** Copyright (C) 2016 Mellanox Technologies
+ **
+ ** Licensed under the Apache License, Version 2.0 (the "License");
+ ** you may not use this file except in compliance with the License.
+ ** You may obtain a copy of the License at:
+ **
+ ** http://www.apache.org/licenses/LICENSE-2.0
+ **
+ ** Unless required by applicable law or agreed to in writing, software
+ ** distributed under the License is distributed on an "AS IS" BASIS,
+ ** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+ ** either express or implied. See the License for the specific language
+ ** governing permissions and  limitations under the License.
+ **
+ */
+
+#include "../include/eco_common.h"
+#include "../include/eco_matrix_cache.h"
+
+/**
+ * Matrix cache entry.
+ *
+ * @lru                          Position in the LRU list, the most recently used entry is first.
+ * @hash_next                    Next entry in the same hash bucket.
+ * @mask                         Bitmask of the erased blocks.
+ * @matrix                       The matrix of this erasure pattern.
+ */
+struct eco_matrix_cache_entry {
+	struct list_head               lru;
+	struct eco_matrix_cache_entry  *hash_next;
+	uint32_t                       mask;
+	uint8_t                        *matrix;
+};
+
+/**
+ * Matrix cache context.
+ *
+ * @entries                      All the entries, allocated once.
+ * @matrices                     Contiguous buffer [capacity x matrix_size] of the matrices.
+ * @buckets                      Hash buckets, number of buckets is a power of 2 of at least twice the capacity.
+ * @bucket_mask                  Number of buckets - 1.
+ * @lru                          LRU list of the used entries.
+ * @stats                        Cache statistics.
+ */
+struct eco_matrix_cache {
+	struct eco_matrix_cache_entry  *entries;
+	uint8_t                        *matrices;
+	struct eco_matrix_cache_entry  **buckets;
+	uint32_t                       bucket_mask;
+	struct list_head               lru;
+	struct eco_matrix_cache_stats  stats;
+};
+
+static inline struct eco_matrix_cache_entry **util_eco_matrix_cache_bucket(struct eco_matrix_cache *cache, uint32_t mask)
+{
+	// spread neighbouring masks (same data erasures, different parity erasures) over the buckets
+	return &cache->buckets[(mask * 0x9e3779b1u) >> 16 & cache->bucket_mask];
+}
+
+struct eco_matrix_cache *eco_matrix_cache_create(int capacity, int matrix_size)
+{
+	struct eco_matrix_cache *cache;
+	uint32_t num_buckets = 1;
+	int i;
+
+	if (capacity <= 0 || matrix_size <= 0) {
+		err_log("eco_matrix_cache_create: Got invalid parameters - capacity = %d, matrix_size = %d\n", capacity, matrix_size);
+		return NULL;
+	}
+
+	while (num_buckets < 2 * (uint32_t)capacity) {
+		num_buckets <<= 1;
+	}
+
+	cache = calloc(1, sizeof(*cache));
+	if (!cache) {
+		goto alloc_cache_error;
+	}
+
+	cache->entries = calloc(capacity, sizeof(*cache->entries));
+	if (!cache->entries) {
+		goto alloc_entries_error;
+	}
+
+	cache->matrices = calloc(capacity, matrix_size);
+	if (!cache->matrices) {
+		goto alloc_matrices_error;
+	}
+
+	cache->buckets = calloc(num_buckets, sizeof(*cache->buckets));
+	if (!cache->buckets) {
+		goto alloc_buckets_error;
+	}
+
+	for (i = 0; i < capacity; i++) {
+		cache->entries[i].matrix = cache->matrices + i * matrix_size;
+	}
+
+	cache->bucket_mask = num_buckets - 1;
+	INIT_LIST_HEAD(&cache->lru);
+	cache->stats.capacity = capacity;
+
+	return cache;
+
+alloc_buckets_error:
+	free(cache->matrices);
+alloc_matrices_error:
+	free(cache->entries);
+alloc_entries_error:
+	free(cache);
+alloc_cache_error:
+	err_log("eco_matrix_cache_create: Failed to allocate a cache of %d matrices\n", capacity);
+
+	return NULL;
+}
+
+const uint8_t *eco_matrix_cache_lookup(struct eco_matrix_cache *cache, uint32_t mask)
+{
+	struct eco_matrix_cache_entry *entry;
+
+	for (entry = *util_eco_matrix_cache_bucket(cache, mask); entry; entry = entry->hash_next) {
+		if (entry->mask == mask) {
+			list_move(&entry->lru, &cache->lru);
+			cache->stats.hits++;
+			return entry->matrix;
+		}
+	}
+
+	cache->stats.misses++;
+
+	return NULL;
+}
+
+uint8_t *eco_matrix_cache_insert(struct eco_matrix_cache *cache, uint32_t mask)
+{
+	struct eco_matrix_cache_entry *entry, **pos;
+
+	if (cache->stats.num_entries < cache->stats.capacity) {
+		entry = &cache->entries[cache->stats.num_entries++];
+	} else {
+		// reuse the least recently used entry
+		entry = list_entry(cache->lru.prev, struct eco_matrix_cache_entry, lru);
+		list_del(&entry->lru);
+
+		for (pos = util_eco_matrix_cache_bucket(cache, entry->mask); *pos != entry; pos = &(*pos)->hash_next);
+		*pos = entry->hash_next;
+
+		cache->stats.evictions++;
+	}
+
+	entry->mask = mask;
+	pos = util_eco_matrix_cache_bucket(cache, mask);
+	entry->hash_next = *pos;
+	*pos = entry;
+	list_add(&entry->lru, &cache->lru);
+
+	return entry->matrix;
+}
+
+void eco_matrix_cache_get_stats(struct eco_matrix_cache *cache, struct eco_matrix_cache_stats *stats)
+{
+	*stats = cache->stats;
+}
+
+void eco_matrix_cache_destroy(struct eco_matrix_cache *cache)
+{
+	if (!cache) {
+		return;
+	}
+
+	free(cache->buckets);
+	free(cache->matrices);
+	free(cache->entries);
+	free(cache);
+}
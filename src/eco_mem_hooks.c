@@ -0,0 +1,189 @@
+/*
+ ** Copyright (C) 2016 Mellanox Technologies
+ **
+ ** Licensed under the Apache License, Version 2.0 (the "License");
+ ** you may not use this file except in compliance with the License.
+ ** You may obtain a copy of the License at:
+ **
+ ** http://www.apache.org/licenses/LICENSE-2.0
+ **
+ ** Unless required by applicable law or agreed to in writing, software
+ ** distributed under the License is distributed on an "AS IS" BASIS,
+ ** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+ ** either express or implied. See the License for the specific language
+ ** governing permissions and  limitations under the License.
+ **
+ */
+
+/*
+ * Hooks of the functions which release pages, so the registration cache never returns a region whose pages no longer
+ * back its addresses. The library defines the functions itself and calls the next definition (libc, or an allocator
+ * loaded after the library) after the registrations of the released range are dropped. free() and realloc() are not
+ * hooked, a freed block keeps its pages until the allocator unmaps or trims them. The hooks are enabled with
+ * MLX_ECO_MEM_HOOKS=1 and apply only when the library is linked to the application or preloaded: a library loaded
+ * with dlopen() and the calls of libc itself are not seen, mlx_eco_invalidate_memory() is the supported path there.
+ */
+
+#include "../include/eco_common.h"
+#include "../include/eco_hca.h"
+#include <dlfcn.h>
+#include <errno.h>
+#include <stdarg.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+/**
+ * Next definitions of the hooked functions.
+ */
+struct eco_mem_hooks_next {
+	int                            (*munmap)(void *addr, size_t length);
+	void                           *(*mremap)(void *old_address, size_t old_size, size_t new_size, int flags, ...);
+	int                            (*madvise)(void *addr, size_t length, int advice);
+	int                            (*brk)(void *addr);
+	void                           *(*sbrk)(intptr_t increment);
+};
+
+static struct eco_mem_hooks_next next;
+
+// -1 until the next definitions are resolved, then 0 if the hooks are disabled.
+static int hooks_enabled = -1;
+
+// Set while the thread resolves the next definitions, dlsym() may call the hooks.
+static __thread int hooks_resolving;
+
+static void util_eco_mem_hooks_resolve(void)
+{
+	const char *env;
+
+	hooks_resolving = 1;
+
+	next.munmap = dlsym(RTLD_NEXT, "munmap");
+	next.mremap = dlsym(RTLD_NEXT, "mremap");
+	next.madvise = dlsym(RTLD_NEXT, "madvise");
+	next.brk = dlsym(RTLD_NEXT, "brk");
+	next.sbrk = dlsym(RTLD_NEXT, "sbrk");
+
+	hooks_resolving = 0;
+
+	env = getenv("MLX_ECO_MEM_HOOKS");
+	__atomic_store_n(&hooks_enabled, env && atoi(env) > 0, __ATOMIC_RELEASE);
+}
+
+/**
+ * Resolve the next definitions on the first call.
+ *
+ * @return                         1 if the released memory should be invalidated, 0 if the hooks are disabled,
+ *                                 -1 while the thread resolves the next definitions.
+ */
+static int util_eco_mem_hooks_ready(void)
+{
+	int enabled = __atomic_load_n(&hooks_enabled, __ATOMIC_ACQUIRE);
+
+	if (enabled < 0 && !hooks_resolving) {
+		util_eco_mem_hooks_resolve();
+		enabled = hooks_enabled;
+	}
+
+	return enabled;
+}
+
+static void __attribute__((constructor)) util_eco_mem_hooks_init(void)
+{
+	util_eco_mem_hooks_ready();
+}
+
+int munmap(void *addr, size_t length)
+{
+	if (util_eco_mem_hooks_ready() > 0) {
+		mlx_eco_invalidate_memory(addr, length);
+	}
+
+	if (!next.munmap) {
+		return syscall(SYS_munmap, addr, length);
+	}
+
+	return next.munmap(addr, length);
+}
+
+void *mremap(void *old_address, size_t old_size, size_t new_size, int flags, ...)
+{
+	void *new_address = NULL;
+	va_list args;
+
+	if (flags & MREMAP_FIXED) {
+		va_start(args, flags);
+		new_address = va_arg(args, void *);
+		va_end(args);
+	}
+
+	// the pages may move, be released when the mapping shrinks, or replace the mappings at new_address
+	if (util_eco_mem_hooks_ready() > 0) {
+		mlx_eco_invalidate_memory(old_address, old_size);
+		if (flags & MREMAP_FIXED) {
+			mlx_eco_invalidate_memory(new_address, new_size);
+		}
+	}
+
+	if (!next.mremap) {
+		return (void *) syscall(SYS_mremap, old_address, old_size, new_size, flags, new_address);
+	}
+
+	return next.mremap(old_address, old_size, new_size, flags, new_address);
+}
+
+int madvise(void *addr, size_t length, int advice)
+{
+	int released = advice == MADV_DONTNEED || advice == MADV_REMOVE;
+
+#ifdef MADV_FREE
+	released |= advice == MADV_FREE;
+#endif
+
+	// the next access gets new pages
+	if (released && util_eco_mem_hooks_ready() > 0) {
+		mlx_eco_invalidate_memory(addr, length);
+	}
+
+	if (!next.madvise) {
+		return syscall(SYS_madvise, addr, length, advice);
+	}
+
+	return next.madvise(addr, length, advice);
+}
+
+int brk(void *addr)
+{
+	uint8_t *end;
+
+	if (util_eco_mem_hooks_ready() > 0 && next.sbrk) {
+		end = next.sbrk(0);
+		if ((uint8_t *) addr < end) {
+			mlx_eco_invalidate_memory(addr, end - (uint8_t *) addr);
+		}
+	}
+
+	if (!next.brk) {
+		errno = ENOMEM;
+		return -1;
+	}
+
+	return next.brk(addr);
+}
+
+void *sbrk(intptr_t increment)
+{
+	uint8_t *end;
+
+	if (increment < 0 && util_eco_mem_hooks_ready() > 0 && next.sbrk) {
+		end = next.sbrk(0);
+		mlx_eco_invalidate_memory(end + increment, -increment);
+	}
+
+	if (!next.sbrk) {
+		errno = ENOMEM;
+		return (void *) -1;
+	}
+
+	return next.sbrk(increment);
+}
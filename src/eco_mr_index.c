@@ -0,0 +1,171 @@
+/*
+ ** Copyright (C) 2016 Mellanox Technologies
+ **
+ ** Licensed under the Apache License, Version 2.0 (the "License");
+ ** you may not use this file except in compliance with the License.
+ ** You may obtain a copy of the License at:
+ **
+ ** http://www.apache.org/licenses/LICENSE-2.0
+ **
+ ** Unless required by applicable law or agreed to in writing, software
+ ** distributed under the License is distributed on an "AS IS" BASIS,
+ ** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+ ** either express or implied. See the License for the specific language
+ ** governing permissions and  limitations under the License.
+ **
+ */
+
+#include "../include/eco_mr_index.h"
+#include <stdlib.h>
+#include <string.h>
+
+#define MR_INDEX_INITIAL_CAPACITY 64
+
+/**
+ * Find the number of entries starting at or below an address.
+ *
+ * @param index                   Pointer to the index.
+ * @param start                   The address.
+ * @return                        Index of the first entry starting above the address.
+ */
+static int util_eco_mr_index_upper_bound(struct eco_mr_index *index, uintptr_t start)
+{
+	int low = 0, high = index->num_entries, mid;
+
+	while (low < high) {
+		mid = low + (high - low) / 2;
+		if (index->entries[mid].start <= start) {
+			low = mid + 1;
+		} else {
+			high = mid;
+		}
+	}
+
+	return low;
+}
+
+/**
+ * Recompute max_end from an entry to the last one.
+ *
+ * @param index                   Pointer to the index.
+ * @param first                   Index of the first entry to update.
+ */
+static void util_eco_mr_index_update_max_end(struct eco_mr_index *index, int first)
+{
+	uintptr_t max_end = first ? index->entries[first - 1].max_end : 0;
+	int i;
+
+	for (i = first; i < index->num_entries; i++) {
+		if (index->entries[i].end > max_end) {
+			max_end = index->entries[i].end;
+		}
+		index->entries[i].max_end = max_end;
+	}
+}
+
+void eco_mr_index_init(struct eco_mr_index *index)
+{
+	memset(index, 0, sizeof(*index));
+}
+
+struct eco_mr *eco_mr_index_find(struct eco_mr_index *index, void *addr, size_t length)
+{
+	uintptr_t start = (uintptr_t) addr, end = start + length;
+	int i;
+
+	// no entry before i reaches the end of the buffer once max_end is below it
+	for (i = util_eco_mr_index_upper_bound(index, start) - 1; i >= 0 && index->entries[i].max_end >= end; i--) {
+		if (index->entries[i].end >= end) {
+			return index->entries[i].mr;
+		}
+	}
+
+	return NULL;
+}
+
+struct eco_mr *eco_mr_index_find_overlap(struct eco_mr_index *index, void *addr, size_t length)
+{
+	uintptr_t start = (uintptr_t) addr, end = start + length;
+	int i;
+
+	if (!length) {
+		return NULL;
+	}
+
+	// the entries starting before the end of the range, until none of them reaches its start
+	for (i = util_eco_mr_index_upper_bound(index, end - 1) - 1; i >= 0 && index->entries[i].max_end > start; i--) {
+		if (index->entries[i].end > start) {
+			return index->entries[i].mr;
+		}
+	}
+
+	return NULL;
+}
+
+int eco_mr_index_insert(struct eco_mr_index *index, struct eco_mr *mr)
+{
+	struct eco_mr_index_entry *entries;
+	int i, capacity;
+
+	if (index->num_entries == index->capacity) {
+		capacity = index->capacity ? index->capacity * 2 : MR_INDEX_INITIAL_CAPACITY;
+		entries = realloc(index->entries, capacity * sizeof(*entries));
+		if (!entries) {
+			return -1;
+		}
+
+		index->entries = entries;
+		index->capacity = capacity;
+	}
+
+	i = util_eco_mr_index_upper_bound(index, (uintptr_t) mr->mr->addr);
+	memmove(&index->entries[i + 1], &index->entries[i], (index->num_entries - i) * sizeof(*index->entries));
+
+	index->entries[i].start = (uintptr_t) mr->mr->addr;
+	index->entries[i].end = (uintptr_t) mr->mr->addr + mr->mr->length;
+	index->entries[i].mr = mr;
+	index->num_entries++;
+
+	util_eco_mr_index_update_max_end(index, i);
+
+	return 0;
+}
+
+void eco_mr_index_remove(struct eco_mr_index *index, struct eco_mr *mr)
+{
+	int i;
+
+	// the entries starting at the same address precede the upper bound
+	for (i = util_eco_mr_index_upper_bound(index, (uintptr_t) mr->mr->addr) - 1; i >= 0 && index->entries[i].mr != mr; i--);
+	if (i < 0) {
+		return;
+	}
+
+	index->num_entries--;
+	memmove(&index->entries[i], &index->entries[i + 1], (index->num_entries - i) * sizeof(*index->entries));
+
+	util_eco_mr_index_update_max_end(index, i);
+}
+
+size_t eco_mr_index_clear(struct eco_mr_index *index)
+{
+	size_t length = 0;
+	int i;
+
+	for (i = 0; i < index->num_entries; i++) {
+		length += index->entries[i].mr->mr->length;
+		ibv_dereg_mr(index->entries[i].mr->mr);
+		free(index->entries[i].mr);
+	}
+
+	index->num_entries = 0;
+
+	return length;
+}
+
+void eco_mr_index_destroy(struct eco_mr_index *index)
+{
+	eco_mr_index_clear(index);
+	free(index->entries);
+	eco_mr_index_init(index);
+}
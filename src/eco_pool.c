@@ -0,0 +1,333 @@
+/*
+ ** Copyright (C) 2016 Mellanox Technologies
+ **
+ ** Licensed under the Apache License, Version 2.0 (the "License");
+ ** you may not use this file except in compliance with the License.
+ ** You may obtain a copy of the License at:
+ **
+ ** http://www.apache.org/licenses/LICENSE-2.0
+ **
+ ** Unless required by applicable law or agreed to in writing, software
+ ** distributed under the License is distributed on an "AS IS" BASIS,
+ ** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+ ** either express or implied. See the License for the specific language
+ ** governing permissions and  limitations under the License.
+ **
+ */
+
+#include "../include/eco_pool.h"
+#include <linux/futex.h>
+#include <errno.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+#define POOL_DEFAULT_MAX_CODERS 64
+#define POOL_MAX_CODERS 65536
+
+/**
+ * Slot of a coder in the pool.
+ *
+ * @coder                        Encoder or decoder of the slot, NULL while the slot is not used.
+ * @next                         Index + 1 of the next slot in the same stack, 0 for the last one.
+ */
+struct eco_pool_entry {
+	void                           *coder;
+	uint32_t                       next;
+};
+
+/**
+ * Pool of coders.
+ * The slots are kept in two lock-free stacks: the idle coders and the unused slots. The head of a stack holds the
+ * index + 1 of its first slot in the low 32 bits and a counter incremented by every change in the high 32 bits,
+ * so a head read before the slot was popped and pushed again by other threads fails the compare-and-swap (ABA).
+ *
+ * @attr                         Pool attributes.
+ * @entries                      Slots of the coders, max_coders entries.
+ * @idle                         Stack of the idle coders.
+ * @unused                       Stack of the slots without a coder.
+ * @num_idle                     Number of idle coders.
+ * @num_coders                   Number of created coders.
+ * @checkins                     Number of checkins, futex word of the waiting checkouts.
+ * @num_waiters                  Number of checkouts waiting for a checkin.
+ */
+struct eco_pool {
+	struct eco_pool_attr           attr;
+	struct eco_pool_entry          *entries;
+	uint64_t                       idle;
+	uint64_t                       unused;
+	int                            num_idle;
+	int                            num_coders;
+	uint32_t                       checkins;
+	int                            num_waiters;
+};
+
+static void util_eco_pool_push(struct eco_pool *pool, uint64_t *stack, struct eco_pool_entry *entry)
+{
+	uint64_t head = __atomic_load_n(stack, __ATOMIC_RELAXED), new_head;
+
+	do {
+		entry->next = (uint32_t) head;
+		new_head = (((head >> 32) + 1) << 32) | (uint32_t) (entry - pool->entries + 1);
+	} while (!__atomic_compare_exchange_n(stack, &head, new_head, 1, __ATOMIC_RELEASE, __ATOMIC_RELAXED));
+}
+
+static struct eco_pool_entry *util_eco_pool_pop(struct eco_pool *pool, uint64_t *stack)
+{
+	uint64_t head = __atomic_load_n(stack, __ATOMIC_ACQUIRE), new_head;
+	struct eco_pool_entry *entry;
+
+	do {
+		if (!(uint32_t) head) {
+			return NULL;
+		}
+
+		// the slots are never freed while the pool exists, a stale next is rejected by the counter
+		entry = &pool->entries[(uint32_t) head - 1];
+		new_head = (((head >> 32) + 1) << 32) | __atomic_load_n(&entry->next, __ATOMIC_RELAXED);
+	} while (!__atomic_compare_exchange_n(stack, &head, new_head, 1, __ATOMIC_ACQUIRE, __ATOMIC_ACQUIRE));
+
+	return entry;
+}
+
+/**
+ * Get the back-pointer of a coder to its slot.
+ *
+ * @param pool                   Pointer to the pool.
+ * @param coder                  Encoder or decoder of the type of the pool.
+ * @return                       Pointer to the pool_entry field of the coder.
+ */
+static void **util_eco_pool_coder_entry(struct eco_pool *pool, void *coder)
+{
+	if (pool->attr.type == ECO_POOL_ENCODER) {
+		return &((struct eco_encoder *) coder)->pool_entry;
+	}
+
+	return &((struct eco_decoder *) coder)->pool_entry;
+}
+
+static void *util_eco_pool_create_coder(struct eco_pool *pool)
+{
+	if (pool->attr.type == ECO_POOL_ENCODER) {
+		return mlx_eco_encoder_init_attr(&pool->attr.encoder);
+	}
+
+	return mlx_eco_decoder_init_attr(&pool->attr.decoder);
+}
+
+static void util_eco_pool_release_coder(struct eco_pool *pool, void *coder)
+{
+	if (pool->attr.type == ECO_POOL_ENCODER) {
+		mlx_eco_encoder_release(coder);
+	} else {
+		mlx_eco_decoder_release(coder);
+	}
+}
+
+/**
+ * Fill an unused slot with a new coder.
+ *
+ * @param pool                   Pointer to the pool.
+ * @param entry                  Returns the slot of the new coder.
+ * @return                       0 successful, -ENOSPC if max_coders coders exist, -ENOMEM if the coder could not
+ *                               be created.
+ */
+static int util_eco_pool_grow(struct eco_pool *pool, struct eco_pool_entry **entry)
+{
+	*entry = util_eco_pool_pop(pool, &pool->unused);
+	if (!*entry) {
+		return -ENOSPC;
+	}
+
+	(*entry)->coder = util_eco_pool_create_coder(pool);
+	if (!(*entry)->coder) {
+		err_log("eco_pool: Failed to create coder\n");
+		util_eco_pool_push(pool, &pool->unused, *entry);
+		return -ENOMEM;
+	}
+
+	*util_eco_pool_coder_entry(pool, (*entry)->coder) = *entry;
+
+	__atomic_fetch_add(&pool->num_coders, 1, __ATOMIC_RELAXED);
+
+	return 0;
+}
+
+static void *util_eco_pool_checkout(struct eco_pool *pool, enum eco_pool_type type, int wait)
+{
+	struct eco_pool_entry *entry;
+	uint32_t checkins;
+	int err;
+
+	if (pool->attr.type != type) {
+		err_log("eco_pool: Wrong coder type %d\n", type);
+		return NULL;
+	}
+
+	for (;;) {
+		// read before the stacks, so a checkin that empties them after is seen by the futex
+		checkins = __atomic_load_n(&pool->checkins, __ATOMIC_SEQ_CST);
+
+		entry = util_eco_pool_pop(pool, &pool->idle);
+		if (entry) {
+			__atomic_fetch_sub(&pool->num_idle, 1, __ATOMIC_RELAXED);
+			return entry->coder;
+		}
+
+		err = util_eco_pool_grow(pool, &entry);
+		if (!err) {
+			return entry->coder;
+		}
+
+		if (!wait || err != -ENOSPC) {
+			return NULL;
+		}
+
+		__atomic_fetch_add(&pool->num_waiters, 1, __ATOMIC_SEQ_CST);
+		syscall(SYS_futex, &pool->checkins, FUTEX_WAIT_PRIVATE, checkins, NULL, NULL, 0);
+		__atomic_fetch_sub(&pool->num_waiters, 1, __ATOMIC_SEQ_CST);
+	}
+}
+
+static void util_eco_pool_checkin(struct eco_pool *pool, enum eco_pool_type type, void *coder)
+{
+	struct eco_pool_entry *entry;
+	int num_coders;
+
+	if (!coder || pool->attr.type != type) {
+		err_log("eco_pool: Invalid coder\n");
+		return;
+	}
+
+	// the slot was set by the thread which created the coder, before its checkout handed it to this thread
+	entry = *util_eco_pool_coder_entry(pool, coder);
+	if (!entry || entry < pool->entries || entry >= pool->entries + pool->attr.max_coders || entry->coder != coder) {
+		err_log("eco_pool: Coder %p does not belong to the pool\n", coder);
+		return;
+	}
+
+	// shrink when enough coders are idle, keeping at least min_coders
+	num_coders = __atomic_load_n(&pool->num_coders, __ATOMIC_RELAXED);
+	while (pool->attr.max_idle && __atomic_load_n(&pool->num_idle, __ATOMIC_RELAXED) >= pool->attr.max_idle &&
+			num_coders > pool->attr.min_coders) {
+		if (__atomic_compare_exchange_n(&pool->num_coders, &num_coders, num_coders - 1, 1,
+				__ATOMIC_RELAXED, __ATOMIC_RELAXED)) {
+			util_eco_pool_release_coder(pool, coder);
+			entry->coder = NULL;
+			util_eco_pool_push(pool, &pool->unused, entry);
+			goto wake;
+		}
+	}
+
+	__atomic_fetch_add(&pool->num_idle, 1, __ATOMIC_RELAXED);
+	util_eco_pool_push(pool, &pool->idle, entry);
+
+wake:
+	__atomic_fetch_add(&pool->checkins, 1, __ATOMIC_SEQ_CST);
+	if (__atomic_load_n(&pool->num_waiters, __ATOMIC_SEQ_CST)) {
+		syscall(SYS_futex, &pool->checkins, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+	}
+}
+
+struct eco_pool *mlx_eco_pool_create(struct eco_pool_attr *attr)
+{
+	dbg_log("mlx_eco_pool_create: type = %d, min_coders = %d, max_coders = %d, max_idle = %d\n",
+			attr->type, attr->min_coders, attr->max_coders, attr->max_idle);
+
+	struct eco_pool *pool;
+	struct eco_pool_entry *entry;
+	int i;
+
+	if ((attr->type != ECO_POOL_ENCODER && attr->type != ECO_POOL_DECODER) || attr->min_coders < 0 ||
+			attr->max_coders < 0 || attr->max_coders > POOL_MAX_CODERS || attr->max_idle < 0) {
+		err_log("mlx_eco_pool_create: Invalid parameters\n");
+		return NULL;
+	}
+
+	pool = calloc(1, sizeof(*pool));
+	if (!pool) {
+		err_log("mlx_eco_pool_create: Failed to allocate pool\n");
+		return NULL;
+	}
+
+	pool->attr = *attr;
+	if (!pool->attr.max_coders) {
+		pool->attr.max_coders = POOL_DEFAULT_MAX_CODERS;
+	}
+
+	if (pool->attr.min_coders > pool->attr.max_coders) {
+		err_log("mlx_eco_pool_create: min_coders %d exceeds max_coders %d\n", pool->attr.min_coders,
+				pool->attr.max_coders);
+		goto entries_error;
+	}
+
+	pool->entries = calloc(pool->attr.max_coders, sizeof(*pool->entries));
+	if (!pool->entries) {
+		err_log("mlx_eco_pool_create: Failed to allocate entries\n");
+		goto entries_error;
+	}
+
+	for (i = pool->attr.max_coders - 1; i >= 0; i--) {
+		util_eco_pool_push(pool, &pool->unused, &pool->entries[i]);
+	}
+
+	for (i = 0; i < pool->attr.min_coders; i++) {
+		if (util_eco_pool_grow(pool, &entry)) {
+			goto coders_error;
+		}
+
+		pool->num_idle++;
+		util_eco_pool_push(pool, &pool->idle, entry);
+	}
+
+	return pool;
+
+coders_error:
+	mlx_eco_pool_destroy(pool);
+	return NULL;
+
+entries_error:
+	free(pool);
+
+	return NULL;
+}
+
+struct eco_encoder *mlx_eco_pool_checkout_encoder(struct eco_pool *pool, int wait)
+{
+	return util_eco_pool_checkout(pool, ECO_POOL_ENCODER, wait);
+}
+
+void mlx_eco_pool_checkin_encoder(struct eco_pool *pool, struct eco_encoder *eco_encoder)
+{
+	util_eco_pool_checkin(pool, ECO_POOL_ENCODER, eco_encoder);
+}
+
+struct eco_decoder *mlx_eco_pool_checkout_decoder(struct eco_pool *pool, int wait)
+{
+	return util_eco_pool_checkout(pool, ECO_POOL_DECODER, wait);
+}
+
+void mlx_eco_pool_checkin_decoder(struct eco_pool *pool, struct eco_decoder *eco_decoder)
+{
+	util_eco_pool_checkin(pool, ECO_POOL_DECODER, eco_decoder);
+}
+
+int mlx_eco_pool_destroy(struct eco_pool *pool)
+{
+	dbg_log("mlx_eco_pool_destroy\n");
+
+	struct eco_pool_entry *entry;
+
+	if (pool->num_idle != pool->num_coders) {
+		err_log("mlx_eco_pool_destroy: %d coders are checked out\n", pool->num_coders - pool->num_idle);
+		return -EBUSY;
+	}
+
+	while ((entry = util_eco_pool_pop(pool, &pool->idle))) {
+		util_eco_pool_release_coder(pool, entry->coder);
+	}
+
+	free(pool->entries);
+	free(pool);
+
+	return 0;
+}
@@ -0,0 +1,338 @@
+/*
+ ** Copyright (C) 2016 Mellanox Technologies
+ **
+ ** Licensed under the Apache License, Version 2.0 (the "License");
+ ** you may not use this file except in compliance with the License.
+ ** You may obtain a copy of the License at:
+ **
+ ** http://www.apache.org/licenses/LICENSE-2.0
+ **
+ ** Unless required by applicable law or agreed to in writing, software
+ ** distributed under the License is distributed on an "AS IS" BASIS,
+ ** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+ ** either express or implied. See the License for the specific language
+ ** governing permissions and  limitations under the License.
+ **
+ */
+
+#include "../include/eco_ring.h"
+#include <linux/futex.h>
+#include <errno.h>
+#include <limits.h>
+#include <sys/syscall.h>
+#include <time.h>
+#include <unistd.h>
+
+#define RING_MAX_ENTRIES 32768
+#define RING_MAX_BACKOFF_NS 1000000
+
+/**
+ * Completion context of an operation submitted by the progress thread.
+ *
+ * @ring                         The rings which the operation belongs to.
+ * @user_data                    User value of the submission ring entry.
+ * @next                         Next unused completion context.
+ */
+struct eco_ring_req {
+	struct eco_ring                *ring;
+	void                           *user_data;
+	struct eco_ring_req            *next;
+};
+
+static void util_eco_ring_post_cqe(struct eco_ring *ring, struct eco_ring_req *req, void *user_data, int status)
+{
+	struct eco_cqe *cqe;
+
+	pthread_mutex_lock(&ring->cq_mutex);
+	cqe = &ring->cqes[ring->cq_tail & (ring->cq_entries - 1)];
+	cqe->user_data = user_data;
+	cqe->status = status;
+	__atomic_store_n(&ring->cq_tail, ring->cq_tail + 1, __ATOMIC_SEQ_CST);
+
+	if (req) {
+		req->next = ring->free_reqs;
+		ring->free_reqs = req;
+	}
+	pthread_mutex_unlock(&ring->cq_mutex);
+
+	if (__atomic_load_n(&ring->cq_waiting, __ATOMIC_SEQ_CST)) {
+		syscall(SYS_futex, &ring->cq_tail, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+	}
+}
+
+/**
+ * Sleep until the completion ring tail moves from tail, i.e. until an operation completes.
+ */
+static void util_eco_ring_wait_tail(struct eco_ring *ring, uint32_t tail)
+{
+	__atomic_fetch_add(&ring->cq_waiting, 1, __ATOMIC_SEQ_CST);
+
+	if (__atomic_load_n(&ring->cq_tail, __ATOMIC_SEQ_CST) == tail) {
+		syscall(SYS_futex, &ring->cq_tail, FUTEX_WAIT_PRIVATE, tail, NULL, NULL, 0);
+	}
+
+	__atomic_fetch_sub(&ring->cq_waiting, 1, __ATOMIC_SEQ_CST);
+}
+
+static void util_eco_ring_done(void *arg, int status)
+{
+	struct eco_ring_req *req = arg;
+
+	util_eco_ring_post_cqe(req->ring, req, req->user_data, status);
+}
+
+/**
+ * Submit a submission ring entry to its coder, retrying while the queue of the coder is full.
+ * The queue of the coder is full of operations of the ring, so the thread sleeps until one of them completes.
+ * Bounce buffers are released by the operations of other coders on the device, so the retries back off up to
+ * RING_MAX_BACKOFF_NS while they are used.
+ * The completion is posted by util_eco_ring_done(), or right away if the entry could not be submitted.
+ */
+static void util_eco_ring_submit_sqe(struct eco_ring *ring, struct eco_sqe *sqe)
+{
+	struct timespec backoff = {0, 1000};
+	struct eco_ring_req *req;
+	uint32_t tail;
+	int err;
+
+	pthread_mutex_lock(&ring->cq_mutex);
+	req = ring->free_reqs;
+	ring->free_reqs = req->next;
+	pthread_mutex_unlock(&ring->cq_mutex);
+
+	req->user_data = sqe->user_data;
+
+	do {
+		/* read before the submission, so a completion which frees the queue meanwhile is not missed */
+		tail = __atomic_load_n(&ring->cq_tail, __ATOMIC_SEQ_CST);
+
+		if (sqe->op == ECO_RING_OP_ENCODE && ring->encoder) {
+			err = mlx_eco_encoder_encode_async(ring->encoder, sqe->data, sqe->coding, ring->encoder->eco_ctx->attr.k,
+					ring->encoder->eco_ctx->attr.m, sqe->block_size, util_eco_ring_done, req);
+		} else if (sqe->op == ECO_RING_OP_DECODE && ring->decoder) {
+			err = mlx_eco_decoder_decode_async(ring->decoder, sqe->data, sqe->coding, ring->decoder->eco_ctx->attr.k,
+					ring->decoder->eco_ctx->attr.m, sqe->block_size, sqe->erasures, sqe->erasures_size, util_eco_ring_done, req);
+		} else {
+			err_log("eco_ring: Invalid operation %d (no coder)\n", sqe->op);
+			err = -EINVAL;
+		}
+
+		if (err == -EBUSY) {
+			util_eco_ring_wait_tail(ring, tail);
+		} else if (err == -ENOBUFS) {
+			nanosleep(&backoff, NULL);
+			if (backoff.tv_nsec < RING_MAX_BACKOFF_NS) {
+				backoff.tv_nsec *= 2;
+			}
+		}
+	} while (err == -EBUSY || err == -ENOBUFS);
+
+	if (err) {
+		util_eco_ring_post_cqe(ring, req, sqe->user_data, err);
+	}
+}
+
+/**
+ * Sleep until the application submits new entries or destroys the rings.
+ * ECO_RING_NEED_WAKEUP is published before the submission ring is checked again, so a concurrent
+ * mlx_eco_ring_submit() either is seen here or sees the flag and wakes the thread.
+ */
+static void util_eco_ring_sleep(struct eco_ring *ring, uint32_t head)
+{
+	__atomic_fetch_or(&ring->sq_flags, ECO_RING_NEED_WAKEUP, __ATOMIC_SEQ_CST);
+
+	if (__atomic_load_n(&ring->sq_tail, __ATOMIC_SEQ_CST) == head && !__atomic_load_n(&ring->stop, __ATOMIC_SEQ_CST)) {
+		syscall(SYS_futex, &ring->sq_flags, FUTEX_WAIT_PRIVATE, ECO_RING_NEED_WAKEUP, NULL, NULL, 0);
+	}
+
+	__atomic_fetch_and(&ring->sq_flags, ~ECO_RING_NEED_WAKEUP, __ATOMIC_SEQ_CST);
+}
+
+/**
+ * Sleep until the application sees completion ring entries or destroys the rings.
+ * ECO_RING_CQ_WAIT is published before the completion ring head is checked again, so a concurrent
+ * mlx_eco_ring_cqe_seen() either is seen here or sees the flag and wakes the thread.
+ */
+static void util_eco_ring_wait_cq(struct eco_ring *ring, uint32_t head)
+{
+	__atomic_fetch_or(&ring->sq_flags, ECO_RING_CQ_WAIT, __ATOMIC_SEQ_CST);
+
+	if (__atomic_load_n(&ring->cq_head, __ATOMIC_SEQ_CST) == head && !__atomic_load_n(&ring->stop, __ATOMIC_SEQ_CST)) {
+		syscall(SYS_futex, &ring->sq_flags, FUTEX_WAIT_PRIVATE, ECO_RING_CQ_WAIT, NULL, NULL, 0);
+	}
+
+	__atomic_fetch_and(&ring->sq_flags, ~ECO_RING_CQ_WAIT, __ATOMIC_SEQ_CST);
+}
+
+static void *util_eco_ring_main(void *arg)
+{
+	struct eco_ring *ring = arg;
+	struct eco_sqe sqe;
+	uint32_t head = ring->sq_head, cq_head;
+
+	for (;;) {
+		if (head == __atomic_load_n(&ring->sq_tail, __ATOMIC_ACQUIRE)) {
+			if (__atomic_load_n(&ring->stop, __ATOMIC_ACQUIRE)) {
+				break;
+			}
+
+			util_eco_ring_sleep(ring, head);
+			continue;
+		}
+
+		/* consume the entry only when its completion is sure to find room in the completion ring */
+		cq_head = __atomic_load_n(&ring->cq_head, __ATOMIC_ACQUIRE);
+		if (ring->num_submitted - cq_head == ring->cq_entries) {
+			if (__atomic_load_n(&ring->stop, __ATOMIC_ACQUIRE)) {
+				err_log("eco_ring: Completion ring is full, dropping %u entries\n", ring->sq_tail - head);
+				break;
+			}
+
+			util_eco_ring_wait_cq(ring, cq_head);
+			continue;
+		}
+
+		sqe = ring->sqes[head & (ring->sq_entries - 1)];
+		__atomic_store_n(&ring->sq_head, ++head, __ATOMIC_RELEASE);
+		ring->num_submitted++;
+
+		util_eco_ring_submit_sqe(ring, &sqe);
+	}
+
+	return NULL;
+}
+
+static uint32_t util_eco_ring_roundup(unsigned entries)
+{
+	uint32_t n = 1;
+
+	while (n < entries) {
+		n <<= 1;
+	}
+
+	return n;
+}
+
+struct eco_ring *mlx_eco_ring_create(struct eco_encoder *encoder, struct eco_decoder *decoder, unsigned entries)
+{
+	dbg_log("mlx_eco_ring_create: entries = %u\n", entries);
+
+	struct eco_ring *ring;
+	uint32_t i;
+
+	if ((!encoder && !decoder) || !entries || entries > RING_MAX_ENTRIES) {
+		err_log("mlx_eco_ring_create: Invalid parameters\n");
+		return NULL;
+	}
+
+	ring = calloc(1, sizeof(*ring));
+	if (!ring) {
+		err_log("mlx_eco_ring_create: Failed to allocate ring\n");
+		return NULL;
+	}
+
+	ring->encoder = encoder;
+	ring->decoder = decoder;
+	ring->sq_entries = util_eco_ring_roundup(entries);
+	ring->cq_entries = ring->sq_entries * 2;
+
+	ring->sqes = calloc(ring->sq_entries, sizeof(*ring->sqes));
+	if (!ring->sqes) {
+		err_log("mlx_eco_ring_create: Failed to allocate submission ring\n");
+		goto sqes_error;
+	}
+
+	ring->cqes = calloc(ring->cq_entries, sizeof(*ring->cqes));
+	if (!ring->cqes) {
+		err_log("mlx_eco_ring_create: Failed to allocate completion ring\n");
+		goto cqes_error;
+	}
+
+	ring->reqs = calloc(ring->cq_entries, sizeof(*ring->reqs));
+	if (!ring->reqs) {
+		err_log("mlx_eco_ring_create: Failed to allocate completion contexts\n");
+		goto reqs_error;
+	}
+
+	for (i = 0; i < ring->cq_entries; i++) {
+		ring->reqs[i].ring = ring;
+		ring->reqs[i].next = ring->free_reqs;
+		ring->free_reqs = &ring->reqs[i];
+	}
+
+	pthread_mutex_init(&ring->cq_mutex, NULL);
+
+	if (pthread_create(&ring->thread, NULL, util_eco_ring_main, ring)) {
+		err_log("mlx_eco_ring_create: Failed to create progress thread\n");
+		goto thread_error;
+	}
+
+	return ring;
+
+thread_error:
+	pthread_mutex_destroy(&ring->cq_mutex);
+	free(ring->reqs);
+
+reqs_error:
+	free(ring->cqes);
+
+cqes_error:
+	free(ring->sqes);
+
+sqes_error:
+	free(ring);
+
+	return NULL;
+}
+
+void mlx_eco_ring_wakeup(struct eco_ring *ring)
+{
+	const uint32_t flags = ECO_RING_NEED_WAKEUP | ECO_RING_CQ_WAIT;
+
+	if (__atomic_fetch_and(&ring->sq_flags, ~flags, __ATOMIC_SEQ_CST) & flags) {
+		syscall(SYS_futex, &ring->sq_flags, FUTEX_WAKE_PRIVATE, 1, NULL, NULL, 0);
+	}
+}
+
+struct eco_cqe *mlx_eco_ring_wait_cqe(struct eco_ring *ring)
+{
+	struct eco_cqe *cqe;
+
+	while (!(cqe = mlx_eco_ring_peek_cqe(ring))) {
+		util_eco_ring_wait_tail(ring, ring->cq_head);
+	}
+
+	return cqe;
+}
+
+int mlx_eco_ring_destroy(struct eco_ring *ring)
+{
+	dbg_log("mlx_eco_ring_destroy\n");
+
+	int err;
+
+	__atomic_store_n(&ring->stop, 1, __ATOMIC_SEQ_CST);
+	mlx_eco_ring_wakeup(ring);
+
+	err = pthread_join(ring->thread, NULL);
+	if (err) {
+		err_log("mlx_eco_ring_destroy: Failed to join progress thread\n");
+		return -err;
+	}
+
+	/* the failures are already reported in the completion ring */
+	if (ring->encoder) {
+		mlx_eco_encoder_wait(ring->encoder);
+	}
+	if (ring->decoder) {
+		mlx_eco_decoder_wait(ring->decoder);
+	}
+
+	pthread_mutex_destroy(&ring->cq_mutex);
+	free(ring->reqs);
+	free(ring->cqes);
+	free(ring->sqes);
+	free(ring);
+
+	return 0;
+}
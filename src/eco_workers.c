@@ -0,0 +1,181 @@
+/*
+ ** Copyright (C) 2016 Mellanox Technologies
+ **
+ ** Licensed under the Apache License, Version 2.0 (the "License");
+ ** you may not use this file except in compliance with the License.
+ ** You may obtain a copy of the License at:
+ **
+ ** http://www.apache.org/licenses/LICENSE-2.0
+ **
+ ** Unless required by applicable law or agreed to in writing, software
+ ** distributed under the License is distributed on an "AS IS" BASIS,
+ ** WITHOUT WARRANTIES OR CONDITIONS OF ANY KIND,
+ ** either express or implied. See the License for the specific language
+ ** governing permissions and  limitations under the License.
+ **
+ */
+
+#include "../include/eco_common.h"
+#include "../include/eco_workers.h"
+
+/**
+ * Worker threads context.
+ *
+ * @mutex                        Protects all the fields below.
+ * @start_cond                   Signaled when a new job is posted or the workers should stop.
+ * @done_cond                    Signaled when the last worker finished the current job.
+ * @func                         Function of the current job.
+ * @arg                          Argument of the current job.
+ * @generation                   Incremented for every posted job.
+ * @pending                      Number of workers which did not finish the current job yet.
+ * @stop                         Set when the workers should exit.
+ * @num_threads                  Number of worker threads.
+ * @threads                      Worker threads.
+ */
+struct eco_workers {
+	pthread_mutex_t                mutex;
+	pthread_cond_t                 start_cond;
+	pthread_cond_t                 done_cond;
+	eco_workers_func               func;
+	void                           *arg;
+	unsigned long                  generation;
+	int                            pending;
+	int                            stop;
+	int                            num_threads;
+	pthread_t                      *threads;
+};
+
+struct eco_worker_arg {
+	struct eco_workers             *workers;
+	int                            index;
+};
+
+static void *util_eco_workers_main(void *arg)
+{
+	struct eco_workers *workers = ((struct eco_worker_arg *)arg)->workers;
+	int index = ((struct eco_worker_arg *)arg)->index;
+	unsigned long generation = 0;
+
+	free(arg);
+
+	pthread_mutex_lock(&workers->mutex);
+
+	for (;;) {
+		while (!workers->stop && workers->generation == generation) {
+			pthread_cond_wait(&workers->start_cond, &workers->mutex);
+		}
+
+		if (workers->stop) {
+			break;
+		}
+
+		generation = workers->generation;
+		pthread_mutex_unlock(&workers->mutex);
+
+		workers->func(workers->arg, index);
+
+		pthread_mutex_lock(&workers->mutex);
+		if (!--workers->pending) {
+			pthread_cond_signal(&workers->done_cond);
+		}
+	}
+
+	pthread_mutex_unlock(&workers->mutex);
+
+	return NULL;
+}
+
+struct eco_workers *eco_workers_create(int num_threads)
+{
+	dbg_log("eco_workers_create: num_threads = %d\n", num_threads);
+
+	struct eco_workers *workers;
+	struct eco_worker_arg *worker_arg;
+	int i;
+
+	workers = calloc(1, sizeof(*workers));
+	if (!workers) {
+		err_log("eco_workers_create: Failed to allocate workers\n");
+		return NULL;
+	}
+
+	workers->threads = calloc(num_threads, sizeof(*workers->threads));
+	if (!workers->threads && num_threads) {
+		err_log("eco_workers_create: Failed to allocate threads\n");
+		goto threads_error;
+	}
+
+	pthread_mutex_init(&workers->mutex, NULL);
+	pthread_cond_init(&workers->start_cond, NULL);
+	pthread_cond_init(&workers->done_cond, NULL);
+
+	for (i = 0; i < num_threads; i++) {
+		worker_arg = malloc(sizeof(*worker_arg));
+		if (!worker_arg) {
+			err_log("eco_workers_create: Failed to allocate worker argument\n");
+			goto create_error;
+		}
+
+		worker_arg->workers = workers;
+		worker_arg->index = i + 1;
+
+		if (pthread_create(&workers->threads[i], NULL, util_eco_workers_main, worker_arg)) {
+			err_log("eco_workers_create: Failed to create worker thread\n");
+			free(worker_arg);
+			goto create_error;
+		}
+
+		workers->num_threads++;
+	}
+
+	return workers;
+
+create_error:
+	eco_workers_destroy(workers);
+
+	return NULL;
+
+threads_error:
+	free(workers);
+
+	return NULL;
+}
+
+void eco_workers_run(struct eco_workers *workers, eco_workers_func func, void *arg)
+{
+	pthread_mutex_lock(&workers->mutex);
+	workers->func = func;
+	workers->arg = arg;
+	workers->pending = workers->num_threads;
+	workers->generation++;
+	pthread_cond_broadcast(&workers->start_cond);
+	pthread_mutex_unlock(&workers->mutex);
+
+	func(arg, 0);
+
+	pthread_mutex_lock(&workers->mutex);
+	while (workers->pending) {
+		pthread_cond_wait(&workers->done_cond, &workers->mutex);
+	}
+	pthread_mutex_unlock(&workers->mutex);
+}
+
+void eco_workers_destroy(struct eco_workers *workers)
+{
+	int i;
+
+	pthread_mutex_lock(&workers->mutex);
+	workers->stop = 1;
+	pthread_cond_broadcast(&workers->start_cond);
+	pthread_mutex_unlock(&workers->mutex);
+
+	for (i = 0; i < workers->num_threads; i++) {
+		pthread_join(workers->threads[i], NULL);
+	}
+
+	pthread_cond_destroy(&workers->done_cond);
+	pthread_cond_destroy(&workers->start_cond);
+	pthread_mutex_destroy(&workers->mutex);
+	free(workers->threads);
+	free(workers);
+}
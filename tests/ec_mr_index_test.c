@@ -0,0 +1,165 @@
+/*
+ * Copyright (c) 2016 Mellanox Technologies.  All rights reserved.
+ *
+ * This software is available to you under a choice of one of two
+ * licenses.  You may choose to be licensed under the terms of the GNU
+ * General Public License (GPL) Version 2, available from the file
+ * COPYING in the main directory of this source tree, or the
+ * OpenIB.org BSD license below:
+ *
+ *     Redistribution and use in source and binary forms, with or
+ *     without modification, are permitted provided that the following
+ *     conditions are met:
+ *
+ *      - Redistributions of source code must retain the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer.
+ *
+ *      - Redistributions in binary form must reproduce the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer in the documentation and/or other materials
+ *        provided with the distribution.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * Checks of the registration index of libecOffload, which run without an HCA:
+ * - eco_mr_index insert/find/remove with nested and overlapping regions.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <ecOffload/eco_mr_index.h>
+
+#define err_log		printf
+
+static int failures;
+
+#define CHECK(cond, ...)				\
+	do {						\
+		if (!(cond)) {				\
+			err_log(__VA_ARGS__);		\
+			failures++;			\
+		}					\
+	} while (0)
+
+static struct eco_mr *alloc_mr(uintptr_t addr, size_t length)
+{
+	struct eco_mr *mr = calloc(1, sizeof(*mr));
+
+	mr->mr = calloc(1, sizeof(*mr->mr));
+	mr->mr->addr = (void *)addr;
+	mr->mr->length = length;
+
+	return mr;
+}
+
+static void free_mr(struct eco_mr *mr)
+{
+	free(mr->mr);
+	free(mr);
+}
+
+static void test_mr_index(void)
+{
+	struct eco_mr_index index;
+	struct eco_mr *outer, *inner, *nested, *left, *right, *last;
+
+	eco_mr_index_init(&index);
+
+	/* outer contains inner, which contains nested; left and right overlap each other, last is after outer */
+	outer = alloc_mr(0x10000, 0x10000);
+	inner = alloc_mr(0x12000, 0x4000);
+	nested = alloc_mr(0x13000, 0x100);
+	left = alloc_mr(0x30000, 0x2000);
+	right = alloc_mr(0x31000, 0x2000);
+	last = alloc_mr(0x40000, 0x1000);
+
+	/* inserted out of order */
+	CHECK(!eco_mr_index_insert(&index, nested), "mr_index: insert nested failed\n");
+	CHECK(!eco_mr_index_insert(&index, right), "mr_index: insert right failed\n");
+	CHECK(!eco_mr_index_insert(&index, outer), "mr_index: insert outer failed\n");
+	CHECK(!eco_mr_index_insert(&index, last), "mr_index: insert last failed\n");
+	CHECK(!eco_mr_index_insert(&index, inner), "mr_index: insert inner failed\n");
+	CHECK(!eco_mr_index_insert(&index, left), "mr_index: insert left failed\n");
+
+	/* the returned region contains the whole buffer, any of the nested ones which do */
+	CHECK(eco_mr_index_find(&index, (void *)0x10000, 0x10000) == outer, "mr_index: whole outer not found\n");
+	CHECK(eco_mr_index_find(&index, (void *)0x11000, 0x2000) == outer, "mr_index: buffer across inner not in outer\n");
+	CHECK(eco_mr_index_find(&index, (void *)0x1f000, 0x1000) == outer, "mr_index: tail of outer not found\n");
+	CHECK(eco_mr_index_find(&index, (void *)0x13000, 0x100) != NULL, "mr_index: nested buffer not found\n");
+	CHECK(eco_mr_index_find(&index, (void *)0x14000, 0x3000) == outer, "mr_index: buffer leaving inner not in outer\n");
+	CHECK(!eco_mr_index_find(&index, (void *)0x1f000, 0x1001), "mr_index: buffer beyond outer found\n");
+	CHECK(!eco_mr_index_find(&index, (void *)0xf000, 0x2000), "mr_index: buffer before outer found\n");
+
+	/* a buffer across two overlapping regions is in none of them */
+	CHECK(eco_mr_index_find(&index, (void *)0x30000, 0x2000) == left, "mr_index: left not found\n");
+	CHECK(eco_mr_index_find(&index, (void *)0x32000, 0x1000) == right, "mr_index: right not found\n");
+	CHECK(eco_mr_index_find(&index, (void *)0x31000, 0x1000) != NULL, "mr_index: overlap of left and right not found\n");
+	CHECK(!eco_mr_index_find(&index, (void *)0x30000, 0x3000), "mr_index: buffer across left and right found\n");
+
+	CHECK(eco_mr_index_find_overlap(&index, (void *)0x2f000, 0x1001) == left, "mr_index: overlap of left not found\n");
+	CHECK(!eco_mr_index_find_overlap(&index, (void *)0x33000, 0xd000), "mr_index: overlap between right and last found\n");
+	CHECK(eco_mr_index_find_overlap(&index, (void *)0x33000, 0xd001) == last, "mr_index: overlap of last not found\n");
+	CHECK(!eco_mr_index_find_overlap(&index, (void *)0x10000, 0), "mr_index: empty range overlaps\n");
+
+	/* removing the outer region leaves the nested ones, whose max_end no longer covers the tail */
+	eco_mr_index_remove(&index, outer);
+	CHECK(index.num_entries == 5, "mr_index: %d entries after removing outer\n", index.num_entries);
+	CHECK(!eco_mr_index_find(&index, (void *)0x1f000, 0x1000), "mr_index: removed outer found\n");
+	CHECK(eco_mr_index_find(&index, (void *)0x12000, 0x4000) == inner, "mr_index: inner not found\n");
+	CHECK(eco_mr_index_find(&index, (void *)0x13000, 0x100) != NULL, "mr_index: nested not found\n");
+
+	eco_mr_index_remove(&index, inner);
+	CHECK(eco_mr_index_find(&index, (void *)0x13000, 0x100) == nested, "mr_index: nested not found without inner\n");
+	CHECK(!eco_mr_index_find(&index, (void *)0x12000, 0x100), "mr_index: removed inner found\n");
+
+	/* removing a region which is not in the index changes nothing */
+	eco_mr_index_remove(&index, inner);
+	CHECK(index.num_entries == 4, "mr_index: %d entries after removing inner twice\n", index.num_entries);
+
+	eco_mr_index_remove(&index, left);
+	CHECK(eco_mr_index_find(&index, (void *)0x31000, 0x1000) == right, "mr_index: right not found without left\n");
+	CHECK(!eco_mr_index_find(&index, (void *)0x30000, 0x1000), "mr_index: removed left found\n");
+
+	eco_mr_index_remove(&index, nested);
+	eco_mr_index_remove(&index, right);
+	eco_mr_index_remove(&index, last);
+	CHECK(index.num_entries == 0, "mr_index: %d entries left\n", index.num_entries);
+	CHECK(!eco_mr_index_find_overlap(&index, (void *)0, UINTPTR_MAX), "mr_index: empty index overlaps\n");
+
+	/* the regions are not registered, the index is empty when it is destroyed */
+	eco_mr_index_destroy(&index);
+
+	free_mr(outer);
+	free_mr(inner);
+	free_mr(nested);
+	free_mr(left);
+	free_mr(right);
+	free_mr(last);
+
+	printf("mr_index: checked\n");
+}
+
+int main(void)
+{
+	test_mr_index();
+
+	if (failures) {
+		err_log("%d checks failed\n", failures);
+		return 1;
+	}
+
+	printf("all checks passed\n");
+
+	return 0;
+}
@@ -0,0 +1,297 @@
+/*
+ * Copyright (c) 2016 Mellanox Technologies.  All rights reserved.
+ *
+ * This software is available to you under a choice of one of two
+ * licenses.  You may choose to be licensed under the terms of the GNU
+ * General Public License (GPL) Version 2, available from the file
+ * COPYING in the main directory of this source tree, or the
+ * OpenIB.org BSD license below:
+ *
+ *     Redistribution and use in source and binary forms, with or
+ *     without modification, are permitted provided that the following
+ *     conditions are met:
+ *
+ *      - Redistributions of source code must retain the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer.
+ *
+ *      - Redistributions in binary form must reproduce the above
+ *        copyright notice, this list of conditions and the following
+ *        disclaimer in the documentation and/or other materials
+ *        provided with the distribution.
+ *
+ * THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND,
+ * EXPRESS OR IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF
+ * MERCHANTABILITY, FITNESS FOR A PARTICULAR PURPOSE AND
+ * NONINFRINGEMENT. IN NO EVENT SHALL THE AUTHORS OR COPYRIGHT HOLDERS
+ * BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER LIABILITY, WHETHER IN AN
+ * ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM, OUT OF OR IN
+ * CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+ * SOFTWARE.
+ */
+
+/*
+ * Checks of the software engine of libecOffload, which run without an HCA:
+ * - eco_gf_encode()/eco_gf_decode() of every kernel tier supported by the CPU against the jerasure matrices.
+ * - eco_gf_make_decode_matrix() for every erasure pattern of up to m blocks.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <jerasure.h>
+#include <jerasure/reed_sol.h>
+#include <jerasure/cauchy.h>
+#include <ecOffload/eco_gf.h>
+
+#define W		4
+#define MAX_BLOCKS	32
+#define BLOCK_SIZE	1031
+
+#define err_log		printf
+
+static const int block_sizes[] = {1, 15, 64, 100, 4096 + 33};
+
+static const struct {
+	int	k;
+	int	m;
+} layouts[] = {{2, 1}, {4, 2}, {6, 3}, {10, 4}};
+
+static int failures;
+
+#define CHECK(cond, ...)				\
+	do {						\
+		if (!(cond)) {				\
+			err_log(__VA_ARGS__);		\
+			failures++;			\
+		}					\
+	} while (0)
+
+/* both nibbles of a byte are multiplied by the same GF(2^4) coefficient, as by the HCA */
+static uint8_t ref_mult(uint8_t x, int y)
+{
+	return (galois_single_multiply(x >> 4, y, W) << 4) | galois_single_multiply(x & 0xf, y, W);
+}
+
+/* out[i] = XOR over j of matrix[j * num_out + i] * in[j] */
+static void ref_mult_blocks(const uint8_t *matrix, int num_in, int num_out, uint8_t **in, uint8_t **out, int offset, int len)
+{
+	int i, j, b;
+
+	for (i = 0; i < num_out; i++) {
+		for (b = offset; b < offset + len; b++) {
+			uint8_t r = 0;
+
+			for (j = 0; j < num_in; j++)
+				r ^= ref_mult(in[j][b], matrix[j * num_out + i]);
+			out[i][b] = r;
+		}
+	}
+}
+
+/* the jerasure coding matrix [m x k] and its transpose [k x m] as given to the HCA */
+static int *alloc_matrices(int k, int m, int use_vandermonde_matrix, uint8_t *encode_matrix)
+{
+	int *rs_mat, i, j;
+
+	rs_mat = use_vandermonde_matrix ? reed_sol_vandermonde_coding_matrix(k, m, W) : cauchy_original_coding_matrix(k, m, W);
+	if (!rs_mat)
+		return NULL;
+
+	for (i = 0; i < m; i++)
+		for (j = 0; j < k; j++)
+			encode_matrix[j * m + i] = (uint8_t)rs_mat[i * k + j];
+
+	return rs_mat;
+}
+
+static void fill_random(uint8_t **blocks, int num_blocks, int len)
+{
+	int i, b;
+
+	for (i = 0; i < num_blocks; i++)
+		for (b = 0; b < len; b++)
+			blocks[i][b] = rand();
+}
+
+static uint8_t **alloc_blocks(int num_blocks, int len)
+{
+	uint8_t **blocks;
+	int i;
+
+	blocks = calloc(num_blocks, sizeof(*blocks));
+	for (i = 0; blocks && i < num_blocks; i++)
+		blocks[i] = calloc(1, len);
+
+	return blocks;
+}
+
+static void free_blocks(uint8_t **blocks, int num_blocks)
+{
+	int i;
+
+	for (i = 0; i < num_blocks; i++)
+		free(blocks[i]);
+	free(blocks);
+}
+
+static void test_encode(const uint8_t *encode_matrix, int k, int m)
+{
+	uint8_t **data, **coding, **ref;
+	int i, s, len, offset;
+
+	data = alloc_blocks(k, BLOCK_SIZE * 5);
+	coding = alloc_blocks(m, BLOCK_SIZE * 5);
+	ref = alloc_blocks(m, BLOCK_SIZE * 5);
+	fill_random(data, k, BLOCK_SIZE * 5);
+
+	/* the kernels must handle any length and alignment, and leave the bytes out of the range */
+	for (s = 0; s < (int)(sizeof(block_sizes) / sizeof(block_sizes[0])); s++) {
+		for (offset = 0; offset < 3; offset++) {
+			len = block_sizes[s];
+
+			fill_random(coding, m, BLOCK_SIZE * 5);
+			for (i = 0; i < m; i++)
+				memcpy(ref[i], coding[i], BLOCK_SIZE * 5);
+
+			ref_mult_blocks(encode_matrix, k, m, data, ref, offset, len);
+			eco_gf_encode(encode_matrix, k, m, data, coding, offset, len);
+
+			for (i = 0; i < m; i++)
+				CHECK(!memcmp(coding[i], ref[i], BLOCK_SIZE * 5),
+				      "encode k=%d m=%d len=%d offset=%d: code block %d differs\n", k, m, len, offset, i);
+		}
+	}
+
+	free_blocks(data, k);
+	free_blocks(coding, m);
+	free_blocks(ref, m);
+}
+
+/* compare the rows of the erased data blocks with the decoding matrix of jerasure */
+static void check_decode_matrix(int *rs_mat, const uint8_t *decode_matrix, const uint8_t *erasures, int k, int m, int num_erasures)
+{
+	int int_erasures[MAX_BLOCKS], dm_ids[MAX_BLOCKS];
+	int *dec_mat, i, j, l = 0;
+
+	for (i = 0; i < k + m; i++)
+		int_erasures[i] = erasures[i];
+
+	dec_mat = calloc(k * k, sizeof(int));
+	if (!dec_mat || jerasure_make_decoding_matrix(k, m, W, rs_mat, int_erasures, dec_mat, dm_ids)) {
+		CHECK(0, "jerasure_make_decoding_matrix failed k=%d m=%d\n", k, m);
+		free(dec_mat);
+		return;
+	}
+
+	for (i = 0; i < k; i++) {
+		if (!erasures[i])
+			continue;
+
+		for (j = 0; j < k; j++)
+			CHECK(decode_matrix[j * num_erasures + l] == dec_mat[i * k + j],
+			      "decode matrix k=%d m=%d: block %d coefficient %d differs from jerasure\n", k, m, i, j);
+		l++;
+	}
+
+	free(dec_mat);
+}
+
+static void test_decode(int *rs_mat, const uint8_t *encode_matrix, int k, int m, int check_matrices)
+{
+	uint8_t **data, **coding, **orig, erasures[MAX_BLOCKS], decode_matrix[MAX_BLOCKS * MAX_BLOCKS];
+	int i, num_erasures, n = k + m, len = BLOCK_SIZE;
+	unsigned int mask;
+
+	data = alloc_blocks(k, len);
+	coding = alloc_blocks(m, len);
+	orig = alloc_blocks(n, len);
+	fill_random(data, k, len);
+	eco_gf_encode(encode_matrix, k, m, data, coding, 0, len);
+
+	for (i = 0; i < n; i++)
+		memcpy(orig[i], i < k ? data[i] : coding[i - k], len);
+
+	for (mask = 1; mask < (1u << n); mask++) {
+		num_erasures = __builtin_popcount(mask);
+		if (num_erasures > m)
+			continue;
+
+		for (i = 0; i < n; i++) {
+			erasures[i] = !!(mask & (1u << i));
+			if (erasures[i])
+				memset(i < k ? data[i] : coding[i - k], 0, len);
+			else
+				memcpy(i < k ? data[i] : coding[i - k], orig[i], len);
+		}
+
+		if (eco_gf_make_decode_matrix(encode_matrix, k, m, erasures, decode_matrix)) {
+			CHECK(0, "eco_gf_make_decode_matrix k=%d m=%d failed for erasures %#x\n", k, m, mask);
+			continue;
+		}
+
+		if (check_matrices)
+			check_decode_matrix(rs_mat, decode_matrix, erasures, k, m, num_erasures);
+
+		CHECK(!eco_gf_decode(decode_matrix, k, m, erasures, data, coding, 0, len),
+		      "eco_gf_decode k=%d m=%d failed for erasures %#x\n", k, m, mask);
+
+		for (i = 0; i < n; i++)
+			CHECK(!memcmp(i < k ? data[i] : coding[i - k], orig[i], len),
+			      "decode k=%d m=%d erasures %#x: block %d not recovered\n", k, m, mask, i);
+	}
+
+	free_blocks(data, k);
+	free_blocks(coding, m);
+	free_blocks(orig, n);
+}
+
+static void test_gf(void)
+{
+	uint8_t encode_matrix[MAX_BLOCKS * MAX_BLOCKS];
+	enum eco_gf_tier tier, best = eco_gf_get_tier();
+	int l, v, *rs_mat;
+
+	for (tier = ECO_GF_TIER_SCALAR; tier < ECO_GF_TIER_MAX; tier++) {
+		if (eco_gf_set_tier(tier)) {
+			printf("gf: %s kernels not supported by the CPU, skipped\n", eco_gf_tier_name(tier));
+			continue;
+		}
+
+		for (l = 0; l < (int)(sizeof(layouts) / sizeof(layouts[0])); l++) {
+			for (v = 0; v <= 1; v++) {
+				rs_mat = alloc_matrices(layouts[l].k, layouts[l].m, v, encode_matrix);
+				if (!rs_mat) {
+					CHECK(0, "failed to allocate the coding matrix k=%d m=%d\n", layouts[l].k, layouts[l].m);
+					continue;
+				}
+
+				test_encode(encode_matrix, layouts[l].k, layouts[l].m);
+				/* the decode matrices do not depend on the tier */
+				test_decode(rs_mat, encode_matrix, layouts[l].k, layouts[l].m, tier == ECO_GF_TIER_SCALAR);
+				free(rs_mat);
+			}
+		}
+
+		printf("gf: %s kernels checked\n", eco_gf_tier_name(tier));
+	}
+
+	eco_gf_set_tier(best);
+}
+
+int main(void)
+{
+	srand(1);
+
+	test_gf();
+
+	if (failures) {
+		err_log("%d checks failed\n", failures);
+		return 1;
+	}
+
+	printf("all checks passed\n");
+
+	return 0;
+}